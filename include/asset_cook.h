@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mesh_format.h"
+
+// Shared between the assetcook tool and the runtime's fallback import path,
+// so a mesh loaded from .obj at runtime comes out exactly like the cooked one.
+namespace AssetCook {
+
+// Bump whenever any cook step's output changes, every asset gets redone
+constexpr uint32_t cookerVersion = 1;
+
+// 64 bit content hash (xxHash64), several GB/s so hashing a whole tree costs
+// about as much as reading it
+uint64_t contentHash(const void* data, size_t size, uint64_t seed = 0);
+// Hashes a file through a read only mapping. Throws if it can't be opened.
+uint64_t hashFile(const std::string& path);
+
+std::string toHex(uint64_t value);
+// 0 for anything that isn't exactly 16 hex digits
+uint64_t fromHex(const std::string& text);
+
+struct MeshCookOptions {
+  MeshFormat::VertexFormat vertexFormat = MeshFormat::VertexFormat::float32;
+  bool buildLods = true;
+  bool buildMeshlets = true;
+  // MeshCodec vertex / index streams in the .vmesh
+  bool encodeGeometry = false;
+  // Threads the importer may use, 0 is one per core
+  unsigned threads = 0;
+
+  // Folded into each asset's cache key, so changing an option recooks
+  std::string key() const;
+};
+
+// Import, lod chain, vertex cache/overdraw/fetch optimization, meshlets.
+// The result is ready for MeshFormat::writeMeshFile.
+MeshFormat::MeshData cookMesh(const std::string& path, const MeshCookOptions& options = {});
+
+enum class TextureEncoding : uint32_t {
+  // BC5 for normal maps (isNormalMap), BC3 if anything isn't fully opaque,
+  // BC1 otherwise
+  automatic,
+  bc1,
+  bc3,
+  bc5,
+  // Left uncompressed
+  rgba8,
+};
+
+struct TextureCookOptions {
+  TextureEncoding encoding = TextureEncoding::automatic;
+  // zlib on each level in the .ktx2, undone at load
+  bool supercompress = true;
+
+  std::string key() const;
+};
+
+// By name, anything ending in _n or _normal (before the extension)
+bool isNormalMap(const std::string& path);
+
+// An uncompressed RGBA8 .ktx2 with its mips (what toktx writes) to a block
+// compressed one, returned as the file's bytes. normalMap picks BC5 under
+// TextureEncoding::automatic.
+std::vector<uint8_t> cookTexture(const std::string& ktx2Path, bool normalMap, const TextureCookOptions& options = {});
+
+// What was cooked last time, so unchanged inputs can be skipped.
+// sourceSize/sourceTime let a rerun skip hashing files nobody touched.
+struct ManifestEntry {
+  std::string source;
+  std::string output;
+  std::string kind;
+  uint64_t sourceHash = 0;
+  uint64_t sourceSize = 0;
+  int64_t sourceTime = 0;
+  // cookerVersion + options the output was made with
+  uint64_t cookKey = 0;
+  uint64_t outputSize = 0;
+};
+
+struct Manifest {
+  uint32_t cookerVersion = 0;
+  // Sorted by source
+  std::vector<ManifestEntry> entries;
+
+  const ManifestEntry* find(const std::string& source) const;
+};
+
+// A missing or unreadable manifest is an empty one, it only costs a full cook
+Manifest readManifest(const std::string& path);
+// Written to a temporary and renamed over, an interrupted cook leaves the
+// old manifest intact
+void writeManifest(const std::string& path, const Manifest& manifest);
+
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mapped_file.h"
+
+// .vpak, many cooked assets in one mapped file. A header, a table of contents
+// sorted by name hash, the names, then the payloads. Stored payloads of a page
+// or more start on a page so they can be used straight out of the mapping,
+// everything else only gets sectionAlignment.
+namespace AssetPack {
+
+constexpr uint32_t magic = 0x4b415056; // "VPAK"
+constexpr uint16_t versionMajor = 1;
+constexpr uint16_t versionMinor = 0;
+constexpr uint64_t pageAlignment = 4096;
+constexpr uint64_t sectionAlignment = 16;
+// Compressed entries are split into independent blocks of this much raw data,
+// so one big entry still decompresses on every core
+constexpr uint32_t blockSize = 256 * 1024;
+
+enum class Compression : uint8_t {
+  stored = 0,
+  // A uint32_t block count, uint32_t compressed size per block, then the
+  // blocks. A block whose compressed size equals its raw size is stored.
+  lz4 = 1,
+};
+
+struct Header {
+  uint32_t magic;
+  uint16_t versionMajor;
+  uint16_t versionMinor;
+  uint64_t fileSize;
+  uint32_t entryCount;
+  uint32_t namesSize;
+  // Entry[entryCount] then namesSize bytes of names, right after the header
+  uint64_t tocOffset;
+};
+
+struct Entry {
+  // AssetCook::contentHash of the name, the toc is sorted by it
+  uint64_t nameHash;
+  uint64_t offset;
+  uint64_t storedSize;
+  uint64_t size;
+  // Of the uncompressed data
+  uint64_t contentHash;
+  uint32_t nameOffset;
+  uint16_t nameLength;
+  Compression compression;
+  uint8_t reserved;
+};
+static_assert(sizeof(Header) == 32);
+static_assert(sizeof(Entry) == 48);
+
+// LZ4 block format with a greedy single probe matcher. Fast to decode, which is
+// what matters at load. Returns the compressed size or 0 if it didn't fit in
+// capacity.
+size_t compressBlock(const uint8_t* source, size_t size, uint8_t* destination, size_t capacity);
+// Throws std::runtime_error unless it decodes to exactly size bytes
+void decompressBlock(const uint8_t* source, size_t sourceSize, uint8_t* destination, size_t size);
+size_t compressBound(size_t size);
+
+class PackReader {
+ public:
+  // Throws std::runtime_error if it isn't a well formed pack
+  explicit PackReader(const std::string& path);
+
+  PackReader(const PackReader&) = delete;
+  PackReader& operator=(const PackReader&) = delete;
+
+  const std::vector<const Entry*>& getEntries() const { return entries; }
+  std::string_view getName(const Entry& entry) const;
+
+  // nullptr if there's no such entry
+  const Entry* find(std::string_view name) const;
+
+  // The payload in the mapping, only for stored entries (nullptr otherwise).
+  // Read it like a file of its own.
+  const uint8_t* mappedData(const Entry& entry) const;
+
+  // entry.size bytes into destination, decompressing if needed
+  void read(const Entry& entry, void* destination) const;
+  std::vector<uint8_t> read(const Entry& entry) const;
+
+  struct ReadRequest {
+    const Entry* entry;
+    // entry->size bytes, e.g. mapped staging memory
+    void* destination;
+  };
+  // Every block of every request spread over threads (0 is one per core).
+  // Rethrows the first failure once all are done.
+  void readParallel(const std::vector<ReadRequest>& requests, unsigned threads = 0) const;
+
+ private:
+  MappedFile file;
+  const Header* header = nullptr;
+  const Entry* toc = nullptr;
+  const char* names = nullptr;
+  std::vector<const Entry*> entries;
+};
+
+class PackWriter {
+ public:
+  // Compressed unless that saves less than an eighth, allowCompression false
+  // keeps it stored and zero copy (gpu ready blobs). Names must be unique.
+  void add(std::string name, std::vector<uint8_t> data, bool allowCompression = true);
+
+  // Compresses in parallel (threads 0 is one per core), then writes to a
+  // temporary and renames it over path
+  void write(const std::string& path, unsigned threads = 0) const;
+
+ private:
+  struct Pending {
+    std::string name;
+    std::vector<uint8_t> data;
+    bool allowCompression;
+  };
+  std::vector<Pending> pending;
+};
+
+}
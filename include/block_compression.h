@@ -0,0 +1,43 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Block compressed texture formats on the cpu. Sizes for all of them,
+// encoders for the BCn formats assetcook writes, and decoders to RGBA8 for
+// devices that can't sample a file's format (ETC2 on most desktops, BCn on
+// most phones).
+namespace BlockCompression {
+
+struct FormatInfo {
+  uint32_t blockWidth = 1;
+  uint32_t blockHeight = 1;
+  // Per block, or per texel for uncompressed formats. 0 for unknown formats.
+  uint32_t blockBytes = 0;
+  bool compressed = false;
+  bool srgb = false;
+};
+
+FormatInfo formatInfo(VkFormat format);
+// Bytes of one tightly packed level, 0 for unknown formats
+size_t levelSize(VkFormat format, uint32_t width, uint32_t height);
+
+// BC1 (opaque), BC3, BC4 (red) and BC5 (red + green), unorm or srgb
+bool canEncode(VkFormat format);
+// From RGBA8 rows, width * 4 bytes each, into levelSize(format, ...) bytes.
+// Partial blocks at the edges repeat the last row/column. Throws
+// std::invalid_argument for !canEncode.
+void encode(VkFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* blocks);
+
+// BC1-5, BC7, ETC2 (RGB, RGBA, punch through alpha) and unsigned EAC
+bool canDecode(VkFormat format);
+// R8G8B8A8, _SRGB when format is
+VkFormat decodedFormat(VkFormat format);
+// To RGBA8 rows. Channels the format doesn't have come out the way the
+// sampler would return them, 0 for green/blue and 255 for alpha. Throws
+// std::invalid_argument for !canDecode.
+void decode(VkFormat format, const uint8_t* blocks, uint32_t width, uint32_t height, uint8_t* rgba);
+
+}
@@ -1,7 +1,11 @@
+#pragma once
+
 #include <fstream>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
-std::vector<char> readFile(const std::string& filename) {
+inline std::vector<char> readFile(const std::string& filename) {
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
     if (!file.is_open())
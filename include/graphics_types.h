@@ -4,6 +4,10 @@
 #include "vulkan/vulkan.h"
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "vertex_layout.h"
 
 namespace GraphicsTypes {
 struct Vertex {
@@ -12,36 +16,42 @@ struct Vertex {
   glm::vec2 texCoord{};
 };
 
+// Full precision, 32 bytes
+using VertexLayoutFloat = VertexLayout<
+    Attributes::Float3,  // location 0, position
+    Attributes::Float3,  // location 1, normal
+    Attributes::Float2>; // location 2, texCoord
+
+static_assert(VertexLayoutFloat::stride == sizeof(Vertex), "Vertex doesn't match its layout");
+static_assert(VertexLayoutFloat::offsets[0] == offsetof(Vertex, position), "Vertex doesn't match its layout");
+static_assert(VertexLayoutFloat::offsets[1] == offsetof(Vertex, normal), "Vertex doesn't match its layout");
+static_assert(VertexLayoutFloat::offsets[2] == offsetof(Vertex, texCoord), "Vertex doesn't match its layout");
+
+// 16 bytes. Position is unorm against the mesh bounds (w unused), the normal
+// is octahedral, uv is half float. quantized_shader.vert decodes it, see
+// VertexQuantize for the cpu side.
+struct QuantizedVertex {
+  std::array<uint16_t, 4> position;
+  std::array<int16_t, 2> normal;
+  std::array<uint16_t, 2> texCoord;
+};
+
+using VertexLayoutQuantized = VertexLayout<
+    Attributes::Unorm16x4, // location 0, position
+    Attributes::Snorm16x2, // location 1, octahedral normal
+    Attributes::Half2>;    // location 2, texCoord
+
+static_assert(VertexLayoutQuantized::stride == sizeof(QuantizedVertex), "QuantizedVertex doesn't match its layout");
+static_assert(VertexLayoutQuantized::offsets[0] == offsetof(QuantizedVertex, position), "QuantizedVertex doesn't match its layout");
+static_assert(VertexLayoutQuantized::offsets[1] == offsetof(QuantizedVertex, normal), "QuantizedVertex doesn't match its layout");
+static_assert(VertexLayoutQuantized::offsets[2] == offsetof(QuantizedVertex, texCoord), "QuantizedVertex doesn't match its layout");
+
 inline VkVertexInputBindingDescription getVertexBindingDescription() {
-  VkVertexInputBindingDescription bindingDescription{};
-  bindingDescription.binding = 0;
-  bindingDescription.stride = sizeof(Vertex);
-  bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-  return bindingDescription;
+  return VertexLayoutFloat::bindingDescription();
 }
 
 // May need to change if ray traced version needs to change
 inline std::array<VkVertexInputAttributeDescription, 3> getVertexAttributeDescriptions() {
-  std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
-
-  // layout(location = 0) -> position
-  attributeDescriptions[0].binding = 0;
-  attributeDescriptions[0].location = 0;
-  attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-  attributeDescriptions[0].offset = offsetof(Vertex, Vertex::position);
-
-  // layout(location = 1) -> normal
-  attributeDescriptions[1].binding = 0;
-  attributeDescriptions[1].location = 1;
-  attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-  attributeDescriptions[1].offset = offsetof(Vertex, Vertex::normal);
-
-  // layout(location = 2) -> texCoord
-  attributeDescriptions[2].binding = 0;
-  attributeDescriptions[2].location = 2;
-  attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-  attributeDescriptions[2].offset = offsetof(Vertex, Vertex::texCoord);
-
-  return attributeDescriptions;
+  return VertexLayoutFloat::attributeDescriptions();
 }
 }
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+// The matrices a shader needs per instance, laid out for std430: what
+// `mat4 model; mat4 modelViewProjection; mat3 normal;` reads back (a mat3's
+// columns take 16 bytes each).
+struct alignas(16) InstanceMatrices {
+  glm::mat4 model;
+  glm::mat4 modelViewProjection;
+  // Inverse transpose of model's upper 3x3 times some positive scale, so
+  // normals need normalizing after. w is 0.
+  glm::vec4 normal[3];
+};
+
+// Batched InstanceMatrices for a frame's worth of instances. Everything is
+// written in order and never read back, so out can be mapped (write
+// combined) memory.
+namespace InstanceKernels {
+
+// scalar is plain glm, kept for comparison. avx2 (with fma) is compiled in
+// on x86 with gcc/clang whatever the build flags and picked at runtime.
+enum class Path { scalar, sse, avx2, neon };
+
+bool supported(Path path);
+// The fastest supported one
+Path bestPath();
+const char* pathName(Path path);
+
+// For i < count: out's i-th entry (outStride bytes apart) from
+// models[indices[i]], or models[i] without indices. out and outStride have
+// to be 16 byte aligned. Throws std::invalid_argument for an unsupported
+// path or misaligned out.
+void computeMatrices(
+    const glm::mat4& viewProjection,
+    const glm::mat4* models,
+    const uint32_t* indices,
+    size_t count,
+    InstanceMatrices* out,
+    size_t outStride = sizeof(InstanceMatrices),
+    Path path = bestPath());
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Just enough JSON for glTF. Parses the whole document into a tree, numbers
+// are doubles, objects keep their key order.
+namespace Json {
+
+class Value {
+ public:
+  enum class Type { null, boolean, number, string, array, object };
+
+  Type getType() const { return type; }
+  bool isNull() const { return type == Type::null; }
+  bool isObject() const { return type == Type::object; }
+  bool isArray() const { return type == Type::array; }
+
+  // Fallback when missing or the wrong type
+  double asNumber(double fallback = 0.0) const { return type == Type::number ? number : fallback; }
+  bool asBool(bool fallback = false) const { return type == Type::boolean ? boolean : fallback; }
+  const std::string& asString() const { return string; }
+
+  // Null value for anything missing, so lookups can be chained
+  const Value& operator[](std::string_view key) const;
+  const Value& operator[](size_t index) const;
+  bool has(std::string_view key) const;
+  size_t size() const { return type == Type::array ? array.size() : object.size(); }
+
+  const std::vector<Value>& items() const { return array; }
+  const std::vector<std::pair<std::string, Value>>& members() const { return object; }
+
+ private:
+  friend class Parser;
+
+  Type type = Type::null;
+  bool boolean = false;
+  double number = 0.0;
+  std::string string;
+  std::vector<Value> array;
+  std::vector<std::pair<std::string, Value>> object;
+};
+
+// Throws std::runtime_error on malformed input
+Value parse(std::string_view text);
+
+}
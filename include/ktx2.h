@@ -0,0 +1,75 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// KTX 2.0 containers, 2D textures with a mip chain. Levels are stored
+// as is or zlib supercompressed, each one on its own so a level can be read
+// without touching the others.
+namespace Ktx2 {
+
+enum class Supercompression : uint32_t {
+  none = 0,
+  // Basis universal, would need the basisu transcoder
+  basisLZ = 1,
+  zstd = 2,
+  zlib = 3,
+};
+
+// A .ktx2 somewhere in memory (a file mapping, a pack entry), nothing is
+// copied so the memory has to outlive it
+class Texture {
+ public:
+  // Throws std::runtime_error for anything malformed, anything but a single
+  // 2D image, formats BlockCompression::formatInfo doesn't know (including
+  // UASTC/ETC1S, whose vkFormat is 0) and supercompression other than zlib.
+  // name is only for the messages.
+  Texture(const void* data, size_t size, const std::string& name = "texture");
+
+  VkFormat getFormat() const { return format; }
+  uint32_t getWidth() const { return width; }
+  uint32_t getHeight() const { return height; }
+  uint32_t getLevelCount() const { return static_cast<uint32_t>(levels.size()); }
+  Supercompression getSupercompression() const { return supercompression; }
+
+  // Level 0 is the full size image
+  uint32_t levelWidth(const uint32_t level) const { return width >> level ? width >> level : 1; }
+  uint32_t levelHeight(const uint32_t level) const { return height >> level ? height >> level : 1; }
+  // Once decompressed, tightly packed
+  size_t levelSize(uint32_t level) const;
+  // levelSize(level) bytes. Throws std::runtime_error if zlib fails.
+  void readLevel(uint32_t level, uint8_t* destination) const;
+
+ private:
+  struct Level {
+    uint64_t offset;
+    uint64_t length;
+  };
+
+  const uint8_t* data;
+  VkFormat format;
+  uint32_t width;
+  uint32_t height;
+  Supercompression supercompression;
+  std::vector<Level> levels;
+};
+
+// Uncompressed RGBA8 and the BCn formats BlockCompression writes, plus BC7
+bool canWrite(VkFormat format);
+
+// levels[0] is the full size image, each levelSize bytes. With zlib every
+// level is compressed on its own. Throws std::invalid_argument for
+// !canWrite or levels of the wrong size.
+std::vector<uint8_t> writeTexture(
+    VkFormat format,
+    uint32_t width,
+    uint32_t height,
+    const std::vector<std::vector<uint8_t>>& levels,
+    Supercompression supercompression = Supercompression::none,
+    const std::string& writer = "assetcook");
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "mesh_format.h"
+
+// Picks a lod per instance from how many pixels its error would cover on
+// screen, with a dead band so an instance sitting right at a threshold
+// doesn't flip between levels every frame.
+class LodSelector {
+ public:
+  // thresholdPixels: most error a lod may show. hysteresis: a coarser level
+  // has to be this fraction under the threshold before switching to it.
+  explicit LodSelector(const float thresholdPixels = 1.0f, const float hysteresis = 0.25f)
+    : thresholdPixels(thresholdPixels), hysteresis(hysteresis) {}
+
+  // Pixels per world unit at distance 1: viewportHeight / (2 tan(fovY / 2)).
+  // Pulled out of the view projection row for y (|P11| * unit rotation row),
+  // so it works with whatever camera built the matrix.
+  static float projectionScale(const glm::mat4& viewProjection, const float viewportHeight) {
+    const glm::vec3 row(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1]);
+    return 0.5f * viewportHeight * glm::length(row);
+  }
+
+  // error is object space, worldScale the model's largest axis scale,
+  // distance from the eye to the nearest point of the bounds
+  float projectedError(const float error, const float worldScale, const float distance, const float pixelsPerUnit) const {
+    return error * worldScale * pixelsPerUnit / std::max(distance, 1e-4f);
+  }
+
+  // Lod errors increase down the chain, so the coarsest level under the
+  // threshold is the last one that passes
+  uint32_t select(
+      const std::vector<MeshFormat::Lod>& lods,
+      const uint32_t current,
+      const float worldScale,
+      const float distance,
+      const float pixelsPerUnit) const {
+    if (lods.size() <= 1 || pixelsPerUnit <= 0.0f || worldScale <= 0.0f)
+      return 0;
+
+    uint32_t target = 0;
+    for (uint32_t level = 1; level < lods.size(); ++level) {
+      if (projectedError(lods[level].error, worldScale, distance, pixelsPerUnit) > thresholdPixels)
+        break;
+      target = level;
+    }
+
+    // Finer right away, coarser only once it's comfortably under
+    if (target <= current)
+      return target;
+    while (target > current &&
+           projectedError(lods[target].error, worldScale, distance, pixelsPerUnit) >
+               thresholdPixels * (1.0f - hysteresis))
+      --target;
+    return target;
+  }
+
+ private:
+  float thresholdPixels;
+  float hysteresis;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// Read only mmap of a whole file. Pages come in on first touch, so copying out
+// of it straight into a mapped vulkan buffer is the only copy that happens.
+class MappedFile {
+ public:
+  MappedFile() = default;
+
+  explicit MappedFile(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("failed to open " + path + "!");
+
+    struct stat info{};
+    if (fstat(fd, &info) != 0) {
+      close(fd);
+      throw std::runtime_error("failed to stat " + path + "!");
+    }
+
+    fileSize = static_cast<size_t>(info.st_size);
+    if (fileSize > 0) {
+      void* mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("failed to map " + path + "!");
+      }
+      // We read front to back once, let the kernel read ahead
+      madvise(mapped, fileSize, MADV_SEQUENTIAL);
+      madvise(mapped, fileSize, MADV_WILLNEED);
+      mapping = static_cast<const uint8_t*>(mapped);
+    }
+
+    // The mapping keeps its own reference
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (mapping)
+      munmap(const_cast<uint8_t*>(mapping), fileSize);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& other) noexcept
+    : mapping(std::exchange(other.mapping, nullptr)),
+      fileSize(std::exchange(other.fileSize, 0)) {}
+
+  MappedFile& operator=(MappedFile&& other) noexcept {
+    std::swap(mapping, other.mapping);
+    std::swap(fileSize, other.fileSize);
+    return *this;
+  }
+
+  const uint8_t* data() const { return mapping; }
+  size_t size() const { return fileSize; }
+
+ private:
+  const uint8_t* mapping = nullptr;
+  size_t fileSize = 0;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lossless geometry compression for assets on disk. Both streams stay
+// byte oriented, so a general purpose compressor on top (the asset pack's
+// LZ4) still finds what's left.
+namespace MeshCodec {
+
+// Vertices go in blocks of up to 256. Inside a block every byte of the
+// stride is its own channel, delta coded against the same byte of the
+// previous vertex and zigzagged, so slowly changing attributes become runs
+// of small values. Each channel is then cut into groups of 16 stored with
+// 0, 2, 4 or 8 bits per value (2 bit selector per group). stride must be a
+// multiple of 4 and at most 256.
+std::vector<uint8_t> encodeVertexBuffer(const void* vertices, size_t vertexCount, size_t stride);
+
+// SSE2 where available, scalar otherwise. Throws std::runtime_error on
+// malformed input, never writes past vertexCount * stride bytes.
+void decodeVertexBuffer(void* destination, size_t vertexCount, size_t stride, const uint8_t* data, size_t size);
+
+// Triangle lists. Each triangle is rotated (winding kept) so it starts on an
+// edge a recent triangle shared, the third vertex is then usually the next
+// new vertex or one of the last 15 seen. That's one code byte per triangle,
+// anything else falls back to a zigzag varint delta. Works best after
+// MeshOptimize's vertex cache and fetch ordering.
+std::vector<uint8_t> encodeIndexBuffer(const uint32_t* indices, size_t indexCount);
+
+// indexSize 2 or 4. Triangles come back rotated as encoded, same winding.
+// Throws std::runtime_error on malformed input.
+void decodeIndexBuffer(void* destination, size_t indexCount, size_t indexSize, const uint8_t* data, size_t size);
+
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "graphics_types.h"
+
+// .vmesh, the on disk mesh container. Everything is little endian and laid out
+// so a mapped file can be used in place: a fixed header, a directory of
+// sections, then each section's blob starting on a sectionAlignment boundary.
+// Unknown section types are skipped, so new ones don't need a major bump.
+namespace MeshFormat {
+
+constexpr uint32_t magic = 0x48534d56; // "VMSH"
+constexpr uint16_t versionMajor = 1;
+constexpr uint16_t versionMinor = 3;
+constexpr uint32_t sectionAlignment = 16;
+
+enum class SectionType : uint32_t {
+  vertices = 1,   // vertexCount * vertexStride bytes
+  indices = 2,    // indexCount * indexSize bytes
+  submeshes = 3,  // Submesh[]
+  lods = 4,       // Lod[]
+  // Since 1.2, all three or none
+  meshlets = 5,          // Meshlet[]
+  meshletVertices = 6,   // uint32_t[], mesh vertex index per meshlet local vertex
+  meshletTriangles = 7,  // uint32_t[], 3 local 8 bit indices per triangle
+  // Since 1.3, MeshCodec streams in place of vertices / indices. Decode
+  // into the upload buffer, see MeshView::isEncoded.
+  encodedVertices = 8,
+  encodedIndices = 9,
+};
+
+enum class VertexFormat : uint32_t {
+  // GraphicsTypes::Vertex as is
+  float32 = 0,
+  // GraphicsTypes::QuantizedVertex, positions relative to Header::bounds.
+  // Since 1.1
+  quantized16 = 1,
+};
+
+struct Bounds {
+  float min[3];
+  float max[3];
+  float center[3];
+  float radius;
+};
+
+struct Header {
+  uint32_t magic;
+  uint16_t versionMajor;
+  uint16_t versionMinor;
+  uint64_t fileSize;
+  VertexFormat vertexFormat;
+  uint32_t vertexStride;
+  uint32_t vertexCount;
+  // 2 or 4
+  uint32_t indexSize;
+  uint32_t indexCount;
+  uint32_t sectionCount;
+  Bounds bounds;
+};
+
+// Directory entry, sectionCount of these follow the header
+struct Section {
+  SectionType type;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t size;
+};
+
+// A range of the index buffer, drawn with its own material
+struct Submesh {
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  uint32_t materialIndex;
+  uint32_t reserved;
+  Bounds bounds;
+};
+
+// Index range for the whole mesh at one detail level, 0 is full detail.
+// Without a lods section the whole index blob is lod 0.
+struct Lod {
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  // Object space error vs lod 0
+  float error;
+  uint32_t reserved;
+};
+
+// Small cluster of lod 0 triangles for cluster culling, never crosses a
+// submesh. Same layout as the std430 struct the culling shader reads.
+struct Meshlet {
+  float center[3];
+  float radius;
+  // Backfacing from anywhere dot(center - eye, coneAxis) >=
+  // coneCutoff * |center - eye| + radius. Zero axis when there's no useful cone.
+  float coneAxis[3];
+  float coneCutoff;
+  uint32_t vertexOffset;   // into meshletVertices
+  uint32_t triangleOffset; // into meshletTriangles
+  uint32_t vertexCount;
+  uint32_t triangleCount;
+};
+
+static_assert(sizeof(Bounds) == 40, "on disk layout");
+static_assert(sizeof(Header) == 80, "on disk layout");
+static_assert(sizeof(Section) == 24, "on disk layout");
+static_assert(sizeof(Submesh) == 56, "on disk layout");
+static_assert(sizeof(Lod) == 16, "on disk layout");
+static_assert(sizeof(Meshlet) == 48, "on disk layout");
+
+// Pointer + count into someone else's memory
+template <typename T>
+struct ArrayView {
+  const T* data = nullptr;
+  size_t count = 0;
+
+  const T* begin() const { return data; }
+  const T* end() const { return data + count; }
+  const T& operator[](size_t i) const { return data[i]; }
+  bool empty() const { return count == 0; }
+};
+
+struct MeshletsView {
+  ArrayView<Meshlet> meshlets;
+  ArrayView<uint32_t> vertices;
+  ArrayView<uint32_t> triangles;
+
+  bool empty() const { return meshlets.empty(); }
+};
+
+// Validated view over a .vmesh already in memory (normally a MappedFile).
+// Doesn't own or copy anything, the memory has to outlive it.
+class MeshView {
+ public:
+  // Throws if the header, directory or any section is out of bounds, or an
+  // index points past the vertices
+  MeshView(const uint8_t* data, size_t size);
+
+  const Header& getHeader() const { return *header; }
+  const Bounds& getBounds() const { return header->bounds; }
+
+  // nullptr when encoded, use decodeVertices / decodeIndices then
+  const void* vertexData() const { return vertices; }
+  size_t vertexBytes() const { return size_t(header->vertexCount) * header->vertexStride; }
+  const void* indexData() const { return indices; }
+  size_t indexBytes() const { return size_t(header->indexCount) * header->indexSize; }
+
+  bool isEncoded() const { return !encodedVertices.empty(); }
+  // vertexBytes() / indexBytes() into destination, decoding or copying.
+  // Throws on a corrupt stream, or decoded indices past the vertices.
+  void decodeVertices(void* destination) const;
+  void decodeIndices(void* destination) const;
+
+  ArrayView<Submesh> getSubmeshes() const { return submeshes; }
+  ArrayView<Lod> getLods() const { return lods; }
+  // Falls back to the whole index range without a lods section
+  Lod getLod(size_t level) const;
+  // Empty if the file has none
+  MeshletsView getMeshlets() const { return meshlets; }
+
+ private:
+  const Header* header = nullptr;
+  const void* vertices = nullptr;
+  const void* indices = nullptr;
+  ArrayView<uint8_t> encodedVertices;
+  ArrayView<uint8_t> encodedIndices;
+  ArrayView<Submesh> submeshes;
+  ArrayView<Lod> lods;
+  MeshletsView meshlets;
+};
+
+// What the writer takes. Offline side, vectors are fine here
+struct MeshData {
+  std::vector<GraphicsTypes::Vertex> vertices;
+  std::vector<uint32_t> indices;
+  // Empty means one submesh covering everything
+  std::vector<Submesh> submeshes;
+  std::vector<Lod> lods;
+  // Optional, see Meshlets::buildMeshlets
+  std::vector<Meshlet> meshlets;
+  std::vector<uint32_t> meshletVertices;
+  std::vector<uint32_t> meshletTriangles;
+
+  MeshletsView meshletsView() const {
+    return {{meshlets.data(), meshlets.size()},
+            {meshletVertices.data(), meshletVertices.size()},
+            {meshletTriangles.data(), meshletTriangles.size()}};
+  }
+};
+
+Bounds computeBounds(const GraphicsTypes::Vertex* vertices, size_t count);
+
+// Fills in bounds for the mesh and every submesh. Indices are stored as 16
+// bit when every vertex fits. encodeGeometry runs vertices and indices
+// through MeshCodec (lossless, triangles keep their winding but may start on
+// another corner), smaller on disk for a decode pass at load.
+void writeMeshFile(
+    const std::string& path,
+    const MeshData& mesh,
+    VertexFormat vertexFormat = VertexFormat::float32,
+    bool encodeGeometry = false);
+
+}
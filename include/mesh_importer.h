@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "mesh_format.h"
+
+// Turns authoring formats into MeshFormat::MeshData (GraphicsTypes::Vertex +
+// 32 bit indices), ready for writeMeshFile or straight into a VulkanModel.
+namespace MeshImport {
+
+struct ImportOptions {
+  // 0 is one per core, 1 is fully single threaded
+  unsigned threads = 0;
+  // Smooth, area weighted, only for vertices the file has no normal for
+  bool generateNormals = true;
+};
+
+// Triangulates polygons as fans, one submesh per usemtl run. Materials are
+// numbered in order of first use, the .mtl isn't read.
+MeshFormat::MeshData importObj(const std::string& path, const ImportOptions& options = {});
+
+// glTF 2.0, .gltf (embedded base64 or external .bin buffers) or .glb. Every
+// triangle primitive becomes a submesh with its material index. Node
+// transforms aren't applied, meshes come out in their own space.
+MeshFormat::MeshData importGltf(const std::string& path, const ImportOptions& options = {});
+
+// A relative uri in a .gltf (buffers, images) as a path, %XX escapes undone
+std::string percentDecode(const std::string& uri);
+
+// Picks by extension
+MeshFormat::MeshData importMesh(const std::string& path, const ImportOptions& options = {});
+
+// Shared by both importers. Collapses identical vertices (bitwise) in
+// parallel and rewrites the indices, keeping first appearance order.
+void weldVertices(MeshFormat::MeshData& mesh, unsigned threads = 0);
+// Fills in normals for vertices flagged in needsNormal (or all of them if
+// it's empty), accumulated over faces sharing a position.
+void generateNormals(MeshFormat::MeshData& mesh, const std::vector<uint8_t>& needsNormal = {});
+
+}
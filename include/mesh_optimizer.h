@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh_format.h"
+
+// Offline/at load index and vertex reordering. Nothing here changes what gets
+// drawn, only the order, so it's always safe to run.
+namespace MeshOptimize {
+
+// Post transform cache stats for a FIFO cache of cacheSize entries.
+// ACMR: vertex shader runs per triangle (0.5 ideal on big grids, 3 worst).
+// ATVR: vertex shader runs per unique vertex (1 ideal).
+struct CacheStats {
+  float acmr = 0.0f;
+  float atvr = 0.0f;
+};
+
+constexpr uint32_t defaultCacheSize = 16;
+
+CacheStats analyzeVertexCache(
+    const uint32_t* indices,
+    size_t indexCount,
+    size_t vertexCount,
+    uint32_t cacheSize = defaultCacheSize);
+
+// Tipsify (Sander et al. 2007), linear time. Reorders the triangles in place.
+void optimizeVertexCache(
+    uint32_t* indices,
+    size_t indexCount,
+    size_t vertexCount,
+    uint32_t cacheSize = defaultCacheSize);
+
+// Splits an already cache optimized range into clusters, allowing each to
+// cost up to threshold x the current ACMR, then draws outward facing clusters
+// first so they occlude the rest. 1.05 keeps nearly all of the cache win.
+void optimizeOverdraw(
+    uint32_t* indices,
+    size_t indexCount,
+    const GraphicsTypes::Vertex* vertices,
+    size_t vertexCount,
+    float threshold = 1.05f,
+    uint32_t cacheSize = defaultCacheSize);
+
+// Renumbers vertices in first use order so fetches walk the vertex buffer
+// forward. Drops unreferenced vertices.
+void optimizeVertexFetch(MeshFormat::MeshData& mesh);
+
+// Fits in VK_INDEX_TYPE_UINT16
+inline bool fitsIn16BitIndices(const size_t vertexCount) { return vertexCount <= 0xffff; }
+
+std::vector<uint16_t> to16BitIndices(const std::vector<uint32_t>& indices);
+
+struct OptimizeReport {
+  CacheStats before;
+  CacheStats after;
+};
+
+// All of the above per submesh, then fetch order over the whole mesh
+OptimizeReport optimizeMesh(MeshFormat::MeshData& mesh, float overdrawThreshold = 1.05f);
+
+}
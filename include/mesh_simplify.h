@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh_format.h"
+
+// Edge collapse simplification with quadric error metrics (Garland and
+// Heckbert 1997). Only the index buffer changes, collapses move a vertex onto
+// one of its neighbours, so every lod shares the mesh's vertex buffer.
+namespace MeshSimplify {
+
+// Returns the simplified triangles. Stops at targetIndexCount, or earlier once
+// the next collapse would move the surface more than maxError (object space).
+// Open borders and attribute seams are locked, so uv/normal seams stay put.
+// resultError gets the largest error actually introduced.
+std::vector<uint32_t> simplify(
+    const std::vector<GraphicsTypes::Vertex>& vertices,
+    const uint32_t* indices,
+    size_t indexCount,
+    size_t targetIndexCount,
+    float maxError,
+    float* resultError = nullptr);
+
+struct LodChainOptions {
+  // Max levels including lod 0
+  uint32_t maxLods = 5;
+  // Triangles kept per level
+  float reduction = 0.5f;
+  // Per level cap, as a fraction of the mesh's bounding radius
+  float maxRelativeError = 0.05f;
+  // A level that can't get below this fraction of the previous one ends the chain
+  float minProgress = 0.9f;
+};
+
+// Appends lods 1.. after lod 0 in mesh.indices and fills mesh.lods, each
+// level simplified from the one before per submesh. Lod errors are object
+// space distances from lod 0, a bound made by adding up every level's error
+// against the one before, so they never decrease down the chain. Replaces
+// any lods already there, lod 0 is taken to be the whole current index
+// buffer.
+void buildLodChain(MeshFormat::MeshData& mesh, const LodChainOptions& options = {});
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mesh_format.h"
+
+// Splits lod 0 into MeshFormat::Meshlets for cluster culling. Run it after
+// MeshOptimize, the meshlets reference vertex indices directly.
+namespace Meshlets {
+
+// 64 / 124 is the usual sweet spot, 124 so a meshlet's 8 bit triangle list
+// still fits nicely if it ever goes to mesh shaders
+constexpr uint32_t defaultMaxVertices = 64;
+constexpr uint32_t defaultMaxTriangles = 124;
+
+// Greedy in index order, so it follows whatever locality the vertex cache
+// optimizer left behind. Per submesh, nothing crosses a submesh boundary.
+// Replaces any meshlets already in the mesh.
+void buildMeshlets(
+    MeshFormat::MeshData& mesh,
+    uint32_t maxVertices = defaultMaxVertices,
+    uint32_t maxTriangles = defaultMaxTriangles);
+
+// Triangles drawn if every meshlet is visible, i.e. the culled index buffer size
+size_t meshletIndexCount(const MeshFormat::MeshletsView& meshlets);
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+inline unsigned defaultThreadCount() {
+  const unsigned count = std::thread::hardware_concurrency();
+  return count ? count : 1;
+}
+
+// Splits [0, count) into one contiguous range per thread and calls
+// fn(begin, end, threadIndex) for each. Blocks until all are done, rethrows
+// the first exception. threads == 0 means one per core. Runs inline when
+// there's only one range.
+template <typename Fn>
+void parallelRanges(const size_t count, unsigned threads, Fn&& fn) {
+  if (threads == 0)
+    threads = defaultThreadCount();
+  threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+  if (threads <= 1) {
+    if (count > 0)
+      fn(size_t(0), count, 0u);
+    return;
+  }
+
+  std::vector<std::exception_ptr> errors(threads);
+  std::vector<std::thread> workers;
+  workers.reserve(threads - 1);
+
+  const auto runRange = [&](const unsigned t) {
+    const size_t begin = count * t / threads;
+    const size_t end = count * (t + 1) / threads;
+    try {
+      fn(begin, end, t);
+    } catch (...) {
+      errors[t] = std::current_exception();
+    }
+  };
+
+  for (unsigned t = 1; t < threads; ++t)
+    workers.emplace_back(runRange, t);
+  runRange(0);
+
+  for (auto& worker : workers)
+    worker.join();
+
+  for (const auto& error : errors)
+    if (error)
+      std::rethrow_exception(error);
+}
+
+// fn(i) for every i in [0, count)
+template <typename Fn>
+void parallelFor(const size_t count, const unsigned threads, Fn&& fn) {
+  parallelRanges(count, threads, [&fn](const size_t begin, const size_t end, unsigned) {
+    for (size_t i = begin; i < end; ++i)
+      fn(i);
+  });
+}
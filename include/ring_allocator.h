@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+
+// Offsets into a ring of capacity bytes, e.g. a persistently mapped staging
+// buffer. Allocations can be freed in any order but their space only comes
+// back once everything allocated before them is freed too, which is how
+// upload memory gets released anyway (copies finish in submission order).
+// Not thread safe.
+class RingAllocator {
+ public:
+  static constexpr uint64_t invalid = UINT64_MAX;
+
+  explicit RingAllocator(const uint64_t _capacity) : capacity(_capacity) {}
+
+  // Start of size bytes aligned to alignment (a power of two), invalid if
+  // there isn't room right now. Never splits an allocation across the end.
+  uint64_t allocate(const uint64_t size, const uint64_t alignment = 16) {
+    if (size == 0 || size > capacity)
+      return invalid;
+
+    uint64_t begin = 0;
+    if (!live.empty()) {
+      // Live allocations cover [tail, head) going round the ring
+      const uint64_t tail = live.front().begin;
+      begin = alignUp(head, alignment);
+      if (head > tail) {
+        // Free space is [head, capacity) then [0, tail)
+        if (begin + size > capacity) {
+          if (size > tail)
+            return invalid;
+          begin = 0;
+        }
+      } else if (begin + size > tail) {
+        return invalid;
+      }
+    }
+
+    live.push_back({begin, begin + size, false});
+    head = begin + size;
+    return begin;
+  }
+
+  void free(const uint64_t offset) {
+    for (auto& range : live) {
+      if (range.begin == offset && !range.freed) {
+        range.freed = true;
+        while (!live.empty() && live.front().freed)
+          live.pop_front();
+        if (live.empty())
+          head = 0;
+        return;
+      }
+    }
+
+    throw std::invalid_argument("freeing a ring allocation that isn't live!");
+  }
+
+  uint64_t getCapacity() const { return capacity; }
+  bool empty() const { return live.empty(); }
+  size_t liveCount() const { return live.size(); }
+
+ private:
+  struct Range {
+    uint64_t begin;
+    uint64_t end;
+    bool freed;
+  };
+
+  static uint64_t alignUp(const uint64_t value, const uint64_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+  }
+
+  const uint64_t capacity;
+  uint64_t head = 0;
+  // In allocation order
+  std::deque<Range> live;
+};
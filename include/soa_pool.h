@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Slot index + generation. The slot's generation goes up every time what's
+// in it is removed, so a handle to something that's gone fails a single
+// compare instead of quietly pointing at whatever took its place. Tag keeps
+// handles into different pools from mixing.
+template <class Tag>
+struct GenerationalHandle {
+  static constexpr uint32_t invalidIndex = UINT32_MAX;
+
+  uint32_t index = invalidIndex;
+  uint32_t generation = 0;
+
+  explicit operator bool() const { return index != invalidIndex; }
+  bool operator==(const GenerationalHandle& other) const {
+    return index == other.index && generation == other.generation;
+  }
+  bool operator!=(const GenerationalHandle& other) const { return !(*this == other); }
+};
+
+// One std::vector per column, all the same length and tightly packed, so a
+// loop over the live elements touches only the columns it reads. Order isn't
+// kept: remove() moves the last element into the hole. Handles go through a
+// slot array (dense index + generation) with a free list, so they stay valid
+// while elements move and can be checked for staleness.
+//
+// column<I>() for hot loops, get<I>(handle) for one element. Not thread safe.
+template <class Tag, class... Columns>
+class SoAPool {
+ public:
+  using Handle = GenerationalHandle<Tag>;
+
+  template <class... Values>
+  Handle insert(Values&&... values) {
+    static_assert(sizeof...(Values) == sizeof...(Columns), "one value per column");
+    const auto dense = static_cast<uint32_t>(slotOf.size());
+    uint32_t index;
+    if (!freeSlots.empty()) {
+      index = freeSlots.back();
+      freeSlots.pop_back();
+    } else {
+      index = static_cast<uint32_t>(slots.size());
+      slots.push_back({});
+    }
+    slots[index].dense = dense;
+    slotOf.push_back(index);
+    pushBack(std::index_sequence_for<Columns...>(), std::forward<Values>(values)...);
+    return {index, slots[index].generation};
+  }
+
+  // Swaps the last element in, its handle keeps working
+  void remove(const Handle handle) {
+    const uint32_t dense = denseIndex(handle);
+    const auto last = static_cast<uint32_t>(slotOf.size() - 1);
+    if (dense != last) {
+      moveDown(std::index_sequence_for<Columns...>(), last, dense);
+      slotOf[dense] = slotOf[last];
+      slots[slotOf[dense]].dense = dense;
+    }
+    popBack(std::index_sequence_for<Columns...>());
+    slotOf.pop_back();
+    slots[handle.index].dense = invalidDense;
+    ++slots[handle.index].generation;
+    freeSlots.push_back(handle.index);
+  }
+
+  bool contains(const Handle handle) const {
+    return handle.index < slots.size() && slots[handle.index].generation == handle.generation &&
+        slots[handle.index].dense != invalidDense;
+  }
+
+  // Where it sits in the columns right now. Throws std::invalid_argument for
+  // a stale handle.
+  uint32_t denseIndex(const Handle handle) const {
+    if (!contains(handle))
+      throw std::invalid_argument("stale or invalid pool handle!");
+    return slots[handle.index].dense;
+  }
+  Handle handleAt(const uint32_t dense) const { return {slotOf[dense], slots[slotOf[dense]].generation}; }
+
+  template <size_t I>
+  auto& get(const Handle handle) { return std::get<I>(columns)[denseIndex(handle)]; }
+  template <size_t I>
+  const auto& get(const Handle handle) const { return std::get<I>(columns)[denseIndex(handle)]; }
+
+  template <size_t I>
+  auto& column() { return std::get<I>(columns); }
+  template <size_t I>
+  const auto& column() const { return std::get<I>(columns); }
+
+  size_t size() const { return slotOf.size(); }
+  bool empty() const { return slotOf.empty(); }
+
+  // Destroys everything, handles from before all go stale
+  void clear() {
+    while (!slotOf.empty())
+      remove(handleAt(static_cast<uint32_t>(slotOf.size() - 1)));
+  }
+
+ private:
+  static constexpr uint32_t invalidDense = UINT32_MAX;
+
+  struct Slot {
+    // invalidDense while on the free list
+    uint32_t dense = invalidDense;
+    uint32_t generation = 0;
+  };
+
+  template <size_t... I, class... Values>
+  void pushBack(std::index_sequence<I...>, Values&&... values) {
+    (std::get<I>(columns).push_back(std::forward<Values>(values)), ...);
+  }
+  template <size_t... I>
+  void moveDown(std::index_sequence<I...>, const uint32_t from, const uint32_t to) {
+    ((std::get<I>(columns)[to] = std::move(std::get<I>(columns)[from])), ...);
+  }
+  template <size_t... I>
+  void popBack(std::index_sequence<I...>) {
+    (std::get<I>(columns).pop_back(), ...);
+  }
+
+  std::tuple<std::vector<Columns>...> columns;
+  // Dense index to slot index, for fixing up the slot of whatever moves
+  std::vector<uint32_t> slotOf;
+  std::vector<Slot> slots;
+  std::vector<uint32_t> freeSlots;
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "soa_pool.h"
+
+struct TransformTag;
+
+// Relative to the parent
+struct LocalTransform {
+  glm::vec3 translation{0.0f, 0.0f, 0.0f};
+  glm::quat rotation{1.0f, 0.0f, 0.0f, 0.0f};
+  glm::vec3 scale{1.0f, 1.0f, 1.0f};
+};
+
+// Parent/child transforms for a scene. Nodes hold a local translation,
+// rotation and scale. update() turns those into world matrices, but only
+// for nodes that were touched since the last update and everything under
+// them. It returns those nodes, so whoever mirrors world matrices
+// elsewhere (instance transforms, a gpu buffer) copies just what changed.
+// A frame where nothing moved costs a branch.
+//
+// Storage is one array per field, sorted by depth, so every parent sits
+// before its children and propagation is a single forward pass with no
+// recursion. Adding a node shallower than the deepest one, reparenting or
+// removing reorders the arrays, fine now and then, not per frame.
+// Handles stay valid through all of it. Not thread safe.
+class TransformHierarchy {
+ public:
+  using Handle = GenerationalHandle<TransformTag>;
+
+  // A null parent makes a root. Throws std::invalid_argument for a stale
+  // parent.
+  Handle add(const LocalTransform& local = {}, Handle parent = {});
+  // Everything under it goes too
+  void remove(Handle node);
+  // Null to make it a root. Throws std::invalid_argument when parent is
+  // node or under it.
+  void setParent(Handle node, Handle parent);
+
+  void setLocal(Handle node, const LocalTransform& local);
+  void setTranslation(Handle node, const glm::vec3& translation);
+  void setRotation(Handle node, const glm::quat& rotation);
+  void setScale(Handle node, const glm::vec3& scale);
+  LocalTransform getLocal(Handle node) const;
+  // As of the last update()
+  const glm::mat4& getWorld(Handle node) const { return worlds[denseIndex(node)]; }
+  Handle getParent(Handle node) const;
+
+  bool contains(Handle node) const {
+    return node.index < slots.size() && slots[node.index].generation == node.generation &&
+        slots[node.index].dense != invalidIndex;
+  }
+  size_t size() const { return slotOf.size(); }
+
+  // World matrices for everything touched since last time, parents before
+  // children. The nodes that changed, valid until the next call.
+  const std::vector<Handle>& update();
+
+  // out = a * b for column major 4x4s, SSE or NEON where there is one. out
+  // may be a, not b.
+  static void multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out);
+
+ private:
+  static constexpr uint32_t invalidIndex = UINT32_MAX;
+
+  struct Slot {
+    uint32_t dense = invalidIndex;
+    uint32_t generation = 0;
+  };
+
+  uint32_t denseIndex(Handle node) const;
+  void markDirty(uint32_t dense);
+  // Stable, so siblings keep their order
+  void sortByDepth();
+  // Keeps the dense indices where keep is set, in order
+  void compact(const std::vector<uint8_t>& keep);
+  // Moves every array to the order in from (from[new] = old)
+  void reorder(const std::vector<uint32_t>& from);
+
+  // Sorted by depth
+  std::vector<glm::vec3> translations;
+  std::vector<glm::quat> rotations;
+  std::vector<glm::vec3> scales;
+  std::vector<uint32_t> parents;
+  std::vector<uint32_t> depths;
+  std::vector<glm::mat4> worlds;
+  std::vector<uint8_t> dirty;
+  std::vector<uint32_t> slotOf;
+
+  std::vector<Slot> slots;
+  std::vector<uint32_t> freeSlots;
+
+  // Nothing before it is dirty, invalidIndex when nothing is
+  uint32_t firstDirty = invalidIndex;
+  bool sorted = true;
+  std::vector<Handle> changed;
+};
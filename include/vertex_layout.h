@@ -0,0 +1,88 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+
+// Vertex layouts declared as a list of attribute types. Offsets, stride and
+// the VkVertexInputAttributeDescriptions all come out at compile time, with
+// locations in declaration order on one interleaved binding.
+namespace GraphicsTypes {
+
+// T is what the cpu writes, Format is what the shader reads it as
+template <typename T, VkFormat Format>
+struct Attribute {
+  using Type = T;
+  static constexpr VkFormat format = Format;
+  static constexpr uint32_t size = sizeof(T);
+  // Keeps every attribute 4 byte aligned when packed back to back
+  static_assert(sizeof(T) % 4 == 0, "vertex attributes should be multiples of 4 bytes");
+};
+
+namespace Attributes {
+using Float2 = Attribute<std::array<float, 2>, VK_FORMAT_R32G32_SFLOAT>;
+using Float3 = Attribute<std::array<float, 3>, VK_FORMAT_R32G32B32_SFLOAT>;
+using Float4 = Attribute<std::array<float, 4>, VK_FORMAT_R32G32B32A32_SFLOAT>;
+using Half2 = Attribute<std::array<uint16_t, 2>, VK_FORMAT_R16G16_SFLOAT>;
+using Half4 = Attribute<std::array<uint16_t, 4>, VK_FORMAT_R16G16B16A16_SFLOAT>;
+using Unorm16x2 = Attribute<std::array<uint16_t, 2>, VK_FORMAT_R16G16_UNORM>;
+// 3 component 16 bit formats are barely supported as vertex input, so xyz + pad
+using Unorm16x4 = Attribute<std::array<uint16_t, 4>, VK_FORMAT_R16G16B16A16_UNORM>;
+using Snorm16x2 = Attribute<std::array<int16_t, 2>, VK_FORMAT_R16G16_SNORM>;
+using Snorm8x4 = Attribute<std::array<int8_t, 4>, VK_FORMAT_R8G8B8A8_SNORM>;
+using Unorm8x4 = Attribute<std::array<uint8_t, 4>, VK_FORMAT_R8G8B8A8_UNORM>;
+}
+
+template <typename... Attrs>
+struct VertexLayout {
+  static constexpr size_t attributeCount = sizeof...(Attrs);
+
+  static constexpr std::array<uint32_t, attributeCount> offsets = [] {
+    constexpr std::array<uint32_t, attributeCount> sizes = {Attrs::size...};
+    std::array<uint32_t, attributeCount> out{};
+    uint32_t offset = 0;
+    for (size_t i = 0; i < attributeCount; ++i) {
+      out[i] = offset;
+      offset += sizes[i];
+    }
+    return out;
+  }();
+
+  static constexpr uint32_t stride = (Attrs::size + ... + 0);
+
+  template <size_t I>
+  using AttributeAt = std::tuple_element_t<I, std::tuple<Attrs...>>;
+
+  static constexpr VkVertexInputBindingDescription bindingDescription(const uint32_t binding = 0) {
+    return {binding, stride, VK_VERTEX_INPUT_RATE_VERTEX};
+  }
+
+  // layout(location = i) is the i-th attribute
+  static constexpr std::array<VkVertexInputAttributeDescription, attributeCount> attributeDescriptions(
+      const uint32_t binding = 0) {
+    constexpr std::array<VkFormat, attributeCount> formats = {Attrs::format...};
+    std::array<VkVertexInputAttributeDescription, attributeCount> out{};
+    for (size_t i = 0; i < attributeCount; ++i)
+      out[i] = {static_cast<uint32_t>(i), binding, formats[i], offsets[i]};
+    return out;
+  }
+
+  // Raw access for building vertex buffers byte by byte
+  template <size_t I>
+  static void write(void* vertex, const typename AttributeAt<I>::Type& value) {
+    std::memcpy(static_cast<uint8_t*>(vertex) + offsets[I], &value, sizeof(value));
+  }
+
+  template <size_t I>
+  static typename AttributeAt<I>::Type read(const void* vertex) {
+    typename AttributeAt<I>::Type value;
+    std::memcpy(&value, static_cast<const uint8_t*>(vertex) + offsets[I], sizeof(value));
+    return value;
+  }
+};
+
+}
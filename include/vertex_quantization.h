@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "graphics_types.h"
+#include "mesh_format.h"
+
+// Float <-> GraphicsTypes::QuantizedVertex. Lossy: positions keep 1/65535 of
+// the bounds extent, normals within ~0.04 degrees, uvs 11 bits of mantissa.
+namespace VertexQuantize {
+
+// position = offset + quantized * scale, what the vertex shader gets per model
+struct PositionTransform {
+  glm::vec3 scale;
+  glm::vec3 offset;
+};
+
+PositionTransform positionTransform(const MeshFormat::Bounds& bounds);
+
+uint16_t floatToHalf(float value);
+float halfToFloat(uint16_t half);
+
+// Unit vector to [-1, 1]^2 and back
+glm::vec2 octEncode(const glm::vec3& normal);
+glm::vec3 octDecode(const glm::vec2& encoded);
+
+std::vector<GraphicsTypes::QuantizedVertex> quantizeVertices(
+    const GraphicsTypes::Vertex* vertices,
+    size_t count,
+    const MeshFormat::Bounds& bounds);
+
+GraphicsTypes::Vertex dequantizeVertex(const GraphicsTypes::QuantizedVertex& vertex, const PositionTransform& transform);
+
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "asset_pack.h"
+#include "mesh_format.h"
+#include "ring_allocator.h"
+#include "vulkan_utils/cluster_culling.h"
+#include "vulkan_utils/command_pool_wrapper.h"
+#include "vulkan_utils/device_manager.h"
+#include "vulkan_utils/mesh_loader.h"
+#include "vulkan_utils/vulkan_types.h"
+
+namespace VulkanUtils {
+
+struct StreamerOptions {
+  // Loader threads, 0 is one per core minus the render thread (at least one)
+  unsigned threads = 0;
+  // Persistently mapped upload memory shared by everything in flight. A mesh
+  // that doesn't fit at all gets a staging buffer of its own.
+  VkDeviceSize stagingSize = VkDeviceSize(64) << 20;
+  // Copy submits that may be in flight at once, more just wait a frame
+  uint32_t maxBatches = 4;
+  MeshFormat::VertexFormat vertexFormat = MeshFormat::VertexFormat::float32;
+  const ClusterCullingPass* clusterCulling = nullptr;
+};
+
+// Loads meshes in the background so the frame loop never waits on disk.
+// Requests are picked up by a pool of loader threads in priority order, read
+// (file or pack entry), decoded/converted (prepareMesh) and written straight
+// into a staging ring. The render thread then copies them into device local
+// buffers on the transfer queue, and once the copy's fence has signalled
+// flips the mesh to ready in the frame that first draws it. Until then draw
+// a placeholder.
+class AssetStreamer {
+ public:
+  enum class State : uint8_t {
+    queued,
+    // On a loader thread
+    loading,
+    // Staged, copy submitted or about to be
+    uploading,
+    ready,
+    failed,
+  };
+
+  using Handle = uint32_t;
+
+  // With a pack, names are entry names, otherwise paths. The pack has to
+  // outlive the streamer.
+  AssetStreamer(DeviceManager& devManager, const StreamerOptions& options, const AssetPack::PackReader* pack = nullptr);
+  // Drops whatever hasn't loaded yet, waits for copies in flight
+  ~AssetStreamer();
+
+  AssetStreamer(const AssetStreamer&) = delete;
+  AssetStreamer& operator=(const AssetStreamer&) = delete;
+
+  // Higher priority loads first, equal ones in request order
+  Handle requestMesh(const std::string& name, int priority = 0);
+
+  State getState(const Handle handle) const { return slots[handle].state.load(std::memory_order_acquire); }
+  // Hands a ready model over, once. Empty before it's ready and after.
+  std::optional<VulkanModel> takeModel(Handle handle);
+  const std::string& getName(const Handle handle) const { return slots[handle].name; }
+  // Neither ready nor failed
+  size_t pendingCount() const;
+
+  // Render thread, once per frame while recording commandBuffer (graphics
+  // queue) before anything draws. Never blocks: retires copies that have
+  // finished, records their queue family acquire + visibility barrier and
+  // marks them ready, then submits whatever got staged since last time.
+  void update(VkCommandBuffer commandBuffer);
+
+ private:
+  struct Slot {
+    std::string name;
+    std::atomic<State> state{State::queued};
+    std::optional<VulkanModel> model;
+    // Only kept past staging for its meshlets
+    PreparedMesh prepared;
+    std::chrono::steady_clock::time_point requested;
+  };
+
+  struct Buffer {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+  };
+
+  // A staged mesh, from the loader thread to the render thread
+  struct Upload {
+    Slot* slot = nullptr;
+    // Into the ring, or RingAllocator::invalid with a dedicated buffer
+    uint64_t ringOffset = RingAllocator::invalid;
+    Buffer dedicatedStaging;
+    VkDeviceSize vertexBytes = 0;
+    VkDeviceSize indexBytes = 0;
+    // Device local
+    Buffer vertices;
+    Buffer indices;
+  };
+
+  struct Batch {
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    std::vector<Upload> uploads;
+  };
+
+  struct Job {
+    int priority;
+    uint64_t sequence;
+    Slot* slot;
+
+    bool operator<(const Job& other) const {
+      return priority != other.priority ? priority < other.priority : sequence > other.sequence;
+    }
+  };
+
+  void workerLoop();
+  void load(Slot& slot);
+  // Blocks while the ring is full. False once the streamer is shutting down.
+  bool stage(Slot& slot, Upload& upload);
+  void retire(Batch& batch, VkCommandBuffer commandBuffer);
+  void submit(Batch& batch);
+  void destroyUpload(Upload& upload);
+  void destroyBuffer(Buffer& buffer);
+
+  DeviceManager& devManager;
+  const VkDevice device;
+  const StreamerOptions options;
+  const AssetPack::PackReader* const pack;
+
+  // Only the render thread touches the deque itself, loaders get a Slot*
+  std::deque<Slot> slots;
+
+  std::mutex jobMutex;
+  std::condition_variable jobAvailable;
+  std::priority_queue<Job> jobs;
+  uint64_t nextSequence = 0;
+  // Checked under jobMutex and ringMutex both
+  std::atomic<bool> stopping{false};
+
+  std::mutex ringMutex;
+  std::condition_variable ringFreed;
+  RingAllocator ring;
+  Buffer ringBuffer;
+  uint8_t* ringMapping = nullptr;
+
+  std::mutex stagedMutex;
+  std::vector<Upload> staged;
+
+  std::optional<CommandPoolWrapper> commandPool;
+  // In submission order
+  std::deque<Batch> inFlight;
+  std::vector<Batch> idleBatches;
+
+  std::vector<std::thread> workers;
+};
+
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "vulkan/vulkan.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "mesh_format.h"
+#include "vulkan_utils/descriptor_allocator.h"
+#include "vulkan_utils/device_manager.h"
+
+namespace VulkanUtils {
+
+// Gpu side of a mesh's MeshFormat::Meshlets: the meshlet data as storage
+// buffers, plus the index buffer and indirect draw the culling pass fills
+// in. Culling is per instance, so every instance of the mesh drawn in a
+// frame needs a target of its own (reserveTargets), each with a worst case
+// sized index buffer. Targets stay until the mesh goes. Draw with the
+// model's vertex buffer, getIndexBuffer(target) (32 bit) and
+// vkCmdDrawIndexedIndirect on getDrawBuffer(target).
+class ClusteredMesh {
+ public:
+  // One target to start with
+  ClusteredMesh(DeviceManager& devManager, VkDescriptorSetLayout setLayout, const MeshFormat::MeshletsView& meshlets);
+  ~ClusteredMesh();
+
+  ClusteredMesh(const ClusteredMesh&) = delete;
+  ClusteredMesh& operator=(const ClusteredMesh&) = delete;
+
+  // At least count targets. New ones only, the ones there may be in use.
+  void reserveTargets(uint32_t count);
+
+  uint32_t getMeshletCount() const { return meshletCount; }
+  uint32_t getTargetCount() const { return static_cast<uint32_t>(targets.size()); }
+  VkDescriptorSet getDescriptorSet(uint32_t target) const { return targets[target].descriptorSet; }
+  VkBuffer getIndexBuffer(uint32_t target) const { return targets[target].indices.buffer; }
+  VkBuffer getDrawBuffer(uint32_t target) const { return targets[target].draw.buffer; }
+
+ private:
+  // Also the shader's binding numbers, the last two are per target
+  enum BufferSlot { meshletData = 0, meshletVertices, meshletTriangles, culledIndices, drawCommand, slotCount };
+
+  struct Buffer {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+  };
+  struct Target {
+    Buffer indices;
+    Buffer draw;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  };
+
+  void createHostBuffer(DeviceManager& devManager, BufferSlot slot, const void* data, VkDeviceSize size);
+  void destroyBuffer(Buffer& buffer);
+
+  DeviceManager& devManager;
+  const VkDevice device;
+  const VkDescriptorSetLayout setLayout;
+  uint32_t meshletCount = 0;
+  // Worst case is everything visible
+  VkDeviceSize indexBytes = 0;
+  // The meshlet data, shared by every target
+  Buffer buffers[culledIndices];
+  std::vector<Target> targets;
+  DescriptorAllocator descriptors;
+};
+
+// Frustum + backface cone culling per meshlet in a compute pass, writing the
+// surviving triangles into one index stream and its indexCount into a
+// VkDrawIndexedIndirectCommand. Plain 1.0: storage buffers, one indirect draw
+// per instance, no mesh shaders or draw count.
+class ClusterCullingPass {
+ public:
+  struct Request {
+    const ClusteredMesh* mesh;
+    // One request per target a frame
+    uint32_t target;
+    glm::mat4 modelMatrix;
+  };
+
+  explicit ClusterCullingPass(DeviceManager& devManager);
+  ~ClusterCullingPass();
+
+  ClusterCullingPass(const ClusterCullingPass&) = delete;
+
+  VkDescriptorSetLayout getSetLayout() const { return setLayout; }
+
+  // Outside any render pass. Resets every request's draw, culls, and leaves
+  // the results visible to index fetch + indirect reads. Also waits on the
+  // previous frame's draws from the same buffers, so one set per target is
+  // enough.
+  void record(
+      VkCommandBuffer commandBuffer,
+      const std::vector<Request>& requests,
+      const glm::mat4& viewProjection,
+      const glm::vec3& cameraPosition) const;
+
+ private:
+  const VkDevice device;
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+};
+
+}
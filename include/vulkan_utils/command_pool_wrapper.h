@@ -6,6 +6,8 @@
 #include <stdexcept>
 #include <vector>
 
+#include "vulkan_utils/host_allocator.h"
+
 namespace VulkanUtils {
 class CommandPoolWrapper {
  public:
@@ -16,14 +18,14 @@ class CommandPoolWrapper {
     poolInfo.queueFamilyIndex = queueFamilyIndex;
     poolInfo.flags = flags;
 
-    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+    if (vkCreateCommandPool(device, &poolInfo, allocationCallbacks(), &commandPool) != VK_SUCCESS)
       throw std::runtime_error("Failed to create command pool!");
   }
 
   CommandPoolWrapper(CommandPoolWrapper&) = delete;
   ~CommandPoolWrapper() {
     if (commandPool != VK_NULL_HANDLE)
-      vkDestroyCommandPool(device, commandPool, nullptr);
+      vkDestroyCommandPool(device, commandPool, allocationCallbacks());
   }
 
   std::vector<VkCommandBuffer> allocateCommandBuffers(
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace VulkanUtils {
+
+// Things the gpu might still be using get parked here with the submit serial
+// (see SyncObjectsManager) they were last used in, and destroyed once that
+// serial has completed. Avoids vkDeviceWaitIdle for anything mid-run.
+//
+// Everything retired with the same serial lands in one batch, plain handles
+// in a list per type, and goes in one pass per type once the gpu is past it.
+// The batches' lists are kept for reuse, so a steady trickle of releases
+// doesn't allocate. enqueue() takes anything else as a callback.
+//
+// Things released while a frame is still being recorded don't have a serial
+// yet, the *Pending versions hold them until submitted() hands it over.
+class DeferredDestructionQueue {
+ public:
+  // vkFreeDescriptorSets, the pool needs FREE_DESCRIPTOR_SET_BIT
+  struct DescriptorSet {
+    VkDescriptorPool pool = VK_NULL_HANDLE;
+    VkDescriptorSet set = VK_NULL_HANDLE;
+  };
+
+  // The typed retire() destroys with device, callbacks only without one
+  explicit DeferredDestructionQueue(VkDevice _device = VK_NULL_HANDLE) : device(_device) {}
+  // Device has to be idle (or about to be) by the time this runs
+  ~DeferredDestructionQueue() { flush(); }
+
+  DeferredDestructionQueue(const DeferredDestructionQueue&) = delete;
+  DeferredDestructionQueue& operator=(const DeferredDestructionQueue&) = delete;
+
+  // destroy can't queue anything itself
+  void enqueue(uint64_t lastUsedSerial, std::function<void()> destroy) {
+    batchFor(lastUsedSerial).add(std::move(destroy));
+  }
+
+  // Buffers, memory, images, views, samplers, framebuffers, pipelines,
+  // descriptor sets/pools, semaphores and swapchains, alone or in a
+  // std::vector, or a std::unique_ptr to anything. Null handles are skipped.
+  template <class... Handles>
+  void retire(uint64_t lastUsedSerial, Handles&&... handles) {
+    requireDevice();
+    Batch& batch = batchFor(lastUsedSerial);
+    (batch.add(std::forward<Handles>(handles)), ...);
+  }
+
+  void enqueuePending(std::function<void()> destroy) { pending.add(std::move(destroy)); }
+  template <class... Handles>
+  void retirePending(Handles&&... handles) {
+    requireDevice();
+    (pending.add(std::forward<Handles>(handles)), ...);
+  }
+
+  // Everything pending went out with the submit that got this serial
+  void submitted(uint64_t serial);
+
+  // Serials only go up, so batches are already in order
+  void collect(uint64_t completedSerial);
+
+  // Pending included
+  void flush();
+
+  // Objects waiting, pending included
+  size_t size() const;
+
+ private:
+  using Lists = std::tuple<
+      std::vector<VkFramebuffer>,
+      std::vector<VkPipeline>,
+      std::vector<DescriptorSet>,
+      std::vector<VkDescriptorPool>,
+      std::vector<VkImageView>,
+      std::vector<VkSampler>,
+      std::vector<VkImage>,
+      std::vector<VkBuffer>,
+      std::vector<VkDeviceMemory>,
+      std::vector<VkSemaphore>,
+      std::vector<VkSwapchainKHR>>;
+  // Lists are picked by handle type, which needs them all distinct
+  static_assert(sizeof(VkBuffer) == sizeof(void*) && sizeof(void*) == 8, "handles have to be distinct types");
+
+  struct Batch {
+    uint64_t serial = 0;
+    std::vector<std::function<void()>> callbacks;
+    Lists lists;
+
+    void add(std::function<void()> destroy) { callbacks.push_back(std::move(destroy)); }
+    template <class T>
+    void add(std::unique_ptr<T> object) {
+      if (object)
+        callbacks.push_back([shared = std::shared_ptr<T>(std::move(object))]() mutable { shared.reset(); });
+    }
+    template <class Handle>
+    void add(const std::vector<Handle>& handles) {
+      for (const Handle handle : handles)
+        add(handle);
+    }
+    void add(const DescriptorSet set) {
+      if (set.set != VK_NULL_HANDLE)
+        std::get<std::vector<DescriptorSet>>(lists).push_back(set);
+    }
+    template <class Handle>
+    void add(const Handle handle) {
+      if (handle != VK_NULL_HANDLE)
+        std::get<std::vector<Handle>>(lists).push_back(handle);
+    }
+
+    size_t size() const;
+    bool empty() const { return size() == 0; }
+    // Moves everything in other onto the end of these
+    void append(Batch& other);
+    void clear();
+  };
+
+  void requireDevice() const {
+    if (device == VK_NULL_HANDLE)
+      throw std::runtime_error("failed to retire handles, the queue has no device!");
+  }
+  Batch& batchFor(uint64_t serial);
+  // Keeps the batch's lists for later
+  void destroy(Batch& batch);
+
+  const VkDevice device;
+  // Oldest first, only ever a few frames' worth
+  std::vector<Batch> batches;
+  Batch pending;
+  // Emptied batches, capacity intact
+  std::vector<Batch> spare;
+};
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "vulkan_utils/device_manager.h"
+
+namespace VulkanUtils {
+
+// How many of a descriptor type a pool holds per set it's sized for
+struct DescriptorPoolRatio {
+  VkDescriptorType type;
+  float perSet;
+};
+
+// Descriptor sets that never run out. Pools are sized from the ratios and
+// chained: when the current one is full (or fragmented) the next allocation
+// goes to a fresh pool twice the size, up to maxSetsPerPool. reset() hands
+// every set back at once and keeps the pools, the way per frame sets are
+// meant to be used. Not thread safe, one per thread/frame.
+class DescriptorAllocator {
+ public:
+  static constexpr uint32_t maxSetsPerPool = 4096;
+
+  DescriptorAllocator(
+      VkDevice device,
+      std::vector<DescriptorPoolRatio> ratios,
+      uint32_t initialSets = 32,
+      VkDescriptorPoolCreateFlags flags = 0);
+  ~DescriptorAllocator();
+
+  DescriptorAllocator(const DescriptorAllocator&) = delete;
+  DescriptorAllocator& operator=(const DescriptorAllocator&) = delete;
+  DescriptorAllocator(DescriptorAllocator&& other) noexcept;
+
+  // Throws std::runtime_error if even a fresh pool can't take it, a layout
+  // with more descriptors than the ratios give one set for example
+  VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+  // Every set allocated so far is gone, the gpu has to be done with them
+  void reset();
+
+  size_t getPoolCount() const { return ready.size() + full.size(); }
+
+ private:
+  VkDescriptorPool createPool(uint32_t sets) const;
+  // The pool allocations go to, a new one if none are left
+  VkDescriptorPool currentPool();
+
+  VkDevice device;
+  std::vector<DescriptorPoolRatio> ratios;
+  VkDescriptorPoolCreateFlags flags;
+  // Size of the next pool made
+  uint32_t setsPerPool;
+  // Allocating from ready.back()
+  std::vector<VkDescriptorPool> ready;
+  std::vector<VkDescriptorPool> full;
+};
+
+// Writes a set from one block of memory laid out as the entries say
+// (offset/stride per binding), one call instead of building
+// VkWriteDescriptorSets. vkUpdateDescriptorSetWithTemplate where the device
+// has it (1.1 or VK_KHR_descriptor_update_template), plain writes built
+// from the same entries where it doesn't.
+class DescriptorUpdateTemplate {
+ public:
+  DescriptorUpdateTemplate(
+      DeviceManager& devManager,
+      VkDescriptorSetLayout layout,
+      std::vector<VkDescriptorUpdateTemplateEntry> entries);
+  ~DescriptorUpdateTemplate();
+
+  DescriptorUpdateTemplate(const DescriptorUpdateTemplate&) = delete;
+  DescriptorUpdateTemplate& operator=(const DescriptorUpdateTemplate&) = delete;
+
+  // data holds VkDescriptorImageInfo/VkDescriptorBufferInfo/VkBufferView
+  // at the entries' offsets
+  void update(VkDescriptorSet set, const void* data) const;
+
+ private:
+  const DeviceManager& devManager;
+  const std::vector<VkDescriptorUpdateTemplateEntry> entries;
+  VkDescriptorUpdateTemplate handle = VK_NULL_HANDLE;
+};
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace VulkanUtils {
+
+// Set layouts by what they describe, so every system asking for the same
+// bindings shares one. Owns them, they live as long as the device
+// (DeviceManager::getLayoutCache). Thread safe.
+class DescriptorLayoutCache {
+ public:
+  explicit DescriptorLayoutCache(VkDevice _device) : device(_device) {}
+  ~DescriptorLayoutCache();
+
+  DescriptorLayoutCache(const DescriptorLayoutCache&) = delete;
+  DescriptorLayoutCache& operator=(const DescriptorLayoutCache&) = delete;
+
+  // Bindings in any order. pNext chains (binding flags) aren't part of the
+  // key, std::invalid_argument for those. Throws std::runtime_error if the
+  // layout can't be created.
+  VkDescriptorSetLayout get(const VkDescriptorSetLayoutCreateInfo& info);
+  size_t size() const;
+
+ private:
+  struct Binding {
+    uint32_t binding;
+    VkDescriptorType type;
+    uint32_t count;
+    VkShaderStageFlags stages;
+    std::vector<VkSampler> immutableSamplers;
+
+    bool operator==(const Binding& other) const;
+  };
+
+  struct Key {
+    VkDescriptorSetLayoutCreateFlags flags;
+    // Sorted by binding
+    std::vector<Binding> bindings;
+
+    bool operator==(const Key& other) const { return flags == other.flags && bindings == other.bindings; }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  const VkDevice device;
+  mutable std::mutex mutex;
+  std::unordered_map<Key, VkDescriptorSetLayout, KeyHash> layouts;
+};
+
+// Samplers by create info. There are only a handful of distinct ones in
+// practice, and some drivers cap the total (maxSamplerAllocationCount can be
+// as low as 4000). Owned like the layouts (DeviceManager::getSamplerCache),
+// never destroy one you got from here. Thread safe.
+class SamplerCache {
+ public:
+  explicit SamplerCache(VkDevice _device) : device(_device) {}
+  ~SamplerCache();
+
+  SamplerCache(const SamplerCache&) = delete;
+  SamplerCache& operator=(const SamplerCache&) = delete;
+
+  // pNext chains (ycbcr conversion, reduction modes) aren't part of the key,
+  // std::invalid_argument for those. Throws std::runtime_error if the
+  // sampler can't be created.
+  VkSampler get(const VkSamplerCreateInfo& info);
+  size_t size() const;
+
+ private:
+  struct Key {
+    VkSamplerCreateInfo info;
+
+    bool operator==(const Key& other) const;
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  const VkDevice device;
+  mutable std::mutex mutex;
+  std::unordered_map<Key, VkSampler, KeyHash> samplers;
+};
+
+}
@@ -6,16 +6,41 @@
 #include <vector>
 
 #include "vulkan_utils/command_pool_wrapper.h"
+#include "vulkan_utils/descriptor_cache.h"
+#include "vulkan_utils/host_allocator.h"
 #include "vulkan_utils/scoped_command_buffer.h"
+#include "vulkan_utils/timeline_semaphore.h"
 
 namespace VulkanUtils {
+// Opt-in features. Anything the device can't do is silently left off, check
+// the has* getters afterwards.
+struct DeviceOptions {
+  // What the instance was created with, gates anything past 1.0
+  uint32_t apiVersion = VK_API_VERSION_1_0;
+  // Needs 1.2. Replaces per frame fences with a timeline per queue
+  bool timelineSemaphores = false;
+  // VK_KHR_present_id + VK_KHR_present_wait, lets frame pacing see when
+  // frames actually hit the screen
+  bool presentWait = false;
+  // vkCmdBeginRendering instead of render pass + framebuffer objects. Core in
+  // 1.3, VK_KHR_dynamic_rendering on 1.2
+  bool dynamicRendering = false;
+  // A queue from a transfer only family (the copy engines on discrete cards)
+  // so uploads run next to rendering. Uses the graphics queue if there's none.
+  bool transferQueue = false;
+  // VK_EXT_memory_budget, what each heap may really hold given everything
+  // else on the system. Needs 1.1 for the properties2 query.
+  bool memoryBudget = false;
+};
+
 class DeviceManager {
  public:
   DeviceManager(
       VkInstance _instance,
       VkSurfaceKHR surface,
       const std::vector<const char*>& requiredDeviceExtensions,
-      const std::optional<std::vector<const char*>>& validationLayers = std::nullopt);
+      const std::optional<std::vector<const char*>>& validationLayers = std::nullopt,
+      const DeviceOptions& options = {});
 
   ~DeviceManager();
 
@@ -24,10 +49,60 @@ class DeviceManager {
   VkDevice getDevice() const { return device; }
   VkQueue getGraphicsQueue() const { return graphicsQueue; }
   VkQueue getPresentQueue() const { return presentQueue; }
+  uint32_t getGraphicsFamily() const { return graphicsFamily; }
+  // The graphics queue unless a dedicated one was asked for and found. Only
+  // ever submit to it from one thread, it may be the graphics queue.
+  VkQueue getTransferQueue() const { return transferQueue; }
+  uint32_t getTransferFamily() const { return transferFamily; }
+  // Buffers/images written on it need a queue family ownership transfer
+  bool hasDedicatedTransferQueue() const { return transferFamily != graphicsFamily; }
   CommandPoolWrapper& getCommandPoolWrapper() { return *commandPoolWrapper; };
 
   VkPhysicalDevice getPhysicalDevice() const { return physicalDevice; }
 
+  bool hasTimelineSemaphores() const { return graphicsTimeline.has_value(); }
+  // null unless timeline semaphores are enabled
+  QueueTimeline* getGraphicsTimeline() { return graphicsTimeline ? &*graphicsTimeline : nullptr; }
+
+  bool hasPresentWait() const { return presentWaitEnabled; }
+  // VK_ERROR_EXTENSION_NOT_PRESENT without present wait, VK_TIMEOUT if not presented yet
+  VkResult waitForPresent(VkSwapchainKHR swapchain, uint64_t presentId, uint64_t timeout) const;
+
+  // See DeviceMemoryManager, heap sizes are all there is without it
+  bool hasMemoryBudget() const { return memoryBudgetEnabled; }
+
+  // Storage images without a format qualifier, MipGenerator's compute path needs it
+  bool hasStorageImageWriteWithoutFormat() const { return storageImageWriteWithoutFormat; }
+
+  bool hasDynamicRendering() const { return beginRenderingFn != nullptr; }
+  // Only valid with dynamic rendering, either the core or the KHR entry point
+  void cmdBeginRendering(VkCommandBuffer commandBuffer, const VkRenderingInfoKHR& renderingInfo) const {
+    beginRenderingFn(commandBuffer, &renderingInfo);
+  }
+  void cmdEndRendering(VkCommandBuffer commandBuffer) const { endRenderingFn(commandBuffer); }
+
+  // Core in 1.1, VK_KHR_descriptor_update_template before that. See
+  // DescriptorUpdateTemplate, which falls back to plain writes without it.
+  bool hasDescriptorUpdateTemplates() const { return updateWithTemplateFn != nullptr; }
+  VkResult createDescriptorUpdateTemplate(
+      const VkDescriptorUpdateTemplateCreateInfo& createInfo,
+      VkDescriptorUpdateTemplate& updateTemplate) const {
+    return createTemplateFn(device, &createInfo, allocationCallbacks(), &updateTemplate);
+  }
+  void destroyDescriptorUpdateTemplate(VkDescriptorUpdateTemplate updateTemplate) const {
+    destroyTemplateFn(device, updateTemplate, allocationCallbacks());
+  }
+  void updateDescriptorSetWithTemplate(
+      VkDescriptorSet set,
+      VkDescriptorUpdateTemplate updateTemplate,
+      const void* data) const {
+    updateWithTemplateFn(device, set, updateTemplate, data);
+  }
+
+  // Shared by everything on this device, gone with it
+  DescriptorLayoutCache& getLayoutCache() { return *layoutCache; }
+  SamplerCache& getSamplerCache() { return *samplerCache; }
+
   ScopedCommandBuffer createScopedCommandBuffer() {
     return ScopedCommandBuffer(device, transientPool->getCommandPool(), getGraphicsQueue());
   }
@@ -87,9 +162,11 @@ class DeviceManager {
         bufferMemory);
   }
 
-  // finalLayout should probably be VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-  // currently no form of texture streaming supported.. once on the gpu it doesn't
-  // come off
+  // finalLayout should probably be VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL.
+  // Images made here stay as they are, TextureResidencyManager streams
+  // textures by making new ones with just the resident levels.
+  // mipLevels see mipLevelCount, fill them with a MipGenerator. All levels
+  // end up in finalLayout.
   VkResult createImage(
       uint32_t width,
       uint32_t height,
@@ -99,19 +176,24 @@ class DeviceManager {
       VkMemoryPropertyFlags properties,
       VkImage& image,
       VkDeviceMemory& imageMemory,
-      VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+      VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      uint32_t mipLevels = 1);
 
+  // mipLevels from baseMipLevel, VK_REMAINING_MIP_LEVELS for the whole chain
   VkResult createImageView(
       VkImage image, 
       VkFormat format, 
       VkImageAspectFlags aspectFlags, 
-      VkImageView& imageView);
+      VkImageView& imageView,
+      uint32_t mipLevels = 1,
+      uint32_t baseMipLevel = 0);
 
 void transitionImageLayout(
     VkImage image,
     VkFormat format,
     VkImageLayout oldLayout,
-    VkImageLayout newLayout);
+    VkImageLayout newLayout,
+    uint32_t mipLevels = 1);
 
  private:
   void pickPhysicalDevice(
@@ -120,7 +202,8 @@ void transitionImageLayout(
   void createLogicalDevice(
       const VkSurfaceKHR surface,
       const std::vector<const char*>& requiredDeviceExtensions,
-      const std::optional<std::vector<const char*>>& validationLayers);
+      const std::optional<std::vector<const char*>>& validationLayers,
+      const DeviceOptions& options);
 
   VkInstance instance;
 
@@ -132,11 +215,31 @@ void transitionImageLayout(
 
   VkQueue graphicsQueue;
   VkQueue presentQueue;
+  VkQueue transferQueue;
+  uint32_t graphicsFamily = 0;
+  uint32_t transferFamily = 0;
+
+  bool timelineSemaphoresEnabled = false;
+  bool presentWaitEnabled = false;
+  bool memoryBudgetEnabled = false;
+  bool storageImageWriteWithoutFormat = false;
+  PFN_vkWaitForPresentKHR waitForPresentFn = nullptr;
+  PFN_vkCmdBeginRenderingKHR beginRenderingFn = nullptr;
+  PFN_vkCmdEndRenderingKHR endRenderingFn = nullptr;
+  PFN_vkCreateDescriptorUpdateTemplate createTemplateFn = nullptr;
+  PFN_vkDestroyDescriptorUpdateTemplate destroyTemplateFn = nullptr;
+  PFN_vkUpdateDescriptorSetWithTemplate updateWithTemplateFn = nullptr;
+  std::optional<DescriptorLayoutCache> layoutCache;
+  std::optional<SamplerCache> samplerCache;
+  // Declared after the pools so it's destroyed before the device goes away
+  std::optional<QueueTimeline> graphicsTimeline;
 };
 
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphicsFamily;
   std::optional<uint32_t> presentFamily;
+  // Transfer but no graphics/compute, the dma engines. Not required.
+  std::optional<uint32_t> transferFamily;
 
   bool isComplete() {
     return graphicsFamily.has_value() && presentFamily.has_value();
@@ -168,9 +271,26 @@ inline QueueFamilyIndices findQueueFamilies(const VkPhysicalDevice device, const
     i++;
   }
 
+  // Every graphics family can transfer, only worth it when it's a separate one
+  for (uint32_t family = 0; family < queueFamilyCount; ++family) {
+    const VkQueueFlags flags = queueFamilies[family].queueFlags;
+    if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+      indices.transferFamily = family;
+      break;
+    }
+  }
+
   return indices;
 }
 
+// Full chain down to 1x1
+inline uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+  uint32_t levels = 1;
+  for (uint32_t size = width > height ? width : height; size > 1; size >>= 1)
+    ++levels;
+  return levels;
+}
+
 struct SwapChainSupportDetails {
   VkSurfaceCapabilitiesKHR capabilities;
   std::vector<VkSurfaceFormatKHR> formats;
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+#include "vulkan_utils/device_manager.h"
+
+namespace VulkanUtils {
+
+struct FramePacingOptions {
+  // 0 is uncapped
+  double maxFps = 0.0;
+  // Sleep before sampling input so the frame finishes just before it's
+  // needed instead of sitting in the present queue. Needs present wait to
+  // know where vsync is, otherwise only the fps cap applies.
+  bool justInTime = false;
+  // How far ahead of the predicted present we never wake later than
+  double minWakeMarginMs = 0.5;
+};
+
+struct FrameLatency {
+  uint64_t frameId = 0;
+  // input sample -> queue submit
+  double cpuMs = 0.0;
+  // input sample -> on screen. Only valid if presentMeasured
+  double presentMs = 0.0;
+  bool presentMeasured = false;
+};
+
+// Call order per frame:
+//   beginFrame() -> sample input -> record -> markSubmitted()
+//   -> attachPresentId(presentInfo) -> vkQueuePresentKHR -> endFrame()
+class FramePacer {
+ public:
+  FramePacer(const DeviceManager& devManager, const FramePacingOptions& options);
+
+  FramePacer(const FramePacer&) = delete;
+
+  // Sleeps according to the cap / just in time policy and marks the input
+  // sample time for this frame.
+  void beginFrame(VkSwapchainKHR swapchain);
+  void markSubmitted();
+  // Chains a VkPresentIdKHR onto presentInfo when present wait is on. The
+  // chained struct lives in the pacer until the next call.
+  void attachPresentId(VkPresentInfoKHR& presentInfo);
+  // Picks up any presents that completed since last frame
+  void endFrame(VkSwapchainKHR swapchain);
+
+  // Pending present ids belong to the old swapchain
+  void onSwapchainRecreated();
+
+  // Oldest first, bounded
+  const std::deque<FrameLatency>& getLatencyHistory() const { return history; }
+  double averagePresentLatencyMs() const;
+  double getRefreshPeriodMs() const { return toMs(refreshPeriod); }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct PendingFrame {
+    uint64_t presentId;
+    Clock::time_point sampled;
+    Clock::time_point submitted;
+  };
+
+  static double toMs(Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); }
+  static void preciseSleepUntil(Clock::time_point target);
+
+  void recordPresent(const PendingFrame& frame, Clock::time_point presentedAt, bool hitTarget);
+  void retireWithoutPresent(const PendingFrame& frame);
+
+  const DeviceManager& devManager;
+  const FramePacingOptions options;
+  const bool canWaitForPresent;
+  const Clock::duration capInterval;
+
+  uint64_t nextFrameId = 1;
+  PendingFrame current{};
+  std::deque<PendingFrame> pending;
+  VkPresentIdKHR presentIdInfo{};
+  uint64_t presentIdStorage = 0;
+
+  // Estimated from present to present deltas
+  Clock::duration refreshPeriod{};
+  Clock::time_point lastPresent{};
+  Clock::time_point targetPresent{};
+  Clock::time_point lastFrameStart{};
+  // How long before the predicted vsync we wake. Grows fast on a missed
+  // vsync, shrinks slowly while we keep hitting them.
+  Clock::duration wakeOffset{};
+
+  std::deque<FrameLatency> history;
+};
+
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace VulkanUtils {
+
+// What every vkCreate*/vkDestroy*/vkAllocateMemory/vkFreeMemory in the tree
+// passes as pAllocator. nullptr (the driver's own malloc) unless a
+// HostAllocator is alive.
+const VkAllocationCallbacks* allocationCallbacks();
+
+struct HostAllocatorOptions {
+  // Small command and object scope allocations come out of per thread
+  // size class pools. Off, everything goes to malloc and is only counted.
+  bool pooling = true;
+  // Pools grow this much at a time
+  size_t chunkSize = size_t(64) << 10;
+};
+
+// VkAllocationCallbacks for the driver's host memory, so it shows up
+// somewhere. Bytes are counted per VkSystemAllocationScope, now and at the
+// peak, along with what the driver reports allocating itself (the internal
+// notifications).
+//
+// Command and object scope allocations up to maxPooledSize are the bulk of
+// it and mostly short lived, they come out of a pool per thread instead of
+// malloc. A thread hands its pool on when it exits, and memory freed on
+// another thread than it came from goes back through a lock free list the
+// owner picks up on its next allocation. Everything else is malloc.
+//
+// Thread safe. allocationCallbacks() points at this one while it's alive,
+// so it has to be made before the instance and outlive every vulkan object
+// and every thread calling into vulkan. One at a time.
+class HostAllocator {
+ public:
+  // Bigger than this (or aligned to more than 16) isn't pooled
+  static constexpr size_t maxPooledSize = 2048 - 16;
+  // Anything aligned to more fails, the header can't reach back further
+  static constexpr size_t maxAlignment = size_t(32) << 10;
+  static constexpr uint32_t scopeCount = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+  struct ScopeStats {
+    uint64_t bytes = 0;
+    uint64_t peakBytes = 0;
+    // Live allocations, every one made, and how many of those were pooled
+    uint64_t allocations = 0;
+    uint64_t totalAllocations = 0;
+    uint64_t pooledAllocations = 0;
+    // pfnInternalAllocation, executable memory and the like
+    uint64_t internalBytes = 0;
+    uint64_t peakInternalBytes = 0;
+  };
+
+  explicit HostAllocator(const HostAllocatorOptions& options = {});
+  ~HostAllocator();
+
+  HostAllocator(const HostAllocator&) = delete;
+  HostAllocator& operator=(const HostAllocator&) = delete;
+
+  const VkAllocationCallbacks* getCallbacks() const { return &callbacks; }
+
+  ScopeStats getStats(VkSystemAllocationScope scope) const;
+  // Peak of the sum across scopes, not the sum of the peaks
+  uint64_t getPeakBytes() const { return peakTotal.load(std::memory_order_relaxed); }
+  // Chunks the pools hold, used or not
+  uint64_t getPoolBytes() const { return poolBytes.load(std::memory_order_relaxed); }
+
+  static const char* scopeName(VkSystemAllocationScope scope);
+
+ private:
+  // Slots are 32 to 2048 bytes, header included
+  static constexpr uint32_t classCount = 7;
+  static constexpr size_t headerSize = 16;
+
+  struct Pool;
+
+  // Right in front of every pointer handed out
+  struct alignas(16) Header {
+    // Where a slot goes back to, nullptr for malloc
+    Pool* pool;
+    uint32_t size;
+    // malloc only: bytes back to what malloc returned
+    uint16_t offset;
+    uint8_t scope;
+    uint8_t sizeClass;
+  };
+  static_assert(sizeof(Header) == headerSize, "header has to keep payloads 16 byte aligned");
+
+  // Owned by one thread at a time
+  struct Pool {
+    // Linked through the first bytes of the payload
+    std::array<Header*, classCount> free{};
+    // Frees from other threads, moved onto free by the owner
+    std::atomic<Header*> remote{nullptr};
+    char* bump = nullptr;
+    char* bumpEnd = nullptr;
+    std::vector<char*> chunks;
+  };
+
+  struct alignas(64) Counters {
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> peakBytes{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> totalAllocations{0};
+    std::atomic<uint64_t> pooledAllocations{0};
+    std::atomic<uint64_t> internalBytes{0};
+    std::atomic<uint64_t> peakInternalBytes{0};
+  };
+
+  static VKAPI_ATTR void* VKAPI_CALL allocationFn(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope);
+  static VKAPI_ATTR void* VKAPI_CALL reallocationFn(
+      void* userData,
+      void* original,
+      size_t size,
+      size_t alignment,
+      VkSystemAllocationScope scope);
+  static VKAPI_ATTR void VKAPI_CALL freeFn(void* userData, void* memory);
+  static VKAPI_ATTR void VKAPI_CALL internalAllocationFn(
+      void* userData,
+      size_t size,
+      VkInternalAllocationType type,
+      VkSystemAllocationScope scope);
+  static VKAPI_ATTR void VKAPI_CALL internalFreeFn(
+      void* userData,
+      size_t size,
+      VkInternalAllocationType type,
+      VkSystemAllocationScope scope);
+
+  void* allocate(size_t size, size_t alignment, VkSystemAllocationScope scope);
+  void* reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+  void free(void* memory);
+
+  // This thread's, taking over an idle one or making one
+  Pool& threadPool();
+  void releasePool(Pool* pool);
+  Header* takeSlot(Pool& pool, uint32_t sizeClass);
+  // Free list link, in the payload
+  static Header*& nextOf(Header* slot);
+  void counted(Header& header, bool pooled);
+  void uncounted(const Header& header);
+
+  const HostAllocatorOptions options;
+  // Tells a thread's cached pool from one of an allocator since destroyed
+  const uint64_t generation;
+  VkAllocationCallbacks callbacks{};
+
+  std::array<Counters, scopeCount> counters;
+  std::atomic<uint64_t> total{0};
+  std::atomic<uint64_t> peakTotal{0};
+  std::atomic<uint64_t> poolBytes{0};
+
+  // Guards the two below, only touched when a thread gets or gives up a pool
+  std::mutex poolsMutex;
+  std::vector<std::unique_ptr<Pool>> pools;
+  std::vector<Pool*> idle;
+
+  friend struct ThreadPoolCache;
+};
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <cstdint>
+
+#include "vulkan_utils/deferred_destruction_queue.h"
+#include "vulkan_utils/descriptor_allocator.h"
+#include "vulkan_utils/device_manager.h"
+#include "vulkan_utils/vulkan_types.h"
+
+namespace VulkanUtils {
+
+// InstanceData for every draw of a frame in one host visible storage buffer,
+// mapped for good. Each frame in flight has its own slice, bound once a
+// frame (one dynamic storage buffer) at that slice's offset, and draws pick
+// theirs with PerDrawPushConstants::instance. Filled in place through the
+// mapping, InstanceKernels included, coherent so there's nothing to flush.
+//
+// Slices double when a frame needs more than they hold, in a new buffer.
+// The old one goes to the DeferredDestructionQueue, its set stays in the
+// allocator until this goes, there's only ever a handful.
+class InstanceBuffer {
+ public:
+  InstanceBuffer(DeviceManager& devManager, uint32_t framesInFlight, uint32_t initialCapacity = 1024);
+  ~InstanceBuffer();
+
+  InstanceBuffer(const InstanceBuffer&) = delete;
+  InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+  // From the device's layout cache, not ours to destroy
+  static VkDescriptorSetLayout createSetLayout(DeviceManager& devManager);
+
+  // Room for count instances in frameIndex's slice, whose last submit has
+  // to have finished. When it has to grow the old buffer is retired with
+  // lastUsedSerial. Write only, it's likely uncached.
+  InstanceData* map(
+      uint32_t frameIndex,
+      uint32_t count,
+      DeferredDestructionQueue& retired,
+      uint64_t lastUsedSerial);
+  // The slice map() last handed out
+  void bind(VkCommandBuffer commandBuffer, VkPipelineLayout layout, uint32_t setIndex) const;
+
+  uint32_t getCapacity() const { return capacity; }
+
+ private:
+  // capacity per frame, a new buffer + set
+  void allocate(uint32_t newCapacity);
+
+  DeviceManager& devManager;
+  const VkDevice device;
+  const uint32_t framesInFlight;
+  // Between slices, minStorageBufferOffsetAlignment at least
+  VkDeviceSize alignment = 0;
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  DescriptorAllocator descriptors;
+
+  uint32_t capacity = 0;
+  VkDeviceSize sliceSize = 0;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  uint8_t* mapped = nullptr;
+  VkDescriptorSet set = VK_NULL_HANDLE;
+  uint32_t currentFrame = 0;
+};
+
+}
@@ -14,10 +14,14 @@ class VulkanInstanceWrapper {
  public:
   VulkanInstanceWrapper(
       VulkanUtils::WindowAndSurfaceManager& windowManager,
-      const std::optional<std::vector<const char*>>& validationLayers = std::nullopt);
+      const std::optional<std::vector<const char*>>& validationLayers = std::nullopt,
+      uint32_t requestedApiVersion = VK_API_VERSION_1_0);
   ~VulkanInstanceWrapper();
 
   inline VkInstance getInstance() { return instance; }
+  // What the instance was actually created with. Can be lower than requested
+  // if the loader is older
+  uint32_t getApiVersion() const { return apiVersion; }
 
   VulkanInstanceWrapper(const VulkanInstanceWrapper&) = delete;
  private:
@@ -39,6 +43,7 @@ class VulkanInstanceWrapper {
   VkInstance instance;
   VkDebugUtilsMessengerEXT debugMessenger;
   const bool enableValidationLayers;
+  uint32_t apiVersion = VK_API_VERSION_1_0;
 };
 
 }
@@ -0,0 +1,226 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "vulkan_utils/deferred_destruction_queue.h"
+#include "vulkan_utils/device_manager.h"
+
+namespace VulkanUtils {
+
+struct MemoryOptions {
+  // Device memory comes from the driver in blocks this size. Anything over
+  // half a block gets a block of its own.
+  VkDeviceSize blockSize = VkDeviceSize(64) << 20;
+  // Fraction of a heap's budget to stay under. Past it streaming clients
+  // are told to give memory back.
+  float softLimit = 0.9f;
+  // Bytes defragmentation copies per update(), 0 turns it off
+  VkDeviceSize defragPerFrame = VkDeviceSize(8) << 20;
+  // Blocks less full than this get emptied into the others and freed, any
+  // block that fits while a heap is over the soft limit
+  float defragThreshold = 0.5f;
+};
+
+// Buffers and images suballocated from a few big blocks per memory type, so
+// the driver sees a handful of vkAllocateMemory calls instead of one per
+// resource.
+//
+// Once a frame, update() reads the heap budgets. That's VK_EXT_memory_budget
+// where the device has it, otherwise a fraction of the heap size measured
+// against our own blocks. Streaming clients (addStreamingClient) get told
+// how much they may hold so the device local heaps stay under the soft
+// limit. Then a step of defragmentation runs. Movable resources in a mostly
+// empty block are copied into the others on the gpu, a few MiB a frame, and
+// the block is freed once it's empty. A moved resource gets a new handle.
+// Its owner hears about it through onMoved and has to fetch it again.
+//
+// Render thread only.
+class DeviceMemoryManager {
+ public:
+  using Resource = uint32_t;
+  static constexpr Resource invalid = UINT32_MAX;
+
+  struct HeapInfo {
+    VkDeviceSize size = 0;
+    // What we can use. From the driver, or 80% of size without the extension.
+    VkDeviceSize budget = 0;
+    // The whole process per the driver, or just our blocks without the
+    // extension
+    VkDeviceSize usage = 0;
+    // In our blocks, and what live resources take of that
+    VkDeviceSize blockBytes = 0;
+    VkDeviceSize usedBytes = 0;
+    // Released or moved away from, free once the gpu is done with them
+    VkDeviceSize releasedBytes = 0;
+    bool deviceLocal = false;
+  };
+
+  struct Stats {
+    uint32_t blocks = 0;
+    uint32_t resources = 0;
+    uint32_t moves = 0;
+    VkDeviceSize movedBytes = 0;
+    uint32_t freedBlocks = 0;
+    // Frames a device local heap was over the soft limit
+    uint32_t overLimitFrames = 0;
+  };
+
+  explicit DeviceMemoryManager(DeviceManager& devManager, const MemoryOptions& options = {});
+  // Device has to be idle
+  ~DeviceMemoryManager();
+
+  DeviceMemoryManager(const DeviceMemoryManager&) = delete;
+  DeviceMemoryManager& operator=(const DeviceMemoryManager&) = delete;
+
+  // onMoved makes it movable. It's called from update() after the copy was
+  // recorded, and the new handle is what later commands have to use.
+  // Movable buffers get transfer src/dst usage added. Both throw
+  // std::runtime_error if there's no memory left for them.
+  Resource createBuffer(
+      VkDeviceSize size,
+      VkBufferUsageFlags usage,
+      VkMemoryPropertyFlags properties,
+      std::function<void()> onMoved = nullptr);
+  // Exclusive sharing only. Movable images have to be in restingLayout,
+  // every subresource, whenever update() records. Transfer src/dst usage is
+  // added for them.
+  Resource createImage(
+      const VkImageCreateInfo& info,
+      VkMemoryPropertyFlags properties,
+      VkImageLayout restingLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      std::function<void()> onMoved = nullptr);
+  // Gone once the frame being recorded is done with it (see submitted)
+  void release(Resource resource);
+
+  VkBuffer getBuffer(const Resource resource) const { return entries[resource].buffer; }
+  VkImage getImage(const Resource resource) const { return entries[resource].image; }
+  // Where it sits, for mapping host visible ones. Changes with a move.
+  VkDeviceMemory getMemory(Resource resource) const;
+  VkDeviceSize getOffset(const Resource resource) const { return entries[resource].allocation.offset; }
+
+  // Something that can give memory back (a texture streamer). usedBytes is
+  // what it holds, setLimit what it may hold from now on, called every
+  // update(). Returns an id for removeStreamingClient.
+  uint32_t addStreamingClient(std::function<VkDeviceSize()> usedBytes, std::function<void(VkDeviceSize)> setLimit);
+  void removeStreamingClient(uint32_t id);
+
+  // Once per frame, outside a render pass and after anything else that
+  // records writes to managed resources. Frees what completedSerial is done
+  // with, reads the budgets, hands out limits and records a defrag step.
+  void update(VkCommandBuffer commandBuffer, uint64_t completedSerial);
+  // Once the frame update() recorded into has been submitted as serial
+  void submitted(uint64_t serial);
+
+  const std::vector<HeapInfo>& getHeaps() const { return heaps; }
+  const Stats& getStats() const { return stats; }
+
+ private:
+  struct Block {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint32_t memoryType = 0;
+    // Optimal tiling images and everything else never share a block, no
+    // bufferImageGranularity to worry about
+    bool images = false;
+    // One resource's, freed with it
+    bool dedicated = false;
+    // Being emptied, nothing new goes in
+    bool draining = false;
+    // Offset to size, merged with neighbours on free
+    std::map<VkDeviceSize, VkDeviceSize> free;
+    VkDeviceSize used = 0;
+    uint32_t allocations = 0;
+    uint32_t unmovable = 0;
+    // Couldn't be emptied, not tried again before this frame
+    uint64_t retryFrame = 0;
+  };
+
+  struct Allocation {
+    uint32_t block = UINT32_MAX;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+  };
+
+  struct Entry {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkImage image = VK_NULL_HANDLE;
+    // To make the copy a move goes to
+    VkDeviceSize bufferSize = 0;
+    VkBufferUsageFlags bufferUsage = 0;
+    VkImageCreateInfo imageInfo{};
+    VkImageLayout restingLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkMemoryPropertyFlags properties = 0;
+    Allocation allocation;
+    std::function<void()> onMoved;
+    bool live = false;
+  };
+
+  struct StreamingClient {
+    std::function<VkDeviceSize()> usedBytes;
+    std::function<void(VkDeviceSize)> setLimit;
+  };
+
+  // A resource this frame's defrag step copies, old to new
+  struct Move {
+    Resource resource;
+    VkBuffer oldBuffer = VK_NULL_HANDLE;
+    VkImage oldImage = VK_NULL_HANDLE;
+  };
+
+  uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+  // In any non draining block of the type, a new block if allowed. False if
+  // there's no room (or no memory for another block).
+  bool allocate(
+      const VkMemoryRequirements& requirements,
+      VkMemoryPropertyFlags properties,
+      bool images,
+      bool allowNewBlock,
+      Allocation& allocation);
+  // First fit, splitting off what's left either side
+  bool allocateFrom(uint32_t blockIndex, const VkMemoryRequirements& requirements, Allocation& allocation);
+  void free(const Allocation& allocation, bool movable);
+  // UINT32_MAX if the driver is out of memory
+  uint32_t createBlock(uint32_t memoryType, VkDeviceSize size, bool images, bool dedicated);
+  void destroyBlock(uint32_t blockIndex);
+  // New handle for entry made and bound to a new allocation. False, with
+  // nothing made, if there's no memory for it.
+  bool createHandle(Entry& entry, bool allowNewBlock);
+  Resource newEntry();
+
+  void refreshBudgets();
+  void applyPressure();
+  void defragment(VkCommandBuffer commandBuffer);
+  // Marks the emptiest block whose contents fit in the rest of its kind.
+  // Over the soft limit that ignores defragThreshold.
+  void startDraining();
+  void record(VkCommandBuffer commandBuffer, const std::vector<Move>& moves);
+
+  DeviceManager& devManager;
+  const VkDevice device;
+  const MemoryOptions options;
+  VkPhysicalDeviceMemoryProperties memoryProperties{};
+
+  // Null where a block was freed, indices stay put
+  std::vector<std::unique_ptr<Block>> blocks;
+  std::vector<Entry> entries;
+  std::vector<Resource> freeEntries;
+  std::vector<HeapInfo> heaps;
+  // The largest device local heap, the one streaming clients are kept under
+  uint32_t pressureHeap = UINT32_MAX;
+  uint64_t frame = 0;
+  std::map<uint32_t, StreamingClient> clients;
+  uint32_t nextClient = 0;
+  Stats stats;
+
+  // Released resources and moved from copies. Pending while the frame being
+  // recorded may still use them, submitted() gives them its serial.
+  DeferredDestructionQueue retired;
+};
+
+}
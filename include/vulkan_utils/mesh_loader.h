@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "asset_pack.h"
+#include "mesh_format.h"
+#include "vulkan_utils/cluster_culling.h"
+#include "vulkan_utils/device_manager.h"
+#include "vulkan_utils/vulkan_types.h"
+
+namespace VulkanUtils {
+// Everything about a mesh that doesn't need the device: decoded, converted to
+// the pipeline's vertex format, ready to be copied into buffers. Safe to build
+// on any thread, the loaders below and AssetStreamer's workers both do.
+struct PreparedMesh {
+  std::string name;
+  const void* vertexData = nullptr;
+  VkDeviceSize vertexBytes = 0;
+  const void* indexData = nullptr;
+  uint32_t indexCount = 0;
+  VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+  // GraphicsTypes::QuantizedVertex, dequantized through bounds
+  bool quantized = false;
+  MeshFormat::Bounds bounds{};
+  // Draw range until lods picks something else
+  MeshFormat::Lod lod0{};
+  std::vector<MeshFormat::Lod> lods;
+  // Only when meshlets were asked for
+  std::optional<MeshFormat::MeshletsView> meshlets;
+
+  // What the pointers above point into: the mapping, pack bytes or cooked
+  // mesh, plus whatever got decoded or converted on the way. Moving keeps
+  // them valid.
+  std::shared_ptr<const void> source;
+  std::vector<uint8_t> decodedVertices;
+  std::vector<uint8_t> decodedIndices;
+  std::vector<GraphicsTypes::QuantizedVertex> quantizedVertices;
+  std::vector<uint16_t> shortIndices;
+
+  VkDeviceSize indexBytes() const {
+    return VkDeviceSize(indexCount) * (indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t));
+  }
+};
+
+// A .vmesh in memory that source keeps alive. Throws on a vertex format the
+// pipeline can't take.
+PreparedMesh prepareMesh(
+    std::shared_ptr<const void> source,
+    const uint8_t* data,
+    size_t size,
+    const std::string& name,
+    MeshFormat::VertexFormat vertexFormat,
+    bool withMeshlets);
+
+// Meshlets get built if asked for and the mesh has none
+PreparedMesh prepareMesh(
+    std::shared_ptr<const MeshFormat::MeshData> mesh,
+    const std::string& name,
+    MeshFormat::VertexFormat vertexFormat,
+    bool withMeshlets);
+
+// .vmesh gets mapped, anything else goes through AssetCook::cookMesh
+PreparedMesh prepareMeshFile(const std::string& path, MeshFormat::VertexFormat vertexFormat, bool withMeshlets);
+
+// Everything but the vertex/index buffers: draw range, lods, dequantization
+// and the meshlet buffers with clusterCulling
+void applyPreparedMesh(
+    DeviceManager& devManager,
+    VulkanModel& model,
+    const PreparedMesh& mesh,
+    const ClusterCullingPass* clusterCulling);
+
+// Host visible buffers filled straight from the prepared pointers
+VulkanModel createMeshModel(
+    DeviceManager& devManager,
+    const PreparedMesh& mesh,
+    const ClusterCullingPass* clusterCulling = nullptr);
+
+// mmaps a .vmesh and uploads it straight from the mapping (MeshCodec encoded
+// geometry gets decoded first). Draws lod 0.
+// .obj/.gltf/.glb get AssetCook::cookMesh on the spot, slower but handy
+// for testing, tools/assetcook does it offline. vertexFormat is what the pipeline takes, float meshes get
+// quantized on the way in, quantized ones can't go back.
+// With clusterCulling the model also gets its meshlets uploaded (built on the
+// spot if the mesh has none, a .vmesh without them just draws normally).
+VulkanModel loadMeshModel(
+    DeviceManager& devManager,
+    const std::string& path,
+    MeshFormat::VertexFormat vertexFormat = MeshFormat::VertexFormat::float32,
+    const ClusterCullingPass* clusterCulling = nullptr);
+
+// A .vmesh already in memory (pack entry, mapping). name is for errors.
+VulkanModel loadMeshModel(
+    DeviceManager& devManager,
+    const uint8_t* data,
+    size_t size,
+    const std::string& name,
+    MeshFormat::VertexFormat vertexFormat = MeshFormat::VertexFormat::float32,
+    const ClusterCullingPass* clusterCulling = nullptr);
+
+// .vmesh entries of an asset pack, decompressed in parallel up front. Throws
+// if a name isn't in the pack.
+std::vector<VulkanModel> loadMeshModels(
+    DeviceManager& devManager,
+    const AssetPack::PackReader& pack,
+    const std::vector<std::string>& names,
+    MeshFormat::VertexFormat vertexFormat = MeshFormat::VertexFormat::float32,
+    const ClusterCullingPass* clusterCulling = nullptr);
+
+// Uploads as is (no optimizing), 16 bit indices when they fit
+VulkanModel createMeshModel(
+    DeviceManager& devManager,
+    const MeshFormat::MeshData& mesh,
+    MeshFormat::VertexFormat vertexFormat = MeshFormat::VertexFormat::float32,
+    const ClusterCullingPass* clusterCulling = nullptr);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "vulkan_utils/device_manager.h"
+
+namespace VulkanUtils {
+
+// Fills mip levels 1..n-1 from level 0 on the gpu. A vkCmdBlitImage chain
+// where the format can be blitted with a linear filter, a compute 2x2 box
+// downsample where it can only be a storage image. Block compressed formats
+// can do neither, those come with their mips precomputed.
+//
+// Any number of images go into one command buffer, level by level, so a
+// batch costs one barrier per level rather than one per image per level.
+class MipGenerator {
+ public:
+  enum class Method { blit, compute, unsupported };
+
+  struct Request {
+    VkImage image;
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    // Level 0, normally just uploaded into. The others can be anything,
+    // they're overwritten.
+    VkImageLayout currentLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    // Every level ends up in this
+    VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  };
+
+  // Image views + descriptors the compute path used. Has to outlive the
+  // command buffer's execution, hand it to a DeferredDestructionQueue or
+  // keep it until the fence.
+  class Scratch {
+   public:
+    explicit Scratch(VkDevice _device) : device(_device) {}
+    ~Scratch();
+
+    Scratch(Scratch&& other) noexcept;
+    Scratch(const Scratch&) = delete;
+    Scratch& operator=(const Scratch&) = delete;
+
+    bool empty() const { return views.empty(); }
+
+   private:
+    friend class MipGenerator;
+
+    VkDevice device;
+    std::vector<VkImageView> views;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  };
+
+  // The compute path only exists with shaderStorageImageWriteWithoutFormat
+  // and build/mip_downsample.spv
+  explicit MipGenerator(DeviceManager& devManager);
+  ~MipGenerator();
+
+  MipGenerator(const MipGenerator&) = delete;
+  MipGenerator& operator=(const MipGenerator&) = delete;
+
+  // Per format, optimal tiling
+  Method methodFor(VkFormat format) const;
+  // What the image has to have been created with for its method
+  VkImageUsageFlags requiredUsage(VkFormat format) const;
+
+  // Throws std::invalid_argument (before recording anything) if a request
+  // with more than one level has an unsupported format
+  Scratch record(VkCommandBuffer commandBuffer, const std::vector<Request>& requests) const;
+
+  // One shot on the graphics queue, blocks until done
+  void generate(const std::vector<Request>& requests) const;
+
+ private:
+  DeviceManager& devManager;
+  const VkDevice device;
+  VkSampler sampler = VK_NULL_HANDLE;
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  mutable std::unordered_map<VkFormat, Method> methods;
+};
+
+}
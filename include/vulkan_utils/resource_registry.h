@@ -0,0 +1,107 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "vulkan/vulkan.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#include "soa_pool.h"
+#include "vulkan_utils/deferred_destruction_queue.h"
+#include "vulkan_utils/vulkan_types.h"
+
+namespace VulkanUtils {
+
+struct MeshTag;
+struct TextureTag;
+struct MaterialTag;
+struct InstanceTag;
+
+using MeshHandle = GenerationalHandle<MeshTag>;
+using TextureHandle = GenerationalHandle<TextureTag>;
+using MaterialHandle = GenerationalHandle<MaterialTag>;
+using InstanceHandle = GenerationalHandle<InstanceTag>;
+
+// Column indices, e.g. registry.instances.column<InstanceColumn::transform>()
+struct MeshColumn {
+  // The buffers, owned. bounds is model.boundingSphere again, for loops that
+  // need nothing else.
+  enum : size_t { model, bounds };
+};
+struct TextureColumn {
+  // Not owned, whoever loaded the texture keeps it alive. The view can
+  // change from frame to frame (TextureResidencyManager), null draws the
+  // dummy texture.
+  enum : size_t { view, sampler };
+};
+struct MaterialColumn {
+  // A null texture draws color alone
+  enum : size_t { color, texture };
+};
+struct InstanceColumn {
+  // lod indexes the mesh's lods, ignored for meshes without any
+  enum : size_t { transform, mesh, material, lod };
+};
+
+using MeshPool = SoAPool<MeshTag, VulkanModel, glm::vec4>;
+using TexturePool = SoAPool<TextureTag, VkImageView, VkSampler>;
+using MaterialPool = SoAPool<MaterialTag, glm::vec4, TextureHandle>;
+using InstancePool = SoAPool<InstanceTag, glm::mat4, MeshHandle, MaterialHandle, uint32_t>;
+
+// What the scene is made of, each kind in its own SoAPool behind
+// generational handles. Instances refer to a mesh and a material, materials
+// to a texture. Nothing stops a mesh going while instances still use it,
+// their handle just stops being contained and they get skipped.
+//
+// meshes.remove() destroys the buffers right away, the gpu has to be done
+// with them. retireMesh() doesn't wait. Render thread only.
+class ResourceRegistry {
+ public:
+  MeshPool meshes;
+  TexturePool textures;
+  MaterialPool materials;
+  InstancePool instances;
+
+  MeshHandle addMesh(VulkanModel model) {
+    const glm::vec4 bounds = model.boundingSphere;
+    return meshes.insert(std::move(model), bounds);
+  }
+
+  TextureHandle addTexture(const VkImageView view, const VkSampler sampler) { return textures.insert(view, sampler); }
+
+  // Throws std::invalid_argument for a stale texture, a null one is fine
+  MaterialHandle addMaterial(const glm::vec4& color, const TextureHandle texture = {}) {
+    if (texture && !textures.contains(texture))
+      throw std::invalid_argument("material with a stale texture handle!");
+    return materials.insert(color, texture);
+  }
+
+  // Throws std::invalid_argument for a stale mesh or material
+  InstanceHandle addInstance(
+      const MeshHandle mesh,
+      const MaterialHandle material,
+      const glm::mat4& transform = glm::mat4(1.0f)) {
+    if (!meshes.contains(mesh) || !materials.contains(material))
+      throw std::invalid_argument("instance with a stale mesh or material handle!");
+    return instances.insert(transform, mesh, material, 0u);
+  }
+
+  // Gone from the pool now, the buffers go once lastUsedSerial completes
+  void retireMesh(const MeshHandle mesh, DeferredDestructionQueue& retired, const uint64_t lastUsedSerial) {
+    meshes.get<MeshColumn::model>(mesh).retire(retired, lastUsedSerial);
+    meshes.remove(mesh);
+  }
+
+  // Index range instance draws: the lod it's on, all of the mesh without lods
+  static std::pair<uint32_t, uint32_t> drawRange(const VulkanModel& model, const uint32_t lod) {
+    if (model.lods.empty())
+      return {model.firstIndex, model.indexCount};
+    const MeshFormat::Lod& range = model.lods[std::min<size_t>(lod, model.lods.size() - 1)];
+    return {range.firstIndex, range.indexCount};
+  }
+};
+
+}
@@ -5,17 +5,48 @@
 #include <stdexcept>
 #include <vector>
 
+#include "vulkan_utils/deferred_destruction_queue.h"
 #include "vulkan_utils/device_manager.h"
 #include "vulkan_utils/window_and_surface_manager.h"
 
 
 namespace VulkanUtils {
+struct SwapChainOptions {
+  // 0 means minImageCount + 1. Gets clamped to what the surface allows, check
+  // getImageCount()
+  uint32_t desiredImageCount = 0;
+  // Falls back to FIFO (always supported) if the surface doesn't have it
+  VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+};
+
 class SwapChainHandler {
  public:
-  SwapChainHandler(const DeviceManager& dev_manager, const WindowAndSurfaceManager& window);
+  SwapChainHandler(
+      const DeviceManager& dev_manager,
+      const WindowAndSurfaceManager& window,
+      const SwapChainOptions& options = {});
   ~SwapChainHandler();
 
+  // Clears the image and starts drawing into it. A render pass, or with
+  // dynamic rendering the layout barrier + vkCmdBeginRendering.
+  void beginRendering(VkCommandBuffer commandBuffer, uint32_t imageIndex, const VkClearValue& clearColor);
+  // Leaves the image in PRESENT_SRC either way
+  void endRendering(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+
+  // For resizes / out of date. Builds the new swapchain off the old one and
+  // hands the old swapchain, views and framebuffers to `retired` instead of
+  // idling the device. The render pass (and so every pipeline) survives, the
+  // format isn't allowed to change. Nothing but views to rebuild with dynamic
+  // rendering.
+  void recreate(
+      const WindowAndSurfaceManager& window,
+      DeferredDestructionQueue& retired,
+      uint64_t lastUsedSerial);
+
+  // VK_NULL_HANDLE with dynamic rendering, pipelines take getImageFormat() instead
   VkRenderPass getRenderPass() const { return renderPass; }
+  bool usesDynamicRendering() const { return dynamicRendering; }
+  VkFormat getImageFormat() const { return swapchainImageFormat; }
 
   VkSwapchainKHR getSwapChain() {return swapchain; }
 
@@ -34,9 +65,13 @@ class SwapChainHandler {
 
   uint32_t getImageCount() const { return scImageCount; }
 
+  VkPresentModeKHR getPresentMode() const { return presentMode; }
+
   SwapChainHandler(const SwapChainHandler&) = delete;
  private:
-  void createSwapChain(const VkPhysicalDevice physicalDevice, const WindowAndSurfaceManager& window);
+  void createSwapChain(
+      const WindowAndSurfaceManager& window,
+      VkSwapchainKHR oldSwapchain);
   void createImageViews();
   void createRenderPass();
   void createFramebuffers();
@@ -46,10 +81,15 @@ class SwapChainHandler {
   std::vector<VkImage> swapchainImages;
   VkFormat swapchainImageFormat;
   VkExtent2D swapchainExtent;
+  VkPresentModeKHR presentMode;
   std::vector<VkImageView> swapchainImageViews;
-  VkRenderPass renderPass;
+  VkRenderPass renderPass = VK_NULL_HANDLE;
 
+  const DeviceManager& devManager;
   const VkDevice device;
+  const bool dynamicRendering;
+  const VkPhysicalDevice physicalDevice;
+  const SwapChainOptions options;
 
   std::vector<VkFramebuffer> swapchainFramebuffers;
   uint32_t scImageCount = 0;
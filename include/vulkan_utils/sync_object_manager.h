@@ -2,26 +2,46 @@
 
 #include "vulkan/vulkan.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <stdexcept>
 
+#include "vulkan_utils/deferred_destruction_queue.h"
 #include "vulkan_utils/device_manager.h"
+#include "vulkan_utils/host_allocator.h"
+#include "vulkan_utils/timeline_semaphore.h"
 
 namespace VulkanUtils {
 
 struct FrameSyncObjects {
   VkSemaphore imageAvailable;
-  VkSemaphore renderFinished;
-  VkFence inFlight;
+  // Only used without timeline semaphores
+  VkFence inFlight = VK_NULL_HANDLE;
+  // Serial of this frame's last submit. The graphics timeline value when
+  // timelines are on, otherwise a running count of frame submits.
+  uint64_t submitSerial = 0;
   // not a sync object, but needs to be synced and one per frame.
   // maybe should live somewhere else
-  VkCommandBuffer commandBuffer; 
+  VkCommandBuffer commandBuffer;
 };
 
+// Frames in flight and swapchain images are independent. Acquire semaphores are
+// per frame slot (we don't know the image until after acquiring), present
+// semaphores are per swapchain image since presentation only lets go of one
+// once that image gets acquired again.
+//
+// WSI still needs binary semaphores for acquire/present, timelines only
+// replace the fences.
 class SyncObjectsManager {
 public:
-    SyncObjectsManager(VulkanUtils::DeviceManager& deviceManager, const int _maxFramesInFlight)
-      : device(deviceManager.getDevice()), maxFramesInFlight(_maxFramesInFlight) 
+    SyncObjectsManager(
+        VulkanUtils::DeviceManager& deviceManager,
+        const int _maxFramesInFlight,
+        const uint32_t swapchainImageCount)
+      : device(deviceManager.getDevice()),
+        timeline(deviceManager.getGraphicsTimeline()),
+        maxFramesInFlight(_maxFramesInFlight)
     {
       auto commandBuffs = deviceManager.getCommandPoolWrapper().allocateCommandBuffers(maxFramesInFlight);
       syncObjects.resize(maxFramesInFlight);
@@ -29,41 +49,164 @@ public:
         createSyncObjects(syncObjects[i]);
         syncObjects[i].commandBuffer = commandBuffs[i];
       }
+
+      createPresentSemaphores(swapchainImageCount);
     }
 
     ~SyncObjectsManager() {
       for (auto& s : syncObjects) {
-        vkDestroySemaphore(device, s.imageAvailable, nullptr);
-        vkDestroySemaphore(device, s.renderFinished, nullptr);
-        vkDestroyFence(device, s.inFlight, nullptr);
+        vkDestroySemaphore(device, s.imageAvailable, allocationCallbacks());
+        if (s.inFlight != VK_NULL_HANDLE)
+          vkDestroyFence(device, s.inFlight, allocationCallbacks());
       }
+
+      for (auto semaphore : presentSemaphores)
+        vkDestroySemaphore(device, semaphore, allocationCallbacks());
     }
 
     FrameSyncObjects& get(int frameIndex) {
       return syncObjects[frameIndex];
     }
 
+    int getFramesInFlight() const { return maxFramesInFlight; }
+
+    VkSemaphore getPresentSemaphore(uint32_t imageIndex) const { return presentSemaphores[imageIndex]; }
+
+    bool usesTimeline() const { return timeline != nullptr; }
+
+    // Anything used by a submit up to and including this serial can be
+    // handed to a DeferredDestructionQueue with it
+    uint64_t lastSubmittedSerial() const {
+      return timeline ? timeline->lastSubmitted() : submitCount;
+    }
+
+    // Non blocking
+    uint64_t completedSerial() {
+      if (timeline)
+        return timeline->completedValue();
+
+      for (const auto& frame : syncObjects)
+        if (frame.submitSerial > completedCount && vkGetFenceStatus(device, frame.inFlight) == VK_SUCCESS)
+          completedCount = frame.submitSerial;
+
+      return completedCount;
+    }
+
+    // Present semaphores might still be waited on by presents to the old
+    // swapchain, so they get retired instead of reused.
+    void onSwapchainRecreated(uint32_t swapchainImageCount, DeferredDestructionQueue& retired) {
+      retired.retire(lastSubmittedSerial(), presentSemaphores);
+
+      createPresentSemaphores(swapchainImageCount);
+    }
+
+    // Blocks until the frame slot's previous submit is done on the gpu.
+    // Doesn't reset the fence, that happens right before the next submit so an
+    // early out between here and submitFrame can't leave it unsignaled.
+    void waitForFrame(int frameIndex) {
+      auto& frame = syncObjects[frameIndex];
+      if (timeline) {
+        timeline->wait(frame.submitSerial);
+      } else {
+        vkWaitForFences(device, 1, &frame.inFlight, VK_TRUE, UINT64_MAX);
+        completedCount = std::max(completedCount, frame.submitSerial);
+      }
+    }
+
+    // With more images than frames (or out of order acquires) the image we got
+    // can still be in use by another frame slot's submit.
+    void waitForImage(int frameIndex, uint32_t imageIndex) {
+      const int owner = imageOwners[imageIndex];
+      if (owner != noOwner && owner != frameIndex)
+        waitForFrame(owner);
+
+      imageOwners[imageIndex] = frameIndex;
+    }
+
+    // Waits on imageAvailable, signals the image's present semaphore
+    void submitFrame(int frameIndex, uint32_t imageIndex, VkQueue queue) {
+      auto& frame = syncObjects[frameIndex];
+      const VkSemaphore presentSemaphore = presentSemaphores[imageIndex];
+      if (timeline) {
+        frame.submitSerial = timeline->submit(
+            {frame.commandBuffer},
+            {{frame.imageAvailable, 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT}},
+            {{presentSemaphore, 0}});
+        return;
+      }
+
+      vkResetFences(device, 1, &frame.inFlight);
+
+      VkSemaphore waitSemaphores[] = {frame.imageAvailable};
+      VkSemaphore signalSemaphores[] = {presentSemaphore};
+      VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+
+      VkSubmitInfo submitInfo{};
+      submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submitInfo.waitSemaphoreCount = 1;
+      submitInfo.pWaitSemaphores = waitSemaphores;
+      submitInfo.pWaitDstStageMask = waitStages;
+      submitInfo.commandBufferCount = 1;
+      submitInfo.pCommandBuffers = &frame.commandBuffer;
+      submitInfo.signalSemaphoreCount = 1;
+      submitInfo.pSignalSemaphores = signalSemaphores;
+
+      if (vkQueueSubmit(queue, 1, &submitInfo, frame.inFlight) != VK_SUCCESS)
+        throw std::runtime_error("failed to submit draw command buffer!");
+
+      frame.submitSerial = ++submitCount;
+    }
+
  private:
-  void createSyncObjects(FrameSyncObjects& frameSync) {
+  static constexpr int noOwner = -1;
+
+  VkSemaphore createSemaphore() {
     VkSemaphoreCreateInfo semaphoreInfo{};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
+    VkSemaphore semaphore;
+    if (vkCreateSemaphore(device, &semaphoreInfo, allocationCallbacks(), &semaphore) != VK_SUCCESS)
+      throw std::runtime_error("Failed to create sync objects!");
+
+    return semaphore;
+  }
+
+  void createPresentSemaphores(uint32_t swapchainImageCount) {
+    presentSemaphores.resize(swapchainImageCount);
+    for (auto& semaphore : presentSemaphores)
+      semaphore = createSemaphore();
+
+    imageOwners.assign(swapchainImageCount, noOwner);
+  }
+
+  void createSyncObjects(FrameSyncObjects& frameSync) {
+    frameSync.imageAvailable = createSemaphore();
+
+    if (timeline)
+      return;
+
     VkFenceCreateInfo fenceInfo{};
     fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frameSync.imageAvailable) != VK_SUCCESS ||
-        vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frameSync.renderFinished) != VK_SUCCESS ||
-        vkCreateFence(device, &fenceInfo, nullptr, &frameSync.inFlight) != VK_SUCCESS)
-    {
+    if (vkCreateFence(device, &fenceInfo, allocationCallbacks(), &frameSync.inFlight) != VK_SUCCESS)
       throw std::runtime_error("Failed to create sync objects!");
-    }
   }
 
  private:
   VkDevice device;
+  QueueTimeline* timeline;
   int maxFramesInFlight;
   std::vector<FrameSyncObjects> syncObjects;
+
+  // Per swapchain image
+  std::vector<VkSemaphore> presentSemaphores;
+  // Which frame slot last rendered to each image
+  std::vector<int> imageOwners;
+
+  // Fence path only, the timeline tracks this itself
+  uint64_t submitCount = 0;
+  uint64_t completedCount = 0;
 };
 
 }
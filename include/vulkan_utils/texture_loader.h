@@ -0,0 +1,102 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "vulkan_utils/device_manager.h"
+#include "vulkan_utils/host_allocator.h"
+#include "vulkan_utils/mip_generator.h"
+
+namespace VulkanUtils {
+
+// A sampled image with its whole mip chain, view and sampler. The sampler
+// is the device SamplerCache's, shared with every other texture.
+class VulkanTexture {
+ public:
+  VulkanTexture(
+      VkDevice _device,
+      VkImage _image,
+      VkDeviceMemory _memory,
+      VkImageView _view,
+      VkSampler _sampler,
+      VkFormat _format,
+      uint32_t _width,
+      uint32_t _height,
+      uint32_t _mipLevels)
+    : device(_device),
+      image(_image),
+      memory(_memory),
+      view(_view),
+      sampler(_sampler),
+      format(_format),
+      width(_width),
+      height(_height),
+      mipLevels(_mipLevels) {}
+
+  ~VulkanTexture() {
+    if (view != VK_NULL_HANDLE)
+      vkDestroyImageView(device, view, allocationCallbacks());
+    if (image != VK_NULL_HANDLE)
+      vkDestroyImage(device, image, allocationCallbacks());
+    if (memory != VK_NULL_HANDLE)
+      vkFreeMemory(device, memory, allocationCallbacks());
+  }
+
+  VulkanTexture(const VulkanTexture&) = delete;
+  VulkanTexture& operator=(const VulkanTexture&) = delete;
+  VulkanTexture(VulkanTexture&& other) noexcept
+    : device(other.device),
+      image(std::exchange(other.image, VK_NULL_HANDLE)),
+      memory(std::exchange(other.memory, VK_NULL_HANDLE)),
+      view(std::exchange(other.view, VK_NULL_HANDLE)),
+      sampler(std::exchange(other.sampler, VK_NULL_HANDLE)),
+      format(other.format),
+      width(other.width),
+      height(other.height),
+      mipLevels(other.mipLevels) {}
+
+  VkImage getImage() const { return image; }
+  VkImageView getView() const { return view; }
+  VkSampler getSampler() const { return sampler; }
+  // What's on the gpu, not necessarily what the file had
+  VkFormat getFormat() const { return format; }
+  uint32_t getWidth() const { return width; }
+  uint32_t getHeight() const { return height; }
+  uint32_t getMipLevels() const { return mipLevels; }
+
+ private:
+  VkDevice device;
+  VkImage image;
+  VkDeviceMemory memory;
+  VkImageView view;
+  VkSampler sampler;
+  VkFormat format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t mipLevels;
+};
+
+// What a texture stored as fileFormat goes to the gpu as: itself if the
+// device can sample and filter it, otherwise RGBA8 decoded on the cpu
+// (BlockCompression::decode). VK_FORMAT_UNDEFINED when neither works,
+// ASTC on a desktop gpu for one.
+VkFormat chooseUploadFormat(VkPhysicalDevice physicalDevice, VkFormat fileFormat);
+
+// A .ktx2 (Ktx2::Texture) with whatever levels it has, uploaded through a
+// staging buffer, blocks until done. A single level uncompressed file gets
+// the rest of its chain from mips when one is given. Throws
+// std::runtime_error if it can't be read or sampled.
+VulkanTexture loadTexture(DeviceManager& devManager, const std::string& path, const MipGenerator* mips = nullptr);
+// From memory, a pack entry say. name is only for messages.
+VulkanTexture loadTexture(
+    DeviceManager& devManager,
+    const void* data,
+    size_t size,
+    const std::string& name,
+    const MipGenerator* mips = nullptr);
+
+}
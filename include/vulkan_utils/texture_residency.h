@@ -0,0 +1,222 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "asset_pack.h"
+#include "ktx2.h"
+#include "mapped_file.h"
+#include "ring_allocator.h"
+#include "vulkan_utils/deferred_destruction_queue.h"
+#include "vulkan_utils/device_manager.h"
+#include "vulkan_utils/memory_manager.h"
+
+namespace VulkanUtils {
+
+struct ResidencyOptions {
+  // Device memory every streamed texture together may use. Mip tails count
+  // towards it but never get evicted, so enough textures can overshoot it.
+  VkDeviceSize budget = VkDeviceSize(256) << 20;
+  // Levels this size (largest side) and smaller stay resident from the first
+  // frame a texture is usable
+  uint32_t tailSize = 64;
+  // Bytes handed to the loader per update(), bounds how much copying a
+  // single frame picks up. One load a frame always goes through.
+  VkDeviceSize uploadPerFrame = VkDeviceSize(16) << 20;
+  // Persistently mapped, every level being streamed in lives here until its
+  // copy is done. A texture's tail has to fit on its own.
+  VkDeviceSize stagingSize = VkDeviceSize(64) << 20;
+  // Frames without a request before a texture counts as unused, its
+  // streamed levels are the first to go once over budget
+  uint32_t idleFrames = 60;
+};
+
+// Keeps the mips of .ktx2 textures resident on demand under a memory budget.
+// Every texture has its tail (levels up to tailSize) resident from the start.
+// Finer levels are asked for per frame, from screen coverage or distance
+// (levelForCoverage), loaded on a background thread into a staging ring and
+// copied in on the render thread. Once the budget is hit, least recently
+// used textures give up levels to make room, down to their tail. The
+// memory manager can lower the budget further while the heap is under
+// pressure, levels go the same way then.
+//
+// No sparse binding (not universally there, and not at all on some mobile
+// parts): a residency change builds a new image holding just the resident
+// levels, copies the kept ones across from the old image on the gpu and
+// retires the old one when the frame is done with it. Views change when
+// that happens (and when defragmentation moves an image), so fetch them
+// every frame. Until the old image goes, a
+// change needs both, so peak use can briefly go past the budget.
+class TextureResidencyManager {
+ public:
+  using Handle = uint32_t;
+
+  struct Stats {
+    // Resident levels of every texture
+    VkDeviceSize residentBytes = 0;
+    VkDeviceSize streamedInBytes = 0;
+    VkDeviceSize evictedBytes = 0;
+    uint32_t streamIns = 0;
+    uint32_t evictions = 0;
+  };
+
+  // With a pack, names are entry names, otherwise paths. The pack has to
+  // outlive the manager.
+  // Images come from memory, which has to outlive the manager
+  TextureResidencyManager(
+      DeviceManager& devManager,
+      DeviceMemoryManager& memory,
+      const ResidencyOptions& options,
+      const AssetPack::PackReader* pack = nullptr);
+  // Device has to be idle, drops loads that haven't finished
+  ~TextureResidencyManager();
+
+  TextureResidencyManager(const TextureResidencyManager&) = delete;
+  TextureResidencyManager& operator=(const TextureResidencyManager&) = delete;
+
+  // Opens and checks it straight away (throws std::runtime_error like
+  // loadTexture), the tail loads in the background
+  Handle addTexture(const std::string& name);
+
+  // Finest level a use this frame wants, the finest of the frame counts.
+  // Levels past the tail just mean the tail.
+  void requestLevel(Handle handle, uint32_t level);
+  // Level whose texels roughly match screen pixels for a texture textureSize
+  // texels across covering screenPixels pixels, what the sampler would pick
+  static uint32_t levelForCoverage(uint32_t textureSize, float screenPixels);
+
+  // Render thread, once per frame outside any render pass and before
+  // anything samples. Frees what completedSerial is done with, copies in
+  // levels that finished loading, evicts to make room and hands the next
+  // loads to the loader. Requests since the last update are this frame's.
+  void update(VkCommandBuffer commandBuffer, uint64_t completedSerial);
+  // Once the frame update() recorded into has been submitted as serial
+  void submitted(uint64_t serial);
+
+  // VK_NULL_HANDLE until the tail is in
+  VkImageView getView(const Handle handle) const { return textures[handle].view; }
+  // Shared by every texture, all levels
+  VkSampler getSampler() const { return sampler; }
+  uint32_t getWidth(const Handle handle) const { return textures[handle].source->getWidth(); }
+  uint32_t getHeight(const Handle handle) const { return textures[handle].source->getHeight(); }
+  // Finest level on the gpu, getLevelCount() before the tail is in
+  uint32_t residentLevel(const Handle handle) const { return textures[handle].base; }
+  uint32_t getLevelCount(const Handle handle) const { return textures[handle].source->getLevelCount(); }
+  const std::string& getName(const Handle handle) const { return textures[handle].name; }
+
+  const Stats& getStats() const { return stats; }
+  // options.budget, or less while the memory manager wants memory back
+  VkDeviceSize getBudget() const { return std::min(options.budget, memoryLimit); }
+
+ private:
+  struct Texture {
+    std::string name;
+    // Whatever the Ktx2::Texture points into
+    std::optional<MappedFile> file;
+    std::vector<uint8_t> copy;
+    std::optional<Ktx2::Texture> source;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    // First level of the tail
+    uint32_t tailBase = 0;
+
+    // Levels [base, levelCount) are resident, level 0 of image is base
+    DeviceMemoryManager::Resource allocation = DeviceMemoryManager::invalid;
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    uint32_t base = 0;
+    bool loading = false;
+    // A level didn't read, it keeps whatever is resident
+    bool failed = false;
+
+    // Finest level asked for in requestFrame
+    uint32_t requested = UINT32_MAX;
+    uint64_t requestFrame = 0;
+  };
+
+  // Levels [first, last) of a texture, loader thread to render thread
+  struct Load {
+    Texture* texture = nullptr;
+    uint32_t first = 0;
+    uint32_t last = 0;
+    VkDeviceSize size = 0;
+    uint64_t ringOffset = RingAllocator::invalid;
+    bool failed = false;
+  };
+
+  // A new image for a texture this frame, from a load or an eviction
+  struct Rebuild {
+    Texture* texture;
+    uint32_t newBase;
+    const Load* load;
+    DeviceMemoryManager::Resource allocation = DeviceMemoryManager::invalid;
+    VkImage image = VK_NULL_HANDLE;
+  };
+
+  void workerLoop();
+  // False if the manager is shutting down
+  bool stage(Load& load);
+  // Bytes levels [first, last) take on the gpu (and in staging)
+  VkDeviceSize levelBytes(const Texture& texture, uint32_t first, uint32_t last) const;
+  // Finest level worth having right now, the tail for idle textures
+  uint32_t wantedLevel(const Texture& texture) const;
+  // Picks levels to give up (moving bases in planned) until bytes more fit
+  // the budget, never from texture itself or anything used as recently.
+  // False if it can't. Without a texture it gives up what it can towards
+  // getting back under, from anything.
+  bool makeRoom(VkDeviceSize bytes, const Texture* texture, std::vector<uint32_t>& planned);
+  void record(VkCommandBuffer commandBuffer, std::vector<Rebuild>& rebuilds);
+  void retire(Texture& texture);
+  // Defragmentation gave texture a new image, the view has to follow
+  void moved(Texture& texture);
+
+  DeviceManager& devManager;
+  DeviceMemoryManager& memory;
+  const VkDevice device;
+  const ResidencyOptions options;
+  const AssetPack::PackReader* const pack;
+
+  // Only the render thread touches these, the loader gets a Load
+  std::deque<Texture> textures;
+  VkSampler sampler = VK_NULL_HANDLE;
+  Stats stats;
+  uint64_t frame = 1;
+  // Resident plus what's being loaded
+  VkDeviceSize committedBytes = 0;
+  // From the memory manager's pressure, see getBudget
+  VkDeviceSize memoryLimit = UINT64_MAX;
+  uint32_t memoryClient = 0;
+
+  std::mutex jobMutex;
+  std::condition_variable jobAvailable;
+  std::deque<Load> jobs;
+  // Checked under jobMutex and ringMutex both
+  std::atomic<bool> stopping{false};
+
+  std::mutex ringMutex;
+  std::condition_variable ringFreed;
+  RingAllocator ring;
+  VkBuffer ringBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory ringMemory = VK_NULL_HANDLE;
+  uint8_t* ringMapping = nullptr;
+
+  std::mutex stagedMutex;
+  std::vector<Load> staged;
+
+  // Old views and ring space, pending while the frame being recorded still
+  // uses them, submitted() gives them its serial
+  DeferredDestructionQueue retired{device};
+
+  std::thread worker;
+};
+
+}
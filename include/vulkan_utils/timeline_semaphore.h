@@ -0,0 +1,84 @@
+#pragma once
+
+#include "vulkan/vulkan.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace VulkanUtils {
+
+// Needs a 1.2 device with the timelineSemaphore feature enabled
+class TimelineSemaphore {
+ public:
+  TimelineSemaphore(VkDevice device, uint64_t initialValue = 0);
+  ~TimelineSemaphore();
+
+  TimelineSemaphore(const TimelineSemaphore&) = delete;
+  TimelineSemaphore& operator=(const TimelineSemaphore&) = delete;
+
+  VkSemaphore get() const { return semaphore; }
+
+  uint64_t completedValue() const;
+
+  // false on timeout
+  bool wait(uint64_t value, uint64_t timeout = UINT64_MAX) const;
+
+  void signalFromHost(uint64_t value);
+
+ private:
+  const VkDevice device;
+  VkSemaphore semaphore = VK_NULL_HANDLE;
+};
+
+// Either a binary semaphore (value ignored) or a point on someone's timeline
+struct SemaphoreWait {
+  VkSemaphore semaphore;
+  uint64_t value = 0;
+  VkPipelineStageFlags stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+};
+
+struct SemaphoreSignal {
+  VkSemaphore semaphore;
+  uint64_t value = 0;
+};
+
+// One monotonically increasing timeline per queue. Every submit through here
+// bumps the value, so "is value N done" replaces per-submit fences. Waiting on
+// another QueueTimeline's value is how cross queue dependencies get expressed.
+class QueueTimeline {
+ public:
+  QueueTimeline(VkDevice device, VkQueue queue);
+
+  QueueTimeline(const QueueTimeline&) = delete;
+  QueueTimeline& operator=(const QueueTimeline&) = delete;
+
+  // Returns the value the timeline reaches once this submit has finished.
+  // waits/signals can mix binary and timeline semaphores.
+  uint64_t submit(
+      const std::vector<VkCommandBuffer>& commandBuffers,
+      const std::vector<SemaphoreWait>& waits = {},
+      const std::vector<SemaphoreSignal>& signals = {});
+
+  // Wait on a point of this timeline from another queue
+  SemaphoreWait waitFor(uint64_t value, VkPipelineStageFlags stage) const {
+    return {timeline.get(), value, stage};
+  }
+
+  uint64_t lastSubmitted() const { return nextValue - 1; }
+  uint64_t completedValue() const { return timeline.completedValue(); }
+  bool isComplete(uint64_t value) const { return value <= completedValue(); }
+
+  // Blocks the cpu
+  bool wait(uint64_t value, uint64_t timeout = UINT64_MAX) const { return timeline.wait(value, timeout); }
+  void waitIdle() const { timeline.wait(lastSubmitted()); }
+
+  VkQueue getQueue() const { return queue; }
+  VkSemaphore getSemaphore() const { return timeline.get(); }
+
+ private:
+  const VkQueue queue;
+  TimelineSemaphore timeline;
+  uint64_t nextValue = 1;
+};
+
+}
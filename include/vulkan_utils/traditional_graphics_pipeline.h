@@ -1,20 +1,33 @@
 #pragma once
 #include "vulkan/vulkan.h"
 
+#include <map>
+#include <optional>
+#include <utility>
 #include <vector>
 
+#include "vulkan_utils/descriptor_allocator.h"
 #include "vulkan_utils/swapchain_handler.h"
 #include "vulkan_utils/device_manager.h"
+#include "vulkan_utils/instance_buffer.h"
 #include "vulkan_utils/vulkan_types.h"
 
 namespace VulkanUtils {
 class TraditionalGraphicsPipeline {
  public:
-  TraditionalGraphicsPipeline(DeviceManager& devManager, const SwapChainHandler& swapchainHandler);
+  // quantizedVertices: GraphicsTypes::QuantizedVertex input + the shader that decodes it
+  TraditionalGraphicsPipeline(
+      DeviceManager& devManager,
+      const SwapChainHandler& swapchainHandler,
+      uint32_t framesInFlight,
+      bool quantizedVertices = false);
   ~TraditionalGraphicsPipeline();
 
   VkPipeline getPipeline() { return graphicsPipeline; }
   VkPipelineLayout getLayout() { return pipelineLayout; }
+  const SceneUBO& getScene() const { return *scene; }
+  // Set 0, the texture set goes in per draw with bindTexture and set 2 is
+  // the InstanceBuffer's
   void bindDescriptors(VkCommandBuffer commandBuffer) {
     vkCmdBindDescriptorSets(
         commandBuffer,
@@ -25,41 +38,38 @@ class TraditionalGraphicsPipeline {
         &staticDescriptorSet,
         0,
         nullptr);
-
-    vkCmdBindDescriptorSets(
-        commandBuffer,
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        pipelineLayout,
-        1, // Position for dynamic data
-        1, 
-        &dynamicDescriptorSet,
-        0,
-        nullptr);
   }
 
-  // potentially dynamic refs
-  void updateTextureDescriptorSet(
-      VkImageView textureImageView,
-      VkSampler textureSampler);
+  // Once frameIndex's last submit has finished, before recording it again.
+  // The texture sets it had go back to its pools.
+  void beginFrame(uint32_t frameIndex);
+  // Set 1 for the draws after this. A set per distinct view + sampler a
+  // frame, out of that frame's pools, never rewritten while it's in use.
+  void bindTexture(VkCommandBuffer commandBuffer, VkImageView textureImageView, VkSampler textureSampler);
  private:
   const VkDevice device;
 
   VkShaderModule createShaderModule(const std::vector<char>& code);
-  void createDescriptorPool();
 
-  VkDescriptorSetLayout createDynamicDescriptorSetLayout();
+  // From the device's layout cache, not ours to destroy
+  static VkDescriptorSetLayout createDynamicDescriptorSetLayout(DeviceManager& devManager);
+  static VkDescriptorSetLayout createStaticDescriptorSetLayout(DeviceManager& devManager);
 
   // One time always points to the same thing
   void updateStaticDescriptorSet();
-  VkDescriptorSetLayout createStaticDescriptorSetLayout();
-
-  void allocateDescriptorSets();
 
   VkDescriptorSetLayout staticDescriptorSetLayout = VK_NULL_HANDLE;
   VkDescriptorSet staticDescriptorSet = VK_NULL_HANDLE;
   VkDescriptorSetLayout dynamicDescriptorSetLayout = VK_NULL_HANDLE;
-  VkDescriptorSet dynamicDescriptorSet = VK_NULL_HANDLE;
-  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSetLayout instanceDescriptorSetLayout = VK_NULL_HANDLE;
+  // Only ever the static set
+  DescriptorAllocator staticDescriptors;
+  // Texture sets, one allocator per frame in flight
+  std::vector<DescriptorAllocator> frameDescriptors;
+  std::optional<DescriptorUpdateTemplate> textureTemplate;
+  uint32_t currentFrame = 0;
+  // What's been written this frame already
+  std::map<std::pair<VkImageView, VkSampler>, VkDescriptorSet> textureSets;
   VkPipelineLayout pipelineLayout;
 
   VkPipeline graphicsPipeline;
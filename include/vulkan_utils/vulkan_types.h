@@ -4,11 +4,19 @@
 #include "vulkan/vulkan.h"
 
 #include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
 #include <stdexcept>
 #include <cstring>
+#include <utility>
 
+#include "vulkan_utils/cluster_culling.h"
+#include "vulkan_utils/deferred_destruction_queue.h"
 #include "vulkan_utils/device_manager.h"
 #include "graphics_types.h"
+#include "instance_kernels.h"
+#include "vulkan_utils/host_allocator.h"
 
 namespace VulkanUtils {
 // I think vecs need to be 16 byte aligned? 
@@ -48,7 +56,7 @@ inline void createDummyTexture(
   imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
   imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
 
-  vkCreateImage(devManager.getDevice(), &imageCreateInfo, nullptr, &dummyImage);
+  vkCreateImage(devManager.getDevice(), &imageCreateInfo, allocationCallbacks(), &dummyImage);
 
   const VkResult imgCreateResult = devManager.createImage(
       1,
@@ -80,7 +88,7 @@ inline void createDummyTexture(
   viewInfo.subresourceRange.levelCount = 1;
   viewInfo.subresourceRange.layerCount = 1;
 
-  vkCreateImageView(devManager.getDevice(), &viewInfo, nullptr, &dummyImageView);
+  vkCreateImageView(devManager.getDevice(), &viewInfo, allocationCallbacks(), &dummyImageView);
 
   VkSamplerCreateInfo samplerInfo{};
   samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -100,89 +108,168 @@ inline void createDummyTexture(
   samplerInfo.minLod = 0.0f;
   samplerInfo.maxLod = 0.0f;
 
-  
-  if (vkCreateSampler(devManager.getDevice(), &samplerInfo, nullptr, &dummySampler) != VK_SUCCESS)
-    throw std::runtime_error("Failed to create dummy VkSampler!");
+  // The device's, don't destroy it
+  dummySampler = devManager.getSamplerCache().get(samplerInfo);
 }
 
-// Probably requires some kind of alignment... we'll see what works
-struct alignas(16) PerModelPushConstants {
-    glm::mat4 uModel;
-    int uUseTexture; // bool
+// One per drawn instance in the frame's InstanceBuffer, std430 like the
+// shaders' Instance struct. Every vec4 sits on 16 bytes.
+struct alignas(16) InstanceData {
+    InstanceMatrices matrices;
     glm::vec4 color;
+    // Quantized vertices only: position = offset + stored * scale
+    glm::vec4 positionScale{1.0f, 1.0f, 1.0f, 0.0f};
+    glm::vec4 positionOffset{0.0f, 0.0f, 0.0f, 0.0f};
 };
+static_assert(sizeof(InstanceData) == 224, "has to match the shaders' Instance struct");
 
-struct VulkanModel {
-    const bool hasTexture = false; // Temp
-    const VkDescriptorSet descriptorSet = VK_NULL_HANDLE; // Temp
-    glm::mat4 model_matrix{}; // zero init should be identity?
-    glm::vec4 color{0, 1, 0, 1}; // If no texture
+// Per draw, everything else is in its InstanceData
+struct PerDrawPushConstants {
+    uint32_t instance; // into the frame's InstanceBuffer
+    int useTexture; // bool
+};
 
+// A mesh on the gpu: vertex/index buffers and what it takes to draw them.
+// Where and how it's drawn is an instance's business (ResourceRegistry).
+struct VulkanModel {
     VkBuffer vertexBuffer = VK_NULL_HANDLE;
     VkDeviceMemory vertexBufferMemory = VK_NULL_HANDLE;
 
     VkBuffer indexBuffer = VK_NULL_HANDLE;
     VkDeviceMemory indexBufferMemory = VK_NULL_HANDLE;
 
+    // Lod 0, or the whole index buffer
+    uint32_t firstIndex = 0;
     uint32_t indexCount = 0;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
+    // Dequantization for GraphicsTypes::QuantizedVertex buffers, identity otherwise
+    glm::vec4 positionScale{1.0f, 1.0f, 1.0f, 0.0f};
+    glm::vec4 positionOffset{0.0f, 0.0f, 0.0f, 0.0f};
+
+    // Set when drawn through ClusterCullingPass instead of the index buffer
+    std::unique_ptr<ClusteredMesh> clusters;
+
+    // Ranges of the index buffer. Empty for single level meshes.
+    std::vector<MeshFormat::Lod> lods;
+    // Object space center + radius
+    glm::vec4 boundingSphere{0.0f, 0.0f, 0.0f, 0.0f};
 
     VulkanModel(const VulkanModel&) = delete;
     VulkanModel& operator=(const VulkanModel&) = delete;
-    VulkanModel(VulkanModel&& other) noexcept
-      : vertexBuffer(other.vertexBuffer),
-        vertexBufferMemory(other.vertexBufferMemory),
-        indexBuffer(other.indexBuffer),
-        indexBufferMemory(other.indexBufferMemory),
-        indexCount(other.indexCount),
-        device(other.device) {
-      other.vertexBuffer = VK_NULL_HANDLE;
-      other.vertexBufferMemory = VK_NULL_HANDLE;
-      other.indexBuffer = VK_NULL_HANDLE;
-      other.indexBufferMemory = VK_NULL_HANDLE;
+    VulkanModel(VulkanModel&& other) noexcept { *this = std::move(other); }
+    // Swaps, other destroys what this held
+    VulkanModel& operator=(VulkanModel&& other) noexcept {
+      std::swap(vertexBuffer, other.vertexBuffer);
+      std::swap(vertexBufferMemory, other.vertexBufferMemory);
+      std::swap(indexBuffer, other.indexBuffer);
+      std::swap(indexBufferMemory, other.indexBufferMemory);
+      firstIndex = other.firstIndex;
+      indexCount = other.indexCount;
+      indexType = other.indexType;
+      positionScale = other.positionScale;
+      positionOffset = other.positionOffset;
+      std::swap(clusters, other.clusters);
+      std::swap(lods, other.lods);
+      boundingSphere = other.boundingSphere;
+      std::swap(device, other.device);
+      return *this;
     }
 
     VulkanModel(
         DeviceManager& devManager,
         const std::vector<GraphicsTypes::Vertex>& vertices,
         const std::vector<uint32_t>& indices)
-          : indexCount(static_cast<uint32_t>(indices.size())),
+          : VulkanModel(
+                devManager,
+                vertices.data(),
+                vertices.size() * sizeof(GraphicsTypes::Vertex),
+                indices.data(),
+                static_cast<uint32_t>(indices.size()),
+                VK_INDEX_TYPE_UINT32)
+      {}
+
+    // Copies straight out of whatever memory it's given (e.g. a mapped mesh
+    // file) into the mapped buffers, no staging vectors. indexData is either
+    // uint16_t or uint32_t per _indexType.
+    VulkanModel(
+        DeviceManager& devManager,
+        const void* vertexData,
+        const VkDeviceSize vertexBufferSize,
+        const void* indexData,
+        const uint32_t _indexCount,
+        const VkIndexType _indexType)
+          : indexCount(_indexCount),
+            indexType(_indexType),
             device(devManager.getDevice())
       {
-      const VkDeviceSize vertexBufferSize = vertices.size() * sizeof(GraphicsTypes::Vertex);
-      devManager.createVertexBuffer(vertexBufferSize, vertexBuffer, vertexBufferMemory);
+      if (devManager.createVertexBuffer(vertexBufferSize, vertexBuffer, vertexBufferMemory) != VK_SUCCESS)
+        throw std::runtime_error("failed to create vertex buffer!");
       {
         void* mappedData = nullptr;
         vkMapMemory(devManager.getDevice(), vertexBufferMemory, 0, vertexBufferSize, 0, &mappedData);
-        memcpy(mappedData, vertices.data(), static_cast<size_t>(vertexBufferSize));
+        memcpy(mappedData, vertexData, static_cast<size_t>(vertexBufferSize));
         vkUnmapMemory(devManager.getDevice(), vertexBufferMemory);
       }
 
-      const VkDeviceSize indexBufferSize = indices.size() * sizeof(uint32_t);
-      devManager.createIndexBuffer(indexBufferSize, indexBuffer, indexBufferMemory);
+      const VkDeviceSize indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+      const VkDeviceSize indexBufferSize = VkDeviceSize(indexCount) * indexSize;
+      if (devManager.createIndexBuffer(indexBufferSize, indexBuffer, indexBufferMemory) != VK_SUCCESS)
+        throw std::runtime_error("failed to create index buffer!");
       {
         void* mappedData = nullptr;
         vkMapMemory(devManager.getDevice(), indexBufferMemory, 0, indexBufferSize, 0, &mappedData);
-        memcpy(mappedData, indices.data(), static_cast<size_t>(indexBufferSize));
+        memcpy(mappedData, indexData, static_cast<size_t>(indexBufferSize));
         vkUnmapMemory(devManager.getDevice(), indexBufferMemory);
       }
     }
 
+    // Takes over buffers someone else created and filled, e.g. the device
+    // local ones AssetStreamer copies into
+    VulkanModel(
+        const VkDevice _device,
+        const VkBuffer _vertexBuffer,
+        const VkDeviceMemory _vertexBufferMemory,
+        const VkBuffer _indexBuffer,
+        const VkDeviceMemory _indexBufferMemory,
+        const uint32_t _indexCount,
+        const VkIndexType _indexType)
+          : vertexBuffer(_vertexBuffer),
+            vertexBufferMemory(_vertexBufferMemory),
+            indexBuffer(_indexBuffer),
+            indexBufferMemory(_indexBufferMemory),
+            indexCount(_indexCount),
+            indexType(_indexType),
+            device(_device)
+      {}
+
+    // Hands the buffers to retired instead of destroying them here, for
+    // unloading while frames up to lastUsedSerial may still draw it. Empty
+    // afterwards.
+    void retire(DeferredDestructionQueue& retired, const uint64_t lastUsedSerial) {
+      retired.retire(lastUsedSerial, indexBuffer, indexBufferMemory, vertexBuffer, vertexBufferMemory, std::move(clusters));
+      indexBuffer = VK_NULL_HANDLE;
+      indexBufferMemory = VK_NULL_HANDLE;
+      vertexBuffer = VK_NULL_HANDLE;
+      vertexBufferMemory = VK_NULL_HANDLE;
+    }
+
     ~VulkanModel() {
       if (indexBuffer != VK_NULL_HANDLE)
-        vkDestroyBuffer(device, indexBuffer, nullptr);
+        vkDestroyBuffer(device, indexBuffer, allocationCallbacks());
 
       if (indexBufferMemory != VK_NULL_HANDLE)
-        vkFreeMemory(device, indexBufferMemory, nullptr);
+        vkFreeMemory(device, indexBufferMemory, allocationCallbacks());
 
       if (vertexBuffer != VK_NULL_HANDLE)
-        vkDestroyBuffer(device, vertexBuffer, nullptr);
+        vkDestroyBuffer(device, vertexBuffer, allocationCallbacks());
 
       if (vertexBufferMemory != VK_NULL_HANDLE)
-        vkFreeMemory(device, vertexBufferMemory, nullptr);
+        vkFreeMemory(device, vertexBufferMemory, allocationCallbacks());
     }
 
    private:
-    VkDevice device;
+    VkDevice device = VK_NULL_HANDLE;
 };
 
 }
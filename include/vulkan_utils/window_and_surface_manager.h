@@ -9,6 +9,8 @@
 #include <stdexcept>
 #include <vector>
 
+#include "vulkan_utils/host_allocator.h"
+
 namespace VulkanUtils {
 
 // Little bit messy that this is both the window and the surface. Could split.
@@ -25,16 +27,34 @@ class WindowAndSurfaceManager {
     return std::make_tuple(width, height);
   }
 
+  // True once after the framebuffer changed size
+  bool consumeResize() {
+    const bool resized = framebufferResized;
+    framebufferResized = false;
+    return resized;
+  }
+
+  // A minimized window has a 0x0 framebuffer, nothing to make a swapchain for
+  void waitWhileMinimized() {
+    auto [width, height] = getFramebufferSize();
+    while (width == 0 || height == 0) {
+      glfwWaitEvents();
+      std::tie(width, height) = getFramebufferSize();
+    }
+  }
+
   WindowAndSurfaceManager() {
     glfwInit();
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
     window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+    glfwSetWindowUserPointer(window, this);
+    glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
   }
   
   ~WindowAndSurfaceManager() {
     if (surface && instance)
-      vkDestroySurfaceKHR(instance, surface, nullptr);
+      vkDestroySurfaceKHR(instance, surface, allocationCallbacks());
 
     glfwDestroyWindow(window);
     glfwTerminate();
@@ -45,7 +65,7 @@ class WindowAndSurfaceManager {
     if (surface)
       std::cerr << "Surface already existed?" << std::endl;
 
-    if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS)
+    if (glfwCreateWindowSurface(instance, window, allocationCallbacks(), &surface) != VK_SUCCESS)
       throw std::runtime_error("failed to create window surface!");
   }
 
@@ -58,7 +78,13 @@ class WindowAndSurfaceManager {
 
   WindowAndSurfaceManager(const WindowAndSurfaceManager&) = delete;
   private:
+  static void framebufferResizeCallback(GLFWwindow* window, int, int) {
+    auto self = static_cast<WindowAndSurfaceManager*>(glfwGetWindowUserPointer(window));
+    self->framebufferResized = true;
+  }
+
   GLFWwindow* window;
+  bool framebufferResized = false;
   VkSurfaceKHR surface = VK_NULL_HANDLE;
   VkInstance instance = VK_NULL_HANDLE;
 
@@ -0,0 +1,63 @@
+#version 450
+
+// GraphicsTypes::QuantizedVertex, normalized by the vertex fetch so
+// aPosition is [0, 1] and aOctNormal [-1, 1]
+layout (location = 0) in vec4 aPosition;
+layout (location = 1) in vec2 aOctNormal;
+layout (location = 2) in vec2 aTextCoord;
+
+// InstanceData, one per draw this frame
+struct Instance {
+    mat4 model;
+    mat4 modelViewProjection;
+    // Not normalized
+    mat3 normal;
+    vec4 color;
+    vec4 positionScale;
+    vec4 positionOffset;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer InstanceBlock {
+    Instance instances[];
+};
+
+layout(push_constant) uniform MyPushConstants {
+    uint uInstance;
+    int uUseTexture;
+} pushConst;
+
+layout(set = 0, binding = 0) uniform SceneBlock {
+    mat4 uViewProjection;
+    mat4 uWorld;
+    mat4 uWorldInverseTranspose;
+    vec3 uViewerWorldPosition;
+} scene;
+
+layout(location = 0) out vec3 vNormal;
+layout(location = 1) out vec3 surfaceWorldPosition;
+layout(location = 2) out vec3 vSurfaceToViewer;
+layout(location = 3) out vec2 vTextCoord;
+layout(location = 4) flat out vec4 vColor;
+
+vec3 octDecode(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+  return normalize(n);
+}
+
+void main() {
+  // gl_InstanceIndex for instanced draws, consecutive instances
+  Instance instance = instances[pushConst.uInstance + gl_InstanceIndex];
+  vec3 position = instance.positionOffset.xyz + aPosition.xyz * instance.positionScale.xyz;
+  vec3 normal = octDecode(aOctNormal);
+
+  vTextCoord = aTextCoord;
+  vColor = instance.color;
+  gl_Position = instance.modelViewProjection * vec4(position, 1.0);
+
+  vNormal = mat3(scene.uWorldInverseTranspose) * (instance.normal * normal);
+
+  surfaceWorldPosition = mat3(scene.uWorld) * (instance.model * vec4(position, 1.0)).xyz;
+  vSurfaceToViewer = scene.uViewerWorldPosition - surfaceWorldPosition;
+}
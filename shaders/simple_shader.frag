@@ -4,6 +4,7 @@ layout(location = 0) in vec3 vNormal;
 layout(location = 1) in vec3 surfaceWorldPosition;
 layout(location = 2) in vec3 vSurfaceToViewer;
 layout(location = 3) in vec2 vTexCoord;
+layout(location = 4) flat in vec4 vColor;
 
 
 layout(set = 0, binding = 1) uniform LightBlock {
@@ -21,15 +22,14 @@ layout(set = 0, binding = 1) uniform LightBlock {
 layout(set = 1, binding = 0) uniform sampler2D uTexture;
 
 layout(push_constant) uniform MyPushConstants {
-    mat4 uModel;
+    uint uInstance;
     int uUseTexture;
-    vec4 u_color;
 } pushConst;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-  vec4 color = pushConst.u_color;
+  vec4 color = vColor;
   if (pushConst.uUseTexture != 0) {
     color = texture(uTexture, vTexCoord);
   }
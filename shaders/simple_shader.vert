@@ -4,10 +4,24 @@ layout (location = 0) in vec3 aPosition;
 layout (location = 1) in vec3 vertexNorm;
 layout (location = 2) in vec2 aTextCoord;
 
+// InstanceData, one per draw this frame
+struct Instance {
+    mat4 model;
+    mat4 modelViewProjection;
+    // Not normalized
+    mat3 normal;
+    vec4 color;
+    vec4 positionScale;
+    vec4 positionOffset;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer InstanceBlock {
+    Instance instances[];
+};
+
 layout(push_constant) uniform MyPushConstants {
-    mat4 uModel;
+    uint uInstance;
     int uUseTexture;
-    vec4 u_color;
 } pushConst;
 
 layout(set = 0, binding = 0) uniform SceneBlock {
@@ -21,13 +35,17 @@ layout(location = 0) out vec3 vNormal;
 layout(location = 1) out vec3 surfaceWorldPosition;
 layout(location = 2) out vec3 vSurfaceToViewer;
 layout(location = 3) out vec2 vTextCoord;
+layout(location = 4) flat out vec4 vColor;
 
 void main() {
+  // gl_InstanceIndex for instanced draws, consecutive instances
+  Instance instance = instances[pushConst.uInstance + gl_InstanceIndex];
   vTextCoord = aTextCoord;
-  gl_Position = scene.uViewProjection * pushConst.uModel * vec4(aPosition, 1.0);
+  vColor = instance.color;
+  gl_Position = instance.modelViewProjection * vec4(aPosition, 1.0);
 
-  vNormal = mat3(scene.uWorldInverseTranspose) * vertexNorm;
+  vNormal = mat3(scene.uWorldInverseTranspose) * (instance.normal * vertexNorm);
 
-  surfaceWorldPosition = mat3(scene.uWorld) * aPosition;
+  surfaceWorldPosition = mat3(scene.uWorld) * (instance.model * vec4(aPosition, 1.0)).xyz;
   vSurfaceToViewer = scene.uViewerWorldPosition - surfaceWorldPosition;
 }
\ No newline at end of file
@@ -0,0 +1,305 @@
+#include "asset_cook.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "block_compression.h"
+#include "json.h"
+#include "ktx2.h"
+#include "mapped_file.h"
+#include "mesh_importer.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplify.h"
+#include "meshlets.h"
+
+namespace AssetCook {
+namespace {
+constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+uint64_t rotl(const uint64_t x, const int r) { return (x << r) | (x >> (64 - r)); }
+
+uint64_t read64(const uint8_t* p) {
+  uint64_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint32_t read32(const uint8_t* p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint64_t hashRound(uint64_t acc, const uint64_t input) {
+  acc += input * prime2;
+  acc = rotl(acc, 31);
+  return acc * prime1;
+}
+
+uint64_t mergeRound(uint64_t acc, const uint64_t value) {
+  acc ^= hashRound(0, value);
+  return acc * prime1 + prime4;
+}
+
+std::string escape(const std::string& text) {
+  std::string result;
+  result.reserve(text.size());
+  for (const char c : text) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buffer[8];
+      std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+      result += buffer;
+    } else {
+      result += c;
+    }
+  }
+  return result;
+}
+}
+
+uint64_t contentHash(const void* data, const size_t size, const uint64_t seed) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  const uint8_t* const end = p + size;
+  uint64_t hash;
+
+  // Four independent lanes over 32 byte stripes
+  if (size >= 32) {
+    uint64_t v1 = seed + prime1 + prime2;
+    uint64_t v2 = seed + prime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - prime1;
+    const uint8_t* const limit = end - 32;
+    do {
+      v1 = hashRound(v1, read64(p));
+      v2 = hashRound(v2, read64(p + 8));
+      v3 = hashRound(v3, read64(p + 16));
+      v4 = hashRound(v4, read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+
+    hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    hash = mergeRound(hash, v1);
+    hash = mergeRound(hash, v2);
+    hash = mergeRound(hash, v3);
+    hash = mergeRound(hash, v4);
+  } else {
+    hash = seed + prime5;
+  }
+
+  hash += size;
+  for (; p + 8 <= end; p += 8) {
+    hash ^= hashRound(0, read64(p));
+    hash = rotl(hash, 27) * prime1 + prime4;
+  }
+  if (p + 4 <= end) {
+    hash ^= uint64_t(read32(p)) * prime1;
+    hash = rotl(hash, 23) * prime2 + prime3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    hash ^= *p * prime5;
+    hash = rotl(hash, 11) * prime1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= prime2;
+  hash ^= hash >> 29;
+  hash *= prime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+uint64_t hashFile(const std::string& path) {
+  const MappedFile file(path);
+  return contentHash(file.data(), file.size());
+}
+
+std::string toHex(const uint64_t value) {
+  char buffer[17];
+  std::snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+  return buffer;
+}
+
+uint64_t fromHex(const std::string& text) {
+  if (text.size() != 16)
+    return 0;
+  uint64_t value = 0;
+  for (const char c : text) {
+    value <<= 4;
+    if (c >= '0' && c <= '9')
+      value |= uint64_t(c - '0');
+    else if (c >= 'a' && c <= 'f')
+      value |= uint64_t(c - 'a' + 10);
+    else
+      return 0;
+  }
+  return value;
+}
+
+std::string MeshCookOptions::key() const {
+  std::ostringstream stream;
+  stream << "mesh " << MeshFormat::versionMajor << "." << MeshFormat::versionMinor
+         << " vertexFormat=" << static_cast<uint32_t>(vertexFormat)
+         << " lods=" << buildLods << " meshlets=" << buildMeshlets << " encode=" << encodeGeometry;
+  return stream.str();
+}
+
+std::string TextureCookOptions::key() const {
+  std::ostringstream stream;
+  stream << "texture encoding=" << static_cast<uint32_t>(encoding) << " supercompress=" << supercompress;
+  return stream.str();
+}
+
+bool isNormalMap(const std::string& path) {
+  const size_t slash = path.find_last_of("/\\");
+  std::string stem = path.substr(slash == std::string::npos ? 0 : slash + 1);
+  stem = stem.substr(0, stem.find('.'));
+  std::transform(stem.begin(), stem.end(), stem.begin(), [](const unsigned char c) { return std::tolower(c); });
+  const auto endsWith = [&](const std::string& suffix) {
+    return stem.size() >= suffix.size() && stem.compare(stem.size() - suffix.size(), suffix.size(), suffix) == 0;
+  };
+  return endsWith("_n") || endsWith("_normal");
+}
+
+std::vector<uint8_t> cookTexture(const std::string& ktx2Path, const bool normalMap, const TextureCookOptions& options) {
+  const MappedFile file(ktx2Path);
+  const Ktx2::Texture source(file.data(), file.size(), ktx2Path);
+  const VkFormat sourceFormat = source.getFormat();
+  if (sourceFormat != VK_FORMAT_R8G8B8A8_UNORM && sourceFormat != VK_FORMAT_R8G8B8A8_SRGB)
+    throw std::runtime_error(ktx2Path + " is not uncompressed RGBA8!");
+  const bool srgb = sourceFormat == VK_FORMAT_R8G8B8A8_SRGB;
+
+  std::vector<std::vector<uint8_t>> levels(source.getLevelCount());
+  for (uint32_t level = 0; level < source.getLevelCount(); ++level) {
+    levels[level].resize(source.levelSize(level));
+    source.readLevel(level, levels[level].data());
+  }
+
+  TextureEncoding encoding = options.encoding;
+  if (encoding == TextureEncoding::automatic) {
+    bool opaque = true;
+    for (size_t i = 3; i < levels[0].size() && opaque; i += 4)
+      opaque = levels[0][i] == 255;
+    encoding = normalMap ? TextureEncoding::bc5 : opaque ? TextureEncoding::bc1 : TextureEncoding::bc3;
+  }
+
+  VkFormat format = sourceFormat;
+  switch (encoding) {
+    case TextureEncoding::bc1: format = srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK; break;
+    case TextureEncoding::bc3: format = srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK; break;
+    // Two channels, the shader rebuilds z. Never srgb.
+    case TextureEncoding::bc5: format = VK_FORMAT_BC5_UNORM_BLOCK; break;
+    default: break;
+  }
+  if (format != sourceFormat) {
+    for (uint32_t level = 0; level < source.getLevelCount(); ++level) {
+      std::vector<uint8_t> blocks(BlockCompression::levelSize(format, source.levelWidth(level), source.levelHeight(level)));
+      BlockCompression::encode(
+          format, levels[level].data(), source.levelWidth(level), source.levelHeight(level), blocks.data());
+      levels[level] = std::move(blocks);
+    }
+  }
+
+  return Ktx2::writeTexture(
+      format,
+      source.getWidth(),
+      source.getHeight(),
+      levels,
+      options.supercompress ? Ktx2::Supercompression::zlib : Ktx2::Supercompression::none);
+}
+
+MeshFormat::MeshData cookMesh(const std::string& path, const MeshCookOptions& options) {
+  MeshImport::ImportOptions importOptions;
+  importOptions.threads = options.threads;
+  MeshFormat::MeshData mesh = MeshImport::importMesh(path, importOptions);
+  if (options.buildLods)
+    MeshSimplify::buildLodChain(mesh);
+  MeshOptimize::optimizeMesh(mesh);
+  if (options.buildMeshlets)
+    Meshlets::buildMeshlets(mesh);
+  return mesh;
+}
+
+const ManifestEntry* Manifest::find(const std::string& source) const {
+  const auto it = std::lower_bound(entries.begin(), entries.end(), source, [](const ManifestEntry& entry, const std::string& key) {
+    return entry.source < key;
+  });
+  return it != entries.end() && it->source == source ? &*it : nullptr;
+}
+
+Manifest readManifest(const std::string& path) {
+  Manifest manifest;
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return manifest;
+
+  std::stringstream contents;
+  contents << file.rdbuf();
+  Json::Value root;
+  try {
+    root = Json::parse(contents.str());
+  } catch (const std::runtime_error&) {
+    return manifest;
+  }
+
+  manifest.cookerVersion = static_cast<uint32_t>(root["cookerVersion"].asNumber());
+  for (const Json::Value& item : root["assets"].items()) {
+    ManifestEntry entry;
+    entry.source = item["source"].asString();
+    entry.output = item["output"].asString();
+    entry.kind = item["kind"].asString();
+    entry.sourceHash = fromHex(item["sourceHash"].asString());
+    entry.sourceSize = static_cast<uint64_t>(item["sourceSize"].asNumber());
+    entry.sourceTime = static_cast<int64_t>(fromHex(item["sourceTime"].asString()));
+    entry.cookKey = fromHex(item["cookKey"].asString());
+    entry.outputSize = static_cast<uint64_t>(item["outputSize"].asNumber());
+    if (!entry.source.empty())
+      manifest.entries.push_back(std::move(entry));
+  }
+  std::sort(manifest.entries.begin(), manifest.entries.end(), [](const ManifestEntry& a, const ManifestEntry& b) {
+    return a.source < b.source;
+  });
+  return manifest;
+}
+
+void writeManifest(const std::string& path, const Manifest& manifest) {
+  const std::string temporary = path + ".tmp";
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    if (!file)
+      throw std::runtime_error("failed to write " + temporary + "!");
+
+    // Hashes and times as hex, json numbers are doubles and would round them
+    file << "{\n  \"cookerVersion\": " << manifest.cookerVersion << ",\n  \"assets\": [";
+    for (size_t i = 0; i < manifest.entries.size(); ++i) {
+      const ManifestEntry& entry = manifest.entries[i];
+      file << (i ? ",\n" : "\n") << "    {\"source\": \"" << escape(entry.source)
+           << "\", \"output\": \"" << escape(entry.output)
+           << "\", \"kind\": \"" << escape(entry.kind)
+           << "\", \"sourceHash\": \"" << toHex(entry.sourceHash)
+           << "\", \"sourceSize\": " << entry.sourceSize
+           << ", \"sourceTime\": \"" << toHex(static_cast<uint64_t>(entry.sourceTime))
+           << "\", \"cookKey\": \"" << toHex(entry.cookKey)
+           << "\", \"outputSize\": " << entry.outputSize << "}";
+    }
+    file << "\n  ]\n}\n";
+    if (!file)
+      throw std::runtime_error("failed to write " + temporary + "!");
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    throw std::runtime_error("failed to replace " + path + "!");
+}
+
+}
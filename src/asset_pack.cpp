@@ -0,0 +1,429 @@
+#include "asset_pack.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "asset_cook.h"
+#include "parallel_for.h"
+
+namespace AssetPack {
+namespace {
+constexpr size_t minMatch = 4;
+// The format wants the last 5 bytes as literals and no match starting in
+// the last 12
+constexpr size_t lastLiterals = 5;
+constexpr size_t matchSafeEnd = 12;
+constexpr int hashBits = 14;
+
+uint32_t read32(const uint8_t* p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint32_t hashSequence(const uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - hashBits);
+}
+
+// 255 runs for lengths past the token's 15
+bool writeLength(size_t length, uint8_t*& op, const uint8_t* end) {
+  while (length >= 255) {
+    if (op >= end)
+      return false;
+    *op++ = 255;
+    length -= 255;
+  }
+  if (op >= end)
+    return false;
+  *op++ = static_cast<uint8_t>(length);
+  return true;
+}
+
+bool writeSequence(
+    const uint8_t* literals,
+    const size_t literalCount,
+    const size_t offset,
+    const size_t matchLength,
+    uint8_t*& op,
+    const uint8_t* end) {
+  if (op >= end)
+    return false;
+  uint8_t* token = op++;
+  *token = static_cast<uint8_t>(std::min<size_t>(literalCount, 15) << 4);
+  if (literalCount >= 15 && !writeLength(literalCount - 15, op, end))
+    return false;
+  if (size_t(end - op) < literalCount)
+    return false;
+  std::memcpy(op, literals, literalCount);
+  op += literalCount;
+
+  // Last literals have no match
+  if (matchLength == 0)
+    return true;
+  if (end - op < 2)
+    return false;
+  *op++ = static_cast<uint8_t>(offset);
+  *op++ = static_cast<uint8_t>(offset >> 8);
+  const size_t extra = matchLength - minMatch;
+  *token |= static_cast<uint8_t>(std::min<size_t>(extra, 15));
+  return extra < 15 || writeLength(extra - 15, op, end);
+}
+
+size_t pad(const size_t offset, const size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+struct BlockJob {
+  const uint8_t* source;
+  size_t sourceSize;
+  uint8_t* destination;
+  size_t size;
+};
+}
+
+size_t compressBound(const size_t size) {
+  return size + size / 255 + 16;
+}
+
+size_t compressBlock(const uint8_t* source, const size_t size, uint8_t* destination, const size_t capacity) {
+  uint8_t* op = destination;
+  const uint8_t* const end = destination + capacity;
+  size_t anchor = 0;
+
+  if (size > matchSafeEnd) {
+    std::vector<uint32_t> table(size_t(1) << hashBits, 0);
+    const size_t matchLimit = size - matchSafeEnd;
+    const size_t extendLimit = size - lastLiterals;
+    size_t ip = 1;
+    table[hashSequence(read32(source))] = 0;
+
+    while (ip < matchLimit) {
+      const uint32_t sequence = read32(source + ip);
+      const uint32_t slot = hashSequence(sequence);
+      size_t reference = table[slot];
+      table[slot] = static_cast<uint32_t>(ip);
+
+      if (ip - reference > 65535 || read32(source + reference) != sequence) {
+        // Step further the longer nothing matches, incompressible data goes
+        // by quickly
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+
+      size_t start = ip;
+      while (start > anchor && reference > 0 && source[start - 1] == source[reference - 1]) {
+        --start;
+        --reference;
+      }
+      size_t length = minMatch + (ip - start);
+      while (start + length < extendLimit && source[start + length] == source[reference + length])
+        ++length;
+
+      if (!writeSequence(source + anchor, start - anchor, start - reference, length, op, end))
+        return 0;
+      anchor = start + length;
+      ip = anchor;
+      if (ip - 2 < matchLimit)
+        table[hashSequence(read32(source + ip - 2))] = static_cast<uint32_t>(ip - 2);
+    }
+  }
+
+  if (!writeSequence(source + anchor, size - anchor, 0, 0, op, end))
+    return 0;
+  return static_cast<size_t>(op - destination);
+}
+
+void decompressBlock(const uint8_t* source, const size_t sourceSize, uint8_t* destination, const size_t size) {
+  const uint8_t* ip = source;
+  const uint8_t* const sourceEnd = source + sourceSize;
+  uint8_t* op = destination;
+  uint8_t* const end = destination + size;
+
+  const auto readLength = [&](size_t length) {
+    if (length != 15)
+      return length;
+    uint8_t next;
+    do {
+      if (ip >= sourceEnd)
+        throw std::runtime_error("truncated compressed block!");
+      next = *ip++;
+      length += next;
+    } while (next == 255);
+    return length;
+  };
+
+  while (true) {
+    if (ip >= sourceEnd)
+      throw std::runtime_error("truncated compressed block!");
+    const uint8_t token = *ip++;
+
+    const size_t literalCount = readLength(token >> 4);
+    if (size_t(sourceEnd - ip) < literalCount || size_t(end - op) < literalCount)
+      throw std::runtime_error("corrupt compressed block!");
+    std::memcpy(op, ip, literalCount);
+    ip += literalCount;
+    op += literalCount;
+    if (ip == sourceEnd)
+      break;
+
+    if (sourceEnd - ip < 2)
+      throw std::runtime_error("truncated compressed block!");
+    const size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+    ip += 2;
+    const size_t length = readLength(token & 15) + minMatch;
+    if (offset == 0 || offset > size_t(op - destination) || size_t(end - op) < length)
+      throw std::runtime_error("corrupt compressed block!");
+
+    const uint8_t* match = op - offset;
+    if (offset >= length) {
+      std::memcpy(op, match, length);
+      op += length;
+    } else {
+      // Overlapping, repeats the last offset bytes
+      for (size_t i = 0; i < length; ++i)
+        *op++ = match[i];
+    }
+  }
+
+  if (op != end)
+    throw std::runtime_error("compressed block has the wrong size!");
+}
+
+PackReader::PackReader(const std::string& path) : file(path) {
+  if (file.size() < sizeof(Header))
+    throw std::runtime_error(path + " is too small to be a pack!");
+  header = reinterpret_cast<const Header*>(file.data());
+  if (header->magic != magic)
+    throw std::runtime_error(path + " is not a vpak file!");
+  if (header->versionMajor != versionMajor)
+    throw std::runtime_error(path + " has an unsupported vpak version!");
+  if (header->fileSize > file.size())
+    throw std::runtime_error(path + " is truncated!");
+
+  // Subtracting from fileSize, garbage offsets could wrap a sum around
+  const uint64_t tocSize = uint64_t(header->entryCount) * sizeof(Entry);
+  if (header->tocOffset % alignof(Entry) != 0 ||
+      header->tocOffset > header->fileSize ||
+      tocSize > header->fileSize - header->tocOffset ||
+      header->namesSize > header->fileSize - header->tocOffset - tocSize)
+    throw std::runtime_error(path + " has a bad table of contents!");
+  const uint64_t tocEnd = header->tocOffset + tocSize;
+  toc = reinterpret_cast<const Entry*>(file.data() + header->tocOffset);
+  names = reinterpret_cast<const char*>(file.data() + tocEnd);
+
+  entries.reserve(header->entryCount);
+  for (uint32_t i = 0; i < header->entryCount; ++i) {
+    const Entry& entry = toc[i];
+    if (entry.offset > header->fileSize ||
+        entry.storedSize > header->fileSize - entry.offset ||
+        uint64_t(entry.nameOffset) + entry.nameLength > header->namesSize ||
+        (i > 0 && toc[i - 1].nameHash > entry.nameHash) ||
+        (entry.compression == Compression::stored && entry.storedSize != entry.size) ||
+        entry.compression > Compression::lz4)
+      throw std::runtime_error(path + " has a bad entry!");
+    entries.push_back(&entry);
+  }
+
+  // Lookups jump around the toc, payloads get read once front to back
+  madvise(const_cast<uint8_t*>(file.data()), tocEnd + header->namesSize, MADV_WILLNEED);
+}
+
+std::string_view PackReader::getName(const Entry& entry) const {
+  return {names + entry.nameOffset, entry.nameLength};
+}
+
+const Entry* PackReader::find(const std::string_view name) const {
+  const uint64_t hash = AssetCook::contentHash(name.data(), name.size());
+  const Entry* const end = toc + header->entryCount;
+  for (const Entry* entry = std::lower_bound(toc, end, hash, [](const Entry& e, const uint64_t h) { return e.nameHash < h; });
+       entry != end && entry->nameHash == hash;
+       ++entry)
+    if (getName(*entry) == name)
+      return entry;
+  return nullptr;
+}
+
+const uint8_t* PackReader::mappedData(const Entry& entry) const {
+  return entry.compression == Compression::stored ? file.data() + entry.offset : nullptr;
+}
+
+void PackReader::read(const Entry& entry, void* destination) const {
+  readParallel({{&entry, destination}}, 1);
+}
+
+std::vector<uint8_t> PackReader::read(const Entry& entry) const {
+  std::vector<uint8_t> data(entry.size);
+  read(entry, data.data());
+  return data;
+}
+
+void PackReader::readParallel(const std::vector<ReadRequest>& requests, const unsigned threads) const {
+  std::vector<BlockJob> jobs;
+  for (const ReadRequest& request : requests) {
+    const Entry& entry = *request.entry;
+    uint8_t* destination = static_cast<uint8_t*>(request.destination);
+    const uint8_t* payload = file.data() + entry.offset;
+
+    if (entry.compression == Compression::stored) {
+      // Copies still split up, page faults on a cold mapping are the slow part
+      for (uint64_t offset = 0; offset < entry.size; offset += blockSize) {
+        const size_t length = static_cast<size_t>(std::min<uint64_t>(blockSize, entry.size - offset));
+        jobs.push_back({payload + offset, length, destination + offset, length});
+      }
+      continue;
+    }
+
+    uint32_t blockCount = 0;
+    if (entry.storedSize < sizeof(uint32_t))
+      throw std::runtime_error("corrupt pack entry " + std::string(getName(entry)) + "!");
+    std::memcpy(&blockCount, payload, sizeof(blockCount));
+    const uint64_t expectedBlocks = (entry.size + blockSize - 1) / blockSize;
+    const uint64_t tableSize = sizeof(uint32_t) * (1 + uint64_t(blockCount));
+    if (blockCount != expectedBlocks || tableSize > entry.storedSize)
+      throw std::runtime_error("corrupt pack entry " + std::string(getName(entry)) + "!");
+
+    uint64_t offset = tableSize;
+    for (uint32_t block = 0; block < blockCount; ++block) {
+      uint32_t compressedSize;
+      std::memcpy(&compressedSize, payload + sizeof(uint32_t) * (1 + block), sizeof(compressedSize));
+      const uint64_t rawOffset = uint64_t(block) * blockSize;
+      const size_t rawSize = static_cast<size_t>(std::min<uint64_t>(blockSize, entry.size - rawOffset));
+      if (offset + compressedSize > entry.storedSize)
+        throw std::runtime_error("corrupt pack entry " + std::string(getName(entry)) + "!");
+      jobs.push_back({payload + offset, compressedSize, destination + rawOffset, rawSize});
+      offset += compressedSize;
+    }
+  }
+
+  parallelFor(jobs.size(), threads, [&jobs](const size_t i) {
+    const BlockJob& job = jobs[i];
+    if (job.sourceSize == job.size)
+      std::memcpy(job.destination, job.source, job.size);
+    else
+      decompressBlock(job.source, job.sourceSize, job.destination, job.size);
+  });
+}
+
+void PackWriter::add(std::string name, std::vector<uint8_t> data, const bool allowCompression) {
+  if (name.size() > UINT16_MAX)
+    throw std::invalid_argument("pack entry name too long!");
+  pending.push_back({std::move(name), std::move(data), allowCompression});
+}
+
+void PackWriter::write(const std::string& path, const unsigned threads) const {
+  struct Prepared {
+    Entry entry{};
+    std::vector<uint8_t> compressed;
+  };
+  std::vector<Prepared> prepared(pending.size());
+
+  parallelFor(pending.size(), threads, [&](const size_t i) {
+    const Pending& item = pending[i];
+    Entry& entry = prepared[i].entry;
+    entry.nameHash = AssetCook::contentHash(item.name.data(), item.name.size());
+    entry.size = item.data.size();
+    entry.contentHash = AssetCook::contentHash(item.data.data(), item.data.size());
+    entry.nameLength = static_cast<uint16_t>(item.name.size());
+    entry.compression = Compression::stored;
+    entry.storedSize = entry.size;
+    if (!item.allowCompression || item.data.empty())
+      return;
+
+    const size_t blockCount = (item.data.size() + blockSize - 1) / blockSize;
+    std::vector<uint8_t> out(sizeof(uint32_t) * (1 + blockCount));
+    const uint32_t count = static_cast<uint32_t>(blockCount);
+    std::memcpy(out.data(), &count, sizeof(count));
+
+    std::vector<uint8_t> scratch(compressBound(blockSize));
+    for (size_t block = 0; block < blockCount; ++block) {
+      const uint8_t* raw = item.data.data() + block * blockSize;
+      const size_t rawSize = std::min<size_t>(blockSize, item.data.size() - block * blockSize);
+      // Anything that doesn't shrink goes in raw, the reader copies those
+      size_t size = compressBlock(raw, rawSize, scratch.data(), rawSize - 1);
+      const uint8_t* bytes = scratch.data();
+      if (size == 0) {
+        size = rawSize;
+        bytes = raw;
+      }
+      const uint32_t size32 = static_cast<uint32_t>(size);
+      std::memcpy(out.data() + sizeof(uint32_t) * (1 + block), &size32, sizeof(size32));
+      out.insert(out.end(), bytes, bytes + size);
+    }
+
+    if (out.size() < item.data.size() - item.data.size() / 8) {
+      entry.compression = Compression::lz4;
+      entry.storedSize = out.size();
+      prepared[i].compressed = std::move(out);
+    }
+  });
+
+  // Hash order, names to break ties so the output is deterministic
+  std::vector<size_t> order(pending.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&](const size_t a, const size_t b) {
+    if (prepared[a].entry.nameHash != prepared[b].entry.nameHash)
+      return prepared[a].entry.nameHash < prepared[b].entry.nameHash;
+    return pending[a].name < pending[b].name;
+  });
+  for (size_t i = 1; i < order.size(); ++i)
+    if (pending[order[i]].name == pending[order[i - 1]].name)
+      throw std::invalid_argument("duplicate pack entry " + pending[order[i]].name + "!");
+
+  std::string names;
+  for (const size_t i : order) {
+    prepared[i].entry.nameOffset = static_cast<uint32_t>(names.size());
+    names += pending[i].name;
+  }
+
+  Header header{};
+  header.magic = magic;
+  header.versionMajor = versionMajor;
+  header.versionMinor = versionMinor;
+  header.entryCount = static_cast<uint32_t>(order.size());
+  header.namesSize = static_cast<uint32_t>(names.size());
+  header.tocOffset = sizeof(Header);
+
+  uint64_t offset = header.tocOffset + order.size() * sizeof(Entry) + names.size();
+  for (const size_t i : order) {
+    Entry& entry = prepared[i].entry;
+    // Padding a tiny entry to a page would cost more than the entry
+    const bool pageAligned = entry.compression == Compression::stored && entry.size >= pageAlignment;
+    offset = pad(offset, pageAligned ? pageAlignment : sectionAlignment);
+    entry.offset = offset;
+    offset += entry.storedSize;
+  }
+  header.fileSize = offset;
+
+  const std::string temporary = path + ".tmp";
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    if (!file)
+      throw std::runtime_error("failed to write " + temporary + "!");
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const size_t i : order)
+      file.write(reinterpret_cast<const char*>(&prepared[i].entry), sizeof(Entry));
+    file.write(names.data(), static_cast<std::streamsize>(names.size()));
+
+    static const char zeros[pageAlignment] = {};
+    uint64_t written = header.tocOffset + order.size() * sizeof(Entry) + names.size();
+    for (const size_t i : order) {
+      const Entry& entry = prepared[i].entry;
+      file.write(zeros, static_cast<std::streamsize>(entry.offset - written));
+      const std::vector<uint8_t>& bytes =
+          entry.compression == Compression::stored ? pending[i].data : prepared[i].compressed;
+      file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+      written = entry.offset + entry.storedSize;
+    }
+    if (!file)
+      throw std::runtime_error("failed to write " + temporary + "!");
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    throw std::runtime_error("failed to replace " + path + "!");
+}
+
+}
@@ -0,0 +1,433 @@
+#include "vulkan_utils/asset_streamer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+#include "parallel_for.h"
+#include "vulkan_utils/host_allocator.h"
+
+namespace VulkanUtils {
+namespace {
+// Offsets into the staging buffer, optimalBufferCopyOffsetAlignment never
+// goes past this on anything real
+constexpr VkDeviceSize stagingAlignment = 256;
+
+VkDeviceSize alignUp(const VkDeviceSize value, const VkDeviceSize alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+VkBufferMemoryBarrier ownershipBarrier(
+    const VkBuffer buffer,
+    const uint32_t srcFamily,
+    const uint32_t dstFamily,
+    const VkAccessFlags srcAccess,
+    const VkAccessFlags dstAccess) {
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = srcAccess;
+  barrier.dstAccessMask = dstAccess;
+  barrier.srcQueueFamilyIndex = srcFamily;
+  barrier.dstQueueFamilyIndex = dstFamily;
+  barrier.buffer = buffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+  return barrier;
+}
+}
+
+AssetStreamer::AssetStreamer(
+    DeviceManager& _devManager,
+    const StreamerOptions& _options,
+    const AssetPack::PackReader* _pack)
+  : devManager(_devManager),
+    device(_devManager.getDevice()),
+    options(_options),
+    pack(_pack),
+    ring(_options.stagingSize) {
+  if (devManager.createStagingBuffer(options.stagingSize, ringBuffer.buffer, ringBuffer.memory) != VK_SUCCESS)
+    throw std::runtime_error("failed to create streaming staging buffer!");
+
+  void* mapped = nullptr;
+  if (vkMapMemory(device, ringBuffer.memory, 0, options.stagingSize, 0, &mapped) != VK_SUCCESS) {
+    destroyBuffer(ringBuffer);
+    throw std::runtime_error("failed to map streaming staging buffer!");
+  }
+  ringMapping = static_cast<uint8_t*>(mapped);
+
+  commandPool.emplace(device, devManager.getTransferFamily(), VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+  const auto commandBuffers = commandPool->allocateCommandBuffers(options.maxBatches);
+  for (const VkCommandBuffer commandBuffer : commandBuffers) {
+    Batch batch;
+    batch.commandBuffer = commandBuffer;
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if (vkCreateFence(device, &fenceInfo, allocationCallbacks(), &batch.fence) != VK_SUCCESS)
+      throw std::runtime_error("failed to create streaming fence!");
+    idleBatches.push_back(std::move(batch));
+  }
+
+  unsigned threads = options.threads;
+  if (threads == 0)
+    threads = std::max(defaultThreadCount(), 2u) - 1;
+  for (unsigned i = 0; i < threads; ++i)
+    workers.emplace_back(&AssetStreamer::workerLoop, this);
+}
+
+AssetStreamer::~AssetStreamer() {
+  {
+    std::lock_guard<std::mutex> lock(jobMutex);
+    stopping = true;
+  }
+  {
+    // Under the ring's lock too, so a loader can't miss it between checking
+    // and going to sleep
+    std::lock_guard<std::mutex> lock(ringMutex);
+    jobAvailable.notify_all();
+    ringFreed.notify_all();
+  }
+  for (auto& worker : workers)
+    worker.join();
+
+  for (auto& batch : inFlight) {
+    vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+    for (auto& upload : batch.uploads) {
+      destroyUpload(upload);
+      destroyBuffer(upload.vertices);
+      destroyBuffer(upload.indices);
+    }
+    idleBatches.push_back(std::move(batch));
+  }
+  for (auto& upload : staged) {
+    destroyUpload(upload);
+    destroyBuffer(upload.vertices);
+    destroyBuffer(upload.indices);
+  }
+
+  for (const auto& batch : idleBatches)
+    vkDestroyFence(device, batch.fence, allocationCallbacks());
+  commandPool.reset();
+
+  vkUnmapMemory(device, ringBuffer.memory);
+  destroyBuffer(ringBuffer);
+}
+
+AssetStreamer::Handle AssetStreamer::requestMesh(const std::string& name, const int priority) {
+  Slot& slot = slots.emplace_back();
+  slot.name = name;
+  slot.requested = std::chrono::steady_clock::now();
+
+  {
+    std::lock_guard<std::mutex> lock(jobMutex);
+    jobs.push({priority, nextSequence++, &slot});
+  }
+  jobAvailable.notify_one();
+  return static_cast<Handle>(slots.size() - 1);
+}
+
+std::optional<VulkanModel> AssetStreamer::takeModel(const Handle handle) {
+  Slot& slot = slots[handle];
+  if (slot.state.load(std::memory_order_acquire) != State::ready)
+    return std::nullopt;
+
+  std::optional<VulkanModel> model = std::move(slot.model);
+  slot.model.reset();
+  return model;
+}
+
+size_t AssetStreamer::pendingCount() const {
+  return std::count_if(slots.begin(), slots.end(), [](const Slot& slot) {
+    const State state = slot.state.load(std::memory_order_acquire);
+    return state != State::ready && state != State::failed;
+  });
+}
+
+void AssetStreamer::workerLoop() {
+  for (;;) {
+    Slot* slot = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(jobMutex);
+      jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+      if (stopping)
+        return;
+      slot = jobs.top().slot;
+      jobs.pop();
+    }
+
+    slot->state.store(State::loading, std::memory_order_release);
+    try {
+      load(*slot);
+    } catch (const std::exception& e) {
+      std::cerr << "failed to stream " << slot->name << ": " << e.what() << std::endl;
+      slot->prepared = {};
+      slot->state.store(State::failed, std::memory_order_release);
+    }
+  }
+}
+
+void AssetStreamer::load(Slot& slot) {
+  const bool withMeshlets = options.clusterCulling != nullptr;
+  if (pack) {
+    const AssetPack::Entry* entry = pack->find(slot.name);
+    if (!entry)
+      throw std::runtime_error("no such entry in the asset pack");
+
+    if (const uint8_t* data = pack->mappedData(*entry)) {
+      slot.prepared = prepareMesh(nullptr, data, entry->size, slot.name, options.vertexFormat, withMeshlets);
+    } else {
+      auto bytes = std::make_shared<std::vector<uint8_t>>(pack->read(*entry));
+      const uint8_t* decompressed = bytes->data();
+      slot.prepared =
+          prepareMesh(std::move(bytes), decompressed, entry->size, slot.name, options.vertexFormat, withMeshlets);
+    }
+  } else {
+    slot.prepared = prepareMeshFile(slot.name, options.vertexFormat, withMeshlets);
+  }
+
+  if (slot.prepared.vertexBytes == 0 || slot.prepared.indexCount == 0)
+    throw std::runtime_error("mesh is empty");
+
+  Upload upload;
+  upload.slot = &slot;
+  if (!stage(slot, upload))
+    return;
+
+  // Only the meshlets are still needed (for ClusteredMesh once it's ready)
+  PreparedMesh& prepared = slot.prepared;
+  prepared.vertexData = nullptr;
+  prepared.indexData = nullptr;
+  std::vector<uint8_t>().swap(prepared.decodedVertices);
+  std::vector<uint8_t>().swap(prepared.decodedIndices);
+  std::vector<GraphicsTypes::QuantizedVertex>().swap(prepared.quantizedVertices);
+  std::vector<uint16_t>().swap(prepared.shortIndices);
+  if (!prepared.meshlets)
+    prepared.source.reset();
+
+  slot.state.store(State::uploading, std::memory_order_release);
+  std::lock_guard<std::mutex> lock(stagedMutex);
+  staged.push_back(upload);
+}
+
+bool AssetStreamer::stage(Slot& slot, Upload& upload) {
+  const PreparedMesh& prepared = slot.prepared;
+  upload.vertexBytes = prepared.vertexBytes;
+  upload.indexBytes = prepared.indexBytes();
+  const VkDeviceSize indexOffset = alignUp(upload.vertexBytes, stagingAlignment);
+  const VkDeviceSize size = indexOffset + upload.indexBytes;
+
+  // Device local buffers first, nothing to undo in the ring if they fail.
+  // Allocation is thread safe, only recording and submitting stay on the
+  // render thread.
+  const auto destroyTargets = [&] {
+    destroyBuffer(upload.vertices);
+    destroyBuffer(upload.indices);
+  };
+  if (devManager.createBuffer(
+          upload.vertexBytes,
+          VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+          upload.vertices.buffer,
+          upload.vertices.memory) != VK_SUCCESS)
+    throw std::runtime_error("failed to create vertex buffer!");
+  if (devManager.createBuffer(
+          upload.indexBytes,
+          VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+          upload.indices.buffer,
+          upload.indices.memory) != VK_SUCCESS) {
+    destroyTargets();
+    throw std::runtime_error("failed to create index buffer!");
+  }
+
+  uint8_t* destination = nullptr;
+  if (size > ring.getCapacity()) {
+    if (devManager.createStagingBuffer(size, upload.dedicatedStaging.buffer, upload.dedicatedStaging.memory) != VK_SUCCESS) {
+      destroyTargets();
+      throw std::runtime_error("failed to create staging buffer!");
+    }
+    void* mapped = nullptr;
+    if (vkMapMemory(device, upload.dedicatedStaging.memory, 0, size, 0, &mapped) != VK_SUCCESS) {
+      destroyBuffer(upload.dedicatedStaging);
+      destroyTargets();
+      throw std::runtime_error("failed to map staging buffer!");
+    }
+    destination = static_cast<uint8_t*>(mapped);
+  } else {
+    std::unique_lock<std::mutex> lock(ringMutex);
+    ringFreed.wait(lock, [&] {
+      if (stopping)
+        return true;
+      upload.ringOffset = ring.allocate(size, stagingAlignment);
+      return upload.ringOffset != RingAllocator::invalid;
+    });
+    if (upload.ringOffset == RingAllocator::invalid) {
+      destroyTargets();
+      return false;
+    }
+    destination = ringMapping + upload.ringOffset;
+  }
+
+  // Coherent memory, written once front to back
+  memcpy(destination, prepared.vertexData, static_cast<size_t>(upload.vertexBytes));
+  memcpy(destination + indexOffset, prepared.indexData, static_cast<size_t>(upload.indexBytes));
+  if (upload.dedicatedStaging.memory != VK_NULL_HANDLE)
+    vkUnmapMemory(device, upload.dedicatedStaging.memory);
+  return true;
+}
+
+void AssetStreamer::update(const VkCommandBuffer commandBuffer) {
+  // Finished copies, oldest first
+  bool retired = false;
+  while (!inFlight.empty() && vkGetFenceStatus(device, inFlight.front().fence) == VK_SUCCESS) {
+    retire(inFlight.front(), commandBuffer);
+    idleBatches.push_back(std::move(inFlight.front()));
+    inFlight.pop_front();
+    retired = true;
+  }
+  if (retired)
+    ringFreed.notify_all();
+
+  if (idleBatches.empty())
+    return;
+
+  Batch& batch = idleBatches.back();
+  {
+    std::lock_guard<std::mutex> lock(stagedMutex);
+    if (staged.empty())
+      return;
+    batch.uploads.swap(staged);
+  }
+  submit(batch);
+  inFlight.push_back(std::move(batch));
+  idleBatches.pop_back();
+}
+
+void AssetStreamer::submit(Batch& batch) {
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkResetCommandBuffer(batch.commandBuffer, 0);
+  if (vkBeginCommandBuffer(batch.commandBuffer, &beginInfo) != VK_SUCCESS)
+    throw std::runtime_error("failed to begin streaming command buffer!");
+
+  std::vector<VkBufferMemoryBarrier> releases;
+  for (const auto& upload : batch.uploads) {
+    const bool dedicated = upload.dedicatedStaging.buffer != VK_NULL_HANDLE;
+    const VkBuffer source = dedicated ? upload.dedicatedStaging.buffer : ringBuffer.buffer;
+    const VkDeviceSize base = dedicated ? 0 : upload.ringOffset;
+
+    VkBufferCopy copy{};
+    copy.srcOffset = base;
+    copy.dstOffset = 0;
+    copy.size = upload.vertexBytes;
+    vkCmdCopyBuffer(batch.commandBuffer, source, upload.vertices.buffer, 1, &copy);
+    copy.srcOffset = base + alignUp(upload.vertexBytes, stagingAlignment);
+    copy.size = upload.indexBytes;
+    vkCmdCopyBuffer(batch.commandBuffer, source, upload.indices.buffer, 1, &copy);
+
+    // The graphics queue acquires them in update() once this has finished
+    if (devManager.hasDedicatedTransferQueue()) {
+      for (const VkBuffer buffer : {upload.vertices.buffer, upload.indices.buffer})
+        releases.push_back(ownershipBarrier(
+            buffer, devManager.getTransferFamily(), devManager.getGraphicsFamily(), VK_ACCESS_TRANSFER_WRITE_BIT, 0));
+    }
+  }
+  if (!releases.empty())
+    vkCmdPipelineBarrier(
+        batch.commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0,
+        0, nullptr,
+        static_cast<uint32_t>(releases.size()), releases.data(),
+        0, nullptr);
+
+  if (vkEndCommandBuffer(batch.commandBuffer) != VK_SUCCESS)
+    throw std::runtime_error("failed to record streaming command buffer!");
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &batch.commandBuffer;
+  vkResetFences(device, 1, &batch.fence);
+  if (vkQueueSubmit(devManager.getTransferQueue(), 1, &submitInfo, batch.fence) != VK_SUCCESS)
+    throw std::runtime_error("failed to submit streaming copies!");
+}
+
+void AssetStreamer::retire(Batch& batch, const VkCommandBuffer commandBuffer) {
+  // The fence was seen signalled before this command buffer is submitted, so
+  // the release has happened before the acquire
+  std::vector<VkBufferMemoryBarrier> acquires;
+  const VkAccessFlags readAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+  if (devManager.hasDedicatedTransferQueue()) {
+    for (const auto& upload : batch.uploads)
+      for (const VkBuffer buffer : {upload.vertices.buffer, upload.indices.buffer})
+        acquires.push_back(ownershipBarrier(
+            buffer, devManager.getTransferFamily(), devManager.getGraphicsFamily(), 0, readAccess));
+
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+        0,
+        0, nullptr,
+        static_cast<uint32_t>(acquires.size()), acquires.data(),
+        0, nullptr);
+  } else {
+    // Same queue, the copies are earlier in submission order
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = readAccess;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+        0,
+        1, &barrier,
+        0, nullptr,
+        0, nullptr);
+  }
+
+  for (auto& upload : batch.uploads) {
+    Slot& slot = *upload.slot;
+    slot.model.emplace(
+        device,
+        upload.vertices.buffer,
+        upload.vertices.memory,
+        upload.indices.buffer,
+        upload.indices.memory,
+        slot.prepared.indexCount,
+        slot.prepared.indexType);
+    applyPreparedMesh(devManager, *slot.model, slot.prepared, options.clusterCulling);
+    slot.prepared = {};
+    destroyUpload(upload);
+
+    const auto elapsed = std::chrono::steady_clock::now() - slot.requested;
+    std::cout << "streamed " << slot.name << " in "
+              << std::chrono::duration<double, std::milli>(elapsed).count() << "ms" << std::endl;
+    slot.state.store(State::ready, std::memory_order_release);
+  }
+  batch.uploads.clear();
+}
+
+void AssetStreamer::destroyUpload(Upload& upload) {
+  if (upload.ringOffset != RingAllocator::invalid) {
+    std::lock_guard<std::mutex> lock(ringMutex);
+    ring.free(upload.ringOffset);
+    upload.ringOffset = RingAllocator::invalid;
+  }
+  destroyBuffer(upload.dedicatedStaging);
+}
+
+void AssetStreamer::destroyBuffer(Buffer& buffer) {
+  if (buffer.buffer != VK_NULL_HANDLE)
+    vkDestroyBuffer(device, buffer.buffer, allocationCallbacks());
+  if (buffer.memory != VK_NULL_HANDLE)
+    vkFreeMemory(device, buffer.memory, allocationCallbacks());
+  buffer = {};
+}
+
+}
@@ -0,0 +1,986 @@
+#include "block_compression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace BlockCompression {
+namespace {
+// 4x4 block of RGBA8, row major
+using Block = uint8_t[16][4];
+
+// BC7 partitions, subset of each texel for the 2 and 3 subset modes
+constexpr uint8_t partitions2[64][16] = {
+    {0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1}, {0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1},
+    {0, 1, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1}, {0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 1, 1, 1},
+    {0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 1, 1}, {0, 0, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1},
+    {0, 0, 0, 1, 0, 0, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1}, {0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 0, 1, 1, 1},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1}, {0, 0, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1},
+    {0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 1, 1, 1, 1, 1, 1}, {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 1, 1},
+    {0, 0, 0, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1}, {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1},
+    {0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1}, {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1},
+    {0, 0, 0, 0, 1, 0, 0, 0, 1, 1, 1, 0, 1, 1, 1, 1}, {0, 1, 1, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 1, 1, 0}, {0, 1, 1, 1, 0, 0, 1, 1, 0, 0, 0, 1, 0, 0, 0, 0},
+    {0, 0, 1, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 1, 0, 0, 0, 1, 1, 0, 0, 1, 1, 1, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 1, 0, 0}, {0, 1, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 0, 1},
+    {0, 0, 1, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0}, {0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 1, 0, 0},
+    {0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0}, {0, 0, 1, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0, 0},
+    {0, 0, 0, 1, 0, 1, 1, 1, 1, 1, 1, 0, 1, 0, 0, 0}, {0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0},
+    {0, 1, 1, 1, 0, 0, 0, 1, 1, 0, 0, 0, 1, 1, 1, 0}, {0, 0, 1, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 1, 0, 0},
+    {0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1}, {0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1},
+    {0, 1, 0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0}, {0, 0, 1, 1, 0, 0, 1, 1, 1, 1, 0, 0, 1, 1, 0, 0},
+    {0, 0, 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0}, {0, 1, 0, 1, 0, 1, 0, 1, 1, 0, 1, 0, 1, 0, 1, 0},
+    {0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1}, {0, 1, 0, 1, 1, 0, 1, 0, 1, 0, 1, 0, 0, 1, 0, 1},
+    {0, 1, 1, 1, 0, 0, 1, 1, 1, 1, 0, 0, 1, 1, 1, 0}, {0, 0, 0, 1, 0, 0, 1, 1, 1, 1, 0, 0, 1, 0, 0, 0},
+    {0, 0, 1, 1, 0, 0, 1, 0, 0, 1, 0, 0, 1, 1, 0, 0}, {0, 0, 1, 1, 1, 0, 1, 1, 1, 1, 0, 1, 1, 1, 0, 0},
+    {0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0}, {0, 0, 1, 1, 1, 1, 0, 0, 1, 1, 0, 0, 0, 0, 1, 1},
+    {0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1}, {0, 0, 0, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 0, 0, 0},
+    {0, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0}, {0, 0, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0}, {0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0, 0},
+    {0, 1, 1, 0, 1, 1, 0, 0, 1, 0, 0, 1, 0, 0, 1, 1}, {0, 0, 1, 1, 0, 1, 1, 0, 1, 1, 0, 0, 1, 0, 0, 1},
+    {0, 1, 1, 0, 0, 0, 1, 1, 1, 0, 0, 1, 1, 1, 0, 0}, {0, 0, 1, 1, 1, 0, 0, 1, 1, 1, 0, 0, 0, 1, 1, 0},
+    {0, 1, 1, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 0, 0, 1}, {0, 1, 1, 0, 0, 0, 1, 1, 0, 0, 1, 1, 1, 0, 0, 1},
+    {0, 1, 1, 1, 1, 1, 1, 0, 1, 0, 0, 0, 0, 0, 0, 1}, {0, 0, 0, 1, 1, 0, 0, 0, 1, 1, 1, 0, 0, 1, 1, 1},
+    {0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1}, {0, 0, 1, 1, 0, 0, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0},
+    {0, 0, 1, 0, 0, 0, 1, 0, 1, 1, 1, 0, 1, 1, 1, 0}, {0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 1, 1, 0, 1, 1, 1},
+};
+
+constexpr uint8_t partitions3[64][16] = {
+    {0, 0, 1, 1, 0, 0, 1, 1, 0, 2, 2, 1, 2, 2, 2, 2}, {0, 0, 0, 1, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2, 2, 1},
+    {0, 0, 0, 0, 2, 0, 0, 1, 2, 2, 1, 1, 2, 2, 1, 1}, {0, 2, 2, 2, 0, 0, 2, 2, 0, 0, 1, 1, 0, 1, 1, 1},
+    {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2}, {0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 2, 2, 0, 0, 2, 2},
+    {0, 0, 2, 2, 0, 0, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1}, {0, 0, 1, 1, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2, 1, 1},
+    {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2}, {0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2},
+    {0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2}, {0, 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2},
+    {0, 1, 1, 2, 0, 1, 1, 2, 0, 1, 1, 2, 0, 1, 1, 2}, {0, 1, 2, 2, 0, 1, 2, 2, 0, 1, 2, 2, 0, 1, 2, 2},
+    {0, 0, 1, 1, 0, 1, 1, 2, 1, 1, 2, 2, 1, 2, 2, 2}, {0, 0, 1, 1, 2, 0, 0, 1, 2, 2, 0, 0, 2, 2, 2, 0},
+    {0, 0, 0, 1, 0, 0, 1, 1, 0, 1, 1, 2, 1, 1, 2, 2}, {0, 1, 1, 1, 0, 0, 1, 1, 2, 0, 0, 1, 2, 2, 0, 0},
+    {0, 0, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2, 1, 1, 2, 2}, {0, 0, 2, 2, 0, 0, 2, 2, 0, 0, 2, 2, 1, 1, 1, 1},
+    {0, 1, 1, 1, 0, 1, 1, 1, 0, 2, 2, 2, 0, 2, 2, 2}, {0, 0, 0, 1, 0, 0, 0, 1, 2, 2, 2, 1, 2, 2, 2, 1},
+    {0, 0, 0, 0, 0, 0, 1, 1, 0, 1, 2, 2, 0, 1, 2, 2}, {0, 0, 0, 0, 1, 1, 0, 0, 2, 2, 1, 0, 2, 2, 1, 0},
+    {0, 1, 2, 2, 0, 1, 2, 2, 0, 0, 1, 1, 0, 0, 0, 0}, {0, 0, 1, 2, 0, 0, 1, 2, 1, 1, 2, 2, 2, 2, 2, 2},
+    {0, 1, 1, 0, 1, 2, 2, 1, 1, 2, 2, 1, 0, 1, 1, 0}, {0, 0, 0, 0, 0, 1, 1, 0, 1, 2, 2, 1, 1, 2, 2, 1},
+    {0, 0, 2, 2, 1, 1, 0, 2, 1, 1, 0, 2, 0, 0, 2, 2}, {0, 1, 1, 0, 0, 1, 1, 0, 2, 0, 0, 2, 2, 2, 2, 2},
+    {0, 0, 1, 1, 0, 1, 2, 2, 0, 1, 2, 2, 0, 0, 1, 1}, {0, 0, 0, 0, 2, 0, 0, 0, 2, 2, 1, 1, 2, 2, 2, 1},
+    {0, 0, 0, 0, 0, 0, 0, 2, 1, 1, 2, 2, 1, 2, 2, 2}, {0, 2, 2, 2, 0, 0, 2, 2, 0, 0, 1, 2, 0, 0, 1, 1},
+    {0, 0, 1, 1, 0, 0, 1, 2, 0, 0, 2, 2, 0, 2, 2, 2}, {0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2, 0},
+    {0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 0, 0, 0, 0}, {0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0},
+    {0, 1, 2, 0, 2, 0, 1, 2, 1, 2, 0, 1, 0, 1, 2, 0}, {0, 0, 1, 1, 2, 2, 0, 0, 1, 1, 2, 2, 0, 0, 1, 1},
+    {0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 0, 0, 0, 0, 1, 1}, {0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2},
+    {0, 0, 0, 0, 0, 0, 0, 0, 2, 1, 2, 1, 2, 1, 2, 1}, {0, 0, 2, 2, 1, 1, 2, 2, 0, 0, 2, 2, 1, 1, 2, 2},
+    {0, 0, 2, 2, 0, 0, 1, 1, 0, 0, 2, 2, 0, 0, 1, 1}, {0, 2, 2, 0, 1, 2, 2, 1, 0, 2, 2, 0, 1, 2, 2, 1},
+    {0, 1, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2, 0, 1, 0, 1}, {0, 0, 0, 0, 2, 1, 2, 1, 2, 1, 2, 1, 2, 1, 2, 1},
+    {0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2}, {0, 2, 2, 2, 0, 1, 1, 1, 0, 2, 2, 2, 0, 1, 1, 1},
+    {0, 0, 0, 2, 1, 1, 1, 2, 0, 0, 0, 2, 1, 1, 1, 2}, {0, 0, 0, 0, 2, 1, 1, 2, 2, 1, 1, 2, 2, 1, 1, 2},
+    {0, 2, 2, 2, 0, 1, 1, 1, 0, 1, 1, 1, 0, 2, 2, 2}, {0, 0, 0, 2, 1, 1, 1, 2, 1, 1, 1, 2, 0, 0, 0, 2},
+    {0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 2, 2, 2, 2}, {0, 0, 0, 0, 0, 0, 0, 0, 2, 1, 1, 2, 2, 1, 1, 2},
+    {0, 1, 1, 0, 0, 1, 1, 0, 2, 2, 2, 2, 2, 2, 2, 2}, {0, 0, 2, 2, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 2, 2},
+    {0, 0, 2, 2, 1, 1, 2, 2, 1, 1, 2, 2, 0, 0, 2, 2}, {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 1, 1, 2},
+    {0, 0, 0, 2, 0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 1}, {0, 2, 2, 2, 1, 2, 2, 2, 0, 2, 2, 2, 1, 2, 2, 2},
+    {0, 1, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2}, {0, 1, 1, 1, 2, 0, 1, 1, 2, 2, 0, 1, 2, 2, 2, 0},
+};
+
+// Texels whose index drops its top bit, besides texel 0 for subset 0
+constexpr uint8_t anchors2[64] = {
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 2,  8,  2,  2,  8,  8,  15, 2,  8,  2,  2,  8,  8,  2,  2,
+    15, 15, 6,  8,  2,  8,  15, 15, 2,  8,  2,  2,  2,  15, 15, 6,  6,  2,  6,  8,  15, 15, 2,  2,  15, 15, 15, 15, 15, 2,  2,  15,
+};
+constexpr uint8_t anchors3Second[64] = {
+    3,  3,  15, 15, 8,  3,  15, 15, 8,  8,  6,  6,  6,  5,  3,  3,  3,  3,  8,  15, 3,  3,  6,  10, 5,  8,  8,  6,  8,  5,  15, 15,
+    8,  15, 3,  5,  6,  10, 8,  15, 15, 3,  15, 5,  15, 15, 15, 15, 3,  15, 5,  5,  5,  8,  5,  10, 5,  10, 8,  13, 15, 12, 3,  3,
+};
+constexpr uint8_t anchors3Third[64] = {
+    15, 8,  8,  3,  15, 15, 3,  8,  15, 15, 15, 15, 15, 15, 15, 8,  15, 8,  15, 3,  15, 8,  15, 8,  3,  15, 6,  10, 15, 15, 10, 8,
+    15, 3,  15, 10, 10, 8,  9,  10, 6,  15, 8,  15, 3,  6,  6,  8,  15, 3,  15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 3,  15, 15, 8,
+};
+
+constexpr uint8_t weights2[4] = {0, 21, 43, 64};
+constexpr uint8_t weights3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+constexpr uint8_t weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+struct Bc7Mode {
+  uint8_t subsets;
+  uint8_t partitionBits;
+  uint8_t rotationBits;
+  uint8_t indexSelectionBits;
+  uint8_t colorBits;
+  uint8_t alphaBits;
+  uint8_t endpointPBits;
+  uint8_t sharedPBits;
+  uint8_t indexBits;
+  uint8_t secondaryIndexBits;
+};
+
+constexpr Bc7Mode bc7Modes[8] = {
+    {3, 4, 0, 0, 4, 0, 1, 0, 3, 0},
+    {2, 6, 0, 0, 6, 0, 0, 1, 3, 0},
+    {3, 6, 0, 0, 5, 0, 0, 0, 2, 0},
+    {2, 6, 0, 0, 7, 0, 1, 0, 2, 0},
+    {1, 0, 2, 1, 5, 6, 0, 0, 2, 3},
+    {1, 0, 2, 0, 7, 8, 0, 0, 2, 2},
+    {1, 0, 0, 0, 7, 7, 1, 0, 4, 0},
+    {2, 6, 0, 0, 5, 5, 1, 0, 2, 0},
+};
+
+constexpr int etcModifiers[8][4] = {
+    {2, 8, -2, -8},
+    {5, 17, -5, -17},
+    {9, 29, -9, -29},
+    {13, 42, -13, -42},
+    {18, 60, -18, -60},
+    {24, 80, -24, -80},
+    {33, 106, -33, -106},
+    {47, 183, -47, -183},
+};
+
+// T and H modes
+constexpr int etcDistances[8] = {3, 6, 11, 16, 23, 32, 41, 64};
+
+constexpr int eacModifiers[16][8] = {
+    {-3, -6, -9, -15, 2, 5, 8, 14},
+    {-3, -7, -10, -13, 2, 6, 9, 12},
+    {-2, -5, -8, -13, 1, 4, 7, 12},
+    {-2, -4, -6, -13, 1, 3, 5, 12},
+    {-3, -6, -8, -12, 2, 5, 7, 11},
+    {-3, -7, -9, -11, 2, 6, 8, 10},
+    {-4, -7, -8, -11, 3, 6, 7, 10},
+    {-3, -5, -8, -11, 2, 4, 7, 10},
+    {-2, -6, -8, -10, 1, 5, 7, 9},
+    {-2, -5, -8, -10, 1, 4, 7, 9},
+    {-2, -4, -8, -10, 1, 3, 7, 9},
+    {-2, -5, -7, -10, 1, 4, 6, 9},
+    {-3, -4, -7, -10, 2, 3, 6, 9},
+    {-1, -2, -3, -10, 0, 1, 2, 9},
+    {-4, -6, -8, -9, 3, 5, 7, 8},
+    {-3, -5, -7, -9, 2, 4, 6, 8},
+};
+
+uint8_t clampByte(const int value) { return static_cast<uint8_t>(std::min(std::max(value, 0), 255)); }
+
+uint16_t read16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+
+uint64_t read64(const uint8_t* p) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; --i)
+    value = (value << 8) | p[i];
+  return value;
+}
+
+void write64(uint8_t* p, uint64_t value) {
+  for (int i = 0; i < 8; ++i, value >>= 8)
+    p[i] = static_cast<uint8_t>(value);
+}
+
+void loadBlock(const uint8_t* rgba, const uint32_t width, const uint32_t height, const uint32_t bx, const uint32_t by, Block& block) {
+  for (uint32_t y = 0; y < 4; ++y) {
+    const uint32_t sy = std::min(by * 4 + y, height - 1);
+    for (uint32_t x = 0; x < 4; ++x) {
+      const uint32_t sx = std::min(bx * 4 + x, width - 1);
+      std::memcpy(block[y * 4 + x], rgba + (size_t(sy) * width + sx) * 4, 4);
+    }
+  }
+}
+
+void storeBlock(const Block& block, const uint32_t width, const uint32_t height, const uint32_t bx, const uint32_t by, uint8_t* rgba) {
+  const uint32_t w = std::min(4u, width - bx * 4);
+  const uint32_t h = std::min(4u, height - by * 4);
+  for (uint32_t y = 0; y < h; ++y)
+    std::memcpy(rgba + (size_t(by * 4 + y) * width + bx * 4) * 4, block[y * 4], w * 4);
+}
+
+// BC1 colour endpoints
+
+void unpack565(const uint16_t value, int color[3]) {
+  const int r = (value >> 11) & 31;
+  const int g = (value >> 5) & 63;
+  const int b = value & 31;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+}
+
+uint16_t pack565(const float color[3]) {
+  const auto quantize = [](const float value, const int max) {
+    return static_cast<int>(std::lround(std::min(std::max(value, 0.0f), 255.0f) * max / 255.0f));
+  };
+  return static_cast<uint16_t>((quantize(color[0], 31) << 11) | (quantize(color[1], 63) << 5) | quantize(color[2], 31));
+}
+
+// Both encoder and decoder build the palette here, so what the encoder
+// measures is what comes out
+void colorPalette(const uint16_t c0, const uint16_t c1, const bool fourColors, int palette[4][3]) {
+  unpack565(c0, palette[0]);
+  unpack565(c1, palette[1]);
+  for (int c = 0; c < 3; ++c) {
+    if (fourColors) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+    } else {
+      palette[2][c] = (palette[0][c] + palette[1][c] + 1) / 2;
+      palette[3][c] = 0;
+    }
+  }
+}
+
+// Always four colour mode, c0 > c1 (c0 == c1 decodes the same either way).
+// Returns the squared error, indices packed 2 bits per texel.
+uint32_t fitIndices(const Block& block, uint16_t c0, uint16_t c1, uint32_t& indices) {
+  int palette[4][3];
+  colorPalette(c0, c1, true, palette);
+  uint32_t error = 0;
+  indices = 0;
+  for (int i = 0; i < 16; ++i) {
+    uint32_t best = UINT32_MAX;
+    uint32_t bestIndex = 0;
+    for (uint32_t p = 0; p < 4; ++p) {
+      uint32_t distance = 0;
+      for (int c = 0; c < 3; ++c) {
+        const int delta = block[i][c] - palette[p][c];
+        distance += delta * delta;
+      }
+      if (distance < best) {
+        best = distance;
+        bestIndex = p;
+      }
+    }
+    indices |= bestIndex << (2 * i);
+    error += best;
+  }
+  return error;
+}
+
+void writeColorBlock(const uint16_t c0, const uint16_t c1, const uint32_t indices, uint8_t* out) {
+  out[0] = static_cast<uint8_t>(c0);
+  out[1] = static_cast<uint8_t>(c0 >> 8);
+  out[2] = static_cast<uint8_t>(c1);
+  out[3] = static_cast<uint8_t>(c1 >> 8);
+  for (int i = 0; i < 4; ++i)
+    out[4 + i] = static_cast<uint8_t>(indices >> (8 * i));
+}
+
+// A single colour rarely survives 565 as an endpoint, but usually does as
+// the 2/3 point between two neighbouring ones
+void encodeSolidColorBlock(const uint8_t color[3], uint8_t* out) {
+  int endpoints[2][3];
+  for (int c = 0; c < 3; ++c) {
+    const int bits = c == 1 ? 6 : 5;
+    const auto expand = [&](const int value) { return bits == 6 ? (value << 2) | (value >> 4) : (value << 3) | (value >> 2); };
+    int best = INT32_MAX;
+    for (int a = 0; a < (1 << bits); ++a)
+      for (int b = 0; b < (1 << bits); ++b) {
+        const int error = std::abs((2 * expand(a) + expand(b) + 1) / 3 - color[c]);
+        if (error < best) {
+          best = error;
+          endpoints[0][c] = a;
+          endpoints[1][c] = b;
+        }
+      }
+  }
+  uint16_t c0 = static_cast<uint16_t>((endpoints[0][0] << 11) | (endpoints[0][1] << 5) | endpoints[0][2]);
+  uint16_t c1 = static_cast<uint16_t>((endpoints[1][0] << 11) | (endpoints[1][1] << 5) | endpoints[1][2]);
+  // Swapped the 2/3 point is index 3
+  uint32_t index = 2;
+  if (c0 < c1) {
+    std::swap(c0, c1);
+    index = 3;
+  } else if (c0 == c1) {
+    index = 0;
+  }
+  uint32_t indices = 0;
+  for (int i = 0; i < 16; ++i)
+    indices |= index << (2 * i);
+  writeColorBlock(c0, c1, indices, out);
+}
+
+void encodeColorBlock(const Block& block, uint8_t* out) {
+  bool solid = true;
+  for (int i = 1; i < 16 && solid; ++i)
+    solid = std::memcmp(block[i], block[0], 3) == 0;
+  if (solid) {
+    encodeSolidColorBlock(block[0], out);
+    return;
+  }
+
+  float mean[3] = {};
+  for (int i = 0; i < 16; ++i)
+    for (int c = 0; c < 3; ++c)
+      mean[c] += block[i][c] / 16.0f;
+
+  float covariance[3][3] = {};
+  for (int i = 0; i < 16; ++i) {
+    float d[3];
+    for (int c = 0; c < 3; ++c)
+      d[c] = block[i][c] - mean[c];
+    for (int a = 0; a < 3; ++a)
+      for (int b = 0; b < 3; ++b)
+        covariance[a][b] += d[a] * d[b];
+  }
+
+  // Principal axis by power iteration, starting from the widest channel
+  int widest = 0;
+  for (int c = 1; c < 3; ++c)
+    if (covariance[c][c] > covariance[widest][widest])
+      widest = c;
+  float axis[3] = {covariance[widest][0], covariance[widest][1], covariance[widest][2]};
+  for (int iteration = 0; iteration < 8; ++iteration) {
+    float next[3];
+    for (int a = 0; a < 3; ++a)
+      next[a] = covariance[a][0] * axis[0] + covariance[a][1] * axis[1] + covariance[a][2] * axis[2];
+    const float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+    if (length < 1e-6f)
+      break;
+    for (int a = 0; a < 3; ++a)
+      axis[a] = next[a] / length;
+  }
+  const float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+  if (axisLength < 1e-6f) {
+    // Flat block
+    axis[0] = axis[1] = axis[2] = 0.0f;
+  } else {
+    for (float& a : axis)
+      a /= axisLength;
+  }
+
+  float minT = 0.0f;
+  float maxT = 0.0f;
+  for (int i = 0; i < 16; ++i) {
+    float t = 0.0f;
+    for (int c = 0; c < 3; ++c)
+      t += (block[i][c] - mean[c]) * axis[c];
+    minT = std::min(minT, t);
+    maxT = std::max(maxT, t);
+  }
+  // Pull the ends in a little, the extremes rarely deserve a palette entry
+  // all to themselves
+  const float inset = (maxT - minT) / 16.0f;
+  minT += inset;
+  maxT -= inset;
+
+  float high[3];
+  float low[3];
+  for (int c = 0; c < 3; ++c) {
+    high[c] = mean[c] + axis[c] * maxT;
+    low[c] = mean[c] + axis[c] * minT;
+  }
+  uint16_t c0 = pack565(high);
+  uint16_t c1 = pack565(low);
+  if (c0 < c1)
+    std::swap(c0, c1);
+  uint32_t indices;
+  uint32_t error = fitIndices(block, c0, c1, indices);
+
+  // One least squares refit of the endpoints to the chosen indices
+  if (c0 != c1) {
+    constexpr float weight0[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ap[3] = {}, bp[3] = {};
+    for (int i = 0; i < 16; ++i) {
+      const float a = weight0[(indices >> (2 * i)) & 3];
+      const float b = 1.0f - a;
+      aa += a * a;
+      ab += a * b;
+      bb += b * b;
+      for (int c = 0; c < 3; ++c) {
+        ap[c] += a * block[i][c];
+        bp[c] += b * block[i][c];
+      }
+    }
+    const float determinant = aa * bb - ab * ab;
+    if (std::fabs(determinant) > 1e-6f) {
+      float fit0[3], fit1[3];
+      for (int c = 0; c < 3; ++c) {
+        fit0[c] = (ap[c] * bb - bp[c] * ab) / determinant;
+        fit1[c] = (bp[c] * aa - ap[c] * ab) / determinant;
+      }
+      uint16_t r0 = pack565(fit0);
+      uint16_t r1 = pack565(fit1);
+      if (r0 < r1)
+        std::swap(r0, r1);
+      uint32_t refitIndices;
+      const uint32_t refitError = fitIndices(block, r0, r1, refitIndices);
+      if (refitError < error) {
+        c0 = r0;
+        c1 = r1;
+        indices = refitIndices;
+        error = refitError;
+      }
+    }
+  }
+  if (c0 == c1)
+    indices = 0;
+  writeColorBlock(c0, c1, indices, out);
+}
+
+void decodeColorBlock(const uint8_t* in, const bool alwaysFourColors, const bool punchThrough, Block& block) {
+  const uint16_t c0 = read16(in);
+  const uint16_t c1 = read16(in + 2);
+  const bool fourColors = alwaysFourColors || c0 > c1;
+  int palette[4][3];
+  colorPalette(c0, c1, fourColors, palette);
+  const uint32_t indices = in[4] | (in[5] << 8) | (in[6] << 16) | (uint32_t(in[7]) << 24);
+  for (int i = 0; i < 16; ++i) {
+    const uint32_t index = (indices >> (2 * i)) & 3;
+    for (int c = 0; c < 3; ++c)
+      block[i][c] = static_cast<uint8_t>(palette[index][c]);
+    block[i][3] = (!fourColors && index == 3 && punchThrough) ? 0 : 255;
+  }
+}
+
+// BC4 style single channel blocks, also BC3's alpha and BC5's two channels
+
+void channelPalette(const uint8_t a0, const uint8_t a1, int palette[8]) {
+  palette[0] = a0;
+  palette[1] = a1;
+  if (a0 > a1) {
+    for (int i = 2; i < 8; ++i)
+      palette[i] = ((8 - i) * a0 + (i - 1) * a1 + 3) / 7;
+  } else {
+    for (int i = 2; i < 6; ++i)
+      palette[i] = ((6 - i) * a0 + (i - 1) * a1 + 2) / 5;
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+void encodeChannelBlock(const Block& block, const int channel, uint8_t* out) {
+  uint8_t low = 255;
+  uint8_t high = 0;
+  for (int i = 0; i < 16; ++i) {
+    low = std::min(low, block[i][channel]);
+    high = std::max(high, block[i][channel]);
+  }
+  // high > low for the eight value palette, equal just repeats index 0
+  int palette[8];
+  channelPalette(high, low, palette);
+  uint64_t bits = uint64_t(high) | (uint64_t(low) << 8);
+  if (high != low) {
+    for (int i = 0; i < 16; ++i) {
+      int best = 256;
+      uint64_t bestIndex = 0;
+      for (uint64_t p = 0; p < 8; ++p) {
+        const int distance = std::abs(block[i][channel] - palette[p]);
+        if (distance < best) {
+          best = distance;
+          bestIndex = p;
+        }
+      }
+      bits |= bestIndex << (16 + 3 * i);
+    }
+  }
+  write64(out, bits);
+}
+
+void decodeChannelBlock(const uint8_t* in, const int channel, Block& block) {
+  int palette[8];
+  channelPalette(in[0], in[1], palette);
+  const uint64_t bits = read64(in) >> 16;
+  for (int i = 0; i < 16; ++i)
+    block[i][channel] = static_cast<uint8_t>(palette[(bits >> (3 * i)) & 7]);
+}
+
+// BC7
+
+class BitReader {
+ public:
+  explicit BitReader(const uint8_t* _data) : data(_data) {}
+
+  uint32_t read(const uint32_t count) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < count; ++i, ++position)
+      value |= uint32_t((data[position >> 3] >> (position & 7)) & 1) << i;
+    return value;
+  }
+
+ private:
+  const uint8_t* data;
+  uint32_t position = 0;
+};
+
+int expandBits(const uint32_t value, const uint32_t bits) {
+  const uint32_t shifted = value << (8 - bits);
+  return static_cast<int>(shifted | (shifted >> bits));
+}
+
+int interpolate(const int e0, const int e1, const uint32_t index, const uint32_t bits) {
+  const uint8_t* weights = bits == 2 ? weights2 : bits == 3 ? weights3 : weights4;
+  return ((64 - weights[index]) * e0 + weights[index] * e1 + 32) >> 6;
+}
+
+void decodeBc7Block(const uint8_t* in, Block& block) {
+  uint32_t mode = 0;
+  while (mode < 8 && !((in[0] >> mode) & 1))
+    ++mode;
+  if (mode == 8) {
+    // Reserved, transparent black
+    std::memset(block, 0, sizeof(Block));
+    return;
+  }
+  const Bc7Mode& info = bc7Modes[mode];
+  BitReader reader(in);
+  reader.read(mode + 1);
+
+  const uint32_t partition = reader.read(info.partitionBits);
+  const uint32_t rotation = reader.read(info.rotationBits);
+  const uint32_t indexSelection = reader.read(info.indexSelectionBits);
+
+  const uint32_t endpointCount = info.subsets * 2u;
+  int endpoints[6][4];
+  for (int c = 0; c < 3; ++c)
+    for (uint32_t e = 0; e < endpointCount; ++e)
+      endpoints[e][c] = static_cast<int>(reader.read(info.colorBits));
+  for (uint32_t e = 0; e < endpointCount; ++e)
+    endpoints[e][3] = static_cast<int>(reader.read(info.alphaBits));
+
+  uint32_t pBits[6] = {};
+  if (info.endpointPBits) {
+    for (uint32_t e = 0; e < endpointCount; ++e)
+      pBits[e] = reader.read(1);
+  } else if (info.sharedPBits) {
+    for (uint32_t s = 0; s < info.subsets; ++s)
+      pBits[2 * s] = pBits[2 * s + 1] = reader.read(1);
+  }
+  const uint32_t extra = info.endpointPBits || info.sharedPBits ? 1 : 0;
+  for (uint32_t e = 0; e < endpointCount; ++e) {
+    for (int c = 0; c < 3; ++c)
+      endpoints[e][c] = expandBits((uint32_t(endpoints[e][c]) << extra) | (extra ? pBits[e] : 0), info.colorBits + extra);
+    endpoints[e][3] = info.alphaBits
+        ? expandBits((uint32_t(endpoints[e][3]) << extra) | (extra ? pBits[e] : 0), info.alphaBits + extra)
+        : 255;
+  }
+
+  const auto subsetOf = [&](const int texel) -> uint32_t {
+    if (info.subsets == 1)
+      return 0;
+    return info.subsets == 2 ? partitions2[partition][texel] : partitions3[partition][texel];
+  };
+  const auto isAnchor = [&](const int texel) {
+    if (texel == 0)
+      return true;
+    if (info.subsets == 2)
+      return texel == anchors2[partition];
+    if (info.subsets == 3)
+      return texel == anchors3Second[partition] || texel == anchors3Third[partition];
+    return false;
+  };
+
+  uint32_t indices[16];
+  for (int i = 0; i < 16; ++i)
+    indices[i] = reader.read(info.indexBits - (isAnchor(i) ? 1 : 0));
+  uint32_t secondary[16] = {};
+  if (info.secondaryIndexBits)
+    for (int i = 0; i < 16; ++i)
+      secondary[i] = reader.read(info.secondaryIndexBits - (i == 0 ? 1 : 0));
+
+  for (int i = 0; i < 16; ++i) {
+    const int* e0 = endpoints[2 * subsetOf(i)];
+    const int* e1 = endpoints[2 * subsetOf(i) + 1];
+    uint32_t colorIndex = indices[i];
+    uint32_t colorBits = info.indexBits;
+    uint32_t alphaIndex = indices[i];
+    uint32_t alphaBits = info.indexBits;
+    if (info.secondaryIndexBits) {
+      if (indexSelection) {
+        colorIndex = secondary[i];
+        colorBits = info.secondaryIndexBits;
+      } else {
+        alphaIndex = secondary[i];
+        alphaBits = info.secondaryIndexBits;
+      }
+    }
+    int texel[4];
+    for (int c = 0; c < 3; ++c)
+      texel[c] = interpolate(e0[c], e1[c], colorIndex, colorBits);
+    texel[3] = interpolate(e0[3], e1[3], alphaIndex, alphaBits);
+    if (rotation)
+      std::swap(texel[3], texel[rotation - 1]);
+    for (int c = 0; c < 4; ++c)
+      block[i][c] = static_cast<uint8_t>(texel[c]);
+  }
+}
+
+// ETC2 / EAC. Texels are numbered column major there, x * 4 + y.
+
+int extend4(const int value) { return value * 17; }
+int extend5(const int value) { return (value << 3) | (value >> 2); }
+int extend6(const int value) { return (value << 2) | (value >> 4); }
+int extend7(const int value) { return (value << 1) | (value >> 6); }
+
+void decodeEtc2Block(const uint8_t* in, const bool punchThrough, Block& block) {
+  const uint32_t indexBits = (uint32_t(in[4]) << 24) | (in[5] << 16) | (in[6] << 8) | in[7];
+  const auto texelIndex = [&](const int x, const int y) {
+    const int i = x * 4 + y;
+    return ((indexBits >> (i + 16)) & 1) << 1 | ((indexBits >> i) & 1);
+  };
+  // Punch through alpha repurposes the individual/differential bit
+  const bool differential = punchThrough || (in[3] & 2);
+  const bool opaque = !punchThrough || (in[3] & 2);
+  const auto setTexel = [&](const int x, const int y, const int r, const int g, const int b, const bool transparent) {
+    uint8_t* texel = block[y * 4 + x];
+    if (transparent) {
+      texel[0] = texel[1] = texel[2] = texel[3] = 0;
+    } else {
+      texel[0] = clampByte(r);
+      texel[1] = clampByte(g);
+      texel[2] = clampByte(b);
+      texel[3] = 255;
+    }
+  };
+
+  int base[2][3];
+  if (differential) {
+    const auto signExtend3 = [](const int value) { return value >= 4 ? value - 8 : value; };
+    const int r = in[0] >> 3;
+    const int g = in[1] >> 3;
+    const int b = in[2] >> 3;
+    const int r2 = r + signExtend3(in[0] & 7);
+    const int g2 = g + signExtend3(in[1] & 7);
+    const int b2 = b + signExtend3(in[2] & 7);
+
+    if (r2 < 0 || r2 > 31) {
+      // T mode
+      const int c1[3] = {
+          extend4(((in[0] >> 1) & 0xC) | (in[0] & 3)), extend4(in[1] >> 4), extend4(in[1] & 15)};
+      const int c2[3] = {extend4(in[2] >> 4), extend4(in[2] & 15), extend4(in[3] >> 4)};
+      const int distance = etcDistances[((in[3] >> 1) & 6) | (in[3] & 1)];
+      int paint[4][3];
+      for (int c = 0; c < 3; ++c) {
+        paint[0][c] = c1[c];
+        paint[1][c] = c2[c] + distance;
+        paint[2][c] = c2[c];
+        paint[3][c] = c2[c] - distance;
+      }
+      for (int x = 0; x < 4; ++x)
+        for (int y = 0; y < 4; ++y) {
+          const uint32_t index = texelIndex(x, y);
+          setTexel(x, y, paint[index][0], paint[index][1], paint[index][2], !opaque && index == 2);
+        }
+      return;
+    }
+    if (g2 < 0 || g2 > 31) {
+      // H mode
+      const int r1 = (in[0] >> 3) & 15;
+      const int g1 = ((in[0] & 7) << 1) | ((in[1] >> 4) & 1);
+      const int b1 = (in[1] & 8) | ((in[1] & 3) << 1) | (in[2] >> 7);
+      const int rr2 = (in[2] >> 3) & 15;
+      const int gg2 = ((in[2] & 7) << 1) | (in[3] >> 7);
+      const int bb2 = (in[3] >> 3) & 15;
+      const int first = (r1 << 8) | (g1 << 4) | b1;
+      const int second = (rr2 << 8) | (gg2 << 4) | bb2;
+      const int distance = etcDistances[(in[3] & 4) | ((in[3] & 1) << 1) | (first >= second ? 1 : 0)];
+      const int c1[3] = {extend4(r1), extend4(g1), extend4(b1)};
+      const int c2[3] = {extend4(rr2), extend4(gg2), extend4(bb2)};
+      int paint[4][3];
+      for (int c = 0; c < 3; ++c) {
+        paint[0][c] = c1[c] + distance;
+        paint[1][c] = c1[c] - distance;
+        paint[2][c] = c2[c] + distance;
+        paint[3][c] = c2[c] - distance;
+      }
+      for (int x = 0; x < 4; ++x)
+        for (int y = 0; y < 4; ++y) {
+          const uint32_t index = texelIndex(x, y);
+          setTexel(x, y, paint[index][0], paint[index][1], paint[index][2], !opaque && index == 2);
+        }
+      return;
+    }
+    if (b2 < 0 || b2 > 31) {
+      // Planar, always opaque
+      const int origin[3] = {
+          extend6((in[0] >> 1) & 63),
+          extend7(((in[0] & 1) << 6) | ((in[1] >> 1) & 63)),
+          extend6(((in[1] & 1) << 5) | (in[2] & 0x18) | ((in[2] & 3) << 1) | (in[3] >> 7))};
+      const int horizontal[3] = {
+          extend6((((in[3] >> 2) & 31) << 1) | (in[3] & 1)), extend7(in[4] >> 1), extend6(((in[4] & 1) << 5) | (in[5] >> 3))};
+      const int vertical[3] = {
+          extend6(((in[5] & 7) << 3) | (in[6] >> 5)), extend7(((in[6] & 31) << 2) | (in[7] >> 6)), extend6(in[7] & 63)};
+      for (int x = 0; x < 4; ++x)
+        for (int y = 0; y < 4; ++y) {
+          int color[3];
+          for (int c = 0; c < 3; ++c)
+            color[c] = (x * (horizontal[c] - origin[c]) + y * (vertical[c] - origin[c]) + 4 * origin[c] + 2) >> 2;
+          setTexel(x, y, color[0], color[1], color[2], false);
+        }
+      return;
+    }
+    base[0][0] = extend5(r);
+    base[0][1] = extend5(g);
+    base[0][2] = extend5(b);
+    base[1][0] = extend5(r2);
+    base[1][1] = extend5(g2);
+    base[1][2] = extend5(b2);
+  } else {
+    for (int c = 0; c < 3; ++c) {
+      base[0][c] = extend4(in[c] >> 4);
+      base[1][c] = extend4(in[c] & 15);
+    }
+  }
+
+  const bool flip = in[3] & 1;
+  const int tables[2] = {in[3] >> 5, (in[3] >> 2) & 7};
+  for (int x = 0; x < 4; ++x)
+    for (int y = 0; y < 4; ++y) {
+      const int subBlock = flip ? (y >= 2) : (x >= 2);
+      const uint32_t index = texelIndex(x, y);
+      // Without the opaque bit index 2 is transparent and index 0 unmodified
+      const int modifier = !opaque && (index & 1) == 0 ? 0 : etcModifiers[tables[subBlock]][index];
+      setTexel(
+          x,
+          y,
+          base[subBlock][0] + modifier,
+          base[subBlock][1] + modifier,
+          base[subBlock][2] + modifier,
+          !opaque && index == 2);
+    }
+}
+
+// elevenBit for R11/RG11, rescaled to 8 bits on the way out
+void decodeEacBlock(const uint8_t* in, const bool elevenBit, const int channel, Block& block) {
+  const int baseValue = in[0];
+  const int multiplier = in[1] >> 4;
+  const int* modifiers = eacModifiers[in[1] & 15];
+  uint64_t bits = 0;
+  for (int i = 2; i < 8; ++i)
+    bits = (bits << 8) | in[i];
+  for (int x = 0; x < 4; ++x)
+    for (int y = 0; y < 4; ++y) {
+      const int i = x * 4 + y;
+      const int modifier = modifiers[(bits >> (45 - 3 * i)) & 7];
+      int value;
+      if (elevenBit) {
+        const int scaled = multiplier ? modifier * multiplier * 8 : modifier;
+        value = std::min(std::max(baseValue * 8 + 4 + scaled, 0), 2047);
+        value = (value * 255 + 1023) / 2047;
+      } else {
+        value = baseValue + modifier * multiplier;
+      }
+      block[y * 4 + x][channel] = clampByte(value);
+    }
+}
+}
+
+FormatInfo formatInfo(const VkFormat format) {
+  FormatInfo info;
+  const auto blocks = [&](const uint32_t bytes, const bool srgb, const uint32_t width = 4, const uint32_t height = 4) {
+    info.blockWidth = width;
+    info.blockHeight = height;
+    info.blockBytes = bytes;
+    info.compressed = true;
+    info.srgb = srgb;
+  };
+  switch (format) {
+    case VK_FORMAT_R8_UNORM: info.blockBytes = 1; break;
+    case VK_FORMAT_R8G8_UNORM: info.blockBytes = 2; break;
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_UNORM: info.blockBytes = 4; break;
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+      info.blockBytes = 4;
+      info.srgb = true;
+      break;
+    case VK_FORMAT_R16G16B16A16_SFLOAT: info.blockBytes = 8; break;
+    case VK_FORMAT_R32G32B32A32_SFLOAT: info.blockBytes = 16; break;
+
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+    case VK_FORMAT_EAC_R11_UNORM_BLOCK:
+    case VK_FORMAT_EAC_R11_SNORM_BLOCK: blocks(8, false); break;
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK: blocks(8, true); break;
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC5_SNORM_BLOCK:
+    case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+    case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+    case VK_FORMAT_EAC_R11G11_UNORM_BLOCK:
+    case VK_FORMAT_EAC_R11G11_SNORM_BLOCK: blocks(16, false); break;
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK: blocks(16, true); break;
+
+    // ASTC is always 16 bytes, only the footprint changes
+    case VK_FORMAT_ASTC_4x4_UNORM_BLOCK: blocks(16, false, 4, 4); break;
+    case VK_FORMAT_ASTC_4x4_SRGB_BLOCK: blocks(16, true, 4, 4); break;
+    case VK_FORMAT_ASTC_5x4_UNORM_BLOCK: blocks(16, false, 5, 4); break;
+    case VK_FORMAT_ASTC_5x4_SRGB_BLOCK: blocks(16, true, 5, 4); break;
+    case VK_FORMAT_ASTC_5x5_UNORM_BLOCK: blocks(16, false, 5, 5); break;
+    case VK_FORMAT_ASTC_5x5_SRGB_BLOCK: blocks(16, true, 5, 5); break;
+    case VK_FORMAT_ASTC_6x5_UNORM_BLOCK: blocks(16, false, 6, 5); break;
+    case VK_FORMAT_ASTC_6x5_SRGB_BLOCK: blocks(16, true, 6, 5); break;
+    case VK_FORMAT_ASTC_6x6_UNORM_BLOCK: blocks(16, false, 6, 6); break;
+    case VK_FORMAT_ASTC_6x6_SRGB_BLOCK: blocks(16, true, 6, 6); break;
+    case VK_FORMAT_ASTC_8x5_UNORM_BLOCK: blocks(16, false, 8, 5); break;
+    case VK_FORMAT_ASTC_8x5_SRGB_BLOCK: blocks(16, true, 8, 5); break;
+    case VK_FORMAT_ASTC_8x6_UNORM_BLOCK: blocks(16, false, 8, 6); break;
+    case VK_FORMAT_ASTC_8x6_SRGB_BLOCK: blocks(16, true, 8, 6); break;
+    case VK_FORMAT_ASTC_8x8_UNORM_BLOCK: blocks(16, false, 8, 8); break;
+    case VK_FORMAT_ASTC_8x8_SRGB_BLOCK: blocks(16, true, 8, 8); break;
+    case VK_FORMAT_ASTC_10x5_UNORM_BLOCK: blocks(16, false, 10, 5); break;
+    case VK_FORMAT_ASTC_10x5_SRGB_BLOCK: blocks(16, true, 10, 5); break;
+    case VK_FORMAT_ASTC_10x6_UNORM_BLOCK: blocks(16, false, 10, 6); break;
+    case VK_FORMAT_ASTC_10x6_SRGB_BLOCK: blocks(16, true, 10, 6); break;
+    case VK_FORMAT_ASTC_10x8_UNORM_BLOCK: blocks(16, false, 10, 8); break;
+    case VK_FORMAT_ASTC_10x8_SRGB_BLOCK: blocks(16, true, 10, 8); break;
+    case VK_FORMAT_ASTC_10x10_UNORM_BLOCK: blocks(16, false, 10, 10); break;
+    case VK_FORMAT_ASTC_10x10_SRGB_BLOCK: blocks(16, true, 10, 10); break;
+    case VK_FORMAT_ASTC_12x10_UNORM_BLOCK: blocks(16, false, 12, 10); break;
+    case VK_FORMAT_ASTC_12x10_SRGB_BLOCK: blocks(16, true, 12, 10); break;
+    case VK_FORMAT_ASTC_12x12_UNORM_BLOCK: blocks(16, false, 12, 12); break;
+    case VK_FORMAT_ASTC_12x12_SRGB_BLOCK: blocks(16, true, 12, 12); break;
+    default: break;
+  }
+  return info;
+}
+
+size_t levelSize(const VkFormat format, const uint32_t width, const uint32_t height) {
+  const FormatInfo info = formatInfo(format);
+  const size_t blocksWide = (width + info.blockWidth - 1) / info.blockWidth;
+  const size_t blocksHigh = (height + info.blockHeight - 1) / info.blockHeight;
+  return blocksWide * blocksHigh * info.blockBytes;
+}
+
+bool canEncode(const VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK: return true;
+    default: return false;
+  }
+}
+
+void encode(const VkFormat format, const uint8_t* rgba, const uint32_t width, const uint32_t height, uint8_t* blocks) {
+  if (!canEncode(format))
+    throw std::invalid_argument("can't encode to format " + std::to_string(format));
+  const uint32_t blockBytes = formatInfo(format).blockBytes;
+  const uint32_t blocksWide = (width + 3) / 4;
+  const uint32_t blocksHigh = (height + 3) / 4;
+  Block block;
+  for (uint32_t by = 0; by < blocksHigh; ++by)
+    for (uint32_t bx = 0; bx < blocksWide; ++bx) {
+      loadBlock(rgba, width, height, bx, by, block);
+      uint8_t* out = blocks + (size_t(by) * blocksWide + bx) * blockBytes;
+      switch (format) {
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+          encodeChannelBlock(block, 3, out);
+          encodeColorBlock(block, out + 8);
+          break;
+        case VK_FORMAT_BC4_UNORM_BLOCK: encodeChannelBlock(block, 0, out); break;
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+          encodeChannelBlock(block, 0, out);
+          encodeChannelBlock(block, 1, out + 8);
+          break;
+        default: encodeColorBlock(block, out); break;
+      }
+    }
+}
+
+bool canDecode(const VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+    case VK_FORMAT_EAC_R11_UNORM_BLOCK:
+    case VK_FORMAT_EAC_R11G11_UNORM_BLOCK: return true;
+    default: return false;
+  }
+}
+
+VkFormat decodedFormat(const VkFormat format) {
+  return formatInfo(format).srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+}
+
+void decode(const VkFormat format, const uint8_t* blocks, const uint32_t width, const uint32_t height, uint8_t* rgba) {
+  if (!canDecode(format))
+    throw std::invalid_argument("can't decode format " + std::to_string(format));
+  const uint32_t blockBytes = formatInfo(format).blockBytes;
+  const uint32_t blocksWide = (width + 3) / 4;
+  const uint32_t blocksHigh = (height + 3) / 4;
+  Block block;
+  for (uint32_t by = 0; by < blocksHigh; ++by)
+    for (uint32_t bx = 0; bx < blocksWide; ++bx) {
+      const uint8_t* in = blocks + (size_t(by) * blocksWide + bx) * blockBytes;
+      switch (format) {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK: decodeColorBlock(in, false, false, block); break;
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: decodeColorBlock(in, false, true, block); break;
+        case VK_FORMAT_BC2_UNORM_BLOCK:
+        case VK_FORMAT_BC2_SRGB_BLOCK: {
+          decodeColorBlock(in + 8, true, false, block);
+          const uint64_t alpha = read64(in);
+          for (int i = 0; i < 16; ++i)
+            block[i][3] = static_cast<uint8_t>(((alpha >> (4 * i)) & 15) * 17);
+          break;
+        }
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+          decodeColorBlock(in + 8, true, false, block);
+          decodeChannelBlock(in, 3, block);
+          break;
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+          for (int i = 0; i < 16; ++i) {
+            block[i][1] = block[i][2] = 0;
+            block[i][3] = 255;
+          }
+          decodeChannelBlock(in, 0, block);
+          if (format == VK_FORMAT_BC5_UNORM_BLOCK)
+            decodeChannelBlock(in + 8, 1, block);
+          break;
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK: decodeBc7Block(in, block); break;
+        case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK: decodeEtc2Block(in, false, block); break;
+        case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK: decodeEtc2Block(in, true, block); break;
+        case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+          decodeEtc2Block(in + 8, false, block);
+          decodeEacBlock(in, false, 3, block);
+          break;
+        default:
+          // EAC R11 / RG11
+          for (int i = 0; i < 16; ++i) {
+            block[i][1] = block[i][2] = 0;
+            block[i][3] = 255;
+          }
+          decodeEacBlock(in, true, 0, block);
+          if (format == VK_FORMAT_EAC_R11G11_UNORM_BLOCK)
+            decodeEacBlock(in + 8, true, 1, block);
+          break;
+      }
+      storeBlock(block, width, height, bx, by, rgba);
+    }
+}
+
+}
@@ -0,0 +1,267 @@
+#include "vulkan_utils/cluster_culling.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+#include "file_loader.h"
+#include "meshlets.h"
+#include "vulkan_utils/host_allocator.h"
+
+namespace VulkanUtils {
+namespace {
+constexpr const char* cullShaderPath = "build/cluster_cull.spv";
+// maxComputeWorkGroupCount[0] every device has, one group per meshlet
+constexpr uint32_t maxGroupsPerDispatch = 65535;
+
+struct CullPushConstants {
+  // Object space, normalized, inside is dot(plane.xyz, p) + plane.w >= 0
+  glm::vec4 planes[6];
+  glm::vec4 cameraPosition;
+  uint32_t meshletOffset;
+  uint32_t meshletCount;
+  uint32_t padding[2];
+};
+static_assert(sizeof(CullPushConstants) == 128, "push constants past the guaranteed limit");
+
+// Gribb/Hartmann, against Vulkan's 0..w depth range
+void extractFrustumPlanes(const glm::mat4& m, glm::vec4 (&planes)[6]) {
+  const auto row = [&](int r) { return glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]); };
+  planes[0] = row(3) + row(0);
+  planes[1] = row(3) - row(0);
+  planes[2] = row(3) + row(1);
+  planes[3] = row(3) - row(1);
+  planes[4] = row(2);
+  planes[5] = row(3) - row(2);
+
+  for (auto& plane : planes) {
+    const float length = glm::length(glm::vec3(plane.x, plane.y, plane.z));
+    if (length > 0.0f)
+      plane /= length;
+  }
+}
+}
+
+ClusteredMesh::ClusteredMesh(
+    DeviceManager& _devManager,
+    const VkDescriptorSetLayout _setLayout,
+    const MeshFormat::MeshletsView& meshlets)
+  : devManager(_devManager),
+    device(_devManager.getDevice()),
+    setLayout(_setLayout),
+    meshletCount(static_cast<uint32_t>(meshlets.meshlets.count)),
+    descriptors(device, {{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, static_cast<float>(slotCount)}}, 1) {
+  if (meshlets.empty())
+    throw std::invalid_argument("clustered mesh without meshlets!");
+
+  createHostBuffer(devManager, meshletData, meshlets.meshlets.data, meshlets.meshlets.count * sizeof(MeshFormat::Meshlet));
+  createHostBuffer(devManager, meshletVertices, meshlets.vertices.data, meshlets.vertices.count * sizeof(uint32_t));
+  createHostBuffer(devManager, meshletTriangles, meshlets.triangles.data, meshlets.triangles.count * sizeof(uint32_t));
+  indexBytes = Meshlets::meshletIndexCount(meshlets) * sizeof(uint32_t);
+  reserveTargets(1);
+}
+
+void ClusteredMesh::reserveTargets(const uint32_t count) {
+  while (targets.size() < count) {
+    // Pushed first, so whatever was made goes with the mesh if this throws
+    targets.emplace_back();
+    Target& target = targets.back();
+    if (devManager.createBuffer(
+            indexBytes,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            target.indices.buffer,
+            target.indices.memory) != VK_SUCCESS)
+      throw std::runtime_error("failed to create culled index buffer!");
+
+    if (devManager.createBuffer(
+            sizeof(VkDrawIndexedIndirectCommand),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            target.draw.buffer,
+            target.draw.memory) != VK_SUCCESS)
+      throw std::runtime_error("failed to create indirect draw buffer!");
+
+    target.descriptorSet = descriptors.allocate(setLayout);
+
+    std::array<VkDescriptorBufferInfo, slotCount> bufferInfos{};
+    std::array<VkWriteDescriptorSet, slotCount> writes{};
+    for (uint32_t slot = 0; slot < slotCount; ++slot) {
+      if (slot == culledIndices)
+        bufferInfos[slot].buffer = target.indices.buffer;
+      else if (slot == drawCommand)
+        bufferInfos[slot].buffer = target.draw.buffer;
+      else
+        bufferInfos[slot].buffer = buffers[slot].buffer;
+      bufferInfos[slot].offset = 0;
+      bufferInfos[slot].range = VK_WHOLE_SIZE;
+
+      writes[slot].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[slot].dstSet = target.descriptorSet;
+      writes[slot].dstBinding = slot;
+      writes[slot].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[slot].descriptorCount = 1;
+      writes[slot].pBufferInfo = &bufferInfos[slot];
+    }
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+  }
+}
+
+void ClusteredMesh::createHostBuffer(
+    DeviceManager& devManager,
+    const BufferSlot slot,
+    const void* data,
+    const VkDeviceSize size) {
+  Buffer& target = buffers[slot];
+  if (devManager.createBuffer(
+          size,
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+          target.buffer,
+          target.memory) != VK_SUCCESS)
+    throw std::runtime_error("failed to create meshlet buffer!");
+
+  void* mappedData = nullptr;
+  vkMapMemory(device, target.memory, 0, size, 0, &mappedData);
+  memcpy(mappedData, data, static_cast<size_t>(size));
+  vkUnmapMemory(device, target.memory);
+}
+
+void ClusteredMesh::destroyBuffer(Buffer& buffer) {
+  if (buffer.buffer != VK_NULL_HANDLE)
+    vkDestroyBuffer(device, buffer.buffer, allocationCallbacks());
+  if (buffer.memory != VK_NULL_HANDLE)
+    vkFreeMemory(device, buffer.memory, allocationCallbacks());
+}
+
+ClusteredMesh::~ClusteredMesh() {
+  // The sets go with descriptors
+  for (auto& target : targets) {
+    destroyBuffer(target.indices);
+    destroyBuffer(target.draw);
+  }
+  for (auto& buffer : buffers)
+    destroyBuffer(buffer);
+}
+
+ClusterCullingPass::ClusterCullingPass(DeviceManager& devManager)
+  : device(devManager.getDevice()) {
+  std::array<VkDescriptorSetLayoutBinding, 5> bindings{};
+  for (uint32_t i = 0; i < bindings.size(); ++i) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+  setLayout = devManager.getLayoutCache().get(layoutInfo);
+
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(CullPushConstants);
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &setLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+  if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocationCallbacks(), &pipelineLayout) != VK_SUCCESS)
+    throw std::runtime_error("failed to create cluster culling pipeline layout!");
+
+  const auto shaderCode = readFile(cullShaderPath);
+  VkShaderModuleCreateInfo moduleInfo{};
+  moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = shaderCode.size();
+  moduleInfo.pCode = reinterpret_cast<const uint32_t*>(shaderCode.data());
+
+  VkShaderModule shaderModule;
+  if (vkCreateShaderModule(device, &moduleInfo, allocationCallbacks(), &shaderModule) != VK_SUCCESS)
+    throw std::runtime_error("failed to create shader module!");
+
+  VkComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = shaderModule;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = pipelineLayout;
+
+  const VkResult result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocationCallbacks(), &pipeline);
+  vkDestroyShaderModule(device, shaderModule, allocationCallbacks());
+  if (result != VK_SUCCESS)
+    throw std::runtime_error("failed to create cluster culling pipeline!");
+}
+
+ClusterCullingPass::~ClusterCullingPass() {
+  vkDestroyPipeline(device, pipeline, allocationCallbacks());
+  vkDestroyPipelineLayout(device, pipelineLayout, allocationCallbacks());
+}
+
+void ClusterCullingPass::record(
+    VkCommandBuffer commandBuffer,
+    const std::vector<Request>& requests,
+    const glm::mat4& viewProjection,
+    const glm::vec3& cameraPosition) const {
+  if (requests.empty())
+    return;
+
+  // Last frame's draws have to be done reading before the reset / rewrite
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+  // indexCount is the atomic the shader appends with
+  const VkDrawIndexedIndirectCommand emptyDraw{0, 1, 0, 0, 0};
+  for (const auto& request : requests)
+    vkCmdUpdateBuffer(commandBuffer, request.mesh->getDrawBuffer(request.target), 0, sizeof(emptyDraw), &emptyDraw);
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+  for (const auto& request : requests) {
+    const VkDescriptorSet descriptorSet = request.mesh->getDescriptorSet(request.target);
+    vkCmdBindDescriptorSets(
+        commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+
+    // Object space so the meshlet data can be used untransformed. Exact for
+    // uniform scale, roughly right otherwise.
+    CullPushConstants constants{};
+    extractFrustumPlanes(viewProjection * request.modelMatrix, constants.planes);
+    constants.cameraPosition = glm::inverse(request.modelMatrix) * glm::vec4(cameraPosition, 1.0f);
+    constants.meshletCount = request.mesh->getMeshletCount();
+
+    for (uint32_t offset = 0; offset < constants.meshletCount; offset += maxGroupsPerDispatch) {
+      constants.meshletOffset = offset;
+      vkCmdPushConstants(
+          commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+      vkCmdDispatch(commandBuffer, std::min(constants.meshletCount - offset, maxGroupsPerDispatch), 1, 1);
+    }
+  }
+
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+      0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+}
@@ -0,0 +1,133 @@
+#include "vulkan_utils/deferred_destruction_queue.h"
+
+#include <algorithm>
+#include <type_traits>
+
+#include "vulkan_utils/host_allocator.h"
+
+namespace VulkanUtils {
+namespace {
+
+template <class T>
+void appendList(std::vector<T>& to, std::vector<T>& from) {
+  if (to.empty())
+    to.swap(from);
+  else
+    to.insert(to.end(), from.begin(), from.end());
+  from.clear();
+}
+
+} // namespace
+
+size_t DeferredDestructionQueue::Batch::size() const {
+  size_t count = callbacks.size();
+  std::apply([&count](const auto&... list) { ((count += list.size()), ...); }, lists);
+  return count;
+}
+
+void DeferredDestructionQueue::Batch::append(Batch& other) {
+  appendList(callbacks, other.callbacks);
+  std::apply(
+      [&other](auto&... list) { (appendList(list, std::get<std::decay_t<decltype(list)>>(other.lists)), ...); },
+      lists);
+}
+
+void DeferredDestructionQueue::Batch::clear() {
+  callbacks.clear();
+  std::apply([](auto&... list) { (list.clear(), ...); }, lists);
+}
+
+void DeferredDestructionQueue::submitted(const uint64_t serial) {
+  if (pending.empty())
+    return;
+
+  Batch& batch = batchFor(serial);
+  batch.append(pending);
+}
+
+void DeferredDestructionQueue::collect(const uint64_t completedSerial) {
+  size_t done = 0;
+  while (done < batches.size() && batches[done].serial <= completedSerial) {
+    destroy(batches[done]);
+    spare.push_back(std::move(batches[done++]));
+  }
+  batches.erase(batches.begin(), batches.begin() + done);
+}
+
+void DeferredDestructionQueue::flush() {
+  for (auto& batch : batches)
+    destroy(batch);
+  batches.clear();
+  destroy(pending);
+}
+
+size_t DeferredDestructionQueue::size() const {
+  size_t count = pending.size();
+  for (const auto& batch : batches)
+    count += batch.size();
+  return count;
+}
+
+DeferredDestructionQueue::Batch& DeferredDestructionQueue::batchFor(const uint64_t serial) {
+  // One that's older than the newest batch waits for that one, a little
+  // longer than it has to
+  if (!batches.empty() && batches.back().serial >= serial)
+    return batches.back();
+
+  if (spare.empty()) {
+    batches.emplace_back();
+  } else {
+    batches.push_back(std::move(spare.back()));
+    spare.pop_back();
+  }
+  batches.back().serial = serial;
+  return batches.back();
+}
+
+void DeferredDestructionQueue::destroy(Batch& batch) {
+  // Callbacks first, they may hold what the handles below were made from
+  for (auto& callback : batch.callbacks)
+    callback();
+  batch.callbacks.clear();
+
+  // Users before what they use: framebuffers and pipelines, then sets and
+  // pools, views before their images, buffers before their memory, and
+  // swapchain image views before the swapchain
+  for (const auto framebuffer : std::get<std::vector<VkFramebuffer>>(batch.lists))
+    vkDestroyFramebuffer(device, framebuffer, allocationCallbacks());
+  for (const auto pipeline : std::get<std::vector<VkPipeline>>(batch.lists))
+    vkDestroyPipeline(device, pipeline, allocationCallbacks());
+
+  // One call per pool
+  auto& sets = std::get<std::vector<DescriptorSet>>(batch.lists);
+  std::sort(sets.begin(), sets.end(), [](const DescriptorSet& a, const DescriptorSet& b) { return a.pool < b.pool; });
+  std::vector<VkDescriptorSet> poolSets;
+  for (size_t begin = 0; begin < sets.size();) {
+    size_t end = begin;
+    poolSets.clear();
+    while (end < sets.size() && sets[end].pool == sets[begin].pool)
+      poolSets.push_back(sets[end++].set);
+    vkFreeDescriptorSets(device, sets[begin].pool, static_cast<uint32_t>(poolSets.size()), poolSets.data());
+    begin = end;
+  }
+
+  for (const auto pool : std::get<std::vector<VkDescriptorPool>>(batch.lists))
+    vkDestroyDescriptorPool(device, pool, allocationCallbacks());
+  for (const auto view : std::get<std::vector<VkImageView>>(batch.lists))
+    vkDestroyImageView(device, view, allocationCallbacks());
+  for (const auto sampler : std::get<std::vector<VkSampler>>(batch.lists))
+    vkDestroySampler(device, sampler, allocationCallbacks());
+  for (const auto image : std::get<std::vector<VkImage>>(batch.lists))
+    vkDestroyImage(device, image, allocationCallbacks());
+  for (const auto buffer : std::get<std::vector<VkBuffer>>(batch.lists))
+    vkDestroyBuffer(device, buffer, allocationCallbacks());
+  for (const auto memory : std::get<std::vector<VkDeviceMemory>>(batch.lists))
+    vkFreeMemory(device, memory, allocationCallbacks());
+  for (const auto semaphore : std::get<std::vector<VkSemaphore>>(batch.lists))
+    vkDestroySemaphore(device, semaphore, allocationCallbacks());
+  for (const auto swapchain : std::get<std::vector<VkSwapchainKHR>>(batch.lists))
+    vkDestroySwapchainKHR(device, swapchain, allocationCallbacks());
+  batch.clear();
+}
+
+}
@@ -0,0 +1,191 @@
+#include "vulkan_utils/descriptor_allocator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#include "vulkan_utils/host_allocator.h"
+
+namespace VulkanUtils {
+
+DescriptorAllocator::DescriptorAllocator(
+    const VkDevice _device,
+    std::vector<DescriptorPoolRatio> _ratios,
+    const uint32_t initialSets,
+    const VkDescriptorPoolCreateFlags _flags)
+  : device(_device),
+    ratios(std::move(_ratios)),
+    flags(_flags),
+    setsPerPool(std::clamp(initialSets, 1u, maxSetsPerPool)) {}
+
+DescriptorAllocator::~DescriptorAllocator() {
+  for (const VkDescriptorPool pool : ready)
+    vkDestroyDescriptorPool(device, pool, allocationCallbacks());
+  for (const VkDescriptorPool pool : full)
+    vkDestroyDescriptorPool(device, pool, allocationCallbacks());
+}
+
+DescriptorAllocator::DescriptorAllocator(DescriptorAllocator&& other) noexcept
+  : device(other.device),
+    ratios(std::move(other.ratios)),
+    flags(other.flags),
+    setsPerPool(other.setsPerPool),
+    ready(std::move(other.ready)),
+    full(std::move(other.full)) {
+  other.ready.clear();
+  other.full.clear();
+}
+
+VkDescriptorPool DescriptorAllocator::createPool(const uint32_t sets) const {
+  std::vector<VkDescriptorPoolSize> sizes;
+  for (const DescriptorPoolRatio& ratio : ratios)
+    sizes.push_back({ratio.type, std::max(1u, static_cast<uint32_t>(std::ceil(ratio.perSet * sets)))});
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.flags = flags;
+  poolInfo.maxSets = sets;
+  poolInfo.poolSizeCount = static_cast<uint32_t>(sizes.size());
+  poolInfo.pPoolSizes = sizes.data();
+
+  VkDescriptorPool pool;
+  if (vkCreateDescriptorPool(device, &poolInfo, allocationCallbacks(), &pool) != VK_SUCCESS)
+    throw std::runtime_error("failed to create descriptor pool!");
+  return pool;
+}
+
+VkDescriptorPool DescriptorAllocator::currentPool() {
+  if (ready.empty()) {
+    ready.push_back(createPool(setsPerPool));
+    setsPerPool = std::min(setsPerPool * 2, maxSetsPerPool);
+  }
+  return ready.back();
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(const VkDescriptorSetLayout layout) {
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = currentPool();
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &layout;
+
+  VkDescriptorSet set;
+  VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &set);
+  if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+    // Full for this layout at least, the next one is fresh
+    full.push_back(ready.back());
+    ready.pop_back();
+    allocInfo.descriptorPool = currentPool();
+    result = vkAllocateDescriptorSets(device, &allocInfo, &set);
+  }
+  if (result != VK_SUCCESS)
+    throw std::runtime_error("failed to allocate descriptor set!");
+  return set;
+}
+
+void DescriptorAllocator::reset() {
+  for (const VkDescriptorPool pool : ready)
+    vkResetDescriptorPool(device, pool, 0);
+  for (const VkDescriptorPool pool : full) {
+    vkResetDescriptorPool(device, pool, 0);
+    ready.push_back(pool);
+  }
+  full.clear();
+}
+
+DescriptorUpdateTemplate::DescriptorUpdateTemplate(
+    DeviceManager& _devManager,
+    const VkDescriptorSetLayout layout,
+    std::vector<VkDescriptorUpdateTemplateEntry> _entries)
+  : devManager(_devManager),
+    entries(std::move(_entries)) {
+  if (!devManager.hasDescriptorUpdateTemplates())
+    return;
+
+  VkDescriptorUpdateTemplateCreateInfo createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+  createInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(entries.size());
+  createInfo.pDescriptorUpdateEntries = entries.data();
+  createInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+  createInfo.descriptorSetLayout = layout;
+  if (devManager.createDescriptorUpdateTemplate(createInfo, handle) != VK_SUCCESS)
+    throw std::runtime_error("failed to create descriptor update template!");
+}
+
+DescriptorUpdateTemplate::~DescriptorUpdateTemplate() {
+  if (handle != VK_NULL_HANDLE)
+    devManager.destroyDescriptorUpdateTemplate(handle);
+}
+
+void DescriptorUpdateTemplate::update(const VkDescriptorSet set, const void* data) const {
+  if (handle != VK_NULL_HANDLE) {
+    devManager.updateDescriptorSetWithTemplate(set, handle, data);
+    return;
+  }
+
+  // Same layout the template would read, one write per entry
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  std::vector<VkDescriptorImageInfo> images;
+  std::vector<VkDescriptorBufferInfo> buffers;
+  std::vector<VkBufferView> texelBuffers;
+  for (const auto& entry : entries) {
+    for (uint32_t i = 0; i < entry.descriptorCount; ++i) {
+      const uint8_t* element = bytes + entry.offset + i * entry.stride;
+      switch (entry.descriptorType) {
+        case VK_DESCRIPTOR_TYPE_SAMPLER:
+        case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+        case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+        case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+        case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+          images.push_back(*reinterpret_cast<const VkDescriptorImageInfo*>(element));
+          break;
+        case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+        case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+          texelBuffers.push_back(*reinterpret_cast<const VkBufferView*>(element));
+          break;
+        default:
+          buffers.push_back(*reinterpret_cast<const VkDescriptorBufferInfo*>(element));
+          break;
+      }
+    }
+  }
+
+  // Filled above, so the pointers are stable now
+  std::vector<VkWriteDescriptorSet> writes;
+  size_t image = 0;
+  size_t buffer = 0;
+  size_t texelBuffer = 0;
+  for (const auto& entry : entries) {
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set;
+    write.dstBinding = entry.dstBinding;
+    write.dstArrayElement = entry.dstArrayElement;
+    write.descriptorCount = entry.descriptorCount;
+    write.descriptorType = entry.descriptorType;
+    switch (entry.descriptorType) {
+      case VK_DESCRIPTOR_TYPE_SAMPLER:
+      case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+      case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+      case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+      case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+        write.pImageInfo = images.data() + image;
+        image += entry.descriptorCount;
+        break;
+      case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+      case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+        write.pTexelBufferView = texelBuffers.data() + texelBuffer;
+        texelBuffer += entry.descriptorCount;
+        break;
+      default:
+        write.pBufferInfo = buffers.data() + buffer;
+        buffer += entry.descriptorCount;
+        break;
+    }
+    writes.push_back(write);
+  }
+  vkUpdateDescriptorSets(devManager.getDevice(), static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+}
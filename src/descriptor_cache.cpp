@@ -0,0 +1,137 @@
+#include "vulkan_utils/descriptor_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "vulkan_utils/host_allocator.h"
+
+namespace VulkanUtils {
+namespace {
+void hashCombine(size_t& seed, const uint64_t value) {
+  seed ^= std::hash<uint64_t>()(value) + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+}
+
+uint64_t floatBits(const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+}
+
+DescriptorLayoutCache::~DescriptorLayoutCache() {
+  for (const auto& [key, layout] : layouts)
+    vkDestroyDescriptorSetLayout(device, layout, allocationCallbacks());
+}
+
+bool DescriptorLayoutCache::Binding::operator==(const Binding& other) const {
+  return binding == other.binding && type == other.type && count == other.count && stages == other.stages &&
+      immutableSamplers == other.immutableSamplers;
+}
+
+size_t DescriptorLayoutCache::KeyHash::operator()(const Key& key) const {
+  size_t seed = key.bindings.size();
+  hashCombine(seed, key.flags);
+  for (const Binding& binding : key.bindings) {
+    hashCombine(seed, binding.binding);
+    hashCombine(seed, binding.type);
+    hashCombine(seed, binding.count);
+    hashCombine(seed, binding.stages);
+    for (const VkSampler sampler : binding.immutableSamplers)
+      hashCombine(seed, reinterpret_cast<uint64_t>(sampler));
+  }
+  return seed;
+}
+
+VkDescriptorSetLayout DescriptorLayoutCache::get(const VkDescriptorSetLayoutCreateInfo& info) {
+  if (info.pNext)
+    throw std::invalid_argument("descriptor set layout pNext chains aren't cached");
+
+  Key key{info.flags, {}};
+  key.bindings.reserve(info.bindingCount);
+  for (uint32_t i = 0; i < info.bindingCount; ++i) {
+    const VkDescriptorSetLayoutBinding& source = info.pBindings[i];
+    Binding& binding = key.bindings.emplace_back();
+    binding.binding = source.binding;
+    binding.type = source.descriptorType;
+    binding.count = source.descriptorCount;
+    binding.stages = source.stageFlags;
+    if (source.pImmutableSamplers)
+      binding.immutableSamplers.assign(source.pImmutableSamplers, source.pImmutableSamplers + source.descriptorCount);
+  }
+  std::sort(key.bindings.begin(), key.bindings.end(), [](const Binding& a, const Binding& b) {
+    return a.binding < b.binding;
+  });
+
+  std::lock_guard<std::mutex> lock(mutex);
+  const auto found = layouts.find(key);
+  if (found != layouts.end())
+    return found->second;
+
+  VkDescriptorSetLayout layout;
+  if (vkCreateDescriptorSetLayout(device, &info, allocationCallbacks(), &layout) != VK_SUCCESS)
+    throw std::runtime_error("failed to create descriptor set layout!");
+  layouts.emplace(std::move(key), layout);
+  return layout;
+}
+
+size_t DescriptorLayoutCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return layouts.size();
+}
+
+SamplerCache::~SamplerCache() {
+  for (const auto& [key, sampler] : samplers)
+    vkDestroySampler(device, sampler, allocationCallbacks());
+}
+
+bool SamplerCache::Key::operator==(const Key& other) const {
+  const VkSamplerCreateInfo& a = info;
+  const VkSamplerCreateInfo& b = other.info;
+  return a.flags == b.flags && a.magFilter == b.magFilter && a.minFilter == b.minFilter &&
+      a.mipmapMode == b.mipmapMode && a.addressModeU == b.addressModeU && a.addressModeV == b.addressModeV &&
+      a.addressModeW == b.addressModeW && floatBits(a.mipLodBias) == floatBits(b.mipLodBias) &&
+      a.anisotropyEnable == b.anisotropyEnable && floatBits(a.maxAnisotropy) == floatBits(b.maxAnisotropy) &&
+      a.compareEnable == b.compareEnable && a.compareOp == b.compareOp && floatBits(a.minLod) == floatBits(b.minLod) &&
+      floatBits(a.maxLod) == floatBits(b.maxLod) && a.borderColor == b.borderColor &&
+      a.unnormalizedCoordinates == b.unnormalizedCoordinates;
+}
+
+size_t SamplerCache::KeyHash::operator()(const Key& key) const {
+  const VkSamplerCreateInfo& info = key.info;
+  size_t seed = 0;
+  hashCombine(seed, info.flags);
+  hashCombine(seed, info.magFilter | (info.minFilter << 8) | (info.mipmapMode << 16));
+  hashCombine(seed, info.addressModeU | (info.addressModeV << 8) | (info.addressModeW << 16));
+  hashCombine(seed, floatBits(info.mipLodBias));
+  hashCombine(seed, info.anisotropyEnable | (info.compareEnable << 1) | (info.unnormalizedCoordinates << 2));
+  hashCombine(seed, floatBits(info.maxAnisotropy));
+  hashCombine(seed, info.compareOp | (info.borderColor << 8));
+  hashCombine(seed, floatBits(info.minLod) | (floatBits(info.maxLod) << 32));
+  return seed;
+}
+
+VkSampler SamplerCache::get(const VkSamplerCreateInfo& info) {
+  if (info.pNext)
+    throw std::invalid_argument("sampler pNext chains aren't cached");
+
+  Key key{info};
+  std::lock_guard<std::mutex> lock(mutex);
+  const auto found = samplers.find(key);
+  if (found != samplers.end())
+    return found->second;
+
+  VkSampler sampler;
+  if (vkCreateSampler(device, &info, allocationCallbacks(), &sampler) != VK_SUCCESS)
+    throw std::runtime_error("failed to create sampler!");
+  samplers.emplace(key, sampler);
+  return sampler;
+}
+
+size_t SamplerCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return samplers.size();
+}
+
+}
@@ -1,10 +1,13 @@
 #include "vulkan_utils/device_manager.h"
 
+#include <algorithm>
 #include <iostream>
 #include <set>
 #include <stdexcept>
 #include <string>
 
+#include "vulkan_utils/host_allocator.h"
+
 namespace VulkanUtils {
 namespace {
 bool checkDeviceExtensionSupport(const VkPhysicalDevice device, const std::vector<const char*>& requiredDeviceExtensions) {
@@ -48,6 +51,77 @@ bool isDeviceSuitable(
       swapChainAdequate;
 }
 
+bool supportsTimelineSemaphores(const VkPhysicalDevice device, const uint32_t instanceApiVersion) {
+  if (instanceApiVersion < VK_API_VERSION_1_2)
+    return false;
+
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(device, &deviceProperties);
+  if (deviceProperties.apiVersion < VK_API_VERSION_1_2)
+    return false;
+
+  VkPhysicalDeviceVulkan12Features features12{};
+  features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+  VkPhysicalDeviceFeatures2 features{};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &features12;
+  vkGetPhysicalDeviceFeatures2(device, &features);
+
+  return features12.timelineSemaphore == VK_TRUE;
+}
+
+// present_wait needs present_id, and both need features2 to query/enable
+bool supportsPresentWait(const VkPhysicalDevice device, const uint32_t instanceApiVersion) {
+  if (instanceApiVersion < VK_API_VERSION_1_1)
+    return false;
+
+  if (!checkDeviceExtensionSupport(device, {VK_KHR_PRESENT_ID_EXTENSION_NAME, VK_KHR_PRESENT_WAIT_EXTENSION_NAME}))
+    return false;
+
+  VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+  presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+
+  VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+  presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+  presentWaitFeatures.pNext = &presentIdFeatures;
+
+  VkPhysicalDeviceFeatures2 features{};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &presentWaitFeatures;
+  vkGetPhysicalDeviceFeatures2(device, &features);
+
+  return presentIdFeatures.presentId == VK_TRUE && presentWaitFeatures.presentWait == VK_TRUE;
+}
+
+enum class DynamicRenderingSupport { none, core, extension };
+
+// The KHR extension's dependencies are all core by 1.2, so don't bother below that
+DynamicRenderingSupport supportsDynamicRendering(const VkPhysicalDevice device, const uint32_t instanceApiVersion) {
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(device, &deviceProperties);
+  const uint32_t apiVersion = std::min(instanceApiVersion, deviceProperties.apiVersion);
+  if (apiVersion < VK_API_VERSION_1_2)
+    return DynamicRenderingSupport::none;
+
+  const bool core = apiVersion >= VK_API_VERSION_1_3;
+  if (!core && !checkDeviceExtensionSupport(device, {VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME}))
+    return DynamicRenderingSupport::none;
+
+  VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
+  dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+
+  VkPhysicalDeviceFeatures2 features{};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &dynamicRenderingFeatures;
+  vkGetPhysicalDeviceFeatures2(device, &features);
+
+  if (dynamicRenderingFeatures.dynamicRendering != VK_TRUE)
+    return DynamicRenderingSupport::none;
+
+  return core ? DynamicRenderingSupport::core : DynamicRenderingSupport::extension;
+}
+
 uint32_t findMemoryType(
     VkPhysicalDevice physicalDevice,
     const uint32_t typeFilter,
@@ -70,28 +144,39 @@ DeviceManager::DeviceManager(
     const VkInstance _instance,
     const VkSurfaceKHR surface,
     const std::vector<const char*>& requiredDeviceExtensions,
-    const std::optional<std::vector<const char*>>& validationLayers)
+    const std::optional<std::vector<const char*>>& validationLayers,
+    const DeviceOptions& options)
  : instance(_instance)
 {
   pickPhysicalDevice(surface, requiredDeviceExtensions);
-  createLogicalDevice(surface, requiredDeviceExtensions, validationLayers);
+  createLogicalDevice(surface, requiredDeviceExtensions, validationLayers, options);
 
-  const auto graphicsQueue =
-      findQueueFamilies(physicalDevice, surface).graphicsFamily.value();
   commandPoolWrapper.emplace(
       device,
-      graphicsQueue,
+      graphicsFamily,
       VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
   transientPool.emplace(
       device,
-      graphicsQueue,
+      graphicsFamily,
       VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+  if (timelineSemaphoresEnabled)
+    graphicsTimeline.emplace(device, getGraphicsQueue());
+
+  layoutCache.emplace(device);
+  samplerCache.emplace(device);
 }
 
 DeviceManager::~DeviceManager() {
+  graphicsTimeline.reset();
+  samplerCache.reset();
+  layoutCache.reset();
+  commandPoolWrapper.reset();
+  transientPool.reset();
+
   if (device != VK_NULL_HANDLE)
-    vkDestroyDevice(device, nullptr);
+    vkDestroyDevice(device, allocationCallbacks());
 }
 
 void DeviceManager::pickPhysicalDevice(const VkSurfaceKHR surface, const std::vector<const char*>& requiredDeviceExtensions) {
@@ -119,11 +204,17 @@ void DeviceManager::pickPhysicalDevice(const VkSurfaceKHR surface, const std::ve
 void DeviceManager::createLogicalDevice(
     const VkSurfaceKHR surface,
     const std::vector<const char*>& requiredDeviceExtensions,
-    const std::optional<std::vector<const char*>>& validationLayers) {
+    const std::optional<std::vector<const char*>>& validationLayers,
+    const DeviceOptions& options) {
   QueueFamilyIndices indices = findQueueFamilies(physicalDevice, surface);
 
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-  std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+  graphicsFamily = indices.graphicsFamily.value();
+  transferFamily = options.transferQueue && indices.transferFamily ? *indices.transferFamily : graphicsFamily;
+  if (options.transferQueue && !indices.transferFamily)
+    std::cout << "no dedicated transfer queue, uploading on the graphics queue" << std::endl;
+
+  std::set<uint32_t> uniqueQueueFamilies = {graphicsFamily, indices.presentFamily.value(), transferFamily};
   float queuePriority = 1.0f;
   for (uint32_t queueFamily : uniqueQueueFamilies) {
     VkDeviceQueueCreateInfo queueCreateInfo{};
@@ -134,15 +225,94 @@ void DeviceManager::createLogicalDevice(
     queueCreateInfos.push_back(queueCreateInfo);
   }
 
-  // Currently no custom features required
   VkPhysicalDeviceFeatures deviceFeatures{};
+  VkPhysicalDeviceFeatures supportedFeatures;
+  vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+  // Free where it's there, lets one compute shader write any storage format
+  deviceFeatures.shaderStorageImageWriteWithoutFormat = supportedFeatures.shaderStorageImageWriteWithoutFormat;
+  storageImageWriteWithoutFormat = supportedFeatures.shaderStorageImageWriteWithoutFormat == VK_TRUE;
+  // Block compressed formats can't be used at all without these. Where the
+  // device lacks one the texture loader decodes to RGBA8 instead.
+  deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+  deviceFeatures.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;
+  deviceFeatures.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
+
+  // Optional features get pushed on the front of this as they're enabled
+  void* featureChain = nullptr;
+  std::vector<const char*> enabledExtensions = requiredDeviceExtensions;
+
+  timelineSemaphoresEnabled =
+      options.timelineSemaphores && supportsTimelineSemaphores(physicalDevice, options.apiVersion);
+  if (options.timelineSemaphores && !timelineSemaphoresEnabled)
+    std::cout << "timeline semaphores unsupported, falling back to fences" << std::endl;
+
+  // Only legal to chain on a 1.2 device
+  VkPhysicalDeviceVulkan12Features features12{};
+  features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  features12.timelineSemaphore = timelineSemaphoresEnabled ? VK_TRUE : VK_FALSE;
+  if (timelineSemaphoresEnabled) {
+    features12.pNext = featureChain;
+    featureChain = &features12;
+  }
+
+  presentWaitEnabled = options.presentWait && supportsPresentWait(physicalDevice, options.apiVersion);
+  if (options.presentWait && !presentWaitEnabled)
+    std::cout << "VK_KHR_present_wait unsupported, present latency won't be measured" << std::endl;
+
+  VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+  presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+  presentIdFeatures.presentId = VK_TRUE;
+  VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+  presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+  presentWaitFeatures.presentWait = VK_TRUE;
+  if (presentWaitEnabled) {
+    presentIdFeatures.pNext = featureChain;
+    presentWaitFeatures.pNext = &presentIdFeatures;
+    featureChain = &presentWaitFeatures;
+    enabledExtensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+    enabledExtensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+  }
+
+  const DynamicRenderingSupport dynamicRendering = options.dynamicRendering
+      ? supportsDynamicRendering(physicalDevice, options.apiVersion)
+      : DynamicRenderingSupport::none;
+  if (options.dynamicRendering && dynamicRendering == DynamicRenderingSupport::none)
+    std::cout << "dynamic rendering unsupported, using render passes" << std::endl;
+
+  VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
+  dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+  dynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+  if (dynamicRendering != DynamicRenderingSupport::none) {
+    dynamicRenderingFeatures.pNext = featureChain;
+    featureChain = &dynamicRenderingFeatures;
+  }
+  if (dynamicRendering == DynamicRenderingSupport::extension)
+    enabledExtensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+
+  memoryBudgetEnabled = options.memoryBudget && options.apiVersion >= VK_API_VERSION_1_1 &&
+      checkDeviceExtensionSupport(physicalDevice, {VK_EXT_MEMORY_BUDGET_EXTENSION_NAME});
+  if (options.memoryBudget && !memoryBudgetEnabled)
+    std::cout << "VK_EXT_memory_budget unsupported, budgeting against heap sizes" << std::endl;
+  if (memoryBudgetEnabled)
+    enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+  // Nothing to enable in 1.1, the extension is there on just about every 1.0
+  // driver otherwise
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+  const bool coreUpdateTemplates = std::min(options.apiVersion, deviceProperties.apiVersion) >= VK_API_VERSION_1_1;
+  const bool extensionUpdateTemplates =
+      !coreUpdateTemplates && checkDeviceExtensionSupport(physicalDevice, {VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME});
+  if (extensionUpdateTemplates)
+    enabledExtensions.push_back(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+
   VkDeviceCreateInfo createInfo{};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-  createInfo.pNext = nullptr;
+  createInfo.pNext = featureChain;
   createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
-  createInfo.enabledExtensionCount = static_cast<uint32_t>(requiredDeviceExtensions.size());
-  createInfo.ppEnabledExtensionNames = requiredDeviceExtensions.data();
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+  createInfo.ppEnabledExtensionNames = enabledExtensions.data();
   createInfo.pEnabledFeatures = &deviceFeatures;
 
   // Largely depricated. Probably can safely be removed
@@ -153,12 +323,50 @@ void DeviceManager::createLogicalDevice(
     createInfo.enabledLayerCount = 0;
   }
 
-  if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
+  if (vkCreateDevice(physicalDevice, &createInfo, allocationCallbacks(), &device) != VK_SUCCESS) {
     throw std::runtime_error("failed to create logical device!");
   }
 
   vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
   vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+  vkGetDeviceQueue(device, transferFamily, 0, &transferQueue);
+
+  if (presentWaitEnabled)
+    waitForPresentFn = (PFN_vkWaitForPresentKHR) vkGetDeviceProcAddr(device, "vkWaitForPresentKHR");
+
+  if (dynamicRendering == DynamicRenderingSupport::core) {
+    beginRenderingFn = (PFN_vkCmdBeginRenderingKHR) vkGetDeviceProcAddr(device, "vkCmdBeginRendering");
+    endRenderingFn = (PFN_vkCmdEndRenderingKHR) vkGetDeviceProcAddr(device, "vkCmdEndRendering");
+  } else if (dynamicRendering == DynamicRenderingSupport::extension) {
+    beginRenderingFn = (PFN_vkCmdBeginRenderingKHR) vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR");
+    endRenderingFn = (PFN_vkCmdEndRenderingKHR) vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR");
+  }
+
+  if (coreUpdateTemplates) {
+    createTemplateFn = (PFN_vkCreateDescriptorUpdateTemplate) vkGetDeviceProcAddr(device, "vkCreateDescriptorUpdateTemplate");
+    destroyTemplateFn = (PFN_vkDestroyDescriptorUpdateTemplate) vkGetDeviceProcAddr(device, "vkDestroyDescriptorUpdateTemplate");
+    updateWithTemplateFn =
+        (PFN_vkUpdateDescriptorSetWithTemplate) vkGetDeviceProcAddr(device, "vkUpdateDescriptorSetWithTemplate");
+  } else if (extensionUpdateTemplates) {
+    createTemplateFn = (PFN_vkCreateDescriptorUpdateTemplate) vkGetDeviceProcAddr(device, "vkCreateDescriptorUpdateTemplateKHR");
+    destroyTemplateFn =
+        (PFN_vkDestroyDescriptorUpdateTemplate) vkGetDeviceProcAddr(device, "vkDestroyDescriptorUpdateTemplateKHR");
+    updateWithTemplateFn =
+        (PFN_vkUpdateDescriptorSetWithTemplate) vkGetDeviceProcAddr(device, "vkUpdateDescriptorSetWithTemplateKHR");
+  }
+  // All or nothing, hasDescriptorUpdateTemplates only looks at the one
+  if (!createTemplateFn || !destroyTemplateFn)
+    updateWithTemplateFn = nullptr;
+}
+
+VkResult DeviceManager::waitForPresent(
+    const VkSwapchainKHR swapchain,
+    const uint64_t presentId,
+    const uint64_t timeout) const {
+  if (!waitForPresentFn)
+    return VK_ERROR_EXTENSION_NOT_PRESENT;
+
+  return waitForPresentFn(device, swapchain, presentId, timeout);
 }
 
 VkResult DeviceManager::createBuffer(
@@ -173,7 +381,7 @@ VkResult DeviceManager::createBuffer(
   bufferInfo.usage = usage;
   bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; // There are other modes
 
-  VkResult result = vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
+  VkResult result = vkCreateBuffer(device, &bufferInfo, allocationCallbacks(), &buffer);
   if (result != VK_SUCCESS)
     return result;
 
@@ -188,9 +396,9 @@ VkResult DeviceManager::createBuffer(
       memRequirements.memoryTypeBits,
       properties);
 
-  result = vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory);
+  result = vkAllocateMemory(device, &allocInfo, allocationCallbacks(), &bufferMemory);
   if (result != VK_SUCCESS) {
-    vkDestroyBuffer(device, buffer, nullptr);
+    vkDestroyBuffer(device, buffer, allocationCallbacks());
     return result;
   }
 
@@ -207,14 +415,15 @@ VkResult DeviceManager::createImage(
     VkMemoryPropertyFlags properties,
     VkImage& image,
     VkDeviceMemory& imageMemory,
-    VkImageLayout finalLayout) {
+    VkImageLayout finalLayout,
+    uint32_t mipLevels) {
   VkImageCreateInfo imageInfo{};
   imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
   imageInfo.imageType = VK_IMAGE_TYPE_2D;
   imageInfo.extent.width = width;
   imageInfo.extent.height = height;
   imageInfo.extent.depth = 1;
-  imageInfo.mipLevels = 1; // for now no mipmapping. Probably change in the future
+  imageInfo.mipLevels = mipLevels;
   imageInfo.arrayLayers = 1;
   imageInfo.format = format;
   imageInfo.tiling = tiling;
@@ -224,7 +433,7 @@ VkResult DeviceManager::createImage(
   imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
   imageInfo.flags = 0; // Optional
 
-  VkResult result = vkCreateImage(device, &imageInfo, nullptr, &image);
+  VkResult result = vkCreateImage(device, &imageInfo, allocationCallbacks(), &image);
   if (result != VK_SUCCESS)
     return result;
 
@@ -239,16 +448,16 @@ VkResult DeviceManager::createImage(
       memRequirements.memoryTypeBits,
       properties);
 
-  result = vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory);
+  result = vkAllocateMemory(device, &allocInfo, allocationCallbacks(), &imageMemory);
   if (result != VK_SUCCESS) {
-    vkDestroyImage(device, image, nullptr);
+    vkDestroyImage(device, image, allocationCallbacks());
     return result;
   }
 
   vkBindImageMemory(device, image, imageMemory, 0);
 
  if (finalLayout != VK_IMAGE_LAYOUT_UNDEFINED) {
-    transitionImageLayout(image, format, VK_IMAGE_LAYOUT_UNDEFINED, finalLayout);
+    transitionImageLayout(image, format, VK_IMAGE_LAYOUT_UNDEFINED, finalLayout, mipLevels);
     vkDeviceWaitIdle(device); // band aid lol
  }
 
@@ -259,26 +468,29 @@ VkResult DeviceManager::createImageView(
     VkImage image, 
     VkFormat format, 
     VkImageAspectFlags aspectFlags, 
-    VkImageView& imageView) {
+    VkImageView& imageView,
+    uint32_t mipLevels,
+    uint32_t baseMipLevel) {
   VkImageViewCreateInfo viewInfo{};
   viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
   viewInfo.image = image;
   viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
   viewInfo.format = format;
   viewInfo.subresourceRange.aspectMask = aspectFlags;
-  viewInfo.subresourceRange.baseMipLevel = 0;
-  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+  viewInfo.subresourceRange.levelCount = mipLevels;
   viewInfo.subresourceRange.baseArrayLayer = 0;
   viewInfo.subresourceRange.layerCount = 1;
 
-  return vkCreateImageView(device, &viewInfo, nullptr, &imageView);
+  return vkCreateImageView(device, &viewInfo, allocationCallbacks(), &imageView);
 }
 
 void DeviceManager::transitionImageLayout(
     VkImage image,
     VkFormat /* format // necessary if there's ever other image formats*/,
     VkImageLayout oldLayout,
-    VkImageLayout newLayout) {
+    VkImageLayout newLayout,
+    uint32_t mipLevels) {
   ScopedCommandBuffer commandBuffer = createScopedCommandBuffer();
 
   VkImageMemoryBarrier barrier{};
@@ -290,7 +502,7 @@ void DeviceManager::transitionImageLayout(
   barrier.image = image;
   barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
   barrier.subresourceRange.baseMipLevel = 0;
-  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.levelCount = mipLevels;
   barrier.subresourceRange.baseArrayLayer = 0;
   barrier.subresourceRange.layerCount = 1;
 
@@ -303,6 +515,12 @@ void DeviceManager::transitionImageLayout(
     barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
     sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
     destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+    // Ready for uploading level 0 (then MipGenerator) or every level
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
   } else {
     throw std::invalid_argument("Unsupported layout transition!");
   }
@@ -1,5 +1,7 @@
 #include "vulkan_utils/dynamic_descriptor_set_wrapper.h"
 
+#include "vulkan_utils/host_allocator.h"
+
 namespace VulkanUtils {
 
 template <uint32_t NumFrames, class T>
@@ -41,20 +43,20 @@ DescriptorSetWrapper<NumFrames, T>::~DescriptorSetWrapper() {
     stagingMappedPtr = nullptr;
   }
   if (stagingBuffer != VK_NULL_HANDLE) {
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    vkDestroyBuffer(device, stagingBuffer, allocationCallbacks());
     stagingBuffer = VK_NULL_HANDLE;
   }
   if (stagingMemory != VK_NULL_HANDLE) {
-    vkFreeMemory(device, stagingMemory, nullptr);
+    vkFreeMemory(device, stagingMemory, allocationCallbacks());
     stagingMemory = VK_NULL_HANDLE;
   }
 
   if (gpuBuffer != VK_NULL_HANDLE) {
-    vkDestroyBuffer(device, gpuBuffer, nullptr);
+    vkDestroyBuffer(device, gpuBuffer, allocationCallbacks());
     gpuBuffer = VK_NULL_HANDLE;
   }
   if (gpuMemory != VK_NULL_HANDLE) {
-    vkFreeMemory(device_, gpuMemory, nullptr);
+    vkFreeMemory(device_, gpuMemory, allocationCallbacks());
     gpuMemory = VK_NULL_HANDLE;
   }
 }
@@ -0,0 +1,176 @@
+#include "vulkan_utils/frame_pacer.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace VulkanUtils {
+namespace {
+constexpr size_t maxHistory = 256;
+// Don't block forever if the window got minimized or the compositor stalls
+constexpr uint64_t presentWaitTimeoutNs = 100'000'000;
+
+using namespace std::chrono_literals;
+constexpr auto wakeGrowStep = 2ms;
+constexpr auto wakeShrinkStep = 100us;
+}
+
+FramePacer::FramePacer(const DeviceManager& devManager, const FramePacingOptions& options)
+ : devManager(devManager),
+   options(options),
+   canWaitForPresent(devManager.hasPresentWait()),
+   capInterval(options.maxFps > 0.0
+       ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / options.maxFps))
+       : Clock::duration::zero())
+{
+  presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+}
+
+void FramePacer::preciseSleepUntil(const Clock::time_point target) {
+  // OS sleeps overshoot by up to a scheduler tick, spin out the tail
+  constexpr auto spinWindow = 1500us;
+  if (target - Clock::now() > spinWindow)
+    std::this_thread::sleep_until(target - spinWindow);
+
+  while (Clock::now() < target)
+    std::this_thread::yield();
+}
+
+void FramePacer::beginFrame(const VkSwapchainKHR swapchain) {
+  Clock::time_point wakeAt = Clock::now();
+
+  if (options.justInTime && canWaitForPresent && !pending.empty()) {
+    // Block until the previous frame is on screen, that's our vsync reference
+    const PendingFrame previous = pending.back();
+    const VkResult result = devManager.waitForPresent(swapchain, previous.presentId, presentWaitTimeoutNs);
+    if (result == VK_SUCCESS) {
+      const auto presentedAt = Clock::now();
+      const bool hitTarget = targetPresent == Clock::time_point{} ||
+          presentedAt <= targetPresent + refreshPeriod / 2;
+
+      // everything older is done too
+      while (!pending.empty()) {
+        const PendingFrame frame = pending.front();
+        pending.pop_front();
+        recordPresent(frame, presentedAt, frame.presentId == previous.presentId ? hitTarget : true);
+      }
+
+      if (refreshPeriod > Clock::duration::zero()) {
+        targetPresent = lastPresent + std::max(refreshPeriod, capInterval);
+        wakeAt = std::max(wakeAt, targetPresent - wakeOffset);
+      }
+    }
+  }
+
+  if (capInterval > Clock::duration::zero() && lastFrameStart != Clock::time_point{}) {
+    const auto capTarget = lastFrameStart + capInterval;
+    // Way behind, don't try to catch up with a burst of frames
+    if (capTarget + capInterval > wakeAt)
+      wakeAt = std::max(wakeAt, capTarget);
+  }
+
+  preciseSleepUntil(wakeAt);
+
+  current = {};
+  current.presentId = nextFrameId++;
+  current.sampled = Clock::now();
+  lastFrameStart = current.sampled;
+}
+
+void FramePacer::markSubmitted() {
+  current.submitted = Clock::now();
+}
+
+void FramePacer::attachPresentId(VkPresentInfoKHR& presentInfo) {
+  if (!canWaitForPresent)
+    return;
+
+  presentIdStorage = current.presentId;
+  presentIdInfo.swapchainCount = 1;
+  presentIdInfo.pPresentIds = &presentIdStorage;
+  presentIdInfo.pNext = presentInfo.pNext;
+  presentInfo.pNext = &presentIdInfo;
+}
+
+void FramePacer::endFrame(const VkSwapchainKHR swapchain) {
+  if (!canWaitForPresent) {
+    retireWithoutPresent(current);
+    return;
+  }
+
+  pending.push_back(current);
+
+  // Non blocking poll. Timestamps here are only as good as our frame rate,
+  // the blocking wait in beginFrame is the precise one.
+  while (pending.size() > 1) {
+    const PendingFrame frame = pending.front();
+    if (devManager.waitForPresent(swapchain, frame.presentId, 0) != VK_SUCCESS)
+      break;
+
+    pending.pop_front();
+    recordPresent(frame, Clock::now(), true);
+  }
+}
+
+void FramePacer::onSwapchainRecreated() {
+  for (const auto& frame : pending)
+    retireWithoutPresent(frame);
+
+  pending.clear();
+  targetPresent = {};
+}
+
+void FramePacer::recordPresent(const PendingFrame& frame, const Clock::time_point presentedAt, const bool hitTarget) {
+  if (lastPresent != Clock::time_point{}) {
+    const auto delta = presentedAt - lastPresent;
+    // Missed vsyncs show up as multiples of the period, keep them out
+    if (refreshPeriod == Clock::duration::zero()) {
+      refreshPeriod = delta;
+      wakeOffset = refreshPeriod;
+    } else if (delta < refreshPeriod * 3 / 2 && delta > refreshPeriod / 2) {
+      refreshPeriod = (refreshPeriod * 7 + delta) / 8;
+    }
+  }
+  lastPresent = presentedAt;
+
+  if (options.justInTime && refreshPeriod > Clock::duration::zero()) {
+    const auto minOffset = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::milli>(options.minWakeMarginMs));
+    wakeOffset = hitTarget ? wakeOffset - wakeShrinkStep : wakeOffset + wakeGrowStep;
+    wakeOffset = std::clamp(wakeOffset, minOffset, std::max(minOffset, refreshPeriod));
+  }
+
+  FrameLatency latency;
+  latency.frameId = frame.presentId;
+  latency.cpuMs = toMs(frame.submitted - frame.sampled);
+  latency.presentMs = toMs(presentedAt - frame.sampled);
+  latency.presentMeasured = true;
+
+  history.push_back(latency);
+  if (history.size() > maxHistory)
+    history.pop_front();
+}
+
+void FramePacer::retireWithoutPresent(const PendingFrame& frame) {
+  FrameLatency latency;
+  latency.frameId = frame.presentId;
+  latency.cpuMs = toMs(frame.submitted - frame.sampled);
+
+  history.push_back(latency);
+  if (history.size() > maxHistory)
+    history.pop_front();
+}
+
+double FramePacer::averagePresentLatencyMs() const {
+  double total = 0.0;
+  size_t count = 0;
+  for (const auto& latency : history) {
+    if (latency.presentMeasured) {
+      total += latency.presentMs;
+      ++count;
+    }
+  }
+
+  return count ? total / count : 0.0;
+}
+
+}
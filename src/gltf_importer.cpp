@@ -0,0 +1,366 @@
+#include "mesh_importer.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+#include "json.h"
+#include "mapped_file.h"
+#include "parallel_for.h"
+
+namespace MeshImport {
+namespace {
+constexpr uint32_t glbMagic = 0x46546c67;     // "glTF"
+constexpr uint32_t glbJsonChunk = 0x4e4f534a; // "JSON"
+constexpr uint32_t glbBinChunk = 0x004e4942;  // "BIN\0"
+
+constexpr int componentByte = 5120;
+constexpr int componentUnsignedByte = 5121;
+constexpr int componentShort = 5122;
+constexpr int componentUnsignedShort = 5123;
+constexpr int componentUnsignedInt = 5125;
+constexpr int componentFloat = 5126;
+
+constexpr int modeTriangles = 4;
+
+struct BufferData {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+};
+
+// Keeps whatever backs the buffers alive (mapped files, decoded base64)
+struct GltfDocument {
+  Json::Value json;
+  std::vector<BufferData> buffers;
+
+  std::vector<std::unique_ptr<MappedFile>> mappedFiles;
+  std::vector<std::vector<uint8_t>> decoded;
+};
+
+std::string directoryOf(const std::string& path) {
+  const auto slash = path.find_last_of("/\\");
+  return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+std::vector<uint8_t> decodeBase64(const char* text, const size_t length) {
+  static const auto table = [] {
+    std::array<int8_t, 256> values{};
+    values.fill(-1);
+    const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (int i = 0; i < 64; ++i)
+      values[static_cast<uint8_t>(alphabet[i])] = static_cast<int8_t>(i);
+    return values;
+  }();
+
+  std::vector<uint8_t> out;
+  out.reserve(length / 4 * 3);
+  uint32_t bits = 0;
+  int bitCount = 0;
+  for (size_t i = 0; i < length; ++i) {
+    const int8_t value = table[static_cast<uint8_t>(text[i])];
+    if (value < 0) {
+      if (text[i] == '=')
+        break;
+      continue;
+    }
+    bits = (bits << 6) | static_cast<uint32_t>(value);
+    bitCount += 6;
+    if (bitCount >= 8) {
+      bitCount -= 8;
+      out.push_back(static_cast<uint8_t>(bits >> bitCount));
+    }
+  }
+  return out;
+}
+
+GltfDocument loadDocument(const std::string& path) {
+  GltfDocument document;
+  auto file = std::make_unique<MappedFile>(path);
+
+  BufferData glbBinary;
+  uint32_t magic = 0;
+  if (file->size() >= 12)
+    memcpy(&magic, file->data(), sizeof(magic));
+
+  if (magic == glbMagic) {
+    // 12 byte header, then chunks of {length, type, data padded to 4}
+    size_t offset = 12;
+    while (offset + 8 <= file->size()) {
+      uint32_t chunkLength, chunkType;
+      memcpy(&chunkLength, file->data() + offset, 4);
+      memcpy(&chunkType, file->data() + offset + 4, 4);
+      offset += 8;
+      if (chunkLength > file->size() - offset)
+        throw std::runtime_error("truncated glb chunk in " + path + "!");
+
+      if (chunkType == glbJsonChunk)
+        document.json = Json::parse({reinterpret_cast<const char*>(file->data() + offset), chunkLength});
+      else if (chunkType == glbBinChunk && !glbBinary.data)
+        glbBinary = {file->data() + offset, chunkLength};
+
+      offset += (chunkLength + 3) & ~size_t(3);
+    }
+  } else {
+    document.json = Json::parse({reinterpret_cast<const char*>(file->data()), file->size()});
+  }
+  document.mappedFiles.push_back(std::move(file));
+
+  if (!document.json.isObject())
+    throw std::runtime_error(path + " isn't a gltf document!");
+
+  const std::string directory = directoryOf(path);
+  for (const auto& buffer : document.json["buffers"].items()) {
+    const size_t byteLength = static_cast<size_t>(buffer["byteLength"].asNumber());
+    BufferData data;
+
+    if (!buffer.has("uri")) {
+      // glb's own binary chunk
+      data = glbBinary;
+    } else {
+      const std::string& uri = buffer["uri"].asString();
+      if (uri.compare(0, 5, "data:") == 0) {
+        const auto comma = uri.find(',');
+        if (comma == std::string::npos || uri.rfind(";base64", comma) == std::string::npos)
+          throw std::runtime_error("only base64 data uris are supported in " + path + "!");
+        document.decoded.push_back(decodeBase64(uri.data() + comma + 1, uri.size() - comma - 1));
+        data = {document.decoded.back().data(), document.decoded.back().size()};
+      } else {
+        document.mappedFiles.push_back(std::make_unique<MappedFile>(directory + percentDecode(uri)));
+        data = {document.mappedFiles.back()->data(), document.mappedFiles.back()->size()};
+      }
+    }
+
+    if (data.size < byteLength)
+      throw std::runtime_error("gltf buffer shorter than its byteLength in " + path + "!");
+    document.buffers.push_back(data);
+  }
+
+  return document;
+}
+
+int componentCountOf(const std::string& type) {
+  if (type == "SCALAR") return 1;
+  if (type == "VEC2") return 2;
+  if (type == "VEC3") return 3;
+  if (type == "VEC4") return 4;
+  throw std::runtime_error("unsupported gltf accessor type " + type);
+}
+
+size_t componentSizeOf(const int componentType) {
+  switch (componentType) {
+    case componentByte:
+    case componentUnsignedByte: return 1;
+    case componentShort:
+    case componentUnsignedShort: return 2;
+    case componentUnsignedInt:
+    case componentFloat: return 4;
+  }
+  throw std::runtime_error("unsupported gltf component type");
+}
+
+float readComponent(const uint8_t* at, const int componentType, const bool normalized) {
+  switch (componentType) {
+    case componentFloat: { float v; memcpy(&v, at, 4); return v; }
+    case componentUnsignedByte: { const uint8_t v = *at; return normalized ? v / 255.0f : v; }
+    case componentByte: { int8_t v; memcpy(&v, at, 1); return normalized ? std::max(v / 127.0f, -1.0f) : v; }
+    case componentUnsignedShort: { uint16_t v; memcpy(&v, at, 2); return normalized ? v / 65535.0f : v; }
+    case componentShort: { int16_t v; memcpy(&v, at, 2); return normalized ? std::max(v / 32767.0f, -1.0f) : v; }
+    case componentUnsignedInt: { uint32_t v; memcpy(&v, at, 4); return static_cast<float>(v); }
+  }
+  throw std::runtime_error("unsupported gltf component type");
+}
+
+// Bounds checked view of one accessor
+struct Accessor {
+  const uint8_t* base = nullptr;
+  size_t count = 0;
+  size_t stride = 0;
+  int componentType = 0;
+  int components = 0;
+  bool normalized = false;
+
+  float component(const size_t element, const int c) const {
+    return readComponent(base + element * stride + c * componentSizeOf(componentType), componentType, normalized);
+  }
+
+  uint32_t index(const size_t element) const {
+    const uint8_t* at = base + element * stride;
+    switch (componentType) {
+      case componentUnsignedByte: return *at;
+      case componentUnsignedShort: { uint16_t v; memcpy(&v, at, 2); return v; }
+      case componentUnsignedInt: { uint32_t v; memcpy(&v, at, 4); return v; }
+    }
+    throw std::runtime_error("bad gltf index component type");
+  }
+};
+
+Accessor getAccessor(const GltfDocument& document, const size_t accessorIndex) {
+  const auto& json = document.json["accessors"][accessorIndex];
+  if (!json.isObject())
+    throw std::runtime_error("gltf accessor out of range");
+  if (json.has("sparse"))
+    throw std::runtime_error("sparse gltf accessors aren't supported");
+
+  Accessor accessor;
+  accessor.count = static_cast<size_t>(json["count"].asNumber());
+  accessor.componentType = static_cast<int>(json["componentType"].asNumber());
+  accessor.components = componentCountOf(json["type"].asString());
+  accessor.normalized = json["normalized"].asBool();
+  const size_t elementSize = componentSizeOf(accessor.componentType) * accessor.components;
+
+  if (!json.has("bufferView"))
+    throw std::runtime_error("gltf accessor without a buffer view isn't supported");
+  const auto& view = document.json["bufferViews"][static_cast<size_t>(json["bufferView"].asNumber())];
+  if (!view.isObject())
+    throw std::runtime_error("gltf buffer view out of range");
+
+  const size_t bufferIndex = static_cast<size_t>(view["buffer"].asNumber());
+  if (bufferIndex >= document.buffers.size())
+    throw std::runtime_error("gltf buffer view out of range");
+
+  const BufferData& buffer = document.buffers[bufferIndex];
+  const size_t viewOffset = static_cast<size_t>(view["byteOffset"].asNumber());
+  const size_t viewLength = static_cast<size_t>(view["byteLength"].asNumber());
+  const size_t accessorOffset = static_cast<size_t>(json["byteOffset"].asNumber());
+  accessor.stride = static_cast<size_t>(view["byteStride"].asNumber(static_cast<double>(elementSize)));
+
+  // Subtracting, so nothing a corrupt file has in it can wrap around
+  const auto fits = [](const size_t offset, const size_t length, const size_t size) {
+    return offset <= size && length <= size - offset;
+  };
+  if (!fits(viewOffset, viewLength, buffer.size))
+    throw std::runtime_error("gltf accessor reads past its buffer");
+  if (accessor.count > 0) {
+    if (accessor.stride != 0 && accessor.count - 1 > (viewLength - std::min(elementSize, viewLength)) / accessor.stride)
+      throw std::runtime_error("gltf accessor reads past its buffer");
+    if (!fits(accessorOffset, (accessor.count - 1) * accessor.stride + elementSize, viewLength))
+      throw std::runtime_error("gltf accessor reads past its buffer");
+  }
+
+  accessor.base = buffer.data + viewOffset + accessorOffset;
+  return accessor;
+}
+
+struct PrimitiveResult {
+  std::vector<GraphicsTypes::Vertex> vertices;
+  std::vector<uint32_t> indices;
+  uint32_t material = 0;
+  bool hasNormals = true;
+};
+
+PrimitiveResult importPrimitive(const GltfDocument& document, const Json::Value& primitive) {
+  const auto& attributes = primitive["attributes"];
+  if (!attributes.has("POSITION"))
+    throw std::runtime_error("gltf primitive without positions");
+
+  const Accessor positions = getAccessor(document, static_cast<size_t>(attributes["POSITION"].asNumber()));
+  if (positions.components != 3)
+    throw std::runtime_error("gltf positions aren't vec3");
+
+  PrimitiveResult result;
+  result.material = static_cast<uint32_t>(primitive["material"].asNumber(0));
+  result.vertices.resize(positions.count);
+  for (size_t i = 0; i < positions.count; ++i)
+    result.vertices[i].position = {positions.component(i, 0), positions.component(i, 1), positions.component(i, 2)};
+
+  if (attributes.has("NORMAL")) {
+    const Accessor normals = getAccessor(document, static_cast<size_t>(attributes["NORMAL"].asNumber()));
+    if (normals.count != positions.count || normals.components != 3)
+      throw std::runtime_error("gltf normals don't match positions");
+    for (size_t i = 0; i < normals.count; ++i)
+      result.vertices[i].normal = {normals.component(i, 0), normals.component(i, 1), normals.component(i, 2)};
+  } else {
+    result.hasNormals = false;
+  }
+
+  if (attributes.has("TEXCOORD_0")) {
+    const Accessor texCoords = getAccessor(document, static_cast<size_t>(attributes["TEXCOORD_0"].asNumber()));
+    if (texCoords.count != positions.count || texCoords.components != 2)
+      throw std::runtime_error("gltf texcoords don't match positions");
+    // gltf is already top left origin
+    for (size_t i = 0; i < texCoords.count; ++i)
+      result.vertices[i].texCoord = {texCoords.component(i, 0), texCoords.component(i, 1)};
+  }
+
+  if (primitive.has("indices")) {
+    const Accessor indices = getAccessor(document, static_cast<size_t>(primitive["indices"].asNumber()));
+    result.indices.resize(indices.count);
+    for (size_t i = 0; i < indices.count; ++i) {
+      result.indices[i] = indices.index(i);
+      if (result.indices[i] >= positions.count)
+        throw std::runtime_error("gltf index out of range");
+    }
+  } else {
+    result.indices.resize(positions.count);
+    for (size_t i = 0; i < positions.count; ++i)
+      result.indices[i] = static_cast<uint32_t>(i);
+  }
+  result.indices.resize(result.indices.size() / 3 * 3);
+
+  return result;
+}
+}
+
+std::string percentDecode(const std::string& uri) {
+  std::string out;
+  for (size_t i = 0; i < uri.size(); ++i) {
+    if (uri[i] == '%' && i + 2 < uri.size()) {
+      out += static_cast<char>(std::stoi(uri.substr(i + 1, 2), nullptr, 16));
+      i += 2;
+    } else {
+      out += uri[i];
+    }
+  }
+  return out;
+}
+
+MeshFormat::MeshData importGltf(const std::string& path, const ImportOptions& options) {
+  const GltfDocument document = loadDocument(path);
+
+  std::vector<const Json::Value*> primitives;
+  for (const auto& mesh : document.json["meshes"].items()) {
+    for (const auto& primitive : mesh["primitives"].items()) {
+      if (primitive["mode"].asNumber(modeTriangles) != modeTriangles) {
+        std::cerr << "skipping non triangle list primitive in " << path << std::endl;
+        continue;
+      }
+      primitives.push_back(&primitive);
+    }
+  }
+
+  // Primitives are independent, decode them side by side
+  std::vector<PrimitiveResult> results(primitives.size());
+  parallelFor(primitives.size(), options.threads, [&](const size_t i) {
+    results[i] = importPrimitive(document, *primitives[i]);
+  });
+
+  MeshFormat::MeshData mesh;
+  std::vector<uint8_t> needsNormal;
+  bool anyMissingNormals = false;
+  for (const auto& result : results) {
+    const uint32_t vertexBase = static_cast<uint32_t>(mesh.vertices.size());
+    const uint32_t firstIndex = static_cast<uint32_t>(mesh.indices.size());
+
+    mesh.vertices.insert(mesh.vertices.end(), result.vertices.begin(), result.vertices.end());
+    needsNormal.insert(needsNormal.end(), result.vertices.size(), result.hasNormals ? 0 : 1);
+    anyMissingNormals |= !result.hasNormals;
+    for (const uint32_t index : result.indices)
+      mesh.indices.push_back(vertexBase + index);
+
+    mesh.submeshes.push_back({firstIndex, static_cast<uint32_t>(result.indices.size()), result.material, 0, {}});
+  }
+
+  if (options.generateNormals && anyMissingNormals)
+    generateNormals(mesh, needsNormal);
+
+  // Non indexed primitives are one vertex per corner, and exporters often
+  // split vertices per primitive for no reason
+  weldVertices(mesh, options.threads);
+
+  return mesh;
+}
+
+}
@@ -0,0 +1,296 @@
+#include "vulkan_utils/host_allocator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace VulkanUtils {
+namespace {
+std::atomic<HostAllocator*> installed{nullptr};
+std::atomic<uint64_t> generations{0};
+
+constexpr size_t slotSize(const uint32_t sizeClass) {
+  return size_t(32) << sizeClass;
+}
+
+void raise(std::atomic<uint64_t>& peak, const uint64_t value) {
+  uint64_t seen = peak.load(std::memory_order_relaxed);
+  while (seen < value && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+}
+
+} // namespace
+
+const VkAllocationCallbacks* allocationCallbacks() {
+  const HostAllocator* allocator = installed.load(std::memory_order_acquire);
+  return allocator ? allocator->getCallbacks() : nullptr;
+}
+
+// The pool this thread allocates from, handed back when the thread exits
+struct ThreadPoolCache {
+  HostAllocator* allocator = nullptr;
+  uint64_t generation = 0;
+  HostAllocator::Pool* pool = nullptr;
+
+  ~ThreadPoolCache() {
+    // Not if the allocator went first, the main thread exits after it
+    const HostAllocator* current = installed.load(std::memory_order_acquire);
+    if (pool && current == allocator && current->generation == generation)
+      allocator->releasePool(pool);
+  }
+};
+
+namespace {
+thread_local ThreadPoolCache threadPoolCache;
+} // namespace
+
+HostAllocator::HostAllocator(const HostAllocatorOptions& _options)
+  : options{_options.pooling, std::max(_options.chunkSize, slotSize(classCount - 1))},
+    generation(++generations) {
+  callbacks.pUserData = this;
+  callbacks.pfnAllocation = allocationFn;
+  callbacks.pfnReallocation = reallocationFn;
+  callbacks.pfnFree = freeFn;
+  callbacks.pfnInternalAllocation = internalAllocationFn;
+  callbacks.pfnInternalFree = internalFreeFn;
+
+  HostAllocator* expected = nullptr;
+  if (!installed.compare_exchange_strong(expected, this, std::memory_order_acq_rel))
+    throw std::runtime_error("failed to install host allocator, there already is one!");
+}
+
+HostAllocator::~HostAllocator() {
+  installed.store(nullptr, std::memory_order_release);
+  for (const auto& pool : pools)
+    for (char* chunk : pool->chunks)
+      std::free(chunk);
+}
+
+void* HostAllocator::allocationFn(
+    void* userData,
+    const size_t size,
+    const size_t alignment,
+    const VkSystemAllocationScope scope) {
+  return static_cast<HostAllocator*>(userData)->allocate(size, alignment, scope);
+}
+
+void* HostAllocator::reallocationFn(
+    void* userData,
+    void* original,
+    const size_t size,
+    const size_t alignment,
+    const VkSystemAllocationScope scope) {
+  return static_cast<HostAllocator*>(userData)->reallocate(original, size, alignment, scope);
+}
+
+void HostAllocator::freeFn(void* userData, void* memory) {
+  static_cast<HostAllocator*>(userData)->free(memory);
+}
+
+void HostAllocator::internalAllocationFn(
+    void* userData,
+    const size_t size,
+    VkInternalAllocationType /* type */,
+    const VkSystemAllocationScope scope) {
+  Counters& scopeCounters = static_cast<HostAllocator*>(userData)->counters[scope];
+  raise(scopeCounters.peakInternalBytes, scopeCounters.internalBytes.fetch_add(size, std::memory_order_relaxed) + size);
+}
+
+void HostAllocator::internalFreeFn(
+    void* userData,
+    const size_t size,
+    VkInternalAllocationType /* type */,
+    const VkSystemAllocationScope scope) {
+  static_cast<HostAllocator*>(userData)->counters[scope].internalBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+void* HostAllocator::allocate(const size_t size, const size_t alignment, const VkSystemAllocationScope scope) {
+  // Null is out of host memory to the driver
+  if (size == 0 || size > UINT32_MAX || alignment > maxAlignment)
+    return nullptr;
+
+  const bool pooled = options.pooling && size <= maxPooledSize && alignment <= headerSize &&
+      (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND || scope == VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+  Header* header;
+  if (pooled) {
+    uint32_t sizeClass = 0;
+    while (slotSize(sizeClass) - headerSize < size)
+      ++sizeClass;
+    Pool& pool = threadPool();
+    header = takeSlot(pool, sizeClass);
+    if (!header)
+      return nullptr;
+    header->pool = &pool;
+    header->offset = 0;
+    header->sizeClass = static_cast<uint8_t>(sizeClass);
+  } else {
+    // Room to slide the payload up to the alignment with the header in front
+    const size_t align = std::max(alignment, headerSize);
+    char* base = static_cast<char*>(std::malloc(size + headerSize + align));
+    if (!base)
+      return nullptr;
+    const uintptr_t payload = (reinterpret_cast<uintptr_t>(base) + headerSize + align - 1) & ~(uintptr_t(align) - 1);
+    header = reinterpret_cast<Header*>(payload - headerSize);
+    header->pool = nullptr;
+    header->offset = static_cast<uint16_t>(payload - reinterpret_cast<uintptr_t>(base));
+    header->sizeClass = 0;
+  }
+  header->size = static_cast<uint32_t>(size);
+  header->scope = static_cast<uint8_t>(scope);
+  counted(*header, pooled);
+  return reinterpret_cast<char*>(header) + headerSize;
+}
+
+void* HostAllocator::reallocate(
+    void* original,
+    const size_t size,
+    const size_t alignment,
+    const VkSystemAllocationScope scope) {
+  if (!original)
+    return allocate(size, alignment, scope);
+  if (size == 0) {
+    free(original);
+    return nullptr;
+  }
+
+  // Rare enough from drivers that it's always a fresh allocation. The
+  // original stays untouched if that fails.
+  const auto* header = reinterpret_cast<const Header*>(static_cast<char*>(original) - headerSize);
+  void* moved = allocate(size, alignment, scope);
+  if (!moved)
+    return nullptr;
+  std::memcpy(moved, original, std::min<size_t>(size, header->size));
+  free(original);
+  return moved;
+}
+
+void HostAllocator::free(void* memory) {
+  if (!memory)
+    return;
+
+  auto* header = reinterpret_cast<Header*>(static_cast<char*>(memory) - headerSize);
+  uncounted(*header);
+  Pool* pool = header->pool;
+  if (!pool) {
+    std::free(static_cast<char*>(memory) - header->offset);
+    return;
+  }
+
+  const ThreadPoolCache& cache = threadPoolCache;
+  if (cache.pool == pool && cache.generation == generation) {
+    nextOf(header) = pool->free[header->sizeClass];
+    pool->free[header->sizeClass] = header;
+    return;
+  }
+  // Someone else's, they pick it up next time they run dry
+  Header* head = pool->remote.load(std::memory_order_relaxed);
+  do {
+    nextOf(header) = head;
+  } while (!pool->remote.compare_exchange_weak(head, header, std::memory_order_release, std::memory_order_relaxed));
+}
+
+HostAllocator::Pool& HostAllocator::threadPool() {
+  ThreadPoolCache& cache = threadPoolCache;
+  if (cache.pool && cache.generation == generation)
+    return *cache.pool;
+
+  std::lock_guard<std::mutex> lock(poolsMutex);
+  if (idle.empty()) {
+    pools.push_back(std::make_unique<Pool>());
+    idle.push_back(pools.back().get());
+  }
+  cache.allocator = this;
+  cache.generation = generation;
+  cache.pool = idle.back();
+  idle.pop_back();
+  return *cache.pool;
+}
+
+void HostAllocator::releasePool(Pool* pool) {
+  std::lock_guard<std::mutex> lock(poolsMutex);
+  idle.push_back(pool);
+}
+
+HostAllocator::Header*& HostAllocator::nextOf(Header* slot) {
+  return *reinterpret_cast<Header**>(reinterpret_cast<char*>(slot) + headerSize);
+}
+
+HostAllocator::Header* HostAllocator::takeSlot(Pool& pool, const uint32_t sizeClass) {
+  if (!pool.free[sizeClass]) {
+    Header* remote = pool.remote.exchange(nullptr, std::memory_order_acquire);
+    while (remote) {
+      Header* next = nextOf(remote);
+      nextOf(remote) = pool.free[remote->sizeClass];
+      pool.free[remote->sizeClass] = remote;
+      remote = next;
+    }
+  }
+  if (Header* slot = pool.free[sizeClass]) {
+    pool.free[sizeClass] = nextOf(slot);
+    return slot;
+  }
+
+  const size_t bytes = slotSize(sizeClass);
+  if (static_cast<size_t>(pool.bumpEnd - pool.bump) < bytes) {
+    // The old chunk's tail is under a slot of the biggest class, let it go
+    char* chunk = static_cast<char*>(std::malloc(options.chunkSize));
+    if (!chunk)
+      return nullptr;
+    pool.chunks.push_back(chunk);
+    pool.bump = chunk;
+    pool.bumpEnd = chunk + options.chunkSize;
+    poolBytes.fetch_add(options.chunkSize, std::memory_order_relaxed);
+  }
+  auto* slot = reinterpret_cast<Header*>(pool.bump);
+  pool.bump += bytes;
+  return slot;
+}
+
+void HostAllocator::counted(Header& header, const bool pooled) {
+  Counters& scopeCounters = counters[header.scope];
+  raise(scopeCounters.peakBytes, scopeCounters.bytes.fetch_add(header.size, std::memory_order_relaxed) + header.size);
+  raise(peakTotal, total.fetch_add(header.size, std::memory_order_relaxed) + header.size);
+  scopeCounters.allocations.fetch_add(1, std::memory_order_relaxed);
+  scopeCounters.totalAllocations.fetch_add(1, std::memory_order_relaxed);
+  if (pooled)
+    scopeCounters.pooledAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void HostAllocator::uncounted(const Header& header) {
+  Counters& scopeCounters = counters[header.scope];
+  scopeCounters.bytes.fetch_sub(header.size, std::memory_order_relaxed);
+  scopeCounters.allocations.fetch_sub(1, std::memory_order_relaxed);
+  total.fetch_sub(header.size, std::memory_order_relaxed);
+}
+
+HostAllocator::ScopeStats HostAllocator::getStats(const VkSystemAllocationScope scope) const {
+  const Counters& scopeCounters = counters[scope];
+  ScopeStats stats;
+  stats.bytes = scopeCounters.bytes.load(std::memory_order_relaxed);
+  stats.peakBytes = scopeCounters.peakBytes.load(std::memory_order_relaxed);
+  stats.allocations = scopeCounters.allocations.load(std::memory_order_relaxed);
+  stats.totalAllocations = scopeCounters.totalAllocations.load(std::memory_order_relaxed);
+  stats.pooledAllocations = scopeCounters.pooledAllocations.load(std::memory_order_relaxed);
+  stats.internalBytes = scopeCounters.internalBytes.load(std::memory_order_relaxed);
+  stats.peakInternalBytes = scopeCounters.peakInternalBytes.load(std::memory_order_relaxed);
+  return stats;
+}
+
+const char* HostAllocator::scopeName(const VkSystemAllocationScope scope) {
+  switch (scope) {
+    case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND:
+      return "command";
+    case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT:
+      return "object";
+    case VK_SYSTEM_ALLOCATION_SCOPE_CACHE:
+      return "cache";
+    case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE:
+      return "device";
+    case VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE:
+      return "instance";
+    default:
+      return "unknown";
+  }
+}
+
+}
@@ -0,0 +1,107 @@
+#include "vulkan_utils/instance_buffer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "vulkan_utils/host_allocator.h"
+
+namespace VulkanUtils {
+
+InstanceBuffer::InstanceBuffer(DeviceManager& _devManager, const uint32_t _framesInFlight, const uint32_t initialCapacity)
+  : devManager(_devManager),
+    device(_devManager.getDevice()),
+    framesInFlight(_framesInFlight),
+    setLayout(createSetLayout(_devManager)),
+    descriptors(device, {{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1.0f}}, 4) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(devManager.getPhysicalDevice(), &properties);
+  // Whole cache lines per slice, and 32 byte InstanceData strides for the
+  // kernels' wide stores
+  alignment = std::max<VkDeviceSize>(properties.limits.minStorageBufferOffsetAlignment, 64);
+  allocate(std::max(initialCapacity, 1u));
+}
+
+InstanceBuffer::~InstanceBuffer() {
+  if (buffer != VK_NULL_HANDLE)
+    vkDestroyBuffer(device, buffer, allocationCallbacks());
+  if (memory != VK_NULL_HANDLE) {
+    vkUnmapMemory(device, memory);
+    vkFreeMemory(device, memory, allocationCallbacks());
+  }
+}
+
+InstanceData* InstanceBuffer::map(
+    const uint32_t frameIndex,
+    const uint32_t count,
+    DeferredDestructionQueue& retired,
+    const uint64_t lastUsedSerial) {
+  if (count > capacity) {
+    // Other frames' slices may still be read from
+    retired.retire(lastUsedSerial, buffer, memory);
+    buffer = VK_NULL_HANDLE;
+    memory = VK_NULL_HANDLE;
+    uint32_t newCapacity = capacity;
+    while (newCapacity < count)
+      newCapacity *= 2;
+    allocate(newCapacity);
+  }
+  currentFrame = frameIndex;
+  return reinterpret_cast<InstanceData*>(mapped + frameIndex * sliceSize);
+}
+
+void InstanceBuffer::bind(VkCommandBuffer commandBuffer, VkPipelineLayout layout, const uint32_t setIndex) const {
+  const auto offset = static_cast<uint32_t>(currentFrame * sliceSize);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, setIndex, 1, &set, 1, &offset);
+}
+
+void InstanceBuffer::allocate(const uint32_t newCapacity) {
+  capacity = newCapacity;
+  sliceSize = (capacity * sizeof(InstanceData) + alignment - 1) / alignment * alignment;
+  if (devManager.createBuffer(
+          sliceSize * framesInFlight,
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+          buffer,
+          memory) != VK_SUCCESS)
+    throw std::runtime_error("failed to create instance buffer!");
+  // Unmapped by vkFreeMemory when it's retired
+  void* data = nullptr;
+  if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS)
+    throw std::runtime_error("failed to map instance buffer!");
+  mapped = static_cast<uint8_t*>(data);
+
+  // Can't rewrite the old set, frames in flight may have it bound
+  set = descriptors.allocate(setLayout);
+  VkDescriptorBufferInfo bufferInfo{};
+  bufferInfo.buffer = buffer;
+  bufferInfo.offset = 0;
+  bufferInfo.range = sliceSize;
+
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = set;
+  write.dstBinding = 0;
+  write.dstArrayElement = 0;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+  write.descriptorCount = 1;
+  write.pBufferInfo = &bufferInfo;
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+VkDescriptorSetLayout InstanceBuffer::createSetLayout(DeviceManager& devManager) {
+  // binding 0, the frame's InstanceData
+  VkDescriptorSetLayoutBinding instanceBinding{};
+  instanceBinding.binding = 0;
+  instanceBinding.descriptorCount = 1;
+  instanceBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+  instanceBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &instanceBinding;
+
+  return devManager.getLayoutCache().get(layoutInfo);
+}
+
+}
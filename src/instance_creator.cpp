@@ -1,8 +1,11 @@
 #include "vulkan_utils/instance_creator.h"
 
+#include <algorithm>
 #include <cstring>
 #include <stdexcept>
 
+#include "vulkan_utils/host_allocator.h"
+
 namespace VulkanUtils {
 namespace {
 VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger) {
@@ -20,19 +23,29 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
 
 VulkanInstanceWrapper::VulkanInstanceWrapper(
     VulkanUtils::WindowAndSurfaceManager& windowManager,
-    const std::optional<std::vector<const char*>>& validationLayers)
+    const std::optional<std::vector<const char*>>& validationLayers,
+    const uint32_t requestedApiVersion)
  : enableValidationLayers(validationLayers && !validationLayers->empty())
 {
   if (enableValidationLayers && !checkValidationLayerSupport(*validationLayers))
     throw std::runtime_error("validation layers requested, but not available!");
 
+  // vkEnumerateInstanceVersion doesn't exist on a 1.0 loader
+  uint32_t loaderVersion = VK_API_VERSION_1_0;
+  const auto enumerateInstanceVersion =
+      (PFN_vkEnumerateInstanceVersion) vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion");
+  if (enumerateInstanceVersion)
+    enumerateInstanceVersion(&loaderVersion);
+
+  apiVersion = std::min(requestedApiVersion, loaderVersion);
+
   VkApplicationInfo appInfo{};
   appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
   appInfo.pApplicationName = "Hello Triangle";
   appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
   appInfo.pEngineName = "No Engine";
   appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  appInfo.apiVersion = apiVersion;
 
   VkInstanceCreateInfo createInfo{};
   createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -52,7 +65,7 @@ VulkanInstanceWrapper::VulkanInstanceWrapper(
       createInfo.enabledLayerCount = 0;
   }
   
-  if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS)
+  if (vkCreateInstance(&createInfo, allocationCallbacks(), &instance) != VK_SUCCESS)
     throw std::runtime_error("failed to create instance!");
   
   if (enableValidationLayers)
@@ -63,9 +76,9 @@ VulkanInstanceWrapper::VulkanInstanceWrapper(
 
 VulkanInstanceWrapper::~VulkanInstanceWrapper() {
   if (enableValidationLayers)
-    DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+    DestroyDebugUtilsMessengerEXT(instance, debugMessenger, allocationCallbacks());
   
-  vkDestroyInstance(instance, nullptr);
+  vkDestroyInstance(instance, allocationCallbacks());
 }
 
 bool VulkanInstanceWrapper::checkValidationLayerSupport(const std::vector<const char*>& validationLayers) {
@@ -102,7 +115,7 @@ void VulkanInstanceWrapper::setupDebugMessenger() {
   createInfo.pfnUserCallback = debugCallback;
   createInfo.pUserData = nullptr;
   
-  if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &debugMessenger) != VK_SUCCESS)
+  if (CreateDebugUtilsMessengerEXT(instance, &createInfo, allocationCallbacks(), &debugMessenger) != VK_SUCCESS)
     throw std::runtime_error("failed to set up debug messenger!");
 }
 
@@ -0,0 +1,278 @@
+#include "instance_kernels.h"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define INSTANCE_SSE 1
+#if defined(__GNUC__) || defined(__clang__)
+// Per function, so the rest of the build stays plain x86-64
+#define INSTANCE_AVX2 1
+#define INSTANCE_AVX2_TARGET __attribute__((target("avx2,fma")))
+#elif defined(__AVX2__)
+#define INSTANCE_AVX2 1
+#define INSTANCE_AVX2_TARGET
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define INSTANCE_NEON 1
+#endif
+
+namespace InstanceKernels {
+namespace {
+
+const glm::mat4& modelAt(const glm::mat4* models, const uint32_t* indices, const size_t i) {
+  return models[indices ? indices[i] : i];
+}
+
+InstanceMatrices& outAt(InstanceMatrices* out, const size_t outStride, const size_t i) {
+  return *reinterpret_cast<InstanceMatrices*>(reinterpret_cast<uint8_t*>(out) + i * outStride);
+}
+
+// Cofactors of the upper 3x3, i.e. the inverse transpose times the
+// determinant. The determinant's sign is taken back out, so a mirrored
+// model still gets outward normals.
+void normalMatrix(const glm::mat4& model, glm::vec4* normal) {
+  const glm::vec3 c0(model[0]), c1(model[1]), c2(model[2]);
+  const glm::vec3 n0 = glm::cross(c1, c2);
+  const float sign = glm::dot(c0, n0) < 0.0f ? -1.0f : 1.0f;
+  normal[0] = glm::vec4(n0 * sign, 0.0f);
+  normal[1] = glm::vec4(glm::cross(c2, c0) * sign, 0.0f);
+  normal[2] = glm::vec4(glm::cross(c0, c1) * sign, 0.0f);
+}
+
+void computeScalar(
+    const glm::mat4& viewProjection,
+    const glm::mat4* models,
+    const uint32_t* indices,
+    const size_t count,
+    InstanceMatrices* out,
+    const size_t outStride) {
+  for (size_t i = 0; i < count; ++i) {
+    const glm::mat4& model = modelAt(models, indices, i);
+    InstanceMatrices& target = outAt(out, outStride, i);
+    target.model = model;
+    target.modelViewProjection = viewProjection * model;
+    normalMatrix(model, target.normal);
+  }
+}
+
+#if defined(INSTANCE_SSE)
+// (a * b.yzx - a.yzx * b).yzx, w comes out 0
+inline __m128 cross(const __m128 a, const __m128 b) {
+  const __m128 aYzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+  const __m128 bYzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+  const __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYzx), _mm_mul_ps(aYzx, b));
+  return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// normalMatrix() without a branch
+inline void storeNormals(const __m128 m0, const __m128 m1, const __m128 m2, float* out) {
+  const __m128 n0 = cross(m1, m2);
+  __m128 det = _mm_mul_ps(m0, n0);
+  det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(2, 3, 0, 1)));
+  det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(1, 0, 3, 2)));
+  const __m128 sign = _mm_and_ps(det, _mm_set1_ps(-0.0f));
+  _mm_store_ps(out, _mm_xor_ps(n0, sign));
+  _mm_store_ps(out + 4, _mm_xor_ps(cross(m2, m0), sign));
+  _mm_store_ps(out + 8, _mm_xor_ps(cross(m0, m1), sign));
+}
+
+void computeSse(
+    const glm::mat4& viewProjection,
+    const glm::mat4* models,
+    const uint32_t* indices,
+    const size_t count,
+    InstanceMatrices* out,
+    const size_t outStride) {
+  const __m128 vp0 = _mm_loadu_ps(&viewProjection[0][0]);
+  const __m128 vp1 = _mm_loadu_ps(&viewProjection[1][0]);
+  const __m128 vp2 = _mm_loadu_ps(&viewProjection[2][0]);
+  const __m128 vp3 = _mm_loadu_ps(&viewProjection[3][0]);
+  for (size_t i = 0; i < count; ++i) {
+    const float* model = &modelAt(models, indices, i)[0][0];
+    float* target = &outAt(out, outStride, i).model[0][0];
+
+    __m128 columns[4];
+    for (int j = 0; j < 4; ++j) {
+      const __m128 column = _mm_loadu_ps(model + 4 * j);
+      columns[j] = column;
+      __m128 product = _mm_mul_ps(vp0, _mm_shuffle_ps(column, column, _MM_SHUFFLE(0, 0, 0, 0)));
+      product = _mm_add_ps(product, _mm_mul_ps(vp1, _mm_shuffle_ps(column, column, _MM_SHUFFLE(1, 1, 1, 1))));
+      product = _mm_add_ps(product, _mm_mul_ps(vp2, _mm_shuffle_ps(column, column, _MM_SHUFFLE(2, 2, 2, 2))));
+      product = _mm_add_ps(product, _mm_mul_ps(vp3, _mm_shuffle_ps(column, column, _MM_SHUFFLE(3, 3, 3, 3))));
+      _mm_store_ps(target + 4 * j, column);
+      _mm_store_ps(target + 16 + 4 * j, product);
+    }
+    storeNormals(columns[0], columns[1], columns[2], target + 32);
+  }
+}
+#endif
+
+#if defined(INSTANCE_AVX2)
+bool cpuHasAvx2() {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+  return true;
+#endif
+}
+
+// Two columns per op: each 128 bit lane does one, with the view projection
+// in both lanes
+INSTANCE_AVX2_TARGET
+__m256 multiplyColumns(const __m256 (&vp)[4], const __m256 columns) {
+  __m256 product = _mm256_mul_ps(vp[0], _mm256_permute_ps(columns, _MM_SHUFFLE(0, 0, 0, 0)));
+  product = _mm256_fmadd_ps(vp[1], _mm256_permute_ps(columns, _MM_SHUFFLE(1, 1, 1, 1)), product);
+  product = _mm256_fmadd_ps(vp[2], _mm256_permute_ps(columns, _MM_SHUFFLE(2, 2, 2, 2)), product);
+  return _mm256_fmadd_ps(vp[3], _mm256_permute_ps(columns, _MM_SHUFFLE(3, 3, 3, 3)), product);
+}
+
+INSTANCE_AVX2_TARGET
+void computeAvx2(
+    const glm::mat4& viewProjection,
+    const glm::mat4* models,
+    const uint32_t* indices,
+    const size_t count,
+    InstanceMatrices* out,
+    const size_t outStride) {
+  __m256 vp[4];
+  for (int j = 0; j < 4; ++j) {
+    const __m128 column = _mm_loadu_ps(&viewProjection[j][0]);
+    vp[j] = _mm256_insertf128_ps(_mm256_castps128_ps256(column), column, 1);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    const float* model = &modelAt(models, indices, i)[0][0];
+    float* target = &outAt(out, outStride, i).model[0][0];
+
+    const __m256 columns01 = _mm256_loadu_ps(model);
+    const __m256 columns23 = _mm256_loadu_ps(model + 8);
+    // Only 16 byte aligned for sure, but a 32 byte stride mostly is
+    _mm256_storeu_ps(target, columns01);
+    _mm256_storeu_ps(target + 8, columns23);
+    _mm256_storeu_ps(target + 16, multiplyColumns(vp, columns01));
+    _mm256_storeu_ps(target + 24, multiplyColumns(vp, columns23));
+    storeNormals(
+        _mm256_castps256_ps128(columns01),
+        _mm256_extractf128_ps(columns01, 1),
+        _mm256_castps256_ps128(columns23),
+        target + 32);
+  }
+}
+#endif
+
+#if defined(INSTANCE_NEON)
+void computeNeon(
+    const glm::mat4& viewProjection,
+    const glm::mat4* models,
+    const uint32_t* indices,
+    const size_t count,
+    InstanceMatrices* out,
+    const size_t outStride) {
+  const float32x4_t vp0 = vld1q_f32(&viewProjection[0][0]);
+  const float32x4_t vp1 = vld1q_f32(&viewProjection[1][0]);
+  const float32x4_t vp2 = vld1q_f32(&viewProjection[2][0]);
+  const float32x4_t vp3 = vld1q_f32(&viewProjection[3][0]);
+  for (size_t i = 0; i < count; ++i) {
+    const glm::mat4& model = modelAt(models, indices, i);
+    InstanceMatrices& target = outAt(out, outStride, i);
+    for (int j = 0; j < 4; ++j) {
+      float32x4_t product = vmulq_n_f32(vp0, model[j][0]);
+      product = vmlaq_n_f32(product, vp1, model[j][1]);
+      product = vmlaq_n_f32(product, vp2, model[j][2]);
+      product = vmlaq_n_f32(product, vp3, model[j][3]);
+      vst1q_f32(&target.model[j][0], vld1q_f32(&model[j][0]));
+      vst1q_f32(&target.modelViewProjection[j][0], product);
+    }
+    // Cross products don't shuffle well in neon
+    normalMatrix(model, target.normal);
+  }
+}
+#endif
+
+} // namespace
+
+bool supported(const Path path) {
+  switch (path) {
+    case Path::scalar:
+      return true;
+#if defined(INSTANCE_SSE)
+    case Path::sse:
+      return true;
+#endif
+#if defined(INSTANCE_AVX2)
+    case Path::avx2: {
+      static const bool hasAvx2 = cpuHasAvx2();
+      return hasAvx2;
+    }
+#endif
+#if defined(INSTANCE_NEON)
+    case Path::neon:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+Path bestPath() {
+  static const Path best = [] {
+    for (const Path path : {Path::avx2, Path::sse, Path::neon})
+      if (supported(path))
+        return path;
+    return Path::scalar;
+  }();
+  return best;
+}
+
+const char* pathName(const Path path) {
+  switch (path) {
+    case Path::scalar:
+      return "scalar";
+    case Path::sse:
+      return "sse";
+    case Path::avx2:
+      return "avx2";
+    case Path::neon:
+      return "neon";
+  }
+  return "unknown";
+}
+
+void computeMatrices(
+    const glm::mat4& viewProjection,
+    const glm::mat4* models,
+    const uint32_t* indices,
+    const size_t count,
+    InstanceMatrices* out,
+    const size_t outStride,
+    const Path path) {
+  if (!supported(path))
+    throw std::invalid_argument(std::string("instance kernel path ") + pathName(path) + " isn't supported here!");
+  if (reinterpret_cast<uintptr_t>(out) % 16 != 0 || outStride % 16 != 0)
+    throw std::invalid_argument("instance matrices have to be 16 byte aligned!");
+
+  switch (path) {
+#if defined(INSTANCE_SSE)
+    case Path::sse:
+      computeSse(viewProjection, models, indices, count, out, outStride);
+      return;
+#endif
+#if defined(INSTANCE_AVX2)
+    case Path::avx2:
+      computeAvx2(viewProjection, models, indices, count, out, outStride);
+      return;
+#endif
+#if defined(INSTANCE_NEON)
+    case Path::neon:
+      computeNeon(viewProjection, models, indices, count, out, outStride);
+      return;
+#endif
+    default:
+      computeScalar(viewProjection, models, indices, count, out, outStride);
+  }
+}
+
+}
@@ -0,0 +1,228 @@
+#include "json.h"
+
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+
+namespace Json {
+namespace {
+const Value& nullValue() {
+  static const Value value;
+  return value;
+}
+
+void appendUtf8(std::string& out, const uint32_t codepoint) {
+  if (codepoint < 0x80) {
+    out += static_cast<char>(codepoint);
+  } else if (codepoint < 0x800) {
+    out += static_cast<char>(0xc0 | (codepoint >> 6));
+    out += static_cast<char>(0x80 | (codepoint & 0x3f));
+  } else if (codepoint < 0x10000) {
+    out += static_cast<char>(0xe0 | (codepoint >> 12));
+    out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+    out += static_cast<char>(0x80 | (codepoint & 0x3f));
+  } else {
+    out += static_cast<char>(0xf0 | (codepoint >> 18));
+    out += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f));
+    out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+    out += static_cast<char>(0x80 | (codepoint & 0x3f));
+  }
+}
+}
+
+class Parser {
+ public:
+  explicit Parser(std::string_view text) : text(text) {}
+
+  Value parseDocument() {
+    Value value = parseValue(0);
+    skipWhitespace();
+    if (at != text.size())
+      fail("trailing characters");
+    return value;
+  }
+
+ private:
+  static constexpr int maxDepth = 256;
+
+  [[noreturn]] void fail(const char* what) {
+    throw std::runtime_error(std::string("bad json at byte ") + std::to_string(at) + ": " + what);
+  }
+
+  void skipWhitespace() {
+    while (at < text.size() && (text[at] == ' ' || text[at] == '\n' || text[at] == '\r' || text[at] == '\t'))
+      ++at;
+  }
+
+  bool consumeLiteral(std::string_view literal) {
+    if (text.substr(at, literal.size()) != literal)
+      return false;
+    at += literal.size();
+    return true;
+  }
+
+  void expect(const char c) {
+    skipWhitespace();
+    if (at >= text.size() || text[at] != c)
+      fail("unexpected character");
+    ++at;
+  }
+
+  uint32_t parseHex4() {
+    if (at + 4 > text.size())
+      fail("short \\u escape");
+    uint32_t value = 0;
+    const auto result = std::from_chars(text.data() + at, text.data() + at + 4, value, 16);
+    if (result.ptr != text.data() + at + 4)
+      fail("bad \\u escape");
+    at += 4;
+    return value;
+  }
+
+  std::string parseString() {
+    expect('"');
+    std::string out;
+    while (true) {
+      if (at >= text.size())
+        fail("unterminated string");
+
+      const char c = text[at++];
+      if (c == '"')
+        return out;
+      if (c != '\\') {
+        out += c;
+        continue;
+      }
+
+      if (at >= text.size())
+        fail("unterminated escape");
+      switch (text[at++]) {
+        case '"': out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '/': out += '/'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+          uint32_t codepoint = parseHex4();
+          // surrogate pair
+          if (codepoint >= 0xd800 && codepoint < 0xdc00 && consumeLiteral("\\u")) {
+            const uint32_t low = parseHex4();
+            codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+          }
+          appendUtf8(out, codepoint);
+          break;
+        }
+        default:
+          fail("unknown escape");
+      }
+    }
+  }
+
+  double parseNumber() {
+    // from_chars doesn't take a leading '+', json doesn't allow one anyway
+    double value = 0.0;
+    const auto result = std::from_chars(text.data() + at, text.data() + text.size(), value);
+    if (result.ec != std::errc())
+      fail("bad number");
+    at = result.ptr - text.data();
+    return value;
+  }
+
+  Value parseValue(const int depth) {
+    if (depth > maxDepth)
+      fail("nested too deep");
+
+    skipWhitespace();
+    if (at >= text.size())
+      fail("unexpected end");
+
+    Value value;
+    const char c = text[at];
+    if (c == '{') {
+      value.type = Value::Type::object;
+      ++at;
+      skipWhitespace();
+      if (at < text.size() && text[at] == '}') {
+        ++at;
+        return value;
+      }
+      while (true) {
+        skipWhitespace();
+        std::string key = parseString();
+        expect(':');
+        value.object.emplace_back(std::move(key), parseValue(depth + 1));
+        skipWhitespace();
+        if (at < text.size() && text[at] == ',') {
+          ++at;
+          continue;
+        }
+        expect('}');
+        return value;
+      }
+    }
+
+    if (c == '[') {
+      value.type = Value::Type::array;
+      ++at;
+      skipWhitespace();
+      if (at < text.size() && text[at] == ']') {
+        ++at;
+        return value;
+      }
+      while (true) {
+        value.array.push_back(parseValue(depth + 1));
+        skipWhitespace();
+        if (at < text.size() && text[at] == ',') {
+          ++at;
+          continue;
+        }
+        expect(']');
+        return value;
+      }
+    }
+
+    if (c == '"') {
+      value.type = Value::Type::string;
+      value.string = parseString();
+    } else if (consumeLiteral("true")) {
+      value.type = Value::Type::boolean;
+      value.boolean = true;
+    } else if (consumeLiteral("false")) {
+      value.type = Value::Type::boolean;
+    } else if (consumeLiteral("null")) {
+      value.type = Value::Type::null;
+    } else {
+      value.type = Value::Type::number;
+      value.number = parseNumber();
+    }
+
+    return value;
+  }
+
+  std::string_view text;
+  size_t at = 0;
+};
+
+const Value& Value::operator[](const std::string_view key) const {
+  for (const auto& member : object)
+    if (member.first == key)
+      return member.second;
+  return nullValue();
+}
+
+const Value& Value::operator[](const size_t index) const {
+  return index < array.size() ? array[index] : nullValue();
+}
+
+bool Value::has(const std::string_view key) const {
+  return !(*this)[key].isNull();
+}
+
+Value parse(const std::string_view text) {
+  return Parser(text).parseDocument();
+}
+
+}
@@ -0,0 +1,273 @@
+#include "ktx2.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "block_compression.h"
+
+namespace Ktx2 {
+namespace {
+constexpr uint8_t identifier[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+constexpr size_t headerSize = 80;
+constexpr size_t levelEntrySize = 24;
+
+// Data format descriptor bits, see the Khronos data format spec
+constexpr uint32_t modelRgbsda = 1;
+constexpr uint32_t modelBc1a = 128;
+constexpr uint32_t modelBc3 = 130;
+constexpr uint32_t modelBc4 = 131;
+constexpr uint32_t modelBc5 = 132;
+constexpr uint32_t modelBc7 = 134;
+constexpr uint32_t primariesBt709 = 1;
+constexpr uint32_t transferLinear = 1;
+constexpr uint32_t transferSrgb = 2;
+constexpr uint32_t channelAlpha = 15;
+
+uint32_t read32(const uint8_t* p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint64_t read64(const uint8_t* p) {
+  uint64_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+void put32(std::vector<uint8_t>& out, const uint32_t value) {
+  const size_t at = out.size();
+  out.resize(at + 4);
+  std::memcpy(out.data() + at, &value, 4);
+}
+
+void set32(std::vector<uint8_t>& out, const size_t at, const uint32_t value) { std::memcpy(out.data() + at, &value, 4); }
+void set64(std::vector<uint8_t>& out, const size_t at, const uint64_t value) { std::memcpy(out.data() + at, &value, 8); }
+
+void pad(std::vector<uint8_t>& out, const size_t alignment) {
+  out.resize((out.size() + alignment - 1) / alignment * alignment, 0);
+}
+
+struct Sample {
+  uint32_t channel;
+  uint32_t bitOffset;
+  uint32_t bitLength;
+  uint32_t upper;
+};
+
+// One basic descriptor block
+std::vector<uint8_t> dataFormatDescriptor(const VkFormat format) {
+  const BlockCompression::FormatInfo info = BlockCompression::formatInfo(format);
+  uint32_t model = 0;
+  std::vector<Sample> samples;
+  switch (format) {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+      model = modelRgbsda;
+      samples = {{0, 0, 8, 255}, {1, 8, 8, 255}, {2, 16, 8, 255}, {channelAlpha, 24, 8, 255}};
+      break;
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+      model = modelBc1a;
+      samples = {{0, 0, 64, UINT32_MAX}};
+      break;
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+      model = modelBc3;
+      samples = {{channelAlpha, 0, 64, UINT32_MAX}, {0, 64, 64, UINT32_MAX}};
+      break;
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+      model = modelBc4;
+      samples = {{0, 0, 64, UINT32_MAX}};
+      break;
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+      model = modelBc5;
+      samples = {{0, 0, 64, UINT32_MAX}, {1, 64, 64, UINT32_MAX}};
+      break;
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+      model = modelBc7;
+      samples = {{0, 0, 128, UINT32_MAX}};
+      break;
+    default: throw std::invalid_argument("can't write ktx2 format " + std::to_string(format));
+  }
+
+  const uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+  std::vector<uint8_t> out;
+  put32(out, 4 + blockSize);
+  // Khronos vendor, basic descriptor type
+  put32(out, 0);
+  // Version 2
+  put32(out, 2 | (blockSize << 16));
+  put32(out, model | (primariesBt709 << 8) | ((info.srgb ? transferSrgb : transferLinear) << 16));
+  put32(out, info.compressed ? (info.blockWidth - 1) | ((info.blockHeight - 1) << 8) : 0);
+  put32(out, info.blockBytes);
+  put32(out, 0);
+  for (const Sample& sample : samples) {
+    put32(out, sample.bitOffset | ((sample.bitLength - 1) << 16) | (sample.channel << 24));
+    put32(out, 0);
+    put32(out, 0);
+    put32(out, sample.upper);
+  }
+  return out;
+}
+}
+
+Texture::Texture(const void* _data, const size_t size, const std::string& name)
+    : data(static_cast<const uint8_t*>(_data)) {
+  if (size < headerSize || std::memcmp(data, identifier, sizeof(identifier)) != 0)
+    throw std::runtime_error(name + " is not a ktx2 file!");
+
+  format = static_cast<VkFormat>(read32(data + 12));
+  width = read32(data + 20);
+  height = read32(data + 24);
+  const uint32_t depth = read32(data + 28);
+  const uint32_t layers = read32(data + 32);
+  const uint32_t faces = read32(data + 36);
+  const uint32_t levelCount = std::max(read32(data + 40), 1u);
+  supercompression = static_cast<Supercompression>(read32(data + 44));
+
+  if (format == VK_FORMAT_UNDEFINED)
+    throw std::runtime_error(name + " is basis universal, it needs recooking to a block format!");
+  if (BlockCompression::formatInfo(format).blockBytes == 0)
+    throw std::runtime_error(name + " has an unsupported format (" + std::to_string(format) + ")!");
+  if (width == 0 || height == 0 || depth > 1 || layers > 1 || faces != 1)
+    throw std::runtime_error(name + " is not a single 2D texture!");
+  if (supercompression != Supercompression::none && supercompression != Supercompression::zlib)
+    throw std::runtime_error(name + " uses an unsupported supercompression scheme!");
+  // floor(log2(max(width, height))) + 1 down to 1x1
+  uint32_t fullChain = 1;
+  for (uint32_t extent = std::max(width, height); extent > 1; extent >>= 1)
+    ++fullChain;
+  if (levelCount > fullChain)
+    throw std::runtime_error(name + " has more mip levels than its size allows!");
+  if (headerSize + size_t(levelCount) * levelEntrySize > size)
+    throw std::runtime_error(name + " is truncated!");
+
+  levels.resize(levelCount);
+  for (uint32_t level = 0; level < levelCount; ++level) {
+    const uint8_t* entry = data + headerSize + size_t(level) * levelEntrySize;
+    levels[level].offset = read64(entry);
+    levels[level].length = read64(entry + 8);
+    if (levels[level].offset > size || levels[level].length > size - levels[level].offset)
+      throw std::runtime_error(name + " is truncated!");
+    if (supercompression == Supercompression::none && levels[level].length != levelSize(level))
+      throw std::runtime_error(name + " has a level of the wrong size!");
+    if (read64(entry + 16) != levelSize(level))
+      throw std::runtime_error(name + " has a level of the wrong size!");
+  }
+}
+
+size_t Texture::levelSize(const uint32_t level) const {
+  return BlockCompression::levelSize(format, levelWidth(level), levelHeight(level));
+}
+
+void Texture::readLevel(const uint32_t level, uint8_t* destination) const {
+  const Level& entry = levels[level];
+  if (supercompression == Supercompression::none) {
+    std::memcpy(destination, data + entry.offset, entry.length);
+    return;
+  }
+  uLongf length = static_cast<uLongf>(levelSize(level));
+  const int result = uncompress(destination, &length, data + entry.offset, static_cast<uLong>(entry.length));
+  if (result != Z_OK || length != levelSize(level))
+    throw std::runtime_error("corrupt zlib level in ktx2 file!");
+}
+
+bool canWrite(const VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK: return true;
+    default: return false;
+  }
+}
+
+std::vector<uint8_t> writeTexture(
+    const VkFormat format,
+    const uint32_t width,
+    const uint32_t height,
+    const std::vector<std::vector<uint8_t>>& levels,
+    const Supercompression supercompression,
+    const std::string& writer) {
+  if (levels.empty())
+    throw std::invalid_argument("a ktx2 texture needs at least one level");
+  if (supercompression != Supercompression::none && supercompression != Supercompression::zlib)
+    throw std::invalid_argument("can only write zlib supercompression");
+  for (size_t level = 0; level < levels.size(); ++level) {
+    const uint32_t w = std::max(width >> level, 1u);
+    const uint32_t h = std::max(height >> level, 1u);
+    if (levels[level].size() != BlockCompression::levelSize(format, w, h))
+      throw std::invalid_argument("ktx2 level " + std::to_string(level) + " has the wrong size");
+  }
+  const std::vector<uint8_t> descriptor = dataFormatDescriptor(format);
+  const uint32_t levelCount = static_cast<uint32_t>(levels.size());
+
+  std::vector<uint8_t> out(identifier, identifier + sizeof(identifier));
+  put32(out, format);
+  // typeSize, 1 for block compressed and 8 bit formats
+  put32(out, 1);
+  put32(out, width);
+  put32(out, height);
+  put32(out, 0);
+  put32(out, 0);
+  put32(out, 1);
+  put32(out, levelCount);
+  put32(out, static_cast<uint32_t>(supercompression));
+  // dfd, kvd and sgd offsets/lengths, filled in below
+  const size_t indexAt = out.size();
+  out.resize(headerSize, 0);
+  const size_t levelIndexAt = out.size();
+  out.resize(levelIndexAt + levelCount * levelEntrySize, 0);
+
+  set32(out, indexAt, static_cast<uint32_t>(out.size()));
+  set32(out, indexAt + 4, static_cast<uint32_t>(descriptor.size()));
+  out.insert(out.end(), descriptor.begin(), descriptor.end());
+
+  const size_t kvdAt = out.size();
+  const std::string key = "KTXwriter";
+  put32(out, static_cast<uint32_t>(key.size() + writer.size() + 2));
+  out.insert(out.end(), key.begin(), key.end());
+  out.push_back(0);
+  out.insert(out.end(), writer.begin(), writer.end());
+  out.push_back(0);
+  pad(out, 4);
+  set32(out, indexAt + 8, static_cast<uint32_t>(kvdAt));
+  set32(out, indexAt + 12, static_cast<uint32_t>(out.size() - kvdAt));
+
+  // Smallest level first in the file, each aligned to its block size unless
+  // supercompressed
+  const uint32_t blockBytes = BlockCompression::formatInfo(format).blockBytes;
+  const size_t alignment = supercompression == Supercompression::none ? std::max<size_t>(blockBytes, 4) : 1;
+  for (uint32_t level = levelCount; level-- > 0;) {
+    pad(out, alignment);
+    const size_t at = out.size();
+    const std::vector<uint8_t>& source = levels[level];
+    if (supercompression == Supercompression::zlib) {
+      uLongf length = compressBound(static_cast<uLong>(source.size()));
+      out.resize(at + length);
+      if (compress2(out.data() + at, &length, source.data(), static_cast<uLong>(source.size()), Z_BEST_COMPRESSION) != Z_OK)
+        throw std::runtime_error("failed to zlib compress a ktx2 level!");
+      out.resize(at + length);
+    } else {
+      out.insert(out.end(), source.begin(), source.end());
+    }
+    const size_t entry = levelIndexAt + size_t(level) * levelEntrySize;
+    set64(out, entry, at);
+    set64(out, entry + 8, out.size() - at);
+    set64(out, entry + 16, source.size());
+  }
+  return out;
+}
+
+}
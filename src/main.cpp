@@ -7,15 +7,36 @@
 #include <utility>
 #include <vector>
 #include <cstdint>
-
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+
+#include "vulkan_utils/host_allocator.h"
 #include "vulkan_utils/window_and_surface_manager.h"
 #include "vulkan_utils/instance_creator.h"
+#include "vulkan_utils/asset_streamer.h"
 #include "vulkan_utils/device_manager.h"
+#include "vulkan_utils/deferred_destruction_queue.h"
 #include "vulkan_utils/swapchain_handler.h"
 #include "vulkan_utils/traditional_graphics_pipeline.h"
 #include "vulkan_utils/sync_object_manager.h"
+#include "vulkan_utils/frame_pacer.h"
+#include "vulkan_utils/instance_buffer.h"
+#include "vulkan_utils/cluster_culling.h"
+#include "vulkan_utils/mesh_loader.h"
+#include "vulkan_utils/mip_generator.h"
+#include "vulkan_utils/texture_loader.h"
+#include "vulkan_utils/memory_manager.h"
+#include "vulkan_utils/texture_residency.h"
+#include "vulkan_utils/resource_registry.h"
 #include "vulkan_utils/vulkan_types.h"
+#include "asset_pack.h"
 #include "graphics_types.h"
+#include "lod_selector.h"
+#include "transform_hierarchy.h"
 
 namespace {
 const std::vector<const char*> validationLayers = {
@@ -26,10 +47,153 @@ const std::vector<const char*> deviceExtensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
-// Careful changing. Currently Swapchain img count is hardcoded to min + 1
-constexpr uint32_t maxInFlightFrameCount = 2;
+// Tunable per deployment from the command line. More frames in flight buys
+// throughput (cpu can run ahead), fewer buys latency.
+struct AppConfig {
+  // 1 to 3 frames of cpu lead
+  uint32_t framesInFlight = 2;
+  // 0 means let the swapchain pick (minImageCount + 1)
+  uint32_t swapchainImages = 0;
+  VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+  VulkanUtils::FramePacingOptions pacing;
+  // Prints average cpu -> present latency about once a second
+  bool reportLatency = false;
+  // No render pass / framebuffers if the device has it
+  bool dynamicRendering = false;
+  // One timeline semaphore instead of per frame fences. Needs a 1.2
+  // instance + device, falls back to the fences otherwise
+  bool timelineSemaphores = false;
+  // .vmesh (or .obj/.gltf/.glb) files to draw instead of the cube
+  std::vector<std::string> meshes;
+  // With a .vpak from assetcook --pack, meshes are entry names in it
+  std::string assetPack;
+  // .ktx2 on every model without a texture of its own, a pack entry name
+  // with a pack
+  std::string texture;
+  // MiB texture levels may take. Set, the texture's mips stream in as the
+  // models get closer instead of all loading up front.
+  uint32_t textureBudgetMb = 0;
+  // Meshes load in the background while a placeholder draws. Off loads
+  // everything before the first frame.
+  bool streaming = true;
+  // 16 byte GraphicsTypes::QuantizedVertex instead of 32 byte floats
+  bool quantizedVertices = false;
+  // Per meshlet frustum + backface culling in a compute pass
+  bool clusterCulling = false;
+  // Most simplification error a lod may put on screen. Clustered meshes
+  // always draw lod 0
+  float lodThresholdPixels = 1.0f;
+  // The driver's host memory through VulkanUtils::HostAllocator, counted per
+  // scope and pooled. Off leaves it to the driver's malloc.
+  bool hostAllocator = true;
+};
+
+VkPresentModeKHR parsePresentMode(const std::string& name) {
+  if (name == "fifo")
+    return VK_PRESENT_MODE_FIFO_KHR;
+  if (name == "fifo_relaxed")
+    return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+  if (name == "mailbox")
+    return VK_PRESENT_MODE_MAILBOX_KHR;
+  if (name == "immediate")
+    return VK_PRESENT_MODE_IMMEDIATE_KHR;
+
+  throw std::invalid_argument("unknown present mode " + name);
+}
+
+AppConfig parseArgs(int argc, char** argv) {
+  AppConfig config;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    const std::string key = arg.substr(0, eq);
+    const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+    if (key == "--frames-in-flight")
+      config.framesInFlight = std::clamp<uint32_t>(std::stoul(value), 1, 3);
+    else if (key == "--swapchain-images")
+      config.swapchainImages = static_cast<uint32_t>(std::stoul(value));
+    else if (key == "--present-mode")
+      config.presentMode = parsePresentMode(value);
+    else if (key == "--fps-cap")
+      config.pacing.maxFps = std::stod(value);
+    else if (key == "--jit")
+      config.pacing.justInTime = true;
+    else if (key == "--report-latency")
+      config.reportLatency = true;
+    else if (key == "--dynamic-rendering")
+      config.dynamicRendering = true;
+    else if (key == "--timeline-semaphores")
+      config.timelineSemaphores = true;
+    else if (key == "--mesh")
+      config.meshes.push_back(value);
+    else if (key == "--pack")
+      config.assetPack = value;
+    else if (key == "--texture")
+      config.texture = value;
+    else if (key == "--texture-budget")
+      config.textureBudgetMb = static_cast<uint32_t>(std::stoul(value));
+    else if (key == "--sync-load")
+      config.streaming = false;
+    else if (key == "--quantized-vertices")
+      config.quantizedVertices = true;
+    else if (key == "--cluster-culling")
+      config.clusterCulling = true;
+    else if (key == "--lod-threshold")
+      config.lodThresholdPixels = std::stof(value);
+    else if (key == "--driver-allocator")
+      config.hostAllocator = false;
+    else
+      std::cerr << "ignoring unknown argument " << arg << std::endl;
+  }
+
+  return config;
+}
+
+bool wantsPresentWait(const AppConfig& config) {
+  return config.pacing.justInTime || config.reportLatency;
+}
+
+uint32_t requestedApiVersion(const AppConfig& config) {
+  // Core there, the KHR extension still works on 1.2 if the loader is older
+  if (config.dynamicRendering)
+    return VK_API_VERSION_1_3;
+  if (config.timelineSemaphores)
+    return VK_API_VERSION_1_2;
+  // features2 for present wait, properties2 for the memory budget, which
+  // DeviceMemoryManager always wants. Clamped to the loader's version, a 1.0
+  // one still gets budgeting against heap sizes.
+  return VK_API_VERSION_1_1;
+}
+
+VulkanUtils::DeviceOptions makeDeviceOptions(
+    const VulkanUtils::VulkanInstanceWrapper& instance,
+    const AppConfig& config) {
+  VulkanUtils::DeviceOptions options;
+  options.apiVersion = instance.getApiVersion();
+  options.timelineSemaphores = config.timelineSemaphores;
+  options.presentWait = wantsPresentWait(config);
+  options.dynamicRendering = config.dynamicRendering;
+  options.transferQueue = config.streaming && !config.meshes.empty();
+  options.memoryBudget = true;
+  return options;
+}
+
+VulkanUtils::SwapChainOptions makeSwapChainOptions(const AppConfig& config) {
+  VulkanUtils::SwapChainOptions options;
+  options.desiredImageCount = config.swapchainImages;
+  options.presentMode = config.presentMode;
+  return options;
+}
+
+MeshFormat::VertexFormat vertexFormat(const AppConfig& config) {
+  return config.quantizedVertices ? MeshFormat::VertexFormat::quantized16 : MeshFormat::VertexFormat::float32;
+}
 
-void createCubeModel(VulkanUtils::DeviceManager& devManager, std::vector<VulkanUtils::VulkanModel>& models) {
+VulkanUtils::VulkanModel createCubeModel(
+    VulkanUtils::DeviceManager& devManager,
+    const MeshFormat::VertexFormat format,
+    const VulkanUtils::ClusterCullingPass* clusterCulling) {
   static const std::vector<GraphicsTypes::Vertex> cubeVertices = {
       { {-0.5f, -0.5f, -0.5f} },
       { {-0.5f, -0.5f,  0.5f} },
@@ -50,26 +214,84 @@ void createCubeModel(VulkanUtils::DeviceManager& devManager, std::vector<VulkanU
       0, 1, 5,  5, 4, 0,
   };
 
-  models.emplace_back(devManager, cubeVertices, cubeIndices);
+  MeshFormat::MeshData cube;
+  cube.vertices = cubeVertices;
+  cube.indices = cubeIndices;
+  return VulkanUtils::createMeshModel(devManager, cube, format, clusterCulling);
 }
 
 }
 
 class VulkanApplication {
  public:
-  VulkanApplication()
-    : instanceWrapper(windowManager, validationLayers),
-      devManager(instanceWrapper.getInstance(), windowManager.getSurface(), deviceExtensions, validationLayers),
-      swapchain(devManager, windowManager),
-      traditionalGP(devManager, swapchain),
-      syncObjects(devManager, maxInFlightFrameCount)
+  VulkanApplication(const AppConfig& _config)
+    : config(_config),
+      hostAllocator(config.hostAllocator ? std::make_unique<VulkanUtils::HostAllocator>() : nullptr),
+      instanceWrapper(
+          windowManager,
+          validationLayers,
+          requestedApiVersion(config)),
+      devManager(
+          instanceWrapper.getInstance(),
+          windowManager.getSurface(),
+          deviceExtensions,
+          validationLayers,
+          makeDeviceOptions(instanceWrapper, config)),
+      memory(devManager),
+      deferredDestruction(devManager.getDevice()),
+      swapchain(devManager, windowManager, makeSwapChainOptions(config)),
+      traditionalGP(devManager, swapchain, config.framesInFlight, config.quantizedVertices),
+      instanceBuffer(devManager, config.framesInFlight),
+      syncObjects(devManager, config.framesInFlight, swapchain.getImageCount()),
+      framePacer(devManager, config.pacing),
+      lodSelector(config.lodThresholdPixels)
   {
-    createCubeModel(devManager, models);
+    std::cout << "frames in flight: " << config.framesInFlight
+              << ", swapchain images: " << swapchain.getImageCount()
+              << ", present mode: " << swapchain.getPresentMode()
+              << ", dynamic rendering: " << swapchain.usesDynamicRendering()
+              << ", timeline semaphores: " << syncObjects.usesTimeline()
+              << ", quantized vertices: " << config.quantizedVertices
+              << ", cluster culling: " << config.clusterCulling
+              << ", streaming: " << (config.streaming && !config.meshes.empty()) << std::endl;
+    if (config.clusterCulling)
+      clusterCulling.emplace(devManager);
+    const VulkanUtils::ClusterCullingPass* culling = clusterCulling ? &*clusterCulling : nullptr;
+    if (!config.assetPack.empty())
+      assetPack.emplace(config.assetPack);
     VulkanUtils::createDummyTexture(devManager, dummyImage, dummyMemory, dummyImageView, dummySampler);
+    if (!config.texture.empty())
+      loadTexture();
+    defaultMaterial = registry.addMaterial(glm::vec4(0.0f, 1.0f, 0.0f, 1.0f), sharedTexture);
+    sceneRoot = transforms.add();
+
+    if (config.meshes.empty()) {
+      addSceneInstance(registry.addMesh(createCubeModel(devManager, vertexFormat(config), culling)));
+    } else if (config.streaming) {
+      // Stands in for everything that hasn't streamed in yet
+      placeholder = registry.addInstance(
+          registry.addMesh(createCubeModel(devManager, vertexFormat(config), culling)),
+          registry.addMaterial(glm::vec4(0.5f, 0.5f, 0.5f, 1.0f), sharedTexture));
+
+      VulkanUtils::StreamerOptions options;
+      options.vertexFormat = vertexFormat(config);
+      options.clusterCulling = culling;
+      streamer.emplace(devManager, options, assetPack ? &*assetPack : nullptr);
+      // First on the command line comes in first
+      for (size_t i = 0; i < config.meshes.size(); ++i)
+        streamed.push_back(streamer->requestMesh(config.meshes[i], static_cast<int>(config.meshes.size() - i)));
+    } else if (assetPack) {
+      for (auto& model : VulkanUtils::loadMeshModels(devManager, *assetPack, config.meshes, vertexFormat(config), culling))
+        addSceneInstance(registry.addMesh(std::move(model)));
+    } else {
+      for (const auto& path : config.meshes)
+        addSceneInstance(registry.addMesh(VulkanUtils::loadMeshModel(devManager, path, vertexFormat(config), culling)));
+    }
   }
 
   void run() {
     mainLoop();
+    reportHostMemory();
   }
 
  private:
@@ -79,29 +301,321 @@ class VulkanApplication {
       const bool enableValidationLayers = true;
   #endif
 
+  const AppConfig config;
+
+  // First in, last out. Everything vulkan allocates on the host goes through
+  // it while it's there.
+  std::unique_ptr<VulkanUtils::HostAllocator> hostAllocator;
   VulkanUtils::WindowAndSurfaceManager windowManager;
   VulkanUtils::VulkanInstanceWrapper instanceWrapper;
   VulkanUtils::DeviceManager devManager;
+  // After the device, before anything allocating from it
+  VulkanUtils::DeviceMemoryManager memory;
+  // Old swapchains etc. after a resize, unloaded meshes. Has to go before
+  // the device does
+  VulkanUtils::DeferredDestructionQueue deferredDestruction;
   VulkanUtils::SwapChainHandler swapchain;
   VulkanUtils::TraditionalGraphicsPipeline traditionalGP;
+  // What every draw of a frame reads in its shaders, see uploadInstances
+  VulkanUtils::InstanceBuffer instanceBuffer;
   VulkanUtils::SyncObjectsManager syncObjects;
-
-  std::vector<VulkanUtils::VulkanModel> models;
+  VulkanUtils::FramePacer framePacer;
+  std::optional<VulkanUtils::ClusterCullingPass> clusterCulling;
+  LodSelector lodSelector;
+
+  // Everything drawn is an instance in here. After clusterCulling, meshes
+  // use it.
+  VulkanUtils::ResourceRegistry registry;
+  VulkanUtils::MaterialHandle defaultMaterial;
+  // The --texture one, null without
+  VulkanUtils::TextureHandle sharedTexture;
+  // Grey cube while meshes are streaming in, null after. Not in transforms,
+  // it stays where it is.
+  VulkanUtils::InstanceHandle placeholder;
+  // World matrices for the instances' transform column, everything under
+  // sceneRoot. Instance of each node by its handle index.
+  TransformHierarchy transforms;
+  TransformHierarchy::Handle sceneRoot;
+  std::vector<VulkanUtils::InstanceHandle> nodeInstances;
+  // Dense instance indices drawn this frame, in draw order. Draw i's
+  // InstanceData is the i-th in instanceBuffer.
+  std::vector<uint32_t> drawn;
+  // With clusterCulling, the ClusteredMesh target each of drawn culled into
+  std::vector<uint32_t> clusterTargets;
+  std::optional<AssetPack::PackReader> assetPack;
+  // Holds models until they're taken, after clusterCulling since they use it
+  std::optional<VulkanUtils::AssetStreamer> streamer;
+  // Still loading, each becomes an instance once it's in
+  std::vector<VulkanUtils::AssetStreamer::Handle> streamed;
 
   VkImage dummyImage;
   VkDeviceMemory dummyMemory;
   VkImageView dummyImageView;
   VkSampler dummySampler;
+  std::optional<VulkanUtils::VulkanTexture> texture;
+  // Instead of texture with a budget
+  std::optional<VulkanUtils::TextureResidencyManager> residency;
+  VulkanUtils::TextureResidencyManager::Handle streamedTexture = 0;
 
   uint32_t currentFrame = 0;
 
+  void loadTexture() {
+    if (config.textureBudgetMb > 0) {
+      VulkanUtils::ResidencyOptions options;
+      options.budget = VkDeviceSize(config.textureBudgetMb) << 20;
+      residency.emplace(devManager, memory, options, assetPack ? &*assetPack : nullptr);
+      streamedTexture = residency->addTexture(config.texture);
+      // The view changes as levels come and go, see recordCommandBuffer
+      sharedTexture = registry.addTexture(residency->getView(streamedTexture), residency->getSampler());
+      std::cout << config.texture << ": " << residency->getWidth(streamedTexture) << "x"
+                << residency->getHeight(streamedTexture) << ", " << residency->getLevelCount(streamedTexture)
+                << " levels, streaming under " << config.textureBudgetMb << "MiB" << std::endl;
+      return;
+    }
+
+    const VulkanUtils::MipGenerator mips(devManager);
+    if (!assetPack) {
+      texture.emplace(VulkanUtils::loadTexture(devManager, config.texture, &mips));
+    } else {
+      // Textures are stored uncompressed in packs, so straight from the mapping
+      const AssetPack::Entry* entry = assetPack->find(config.texture);
+      if (!entry)
+        throw std::runtime_error(config.texture + " is not in " + config.assetPack + "!");
+      const uint8_t* mapped = assetPack->mappedData(*entry);
+      const std::vector<uint8_t> copy = mapped ? std::vector<uint8_t>() : assetPack->read(*entry);
+      texture.emplace(VulkanUtils::loadTexture(
+          devManager, mapped ? mapped : copy.data(), entry->size, config.texture, &mips));
+    }
+    sharedTexture = registry.addTexture(texture->getView(), texture->getSampler());
+    std::cout << config.texture << ": " << texture->getWidth() << "x" << texture->getHeight() << ", "
+              << texture->getMipLevels() << " levels, format " << texture->getFormat() << std::endl;
+  }
+
   void mainLoop() {
+    auto lastReport = std::chrono::steady_clock::now();
     while (!windowManager.windowShouldClose()) {
+      // Input gets sampled after the pacer is done sleeping
+      framePacer.beginFrame(swapchain.getSwapChain());
       windowManager.pollEvents();
       drawFrame();
+
+      const auto now = std::chrono::steady_clock::now();
+      if (config.reportLatency && now - lastReport > std::chrono::seconds(1)) {
+        lastReport = now;
+        reportLatency();
+      }
     }
 
     vkDeviceWaitIdle(devManager.getDevice());
+    deferredDestruction.flush();
+  }
+
+  // No device idle. The old swapchain keeps presenting whatever is queued on
+  // it, its views/framebuffers/present semaphores get destroyed once the last
+  // submit that could have touched them is done.
+  void recreateSwapchain() {
+    windowManager.waitWhileMinimized();
+
+    swapchain.recreate(windowManager, deferredDestruction, syncObjects.lastSubmittedSerial());
+    syncObjects.onSwapchainRecreated(swapchain.getImageCount(), deferredDestruction);
+    framePacer.onSwapchainRecreated();
+  }
+
+  void reportLatency() {
+    if (residency) {
+      const auto& stats = residency->getStats();
+      std::cout << "textures " << (stats.residentBytes >> 10) << "KiB resident (level "
+                << residency->residentLevel(streamedTexture) << "), " << stats.streamIns << " streamed in, "
+                << stats.evictions << " evicted, budget " << (residency->getBudget() >> 20) << "MiB" << std::endl;
+    }
+    for (const auto& heap : memory.getHeaps()) {
+      if (!heap.deviceLocal)
+        continue;
+      std::cout << "device heap " << (heap.usage >> 20) << "/" << (heap.budget >> 20) << "MiB, ours "
+                << (heap.usedBytes >> 20) << "MiB in " << (heap.blockBytes >> 20) << "MiB of blocks" << std::endl;
+    }
+    const auto& memoryStats = memory.getStats();
+    if (memoryStats.moves > 0)
+      std::cout << "defrag moved " << memoryStats.moves << " (" << (memoryStats.movedBytes >> 10) << "KiB), freed "
+                << memoryStats.freedBlocks << " blocks" << std::endl;
+
+    reportHostMemory();
+
+    const auto& history = framePacer.getLatencyHistory();
+    if (history.empty())
+      return;
+
+    const auto& last = history.back();
+    std::cout << "frame " << last.frameId << " cpu " << last.cpuMs << "ms";
+    if (devManager.hasPresentWait())
+      std::cout << ", avg cpu->present " << framePacer.averagePresentLatencyMs() << "ms"
+                << ", refresh " << framePacer.getRefreshPeriodMs() << "ms";
+    std::cout << std::endl;
+  }
+
+  // Per scope, KiB now/peak and how much of it came from the pools
+  void reportHostMemory() {
+    if (!hostAllocator)
+      return;
+
+    std::cout << "driver host memory";
+    for (uint32_t scope = 0; scope < VulkanUtils::HostAllocator::scopeCount; ++scope) {
+      const auto stats = hostAllocator->getStats(static_cast<VkSystemAllocationScope>(scope));
+      if (stats.totalAllocations == 0 && stats.peakInternalBytes == 0)
+        continue;
+      std::cout << ", " << VulkanUtils::HostAllocator::scopeName(static_cast<VkSystemAllocationScope>(scope)) << " "
+                << (stats.bytes >> 10) << "/" << (stats.peakBytes >> 10) << "KiB";
+      if (stats.pooledAllocations > 0)
+        std::cout << " (" << stats.pooledAllocations * 100 / stats.totalAllocations << "% pooled)";
+      if (stats.peakInternalBytes > 0)
+        std::cout << " +" << (stats.peakInternalBytes >> 10) << "KiB internal";
+    }
+    std::cout << ", peak " << (hostAllocator->getPeakBytes() >> 10) << "KiB, pools "
+              << (hostAllocator->getPoolBytes() >> 10) << "KiB" << std::endl;
+  }
+
+  // Largest scale the transform applies, and how far the viewer is from the
+  // bounding sphere (0 inside it)
+  std::pair<float, float> scaleAndDistance(const glm::mat4& m, const glm::vec4& bounds) const {
+    const float worldScale = std::max({
+        glm::length(glm::vec3(m[0].x, m[0].y, m[0].z)),
+        glm::length(glm::vec3(m[1].x, m[1].y, m[1].z)),
+        glm::length(glm::vec3(m[2].x, m[2].y, m[2].z))});
+    const glm::vec4 center = m * glm::vec4(bounds.x, bounds.y, bounds.z, 1.0f);
+    const glm::vec3 toCenter = glm::vec3(center.x, center.y, center.z) - traditionalGP.getScene().uViewerWorldPosition;
+    return {worldScale, std::max(glm::length(toCenter) - bounds.w * worldScale, 0.0f)};
+  }
+
+  // Per instance from the projected error of each level, sticky thanks to
+  // the selector's hysteresis
+  void selectLods() {
+    const auto& scene = traditionalGP.getScene();
+    const float pixelsPerUnit =
+        LodSelector::projectionScale(scene.uMat, static_cast<float>(swapchain.getExtent().height));
+
+    const auto& transforms = registry.instances.column<VulkanUtils::InstanceColumn::transform>();
+    const auto& meshes = registry.instances.column<VulkanUtils::InstanceColumn::mesh>();
+    auto& lods = registry.instances.column<VulkanUtils::InstanceColumn::lod>();
+    for (size_t i = 0; i < lods.size(); ++i) {
+      if (!registry.meshes.contains(meshes[i]))
+        continue;
+      const auto& model = registry.meshes.get<VulkanUtils::MeshColumn::model>(meshes[i]);
+      if (model.lods.size() <= 1 || model.clusters)
+        continue;
+
+      const auto [worldScale, distance] = scaleAndDistance(transforms[i], model.boundingSphere);
+      lods[i] = lodSelector.select(model.lods, lods[i], worldScale, distance, pixelsPerUnit);
+    }
+  }
+
+  // The shared texture's level from how big each instance using it is on
+  // screen, taking it as mapped once across the bounding sphere. Has to be
+  // recorded outside the render pass.
+  void streamTextures(VkCommandBuffer commandBuffer) {
+    const auto& scene = traditionalGP.getScene();
+    const float pixelsPerUnit =
+        LodSelector::projectionScale(scene.uMat, static_cast<float>(swapchain.getExtent().height));
+    const uint32_t size =
+        std::max(residency->getWidth(streamedTexture), residency->getHeight(streamedTexture));
+
+    const auto& transforms = registry.instances.column<VulkanUtils::InstanceColumn::transform>();
+    const auto& meshes = registry.instances.column<VulkanUtils::InstanceColumn::mesh>();
+    const auto& materials = registry.instances.column<VulkanUtils::InstanceColumn::material>();
+    for (size_t i = 0; i < transforms.size(); ++i) {
+      if (!registry.meshes.contains(meshes[i]) || !registry.materials.contains(materials[i]) ||
+          registry.materials.get<VulkanUtils::MaterialColumn::texture>(materials[i]) != sharedTexture)
+        continue;
+
+      const glm::vec4& bounds = registry.meshes.get<VulkanUtils::MeshColumn::bounds>(meshes[i]);
+      const auto [worldScale, distance] = scaleAndDistance(transforms[i], bounds);
+      if (distance <= 0.0f) {
+        residency->requestLevel(streamedTexture, 0);
+        continue;
+      }
+      const float screenPixels = 2.0f * bounds.w * worldScale * pixelsPerUnit / distance;
+      residency->requestLevel(
+          streamedTexture, VulkanUtils::TextureResidencyManager::levelForCoverage(size, screenPixels));
+    }
+    residency->update(commandBuffer, syncObjects.completedSerial());
+  }
+
+  // Streamed meshes that are in become instances, the placeholder goes once
+  // none are left loading. Failed ones are just dropped. Has to be recorded
+  // before anything draws, the streamer's barriers go in first.
+  void updateStreamedMeshes(VkCommandBuffer commandBuffer) {
+    if (!streamer)
+      return;
+
+    streamer->update(commandBuffer);
+    const auto arrived = std::remove_if(streamed.begin(), streamed.end(), [this](const auto handle) {
+      if (auto model = streamer->takeModel(handle)) {
+        addSceneInstance(registry.addMesh(std::move(*model)));
+        return true;
+      }
+      return streamer->getState(handle) == VulkanUtils::AssetStreamer::State::failed;
+    });
+    streamed.erase(arrived, streamed.end());
+    if (streamed.empty() && placeholder) {
+      retireInstance(placeholder);
+      placeholder = {};
+    }
+  }
+
+  // With the default material and a transform node under sceneRoot
+  TransformHierarchy::Handle addSceneInstance(const VulkanUtils::MeshHandle mesh) {
+    const auto node = transforms.add({}, sceneRoot);
+    if (nodeInstances.size() <= node.index)
+      nodeInstances.resize(node.index + 1);
+    nodeInstances[node.index] = registry.addInstance(mesh, defaultMaterial);
+    return node;
+  }
+
+  // Copies world matrices that moved into the instances, nothing when the
+  // scene stood still
+  void updateTransforms() {
+    for (const auto node : transforms.update()) {
+      // sceneRoot has none
+      if (node.index >= nodeInstances.size() || !registry.instances.contains(nodeInstances[node.index]))
+        continue;
+      registry.instances.get<VulkanUtils::InstanceColumn::transform>(nodeInstances[node.index]) = transforms.getWorld(node);
+    }
+  }
+
+  // InstanceData for every instance with its mesh and material around, the
+  // matrices in one InstanceKernels batch straight into the mapped buffer.
+  // There's no culling on the cpu, cluster culling happens after on the gpu.
+  void uploadInstances() {
+    const auto& meshes = registry.instances.column<VulkanUtils::InstanceColumn::mesh>();
+    const auto& materials = registry.instances.column<VulkanUtils::InstanceColumn::material>();
+    drawn.clear();
+    for (uint32_t i = 0; i < meshes.size(); ++i)
+      if (registry.meshes.contains(meshes[i]) && registry.materials.contains(materials[i]))
+        drawn.push_back(i);
+
+    VulkanUtils::InstanceData* instances = instanceBuffer.map(
+        currentFrame, static_cast<uint32_t>(drawn.size()), deferredDestruction, syncObjects.lastSubmittedSerial());
+    InstanceKernels::computeMatrices(
+        traditionalGP.getScene().uMat,
+        registry.instances.column<VulkanUtils::InstanceColumn::transform>().data(),
+        drawn.data(),
+        drawn.size(),
+        &instances[0].matrices,
+        sizeof(VulkanUtils::InstanceData));
+    for (size_t slot = 0; slot < drawn.size(); ++slot) {
+      const auto& model = registry.meshes.get<VulkanUtils::MeshColumn::model>(meshes[drawn[slot]]);
+      instances[slot].color = registry.materials.get<VulkanUtils::MaterialColumn::color>(materials[drawn[slot]]);
+      instances[slot].positionScale = model.positionScale;
+      instances[slot].positionOffset = model.positionOffset;
+    }
+  }
+
+  // Along with its mesh and material, once the frames that may draw them are
+  // done. Only for instances that don't share either.
+  void retireInstance(const VulkanUtils::InstanceHandle instance) {
+    const auto mesh = registry.instances.get<VulkanUtils::InstanceColumn::mesh>(instance);
+    registry.materials.remove(registry.instances.get<VulkanUtils::InstanceColumn::material>(instance));
+    registry.instances.remove(instance);
+    registry.retireMesh(mesh, deferredDestruction, syncObjects.lastSubmittedSerial());
   }
 
   void recordCommandBuffer(VkCommandBuffer commandBuffer, const uint32_t imageIndex) {
@@ -112,13 +626,40 @@ class VulkanApplication {
 
     if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
       throw std::runtime_error("failed to begin recording command buffer!");
-  
-    auto renderPassInfo = swapchain.createRenderBeginInfo(imageIndex);
-    VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    updateStreamedMeshes(commandBuffer);
+    updateTransforms();
+    selectLods();
+    if (residency)
+      streamTextures(commandBuffer);
+    // After everything writing managed resources this frame
+    memory.update(commandBuffer, syncObjects.completedSerial());
+    uploadInstances();
+
+    // Compute can't go inside the render pass
+    if (clusterCulling) {
+      // Every drawn instance of a mesh culls into a target of its own
+      std::vector<VulkanUtils::ClusterCullingPass::Request> requests;
+      std::unordered_map<const VulkanUtils::ClusteredMesh*, uint32_t> targetsUsed;
+      const auto& transforms = registry.instances.column<VulkanUtils::InstanceColumn::transform>();
+      const auto& meshes = registry.instances.column<VulkanUtils::InstanceColumn::mesh>();
+      clusterTargets.assign(drawn.size(), 0);
+      for (size_t slot = 0; slot < drawn.size(); ++slot) {
+        const uint32_t i = drawn[slot];
+        const auto& clusters = registry.meshes.get<VulkanUtils::MeshColumn::model>(meshes[i]).clusters;
+        if (!clusters)
+          continue;
+        const uint32_t target = targetsUsed[clusters.get()]++;
+        clusters->reserveTargets(target + 1);
+        clusterTargets[slot] = target;
+        requests.push_back({clusters.get(), target, transforms[i]});
+      }
+      const auto& scene = traditionalGP.getScene();
+      clusterCulling->record(commandBuffer, requests, scene.uMat, scene.uViewerWorldPosition);
+    }
+
+    VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+    swapchain.beginRendering(commandBuffer, imageIndex, clearColor);
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, traditionalGP.getPipeline());
     VkViewport viewport{};
     viewport.x = 0.0f;
@@ -136,44 +677,55 @@ class VulkanApplication {
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
     traditionalGP.bindDescriptors(commandBuffer);
-
-    for (const auto& model : models) {
-      if (model.hasTexture) {
-        // Bind texture. Technically slower and can add overhead if done many times a frame (many materials on many models).
-        vkCmdBindDescriptorSets(
-            commandBuffer,
-            VK_PIPELINE_BIND_POINT_GRAPHICS,
-            traditionalGP.getLayout(),
-            1, // position for textures
-            1,
-            &model.descriptorSet,
-            0,
-            nullptr);
-      } else {
-        traditionalGP.updateTextureDescriptorSet(dummyImageView, dummySampler);
+    instanceBuffer.bind(commandBuffer, traditionalGP.getLayout(), 2);
+
+    // A streamed texture's view is null until its tail is in
+    if (residency)
+      registry.textures.get<VulkanUtils::TextureColumn::view>(sharedTexture) = residency->getView(streamedTexture);
+
+    const auto& meshes = registry.instances.column<VulkanUtils::InstanceColumn::mesh>();
+    const auto& materials = registry.instances.column<VulkanUtils::InstanceColumn::material>();
+    const auto& lods = registry.instances.column<VulkanUtils::InstanceColumn::lod>();
+    for (uint32_t slot = 0; slot < drawn.size(); ++slot) {
+      const uint32_t i = drawn[slot];
+      const auto& model = registry.meshes.get<VulkanUtils::MeshColumn::model>(meshes[i]);
+      const auto texture = registry.materials.get<VulkanUtils::MaterialColumn::texture>(materials[i]);
+
+      VkImageView view = VK_NULL_HANDLE;
+      VkSampler sampler = VK_NULL_HANDLE;
+      if (registry.textures.contains(texture)) {
+        view = registry.textures.get<VulkanUtils::TextureColumn::view>(texture);
+        sampler = registry.textures.get<VulkanUtils::TextureColumn::sampler>(texture);
       }
+      if (view != VK_NULL_HANDLE)
+        traditionalGP.bindTexture(commandBuffer, view, sampler);
+      else
+        traditionalGP.bindTexture(commandBuffer, dummyImageView, dummySampler);
 
-      VulkanUtils::PerModelPushConstants modelPushes{
-          model.model_matrix,
-          static_cast<int>(model.hasTexture),
-          model.color
-      };
-      // could calc the full mvp here then push that. Not really sure which would be faster
+      const VulkanUtils::PerDrawPushConstants drawPushes{slot, static_cast<int>(view != VK_NULL_HANDLE)};
       vkCmdPushConstants(
           commandBuffer,
           traditionalGP.getLayout(),
           VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
           0,
-          sizeof(VulkanUtils::PerModelPushConstants),
-          &modelPushes);
+          sizeof(VulkanUtils::PerDrawPushConstants),
+          &drawPushes);
 
       VkDeviceSize offsets[] = { 0 };
       vkCmdBindVertexBuffers(commandBuffer, 0, 1, &model.vertexBuffer, offsets);
-      vkCmdBindIndexBuffer(commandBuffer, model.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-      vkCmdDrawIndexed(commandBuffer, model.indexCount, 1, 0, 0, 0);
+      if (model.clusters) {
+        const uint32_t target = clusterTargets[slot];
+        vkCmdBindIndexBuffer(commandBuffer, model.clusters->getIndexBuffer(target), 0, VK_INDEX_TYPE_UINT32);
+        vkCmdDrawIndexedIndirect(
+            commandBuffer, model.clusters->getDrawBuffer(target), 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+        continue;
+      }
+      const auto [firstIndex, indexCount] = VulkanUtils::ResourceRegistry::drawRange(model, lods[i]);
+      vkCmdBindIndexBuffer(commandBuffer, model.indexBuffer, 0, model.indexType);
+      vkCmdDrawIndexed(commandBuffer, indexCount, 1, firstIndex, 0, 0);
     }
 
-    vkCmdEndRenderPass(commandBuffer);
+    swapchain.endRendering(commandBuffer, imageIndex);
 
     if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
       throw std::runtime_error("failed to record command buffer!");
@@ -182,8 +734,9 @@ class VulkanApplication {
   void drawFrame() {
     auto& imageSyncObjects = syncObjects.get(currentFrame);
 
-    vkWaitForFences(devManager.getDevice(), 1, &imageSyncObjects.inFlight, VK_TRUE, UINT64_MAX);
-    vkResetFences(devManager.getDevice(), 1, &imageSyncObjects.inFlight);
+    syncObjects.waitForFrame(currentFrame);
+    deferredDestruction.collect(syncObjects.completedSerial());
+    traditionalGP.beginFrame(currentFrame);
 
     uint32_t imageIndex;
     auto result = vkAcquireNextImageKHR(
@@ -194,33 +747,26 @@ class VulkanApplication {
         VK_NULL_HANDLE,
         &imageIndex);
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-      throw std::runtime_error("Handle swapchain out of date!");
+      // Nothing was submitted for this frame, the slot is still free to reuse
+      recreateSwapchain();
+      return;
     } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
       throw std::runtime_error("failed to acquire swap chain image!");
     }
 
+    syncObjects.waitForImage(currentFrame, imageIndex);
+
     // switch to one buff per frame at some point
     vkResetCommandBuffer(imageSyncObjects.commandBuffer, 0);
     recordCommandBuffer(imageSyncObjects.commandBuffer, imageIndex);
 
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-    VkSemaphore waitSemaphores[] = {imageSyncObjects.imageAvailable};
-    VkSemaphore signalSemaphores[] = {imageSyncObjects.renderFinished};
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &imageSyncObjects.commandBuffer;
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = signalSemaphores;
-
-    if (vkQueueSubmit(devManager.getGraphicsQueue(), 1, &submitInfo, imageSyncObjects.inFlight) != VK_SUCCESS)
-      throw std::runtime_error("failed to submit draw command buffer!");
+    syncObjects.submitFrame(currentFrame, imageIndex, devManager.getGraphicsQueue());
+    if (residency)
+      residency->submitted(syncObjects.lastSubmittedSerial());
+    memory.submitted(syncObjects.lastSubmittedSerial());
+    framePacer.markSubmitted();
 
+    VkSemaphore signalSemaphores[] = {syncObjects.getPresentSemaphore(imageIndex)};
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     presentInfo.waitSemaphoreCount = 1;
@@ -230,17 +776,21 @@ class VulkanApplication {
     presentInfo.pSwapchains = swapChains;
     presentInfo.pImageIndices = &imageIndex;
     presentInfo.pResults = nullptr; // Optional
+    framePacer.attachPresentId(presentInfo);
     result = vkQueuePresentKHR(devManager.getPresentQueue(), &presentInfo);
+    framePacer.endFrame(swapchain.getSwapChain());
 
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
-      throw std::runtime_error("Issue with present");
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || windowManager.consumeResize())
+      recreateSwapchain();
+    else if (result != VK_SUCCESS)
+      throw std::runtime_error("failed to present swap chain image!");
 
-    currentFrame = (currentFrame + 1) % maxInFlightFrameCount;
+    currentFrame = (currentFrame + 1) % config.framesInFlight;
   }
 };
 
-int main() {
-  VulkanApplication app;
+int main(int argc, char** argv) {
+  VulkanApplication app(parseArgs(argc, argv));
 
   try {
     app.run();
@@ -0,0 +1,607 @@
+#include "vulkan_utils/memory_manager.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "vulkan_utils/host_allocator.h"
+
+namespace VulkanUtils {
+namespace {
+// Frames before a block that couldn't be emptied is tried again
+constexpr uint64_t drainRetryFrames = 300;
+
+VkDeviceSize alignUp(const VkDeviceSize value, const VkDeviceSize alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+VkImageAspectFlags aspectFor(const VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_D16_UNORM:
+    case VK_FORMAT_X8_D24_UNORM_PACK32:
+    case VK_FORMAT_D32_SFLOAT:
+      return VK_IMAGE_ASPECT_DEPTH_BIT;
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+      return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    case VK_FORMAT_S8_UINT:
+      return VK_IMAGE_ASPECT_STENCIL_BIT;
+    default:
+      return VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+}
+
+VkImageMemoryBarrier imageBarrier(
+    const VkImage image,
+    const VkImageCreateInfo& info,
+    const VkImageLayout oldLayout,
+    const VkImageLayout newLayout,
+    const VkAccessFlags srcAccess,
+    const VkAccessFlags dstAccess) {
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.oldLayout = oldLayout;
+  barrier.newLayout = newLayout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = aspectFor(info.format);
+  barrier.subresourceRange.levelCount = info.mipLevels;
+  barrier.subresourceRange.layerCount = info.arrayLayers;
+  barrier.srcAccessMask = srcAccess;
+  barrier.dstAccessMask = dstAccess;
+  return barrier;
+}
+}
+
+DeviceMemoryManager::DeviceMemoryManager(DeviceManager& _devManager, const MemoryOptions& _options)
+  : devManager(_devManager),
+    device(_devManager.getDevice()),
+    options(_options) {
+  vkGetPhysicalDeviceMemoryProperties(devManager.getPhysicalDevice(), &memoryProperties);
+  heaps.resize(memoryProperties.memoryHeapCount);
+  for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+    heaps[i].size = memoryProperties.memoryHeaps[i].size;
+    heaps[i].deviceLocal = (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+    // Where device local resources end up, the vram on a discrete card
+    if (heaps[i].deviceLocal && (pressureHeap == UINT32_MAX || heaps[i].size > heaps[pressureHeap].size))
+      pressureHeap = i;
+  }
+  refreshBudgets();
+}
+
+DeviceMemoryManager::~DeviceMemoryManager() {
+  retired.flush();
+
+  for (const Entry& entry : entries) {
+    if (!entry.live)
+      continue;
+    if (entry.buffer != VK_NULL_HANDLE)
+      vkDestroyBuffer(device, entry.buffer, allocationCallbacks());
+    if (entry.image != VK_NULL_HANDLE)
+      vkDestroyImage(device, entry.image, allocationCallbacks());
+  }
+  for (const auto& block : blocks)
+    if (block)
+      vkFreeMemory(device, block->memory, allocationCallbacks());
+}
+
+uint32_t DeviceMemoryManager::findMemoryType(const uint32_t typeFilter, const VkMemoryPropertyFlags properties) const {
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+    if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+      return i;
+
+  throw std::runtime_error("Failed to find suitable memory type!");
+}
+
+uint32_t DeviceMemoryManager::createBlock(
+    const uint32_t memoryType,
+    const VkDeviceSize size,
+    const bool images,
+    const bool dedicated) {
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = size;
+  allocInfo.memoryTypeIndex = memoryType;
+  VkDeviceMemory memory;
+  if (vkAllocateMemory(device, &allocInfo, allocationCallbacks(), &memory) != VK_SUCCESS)
+    return UINT32_MAX;
+
+  auto block = std::make_unique<Block>();
+  block->memory = memory;
+  block->size = size;
+  block->memoryType = memoryType;
+  block->images = images;
+  block->dedicated = dedicated;
+  block->free.emplace(0, size);
+  heaps[memoryProperties.memoryTypes[memoryType].heapIndex].blockBytes += size;
+  ++stats.blocks;
+
+  const auto empty = std::find(blocks.begin(), blocks.end(), nullptr);
+  if (empty != blocks.end()) {
+    *empty = std::move(block);
+    return static_cast<uint32_t>(empty - blocks.begin());
+  }
+  blocks.push_back(std::move(block));
+  return static_cast<uint32_t>(blocks.size() - 1);
+}
+
+void DeviceMemoryManager::destroyBlock(const uint32_t blockIndex) {
+  const Block& block = *blocks[blockIndex];
+  vkFreeMemory(device, block.memory, allocationCallbacks());
+  heaps[memoryProperties.memoryTypes[block.memoryType].heapIndex].blockBytes -= block.size;
+  if (block.draining)
+    ++stats.freedBlocks;
+  --stats.blocks;
+  blocks[blockIndex].reset();
+}
+
+bool DeviceMemoryManager::allocateFrom(
+    const uint32_t blockIndex,
+    const VkMemoryRequirements& requirements,
+    Allocation& allocation) {
+  Block& block = *blocks[blockIndex];
+  for (auto range = block.free.begin(); range != block.free.end(); ++range) {
+    const VkDeviceSize start = range->first;
+    const VkDeviceSize end = start + range->second;
+    const VkDeviceSize offset = alignUp(start, requirements.alignment);
+    if (offset + requirements.size > end)
+      continue;
+
+    block.free.erase(range);
+    if (offset > start)
+      block.free.emplace(start, offset - start);
+    if (offset + requirements.size < end)
+      block.free.emplace(offset + requirements.size, end - offset - requirements.size);
+    block.used += requirements.size;
+    ++block.allocations;
+    heaps[memoryProperties.memoryTypes[block.memoryType].heapIndex].usedBytes += requirements.size;
+    allocation = {blockIndex, offset, requirements.size};
+    return true;
+  }
+  return false;
+}
+
+bool DeviceMemoryManager::allocate(
+    const VkMemoryRequirements& requirements,
+    const VkMemoryPropertyFlags properties,
+    const bool images,
+    const bool allowNewBlock,
+    Allocation& allocation) {
+  const uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+
+  if (requirements.size > options.blockSize / 2) {
+    if (!allowNewBlock)
+      return false;
+    const uint32_t block = createBlock(memoryType, requirements.size, images, true);
+    return block != UINT32_MAX && allocateFrom(block, requirements, allocation);
+  }
+
+  for (uint32_t i = 0; i < blocks.size(); ++i) {
+    const Block* block = blocks[i].get();
+    if (block && !block->dedicated && !block->draining && block->memoryType == memoryType && block->images == images &&
+        block->size - block->used >= requirements.size && allocateFrom(i, requirements, allocation))
+      return true;
+  }
+  if (!allowNewBlock)
+    return false;
+
+  // Smaller blocks if the driver won't give us a whole one
+  for (VkDeviceSize size = options.blockSize; size >= requirements.size; size /= 2) {
+    const uint32_t block = createBlock(memoryType, size, images, false);
+    if (block != UINT32_MAX)
+      return allocateFrom(block, requirements, allocation);
+  }
+  return false;
+}
+
+void DeviceMemoryManager::free(const Allocation& allocation, const bool movable) {
+  Block& block = *blocks[allocation.block];
+  auto range = block.free.emplace(allocation.offset, allocation.size).first;
+  const auto next = std::next(range);
+  if (next != block.free.end() && range->first + range->second == next->first) {
+    range->second += next->second;
+    block.free.erase(next);
+  }
+  if (range != block.free.begin()) {
+    const auto previous = std::prev(range);
+    if (previous->first + previous->second == range->first) {
+      previous->second += range->second;
+      block.free.erase(range);
+    }
+  }
+  block.used -= allocation.size;
+  --block.allocations;
+  if (!movable)
+    --block.unmovable;
+  heaps[memoryProperties.memoryTypes[block.memoryType].heapIndex].usedBytes -= allocation.size;
+
+  if (block.allocations > 0)
+    return;
+  // Keep one empty block of a kind around so a resource coming and going
+  // doesn't allocate a block every time
+  bool spare = false;
+  for (const auto& other : blocks)
+    spare |= other && other.get() != &block && !other->dedicated && !other->draining &&
+        other->memoryType == block.memoryType && other->images == block.images && other->allocations == 0;
+  if (block.dedicated || block.draining || spare)
+    destroyBlock(allocation.block);
+}
+
+DeviceMemoryManager::Resource DeviceMemoryManager::newEntry() {
+  if (!freeEntries.empty()) {
+    const Resource resource = freeEntries.back();
+    freeEntries.pop_back();
+    entries[resource] = Entry{};
+    return resource;
+  }
+  entries.emplace_back();
+  return static_cast<Resource>(entries.size() - 1);
+}
+
+bool DeviceMemoryManager::createHandle(Entry& entry, const bool allowNewBlock) {
+  VkMemoryRequirements requirements;
+  bool images = false;
+  if (entry.imageInfo.sType == VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO) {
+    VkImage image;
+    if (vkCreateImage(device, &entry.imageInfo, allocationCallbacks(), &image) != VK_SUCCESS)
+      throw std::runtime_error("failed to create image!");
+    vkGetImageMemoryRequirements(device, image, &requirements);
+    images = entry.imageInfo.tiling == VK_IMAGE_TILING_OPTIMAL;
+    Allocation allocation;
+    if (!allocate(requirements, entry.properties, images, allowNewBlock, allocation)) {
+      vkDestroyImage(device, image, allocationCallbacks());
+      return false;
+    }
+    vkBindImageMemory(device, image, blocks[allocation.block]->memory, allocation.offset);
+    entry.image = image;
+    entry.allocation = allocation;
+    return true;
+  }
+
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = entry.bufferSize;
+  bufferInfo.usage = entry.bufferUsage;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  VkBuffer buffer;
+  if (vkCreateBuffer(device, &bufferInfo, allocationCallbacks(), &buffer) != VK_SUCCESS)
+    throw std::runtime_error("failed to create buffer!");
+  vkGetBufferMemoryRequirements(device, buffer, &requirements);
+  Allocation allocation;
+  if (!allocate(requirements, entry.properties, images, allowNewBlock, allocation)) {
+    vkDestroyBuffer(device, buffer, allocationCallbacks());
+    return false;
+  }
+  vkBindBufferMemory(device, buffer, blocks[allocation.block]->memory, allocation.offset);
+  entry.buffer = buffer;
+  entry.allocation = allocation;
+  return true;
+}
+
+DeviceMemoryManager::Resource DeviceMemoryManager::createBuffer(
+    const VkDeviceSize size,
+    const VkBufferUsageFlags usage,
+    const VkMemoryPropertyFlags properties,
+    std::function<void()> onMoved) {
+  const Resource resource = newEntry();
+  Entry& entry = entries[resource];
+  entry.bufferSize = size;
+  entry.bufferUsage = usage;
+  if (onMoved)
+    entry.bufferUsage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  entry.properties = properties;
+  entry.onMoved = std::move(onMoved);
+  if (!createHandle(entry, true)) {
+    freeEntries.push_back(resource);
+    throw std::runtime_error("failed to allocate buffer memory!");
+  }
+
+  entry.live = true;
+  if (!entry.onMoved)
+    ++blocks[entry.allocation.block]->unmovable;
+  ++stats.resources;
+  return resource;
+}
+
+DeviceMemoryManager::Resource DeviceMemoryManager::createImage(
+    const VkImageCreateInfo& info,
+    const VkMemoryPropertyFlags properties,
+    const VkImageLayout restingLayout,
+    std::function<void()> onMoved) {
+  if (info.pNext || info.sharingMode != VK_SHARING_MODE_EXCLUSIVE)
+    throw std::invalid_argument("only plain exclusive images can be managed");
+  if (onMoved && restingLayout == VK_IMAGE_LAYOUT_UNDEFINED)
+    throw std::invalid_argument("movable images need a layout to copy them in");
+
+  const Resource resource = newEntry();
+  Entry& entry = entries[resource];
+  entry.imageInfo = info;
+  entry.imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  if (onMoved)
+    entry.imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  entry.restingLayout = restingLayout;
+  entry.properties = properties;
+  entry.onMoved = std::move(onMoved);
+  if (!createHandle(entry, true)) {
+    freeEntries.push_back(resource);
+    throw std::runtime_error("failed to allocate image memory!");
+  }
+
+  entry.live = true;
+  if (!entry.onMoved)
+    ++blocks[entry.allocation.block]->unmovable;
+  ++stats.resources;
+  return resource;
+}
+
+void DeviceMemoryManager::release(const Resource resource) {
+  Entry& entry = entries[resource];
+  const bool movable = static_cast<bool>(entry.onMoved);
+  const VkBuffer buffer = entry.buffer;
+  const VkImage image = entry.image;
+  const Allocation allocation = entry.allocation;
+  heaps[memoryProperties.memoryTypes[blocks[allocation.block]->memoryType].heapIndex].releasedBytes += allocation.size;
+  retired.enqueuePending([this, buffer, image, allocation, movable] {
+    if (buffer != VK_NULL_HANDLE)
+      vkDestroyBuffer(device, buffer, allocationCallbacks());
+    if (image != VK_NULL_HANDLE)
+      vkDestroyImage(device, image, allocationCallbacks());
+    heaps[memoryProperties.memoryTypes[blocks[allocation.block]->memoryType].heapIndex].releasedBytes -= allocation.size;
+    free(allocation, movable);
+  });
+
+  entry = Entry{};
+  freeEntries.push_back(resource);
+  --stats.resources;
+}
+
+VkDeviceMemory DeviceMemoryManager::getMemory(const Resource resource) const {
+  return blocks[entries[resource].allocation.block]->memory;
+}
+
+uint32_t DeviceMemoryManager::addStreamingClient(
+    std::function<VkDeviceSize()> usedBytes,
+    std::function<void(VkDeviceSize)> setLimit) {
+  const uint32_t id = nextClient++;
+  clients.emplace(id, StreamingClient{std::move(usedBytes), std::move(setLimit)});
+  return id;
+}
+
+void DeviceMemoryManager::removeStreamingClient(const uint32_t id) {
+  clients.erase(id);
+}
+
+void DeviceMemoryManager::refreshBudgets() {
+  if (devManager.hasMemoryBudget()) {
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{};
+    budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+    VkPhysicalDeviceMemoryProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    properties.pNext = &budget;
+    vkGetPhysicalDeviceMemoryProperties2(devManager.getPhysicalDevice(), &properties);
+    for (uint32_t i = 0; i < heaps.size(); ++i) {
+      heaps[i].budget = budget.heapBudget[i];
+      heaps[i].usage = budget.heapUsage[i];
+    }
+    return;
+  }
+
+  // Leaves room for whatever else is running, and for what isn't ours
+  for (HeapInfo& heap : heaps) {
+    heap.budget = heap.size / 10 * 8;
+    heap.usage = heap.blockBytes;
+  }
+}
+
+void DeviceMemoryManager::applyPressure() {
+  if (pressureHeap == UINT32_MAX)
+    return;
+
+  const HeapInfo& heap = heaps[pressureHeap];
+  const auto limit = static_cast<int64_t>(static_cast<double>(heap.budget) * options.softLimit);
+  if (static_cast<int64_t>(heap.usage) > limit)
+    ++stats.overLimitFrames;
+  if (clients.empty())
+    return;
+
+  // Free space in our blocks and what's on its way out can be reused without
+  // the heap growing, less a bit that's too fragmented to. Past that, only as
+  // many new blocks as fit under the limit, or the next one tips it over.
+  const auto live = static_cast<int64_t>(heap.usedBytes - heap.releasedBytes);
+  const auto blockSize = static_cast<int64_t>(options.blockSize);
+  const int64_t spare = limit - static_cast<int64_t>(heap.usage);
+  int64_t keep = static_cast<int64_t>(heap.blockBytes) + std::max<int64_t>(spare, 0) / blockSize * blockSize;
+  if (spare < 0) {
+    // Only freeing whole blocks brings usage down. Shrink to what fits in
+    // enough fewer of them and stay there until a block actually goes.
+    keep = static_cast<int64_t>(heap.blockBytes) - (-spare + blockSize - 1) / blockSize * blockSize;
+  }
+  const int64_t headroom = std::max<int64_t>(keep - blockSize / 8, 0) - live;
+  const int64_t share = headroom / static_cast<int64_t>(clients.size());
+  for (const auto& [id, client] : clients) {
+    const int64_t allowed = static_cast<int64_t>(client.usedBytes()) + share;
+    client.setLimit(static_cast<VkDeviceSize>(std::max<int64_t>(allowed, 0)));
+  }
+}
+
+void DeviceMemoryManager::startDraining() {
+  uint32_t best = UINT32_MAX;
+  for (uint32_t i = 0; i < blocks.size(); ++i) {
+    const Block* block = blocks[i].get();
+    if (!block || block->dedicated || block->unmovable > 0 || block->allocations == 0 || frame < block->retryFrame)
+      continue;
+    // Over the soft limit the streaming clients have already shrunk, what
+    // they gave back only counts once a block goes. Any block will do then.
+    const HeapInfo& heap = heaps[memoryProperties.memoryTypes[block->memoryType].heapIndex];
+    const bool overLimit = static_cast<double>(heap.usage) > static_cast<double>(heap.budget) * options.softLimit;
+    if (!overLimit && static_cast<float>(block->used) >= static_cast<float>(block->size) * options.defragThreshold)
+      continue;
+
+    VkDeviceSize elsewhere = 0;
+    for (uint32_t j = 0; j < blocks.size(); ++j) {
+      const Block* other = blocks[j].get();
+      if (j != i && other && !other->dedicated && !other->draining && other->memoryType == block->memoryType &&
+          other->images == block->images)
+        elsewhere += other->size - other->used;
+    }
+    // With room to spare afterwards, or the next thing streamed in just
+    // allocates the block again
+    if (elsewhere < block->used + (overLimit ? 0 : options.blockSize / 4))
+      continue;
+    if (best == UINT32_MAX || block->used < blocks[best]->used)
+      best = i;
+  }
+  if (best != UINT32_MAX)
+    blocks[best]->draining = true;
+}
+
+void DeviceMemoryManager::defragment(const VkCommandBuffer commandBuffer) {
+  if (options.defragPerFrame == 0)
+    return;
+  if (std::none_of(blocks.begin(), blocks.end(), [](const auto& block) { return block && block->draining; }))
+    startDraining();
+
+  std::vector<Move> moves;
+  VkDeviceSize moved = 0;
+  for (Resource resource = 0; resource < entries.size() && moved < options.defragPerFrame; ++resource) {
+    Entry& entry = entries[resource];
+    if (!entry.live || !entry.onMoved)
+      continue;
+    Block& block = *blocks[entry.allocation.block];
+    if (!block.draining)
+      continue;
+
+    const Move move{resource, entry.buffer, entry.image};
+    const Allocation from = entry.allocation;
+    if (!createHandle(entry, false)) {
+      // Fragmented elsewhere after all, the rest stays put for now
+      block.draining = false;
+      block.retryFrame = frame + drainRetryFrames;
+      continue;
+    }
+    moves.push_back(move);
+    moved += from.size;
+    stats.movedBytes += from.size;
+    ++stats.moves;
+
+    heaps[memoryProperties.memoryTypes[block.memoryType].heapIndex].releasedBytes += from.size;
+    retired.enqueuePending([this, move, from] {
+      if (move.oldBuffer != VK_NULL_HANDLE)
+        vkDestroyBuffer(device, move.oldBuffer, allocationCallbacks());
+      if (move.oldImage != VK_NULL_HANDLE)
+        vkDestroyImage(device, move.oldImage, allocationCallbacks());
+      heaps[memoryProperties.memoryTypes[blocks[from.block]->memoryType].heapIndex].releasedBytes -= from.size;
+      free(from, true);
+    });
+  }
+
+  record(commandBuffer, moves);
+  for (const Move& move : moves)
+    entries[move.resource].onMoved();
+}
+
+void DeviceMemoryManager::record(const VkCommandBuffer commandBuffer, const std::vector<Move>& moves) {
+  if (moves.empty())
+    return;
+
+  // Whatever wrote them earlier, in this frame or before
+  std::vector<VkImageMemoryBarrier> toTransfer;
+  std::vector<VkImageMemoryBarrier> toResting;
+  for (const Move& move : moves) {
+    const Entry& entry = entries[move.resource];
+    if (move.oldImage == VK_NULL_HANDLE)
+      continue;
+    toTransfer.push_back(imageBarrier(
+        move.oldImage,
+        entry.imageInfo,
+        entry.restingLayout,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_ACCESS_MEMORY_WRITE_BIT,
+        VK_ACCESS_TRANSFER_READ_BIT));
+    toTransfer.push_back(imageBarrier(
+        entry.image,
+        entry.imageInfo,
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        0,
+        VK_ACCESS_TRANSFER_WRITE_BIT));
+    toResting.push_back(imageBarrier(
+        entry.image,
+        entry.imageInfo,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        entry.restingLayout,
+        VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT));
+  }
+
+  VkMemoryBarrier before{};
+  before.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  before.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+  before.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      0,
+      1, &before,
+      0, nullptr,
+      static_cast<uint32_t>(toTransfer.size()), toTransfer.data());
+
+  for (const Move& move : moves) {
+    const Entry& entry = entries[move.resource];
+    if (move.oldBuffer != VK_NULL_HANDLE) {
+      const VkBufferCopy copy{0, 0, entry.bufferSize};
+      vkCmdCopyBuffer(commandBuffer, move.oldBuffer, entry.buffer, 1, &copy);
+      continue;
+    }
+
+    const VkImageCreateInfo& info = entry.imageInfo;
+    std::vector<VkImageCopy> levels;
+    for (uint32_t level = 0; level < info.mipLevels; ++level) {
+      VkImageCopy copy{};
+      copy.srcSubresource = {aspectFor(info.format), level, 0, info.arrayLayers};
+      copy.dstSubresource = copy.srcSubresource;
+      copy.extent = {
+          std::max(info.extent.width >> level, 1u),
+          std::max(info.extent.height >> level, 1u),
+          std::max(info.extent.depth >> level, 1u)};
+      levels.push_back(copy);
+    }
+    vkCmdCopyImage(
+        commandBuffer,
+        move.oldImage,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        entry.image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(levels.size()),
+        levels.data());
+  }
+
+  VkMemoryBarrier after{};
+  after.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  after.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  after.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+      0,
+      1, &after,
+      0, nullptr,
+      static_cast<uint32_t>(toResting.size()), toResting.data());
+}
+
+void DeviceMemoryManager::update(const VkCommandBuffer commandBuffer, const uint64_t completedSerial) {
+  retired.collect(completedSerial);
+  refreshBudgets();
+  applyPressure();
+  defragment(commandBuffer);
+  ++frame;
+}
+
+void DeviceMemoryManager::submitted(const uint64_t serial) {
+  retired.submitted(serial);
+}
+
+}
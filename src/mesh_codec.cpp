@@ -0,0 +1,496 @@
+#include "mesh_codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MESH_CODEC_SSE2 1
+#endif
+
+namespace MeshCodec {
+namespace {
+constexpr uint8_t vertexHeader = 0xa1;
+constexpr uint8_t indexHeader = 0xe1;
+constexpr size_t maxBlockVertices = 256;
+constexpr size_t groupSize = 16;
+// A block's transposed channels fit in L1 for any stride
+constexpr size_t blockBytesTarget = 8192;
+constexpr uint32_t fifoSize = 16;
+
+size_t blockVertexCount(const size_t stride) {
+  return std::min(maxBlockVertices, std::max(groupSize, blockBytesTarget / stride / groupSize * groupSize));
+}
+
+// Bytes of payload per group for each 2 bit selector
+constexpr size_t groupBytes[4] = {0, 4, 8, 16};
+
+uint8_t zigzag8(const uint8_t delta) {
+  return static_cast<uint8_t>((delta << 1) ^ static_cast<uint8_t>(static_cast<int8_t>(delta) >> 7));
+}
+
+#ifndef MESH_CODEC_SSE2
+uint8_t unzigzag8(const uint8_t value) {
+  return static_cast<uint8_t>((value >> 1) ^ static_cast<uint8_t>(-(value & 1)));
+}
+#endif
+
+// Values are stored planar so the decoder only needs shifts and masks:
+// 2 bit byte j holds values j, j+4, j+8, j+12 from the low bits up, 4 bit
+// byte j holds j in the low nibble and j+8 in the high one
+void encodeGroup(const uint8_t* values, const uint32_t selector, std::vector<uint8_t>& out) {
+  if (selector == 1) {
+    for (int j = 0; j < 4; ++j)
+      out.push_back(static_cast<uint8_t>(values[j] | (values[j + 4] << 2) | (values[j + 8] << 4) | (values[j + 12] << 6)));
+  } else if (selector == 2) {
+    for (int j = 0; j < 8; ++j)
+      out.push_back(static_cast<uint8_t>(values[j] | (values[j + 8] << 4)));
+  } else if (selector == 3) {
+    out.insert(out.end(), values, values + groupSize);
+  }
+}
+
+// Caller has checked the group's bytes are there
+const uint8_t* decodeGroup(const uint8_t* data, const uint32_t selector, uint8_t* values) {
+#ifdef MESH_CODEC_SSE2
+  __m128i result;
+  switch (selector) {
+    case 0:
+      result = _mm_setzero_si128();
+      break;
+    case 1: {
+      uint32_t packed;
+      std::memcpy(&packed, data, sizeof(packed));
+      const __m128i bits = _mm_cvtsi32_si128(static_cast<int>(packed));
+      const __m128i mask = _mm_set1_epi8(3);
+      result = _mm_or_si128(
+          _mm_or_si128(_mm_and_si128(bits, mask), _mm_slli_si128(_mm_and_si128(_mm_srli_epi16(bits, 2), mask), 4)),
+          _mm_or_si128(
+              _mm_slli_si128(_mm_and_si128(_mm_srli_epi16(bits, 4), mask), 8),
+              _mm_slli_si128(_mm_and_si128(_mm_srli_epi16(bits, 6), mask), 12)));
+      break;
+    }
+    case 2: {
+      const __m128i bits = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(data));
+      const __m128i mask = _mm_set1_epi8(15);
+      result = _mm_or_si128(_mm_and_si128(bits, mask), _mm_slli_si128(_mm_and_si128(_mm_srli_epi16(bits, 4), mask), 8));
+      break;
+    }
+    default:
+      result = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+      break;
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(values), result);
+#else
+  switch (selector) {
+    case 0:
+      std::memset(values, 0, groupSize);
+      break;
+    case 1:
+      for (int j = 0; j < 4; ++j)
+        for (int k = 0; k < 4; ++k)
+          values[j + 4 * k] = (data[j] >> (2 * k)) & 3;
+      break;
+    case 2:
+      for (int j = 0; j < 8; ++j) {
+        values[j] = data[j] & 15;
+        values[j + 8] = data[j] >> 4;
+      }
+      break;
+    default:
+      std::memcpy(values, data, groupSize);
+      break;
+  }
+#endif
+  return data + groupBytes[selector];
+}
+
+// Rebuilds vertices [0, count) of a block from zigzagged deltas, channel k at
+// channels + k * maxBlockVertices. last carries each channel's previous byte.
+void reconstructBlock(
+    const uint8_t* channels,
+    const size_t count,
+    const size_t stride,
+    uint8_t* last,
+    uint8_t* destination) {
+#ifdef MESH_CODEC_SSE2
+  // Four channels by sixteen vertices at a time: undo the zigzag, prefix sum
+  // across the vertices, transpose back to 4 byte columns
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i low7 = _mm_set1_epi8(0x7f);
+  const auto decodeLane = [&](const size_t channel, const size_t first) {
+    const __m128i delta = _mm_loadu_si128(reinterpret_cast<const __m128i*>(channels + channel * maxBlockVertices + first));
+    __m128i value = _mm_xor_si128(
+        _mm_and_si128(_mm_srli_epi16(delta, 1), low7), _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(delta, one)));
+    value = _mm_add_epi8(value, _mm_slli_si128(value, 1));
+    value = _mm_add_epi8(value, _mm_slli_si128(value, 2));
+    value = _mm_add_epi8(value, _mm_slli_si128(value, 4));
+    value = _mm_add_epi8(value, _mm_slli_si128(value, 8));
+    return _mm_add_epi8(value, _mm_set1_epi8(static_cast<char>(last[channel])));
+  };
+
+  for (size_t channel = 0; channel < stride; channel += 4) {
+    for (size_t first = 0; first < count; first += groupSize) {
+      __m128i lanes[4];
+      for (size_t j = 0; j < 4; ++j)
+        lanes[j] = decodeLane(channel + j, first);
+
+      const size_t valid = std::min(groupSize, count - first);
+      if (valid == groupSize) {
+        for (size_t j = 0; j < 4; ++j)
+          last[channel + j] = static_cast<uint8_t>(_mm_extract_epi16(lanes[j], 7) >> 8);
+      } else {
+        alignas(16) uint8_t tail[groupSize];
+        for (size_t j = 0; j < 4; ++j) {
+          _mm_store_si128(reinterpret_cast<__m128i*>(tail), lanes[j]);
+          last[channel + j] = tail[valid - 1];
+        }
+      }
+
+      const __m128i t0 = _mm_unpacklo_epi8(lanes[0], lanes[1]);
+      const __m128i t1 = _mm_unpackhi_epi8(lanes[0], lanes[1]);
+      const __m128i t2 = _mm_unpacklo_epi8(lanes[2], lanes[3]);
+      const __m128i t3 = _mm_unpackhi_epi8(lanes[2], lanes[3]);
+      __m128i rows[4] = {
+          _mm_unpacklo_epi16(t0, t2), _mm_unpackhi_epi16(t0, t2), _mm_unpacklo_epi16(t1, t3), _mm_unpackhi_epi16(t1, t3)};
+
+      uint8_t* out = destination + first * stride + channel;
+      const auto store = [out, stride](const size_t v, const __m128i row) {
+        const int column = _mm_cvtsi128_si32(row);
+        std::memcpy(out + v * stride, &column, sizeof(column));
+      };
+      if (valid == groupSize) {
+        for (size_t r = 0; r < 4; ++r) {
+          store(r * 4, rows[r]);
+          store(r * 4 + 1, _mm_shuffle_epi32(rows[r], 1));
+          store(r * 4 + 2, _mm_shuffle_epi32(rows[r], 2));
+          store(r * 4 + 3, _mm_shuffle_epi32(rows[r], 3));
+        }
+      } else {
+        for (size_t v = 0; v < valid; ++v) {
+          __m128i& row = rows[v / 4];
+          store(v, row);
+          row = _mm_srli_si128(row, 4);
+        }
+      }
+    }
+  }
+#else
+  for (size_t channel = 0; channel < stride; ++channel) {
+    uint8_t value = last[channel];
+    for (size_t v = 0; v < count; ++v) {
+      value = static_cast<uint8_t>(value + unzigzag8(channels[channel * maxBlockVertices + v]));
+      destination[v * stride + channel] = value;
+    }
+    last[channel] = value;
+  }
+#endif
+}
+
+void writeVarint(uint32_t value, std::vector<uint8_t>& out) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+uint32_t readVarint(const uint8_t*& data, const uint8_t* end) {
+  uint32_t value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (data >= end)
+      throw std::runtime_error("truncated index stream!");
+    const uint8_t byte = *data++;
+    value |= uint32_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return value;
+  }
+  throw std::runtime_error("bad varint in index stream!");
+}
+
+uint32_t zigzag32(const uint32_t delta) {
+  return (delta << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(delta) >> 31);
+}
+
+uint32_t unzigzag32(const uint32_t value) {
+  return (value >> 1) ^ (0u - (value & 1));
+}
+
+// Shared by both sides so they can't drift apart
+struct IndexState {
+  uint32_t edges[fifoSize][2] = {};
+  uint32_t edgeCount = 0;
+  uint32_t vertices[fifoSize] = {};
+  uint32_t vertexCount = 0;
+  uint32_t next = 0;
+  uint32_t last = 0;
+
+  void pushEdge(const uint32_t a, const uint32_t b) {
+    edges[edgeCount % fifoSize][0] = a;
+    edges[edgeCount % fifoSize][1] = b;
+    ++edgeCount;
+  }
+  // distance 0 is the newest
+  const uint32_t* edge(const uint32_t distance) const { return edges[(edgeCount - 1 - distance) % fifoSize]; }
+  uint32_t edgesAvailable() const { return std::min(edgeCount, fifoSize - 1); }
+
+  void pushVertex(const uint32_t v) { vertices[vertexCount++ % fifoSize] = v; }
+  uint32_t vertex(const uint32_t distance) const { return vertices[(vertexCount - 1 - distance) % fifoSize]; }
+  // Codes 1..14 address the vertex fifo
+  uint32_t verticesAvailable() const { return std::min(vertexCount, fifoSize - 2); }
+};
+}
+
+std::vector<uint8_t> encodeVertexBuffer(const void* vertices, const size_t vertexCount, const size_t stride) {
+  if (stride == 0 || stride % 4 != 0 || stride > 256)
+    throw std::invalid_argument("vertex stride must be a multiple of 4 up to 256!");
+
+  const uint8_t* source = static_cast<const uint8_t*>(vertices);
+  std::vector<uint8_t> out;
+  out.reserve(vertexCount * stride / 2 + 16);
+  out.push_back(vertexHeader);
+
+  const size_t blockVertices = blockVertexCount(stride);
+  uint8_t last[256] = {};
+  uint8_t deltas[maxBlockVertices];
+  std::vector<uint8_t> payload;
+
+  for (size_t first = 0; first < vertexCount; first += blockVertices) {
+    const size_t count = std::min(blockVertices, vertexCount - first);
+    const size_t groups = (count + groupSize - 1) / groupSize;
+
+    for (size_t channel = 0; channel < stride; ++channel) {
+      std::memset(deltas, 0, sizeof(deltas));
+      uint8_t previous = last[channel];
+      for (size_t v = 0; v < count; ++v) {
+        const uint8_t value = source[(first + v) * stride + channel];
+        deltas[v] = zigzag8(static_cast<uint8_t>(value - previous));
+        previous = value;
+      }
+      last[channel] = previous;
+
+      const size_t selectorOffset = out.size();
+      out.resize(out.size() + (groups + 3) / 4, 0);
+      payload.clear();
+      for (size_t group = 0; group < groups; ++group) {
+        const uint8_t* values = deltas + group * groupSize;
+        const uint8_t largest = *std::max_element(values, values + groupSize);
+        const uint32_t selector = largest == 0 ? 0 : largest < 4 ? 1 : largest < 16 ? 2 : 3;
+        out[selectorOffset + group / 4] |= static_cast<uint8_t>(selector << (2 * (group % 4)));
+        encodeGroup(values, selector, payload);
+      }
+      out.insert(out.end(), payload.begin(), payload.end());
+    }
+  }
+  return out;
+}
+
+void decodeVertexBuffer(void* destination, const size_t vertexCount, const size_t stride, const uint8_t* data, const size_t size) {
+  if (stride == 0 || stride % 4 != 0 || stride > 256)
+    throw std::invalid_argument("vertex stride must be a multiple of 4 up to 256!");
+  if (size < 1 || data[0] != vertexHeader)
+    throw std::runtime_error("not an encoded vertex stream!");
+
+  const uint8_t* read = data + 1;
+  const uint8_t* const end = data + size;
+  uint8_t* out = static_cast<uint8_t*>(destination);
+
+  const size_t blockVertices = blockVertexCount(stride);
+  uint8_t last[256] = {};
+  // Group decode writes whole groups, so the channel rows are padded
+  alignas(16) static thread_local uint8_t channels[256 * maxBlockVertices];
+
+  for (size_t first = 0; first < vertexCount; first += blockVertices) {
+    const size_t count = std::min(blockVertices, vertexCount - first);
+    const size_t groups = (count + groupSize - 1) / groupSize;
+    const size_t selectorBytes = (groups + 3) / 4;
+
+    for (size_t channel = 0; channel < stride; ++channel) {
+      if (size_t(end - read) < selectorBytes)
+        throw std::runtime_error("truncated vertex stream!");
+      const uint8_t* selectors = read;
+      read += selectorBytes;
+      // Whole selector bytes get decoded below, padding groups past the
+      // block's last vertex have to be zero (no payload) for that
+      if (groups % 4 != 0 && (selectors[selectorBytes - 1] >> (2 * (groups % 4))) != 0)
+        throw std::runtime_error("corrupt vertex stream!");
+
+      // Only near the end of the stream is it worth adding up exactly
+      if (size_t(end - read) < groups * groupSize) {
+        size_t payloadBytes = 0;
+        for (size_t group = 0; group < groups; ++group)
+          payloadBytes += groupBytes[(selectors[group / 4] >> (2 * (group % 4))) & 3];
+        if (size_t(end - read) < payloadBytes)
+          throw std::runtime_error("truncated vertex stream!");
+      }
+
+      uint8_t* row = channels + channel * maxBlockVertices;
+      for (size_t byte = 0; byte < selectorBytes; ++byte, row += 4 * groupSize) {
+        const uint32_t selector = selectors[byte];
+        read = decodeGroup(read, selector & 3, row);
+        read = decodeGroup(read, (selector >> 2) & 3, row + groupSize);
+        read = decodeGroup(read, (selector >> 4) & 3, row + 2 * groupSize);
+        read = decodeGroup(read, selector >> 6, row + 3 * groupSize);
+      }
+    }
+
+    reconstructBlock(channels, count, stride, last, out + first * stride);
+  }
+
+  if (read != end)
+    throw std::runtime_error("trailing bytes after vertex stream!");
+}
+
+std::vector<uint8_t> encodeIndexBuffer(const uint32_t* indices, const size_t indexCount) {
+  if (indexCount % 3 != 0)
+    throw std::invalid_argument("index count isn't a multiple of 3!");
+
+  const size_t triangleCount = indexCount / 3;
+  std::vector<uint8_t> out(1 + triangleCount);
+  out[0] = indexHeader;
+  std::vector<uint8_t> extra;
+  IndexState state;
+
+  for (size_t t = 0; t < triangleCount; ++t) {
+    const uint32_t a = indices[t * 3], b = indices[t * 3 + 1], c = indices[t * 3 + 2];
+
+    // Look for a shared edge in any of the three rotations
+    uint32_t rotated[3] = {a, b, c};
+    uint32_t edgeDistance = fifoSize - 1;
+    for (uint32_t distance = 0; distance < state.edgesAvailable() && edgeDistance == fifoSize - 1; ++distance) {
+      const uint32_t* e = state.edge(distance);
+      const uint32_t rotations[3][3] = {{a, b, c}, {b, c, a}, {c, a, b}};
+      for (const auto& r : rotations)
+        if (r[0] == e[0] && r[1] == e[1]) {
+          std::copy(r, r + 3, rotated);
+          edgeDistance = distance;
+          break;
+        }
+    }
+
+    if (edgeDistance < fifoSize - 1) {
+      const uint32_t x = rotated[0], y = rotated[1], z = rotated[2];
+      uint32_t low;
+      if (z == state.next) {
+        low = 0;
+        ++state.next;
+        state.pushVertex(z);
+      } else {
+        low = fifoSize - 1;
+        for (uint32_t distance = 0; distance < state.verticesAvailable(); ++distance)
+          if (state.vertex(distance) == z) {
+            low = 1 + distance;
+            break;
+          }
+        if (low == fifoSize - 1) {
+          writeVarint(zigzag32(z - state.last), extra);
+          state.last = z;
+          state.pushVertex(z);
+        }
+      }
+      out[1 + t] = static_cast<uint8_t>((edgeDistance << 4) | low);
+      state.pushEdge(z, y);
+      state.pushEdge(x, z);
+    } else {
+      // No shared edge: bit k says corner k is the next new vertex
+      uint32_t mask = 0;
+      const uint32_t corners[3] = {a, b, c};
+      for (uint32_t k = 0; k < 3; ++k) {
+        if (corners[k] == state.next) {
+          mask |= 1u << k;
+          ++state.next;
+        } else {
+          writeVarint(zigzag32(corners[k] - state.last), extra);
+          state.last = corners[k];
+        }
+        state.pushVertex(corners[k]);
+      }
+      out[1 + t] = static_cast<uint8_t>(0xf0 | mask);
+      state.pushEdge(b, a);
+      state.pushEdge(c, b);
+      state.pushEdge(a, c);
+    }
+  }
+
+  out.insert(out.end(), extra.begin(), extra.end());
+  return out;
+}
+
+void decodeIndexBuffer(void* destination, const size_t indexCount, const size_t indexSize, const uint8_t* data, const size_t size) {
+  if (indexCount % 3 != 0 || (indexSize != 2 && indexSize != 4))
+    throw std::invalid_argument("bad index count or size!");
+  const size_t triangleCount = indexCount / 3;
+  if (size < 1 + triangleCount || data[0] != indexHeader)
+    throw std::runtime_error("not an encoded index stream!");
+
+  const uint8_t* codes = data + 1;
+  const uint8_t* extra = codes + triangleCount;
+  const uint8_t* const end = data + size;
+  IndexState state;
+
+  const auto write = [&](const size_t t, const uint32_t x, const uint32_t y, const uint32_t z) {
+    if (indexSize == 2) {
+      if ((x | y | z) > UINT16_MAX)
+        throw std::runtime_error("index doesn't fit in 16 bits!");
+      uint16_t* out = static_cast<uint16_t*>(destination) + t * 3;
+      out[0] = static_cast<uint16_t>(x);
+      out[1] = static_cast<uint16_t>(y);
+      out[2] = static_cast<uint16_t>(z);
+    } else {
+      uint32_t* out = static_cast<uint32_t*>(destination) + t * 3;
+      out[0] = x;
+      out[1] = y;
+      out[2] = z;
+    }
+  };
+
+  for (size_t t = 0; t < triangleCount; ++t) {
+    const uint32_t code = codes[t];
+    const uint32_t edgeDistance = code >> 4;
+    const uint32_t low = code & 15;
+
+    if (edgeDistance < fifoSize - 1) {
+      if (edgeDistance >= state.edgesAvailable())
+        throw std::runtime_error("bad edge reference in index stream!");
+      const uint32_t x = state.edge(edgeDistance)[0];
+      const uint32_t y = state.edge(edgeDistance)[1];
+      uint32_t z;
+      if (low == 0) {
+        z = state.next++;
+        state.pushVertex(z);
+      } else if (low < fifoSize - 1) {
+        if (low - 1 >= state.verticesAvailable())
+          throw std::runtime_error("bad vertex reference in index stream!");
+        z = state.vertex(low - 1);
+      } else {
+        z = state.last + unzigzag32(readVarint(extra, end));
+        state.last = z;
+        state.pushVertex(z);
+      }
+      write(t, x, y, z);
+      state.pushEdge(z, y);
+      state.pushEdge(x, z);
+    } else {
+      uint32_t corners[3];
+      for (uint32_t k = 0; k < 3; ++k) {
+        if (low & (1u << k)) {
+          corners[k] = state.next++;
+        } else {
+          corners[k] = state.last + unzigzag32(readVarint(extra, end));
+          state.last = corners[k];
+        }
+        state.pushVertex(corners[k]);
+      }
+      write(t, corners[0], corners[1], corners[2]);
+      state.pushEdge(corners[1], corners[0]);
+      state.pushEdge(corners[2], corners[1]);
+      state.pushEdge(corners[0], corners[2]);
+    }
+  }
+
+  if (extra != end)
+    throw std::runtime_error("trailing bytes after index stream!");
+}
+
+}
@@ -0,0 +1,322 @@
+#include "mesh_format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include "mesh_codec.h"
+#include "mesh_optimizer.h"
+#include "vertex_quantization.h"
+
+namespace MeshFormat {
+namespace {
+uint64_t alignUp(const uint64_t value, const uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+template <typename T>
+ArrayView<T> sectionArray(const uint8_t* data, const Section& section) {
+  if (section.size % sizeof(T) != 0)
+    throw std::runtime_error("mesh section size isn't a whole number of entries!");
+
+  return {reinterpret_cast<const T*>(data + section.offset), static_cast<size_t>(section.size / sizeof(T))};
+}
+
+template <typename T>
+uint32_t largestIndex(const void* indices, const size_t count) {
+  const T* values = static_cast<const T*>(indices);
+  T largest = 0;
+  for (size_t i = 0; i < count; ++i)
+    largest = std::max(largest, values[i]);
+  return largest;
+}
+
+// Goes straight into an index buffer, and nothing enables robustBufferAccess.
+// Submeshes and lods have no base vertex, so the whole blob covers them all.
+void checkIndices(const void* indices, const size_t count, const uint32_t indexSize, const uint32_t vertexCount) {
+  if (count == 0)
+    return;
+  const uint32_t largest = indexSize == sizeof(uint16_t) ? largestIndex<uint16_t>(indices, count)
+                                                         : largestIndex<uint32_t>(indices, count);
+  if (largest >= vertexCount)
+    throw std::runtime_error("mesh index out of range!");
+}
+
+Bounds boundsOfIndexed(
+    const std::vector<GraphicsTypes::Vertex>& vertices,
+    const uint32_t* indices,
+    const size_t indexCount) {
+  std::vector<GraphicsTypes::Vertex> used;
+  used.reserve(indexCount);
+  for (size_t i = 0; i < indexCount; ++i)
+    used.push_back(vertices[indices[i]]);
+
+  return computeBounds(used.data(), used.size());
+}
+}
+
+MeshView::MeshView(const uint8_t* data, const size_t size) {
+  if (size < sizeof(Header))
+    throw std::runtime_error("mesh file too small!");
+
+  header = reinterpret_cast<const Header*>(data);
+  if (header->magic != magic)
+    throw std::runtime_error("not a vmesh file!");
+  if (header->versionMajor != versionMajor)
+    throw std::runtime_error("unsupported vmesh version!");
+  if (header->fileSize > size)
+    throw std::runtime_error("truncated mesh file!");
+  if (header->indexSize != 2 && header->indexSize != 4)
+    throw std::runtime_error("bad mesh index size!");
+
+  const uint64_t directoryEnd = sizeof(Header) + uint64_t(header->sectionCount) * sizeof(Section);
+  if (directoryEnd > header->fileSize)
+    throw std::runtime_error("mesh section directory out of bounds!");
+
+  const Section* sections = reinterpret_cast<const Section*>(data + sizeof(Header));
+  for (uint32_t i = 0; i < header->sectionCount; ++i) {
+    const Section& section = sections[i];
+    if (section.offset % sectionAlignment != 0 ||
+        section.offset < directoryEnd ||
+        section.offset > header->fileSize ||
+        section.size > header->fileSize - section.offset)
+      throw std::runtime_error("mesh section out of bounds!");
+
+    switch (section.type) {
+      case SectionType::vertices:
+        if (section.size != uint64_t(header->vertexCount) * header->vertexStride)
+          throw std::runtime_error("mesh vertex section doesn't match the header!");
+        vertices = data + section.offset;
+        break;
+      case SectionType::indices:
+        if (section.size != uint64_t(header->indexCount) * header->indexSize)
+          throw std::runtime_error("mesh index section doesn't match the header!");
+        indices = data + section.offset;
+        break;
+      case SectionType::encodedVertices:
+        encodedVertices = sectionArray<uint8_t>(data, section);
+        break;
+      case SectionType::encodedIndices:
+        encodedIndices = sectionArray<uint8_t>(data, section);
+        break;
+      case SectionType::submeshes:
+        submeshes = sectionArray<Submesh>(data, section);
+        break;
+      case SectionType::lods:
+        lods = sectionArray<Lod>(data, section);
+        break;
+      case SectionType::meshlets:
+        meshlets.meshlets = sectionArray<Meshlet>(data, section);
+        break;
+      case SectionType::meshletVertices:
+        meshlets.vertices = sectionArray<uint32_t>(data, section);
+        break;
+      case SectionType::meshletTriangles:
+        meshlets.triangles = sectionArray<uint32_t>(data, section);
+        break;
+      default:
+        // newer minor version, not for us
+        break;
+    }
+  }
+
+  const bool plain = vertices && indices && encodedVertices.empty() && encodedIndices.empty();
+  const bool encoded = !vertices && !indices && !encodedVertices.empty() && !encodedIndices.empty();
+  if (!plain && !encoded)
+    throw std::runtime_error("mesh file is missing vertices or indices!");
+  if (encoded && (header->vertexStride == 0 || header->vertexStride % 4 != 0 || header->vertexStride > 256))
+    throw std::runtime_error("mesh vertex stride can't be encoded!");
+
+  if (plain)
+    checkIndices(indices, header->indexCount, header->indexSize, header->vertexCount);
+
+  for (const auto& submesh : submeshes)
+    if (uint64_t(submesh.firstIndex) + submesh.indexCount > header->indexCount)
+      throw std::runtime_error("mesh submesh out of range!");
+
+  for (const auto& lod : lods)
+    if (uint64_t(lod.firstIndex) + lod.indexCount > header->indexCount)
+      throw std::runtime_error("mesh lod out of range!");
+
+  // The culling shader trusts these, so check every local index too
+  for (const auto& meshlet : meshlets.meshlets) {
+    if (uint64_t(meshlet.vertexOffset) + meshlet.vertexCount > meshlets.vertices.count ||
+        uint64_t(meshlet.triangleOffset) + meshlet.triangleCount > meshlets.triangles.count)
+      throw std::runtime_error("mesh meshlet out of range!");
+    for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+      const uint32_t packed = meshlets.triangles[meshlet.triangleOffset + t];
+      for (int corner = 0; corner < 3; ++corner)
+        if (((packed >> (corner * 8)) & 0xff) >= meshlet.vertexCount)
+          throw std::runtime_error("mesh meshlet triangle out of range!");
+    }
+  }
+  for (const uint32_t vertex : meshlets.vertices)
+    if (vertex >= header->vertexCount)
+      throw std::runtime_error("mesh meshlet vertex out of range!");
+}
+
+void MeshView::decodeVertices(void* destination) const {
+  if (vertices)
+    std::memcpy(destination, vertices, vertexBytes());
+  else
+    MeshCodec::decodeVertexBuffer(
+        destination, header->vertexCount, header->vertexStride, encodedVertices.data, encodedVertices.count);
+}
+
+void MeshView::decodeIndices(void* destination) const {
+  if (indices)
+    std::memcpy(destination, indices, indexBytes());
+  else {
+    MeshCodec::decodeIndexBuffer(
+        destination, header->indexCount, header->indexSize, encodedIndices.data, encodedIndices.count);
+    // Rebuilt from deltas and cache slots, the stream sizes say nothing
+    // about the values
+    checkIndices(destination, header->indexCount, header->indexSize, header->vertexCount);
+  }
+}
+
+Lod MeshView::getLod(const size_t level) const {
+  if (lods.empty())
+    return {0, header->indexCount, 0.0f, 0};
+
+  return lods[std::min(level, lods.count - 1)];
+}
+
+Bounds computeBounds(const GraphicsTypes::Vertex* vertices, const size_t count) {
+  Bounds bounds{};
+  if (count == 0)
+    return bounds;
+
+  glm::vec3 min(std::numeric_limits<float>::max());
+  glm::vec3 max(std::numeric_limits<float>::lowest());
+  for (size_t i = 0; i < count; ++i) {
+    min = glm::min(min, vertices[i].position);
+    max = glm::max(max, vertices[i].position);
+  }
+
+  const glm::vec3 center = (min + max) * 0.5f;
+  float radiusSq = 0.0f;
+  for (size_t i = 0; i < count; ++i) {
+    const glm::vec3 d = vertices[i].position - center;
+    radiusSq = std::max(radiusSq, glm::dot(d, d));
+  }
+
+  for (int axis = 0; axis < 3; ++axis) {
+    bounds.min[axis] = min[axis];
+    bounds.max[axis] = max[axis];
+    bounds.center[axis] = center[axis];
+  }
+  bounds.radius = std::sqrt(radiusSq);
+
+  return bounds;
+}
+
+void writeMeshFile(
+    const std::string& path,
+    const MeshData& mesh,
+    const VertexFormat vertexFormat,
+    const bool encodeGeometry) {
+  // Default submesh is all of lod 0, not the lods after it
+  std::vector<Submesh> submeshes = mesh.submeshes;
+  if (submeshes.empty() && !mesh.lods.empty())
+    submeshes.push_back({mesh.lods[0].firstIndex, mesh.lods[0].indexCount, 0, 0, {}});
+  if (submeshes.empty())
+    submeshes.push_back({0, static_cast<uint32_t>(mesh.indices.size()), 0, 0, {}});
+
+  for (auto& submesh : submeshes) {
+    if (uint64_t(submesh.firstIndex) + submesh.indexCount > mesh.indices.size())
+      throw std::invalid_argument("submesh out of range!");
+    submesh.bounds = boundsOfIndexed(mesh.vertices, mesh.indices.data() + submesh.firstIndex, submesh.indexCount);
+  }
+
+  struct Blob {
+    SectionType type;
+    const void* data;
+    uint64_t size;
+  };
+  std::vector<uint16_t> indices16;
+  const bool shortIndices = MeshOptimize::fitsIn16BitIndices(mesh.vertices.size());
+  if (shortIndices)
+    indices16 = MeshOptimize::to16BitIndices(mesh.indices);
+  const uint32_t indexSize = shortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+
+  const Bounds bounds = computeBounds(mesh.vertices.data(), mesh.vertices.size());
+  std::vector<GraphicsTypes::QuantizedVertex> quantized;
+  const void* vertexData = mesh.vertices.data();
+  uint32_t vertexStride = sizeof(GraphicsTypes::Vertex);
+  if (vertexFormat == VertexFormat::quantized16) {
+    quantized = VertexQuantize::quantizeVertices(mesh.vertices.data(), mesh.vertices.size(), bounds);
+    vertexData = quantized.data();
+    vertexStride = sizeof(GraphicsTypes::QuantizedVertex);
+  }
+
+  std::vector<uint8_t> encodedVertices;
+  std::vector<uint8_t> encodedIndices;
+  std::vector<Blob> blobs;
+  if (encodeGeometry) {
+    encodedVertices = MeshCodec::encodeVertexBuffer(vertexData, mesh.vertices.size(), vertexStride);
+    encodedIndices = MeshCodec::encodeIndexBuffer(mesh.indices.data(), mesh.indices.size());
+    blobs.push_back({SectionType::encodedVertices, encodedVertices.data(), encodedVertices.size()});
+    blobs.push_back({SectionType::encodedIndices, encodedIndices.data(), encodedIndices.size()});
+  } else {
+    blobs.push_back({SectionType::vertices, vertexData, uint64_t(mesh.vertices.size()) * vertexStride});
+    blobs.push_back(
+        {SectionType::indices,
+         shortIndices ? static_cast<const void*>(indices16.data()) : mesh.indices.data(),
+         mesh.indices.size() * indexSize});
+  }
+  blobs.push_back({SectionType::submeshes, submeshes.data(), submeshes.size() * sizeof(Submesh)});
+  if (!mesh.lods.empty())
+    blobs.push_back({SectionType::lods, mesh.lods.data(), mesh.lods.size() * sizeof(Lod)});
+  if (!mesh.meshlets.empty()) {
+    blobs.push_back({SectionType::meshlets, mesh.meshlets.data(), mesh.meshlets.size() * sizeof(Meshlet)});
+    blobs.push_back(
+        {SectionType::meshletVertices, mesh.meshletVertices.data(), mesh.meshletVertices.size() * sizeof(uint32_t)});
+    blobs.push_back(
+        {SectionType::meshletTriangles, mesh.meshletTriangles.data(), mesh.meshletTriangles.size() * sizeof(uint32_t)});
+  }
+
+  std::vector<Section> sections;
+  uint64_t offset = sizeof(Header) + blobs.size() * sizeof(Section);
+  for (const auto& blob : blobs) {
+    offset = alignUp(offset, sectionAlignment);
+    sections.push_back({blob.type, 0, offset, blob.size});
+    offset += blob.size;
+  }
+
+  Header header{};
+  header.magic = magic;
+  header.versionMajor = versionMajor;
+  header.versionMinor = versionMinor;
+  header.fileSize = offset;
+  header.vertexFormat = vertexFormat;
+  header.vertexStride = vertexStride;
+  header.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+  header.indexSize = indexSize;
+  header.indexCount = static_cast<uint32_t>(mesh.indices.size());
+  header.sectionCount = static_cast<uint32_t>(sections.size());
+  header.bounds = bounds;
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+    throw std::runtime_error("failed to open " + path + " for writing!");
+
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(sections.data()), sections.size() * sizeof(Section));
+
+  uint64_t written = sizeof(Header) + sections.size() * sizeof(Section);
+  const char zeros[sectionAlignment] = {};
+  for (size_t i = 0; i < blobs.size(); ++i) {
+    file.write(zeros, sections[i].offset - written);
+    file.write(static_cast<const char*>(blobs[i].data), blobs[i].size);
+    written = sections[i].offset + blobs[i].size;
+  }
+
+  if (!file)
+    throw std::runtime_error("failed to write " + path + "!");
+}
+
+}
@@ -0,0 +1,454 @@
+#include "mesh_importer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "mapped_file.h"
+#include "parallel_for.h"
+
+namespace MeshImport {
+namespace {
+uint64_t hashWords(const uint32_t* words, const size_t count) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < count; ++i) {
+    hash ^= words[i];
+    hash *= 0x100000001b3ull;
+    hash ^= hash >> 29;
+  }
+  return hash;
+}
+
+// Numbers every key by first appearance, remap[i] is key i's number. The
+// hash set is what limits single threaded dedup, so the keys are sharded by
+// hash and every thread owns one shard's set. Returns the unique count,
+// firstOf[n] is the first i that got number n.
+template <typename Key, typename Hash, typename Equal>
+size_t dedupe(
+    const Key* keys,
+    const size_t count,
+    unsigned threads,
+    const Hash& hash,
+    const Equal& equal,
+    std::vector<uint32_t>& remap,
+    std::vector<uint32_t>& firstOf) {
+  if (count > std::numeric_limits<uint32_t>::max())
+    throw std::runtime_error("too many vertices to index with 32 bits!");
+  if (threads == 0)
+    threads = defaultThreadCount();
+
+  std::vector<uint64_t> hashes(count);
+  parallelFor(count, threads, [&](const size_t i) { hashes[i] = hash(keys[i]); });
+
+  std::vector<uint32_t> representative(count);
+  const unsigned shards = threads;
+  parallelFor(shards, threads, [&](const size_t shard) {
+    const auto hashOf = [&](const uint32_t i) { return static_cast<size_t>(hashes[i]); };
+    const auto sameKey = [&](const uint32_t a, const uint32_t b) {
+      return hashes[a] == hashes[b] && equal(keys[a], keys[b]);
+    };
+    std::unordered_set<uint32_t, decltype(hashOf), decltype(sameKey)> seen(
+        count / shards + 1, hashOf, sameKey);
+
+    for (size_t i = 0; i < count; ++i) {
+      if (hashes[i] % shards != shard)
+        continue;
+      representative[i] = *seen.insert(static_cast<uint32_t>(i)).first;
+    }
+  });
+
+  // representative[i] <= i, so this is one pass
+  remap.resize(count);
+  firstOf.clear();
+  for (size_t i = 0; i < count; ++i) {
+    if (representative[i] == i) {
+      remap[i] = static_cast<uint32_t>(firstOf.size());
+      firstOf.push_back(static_cast<uint32_t>(i));
+    } else {
+      remap[i] = remap[representative[i]];
+    }
+  }
+
+  return firstOf.size();
+}
+
+// --- OBJ ---
+
+constexpr int32_t missingIndex = std::numeric_limits<int32_t>::min();
+
+// 0 based. Negative (relative) indices are resolved against the chunk's own
+// counts and flagged, the chunk's global base gets added once it's known.
+struct RawCorner {
+  int32_t index[3]; // position, texcoord, normal
+  uint8_t relative;
+};
+
+struct Corner {
+  int32_t position;
+  int32_t texCoord;
+  int32_t normal;
+
+  bool operator==(const Corner& other) const {
+    return position == other.position && texCoord == other.texCoord && normal == other.normal;
+  }
+};
+
+struct MaterialRun {
+  size_t firstCorner;
+  std::string name;
+};
+
+struct ObjChunk {
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec2> texCoords;
+  std::vector<glm::vec3> normals;
+  std::vector<RawCorner> corners;
+  std::vector<MaterialRun> materials;
+};
+
+class LineCursor {
+ public:
+  LineCursor(const char* begin, const char* end) : at(begin), end(end) {}
+
+  void skipSpaces() {
+    while (at < end && (*at == ' ' || *at == '\t' || *at == '\r'))
+      ++at;
+  }
+
+  bool atEnd() {
+    skipSpaces();
+    return at == end;
+  }
+
+  float readFloat() {
+    skipSpaces();
+    if (at < end && *at == '+')
+      ++at;
+
+    float value = 0.0f;
+    const auto result = std::from_chars(at, end, value);
+    if (result.ec != std::errc())
+      throw std::runtime_error("bad number in obj file!");
+    at = result.ptr;
+    return value;
+  }
+
+  // 0 if there's no number here (e.g. the empty texcoord in 1//2)
+  long readInt() {
+    long value = 0;
+    const auto result = std::from_chars(at, end, value);
+    if (result.ec != std::errc())
+      return 0;
+    at = result.ptr;
+    return value;
+  }
+
+  std::string readWord() {
+    skipSpaces();
+    const char* start = at;
+    while (at < end && !std::isspace(static_cast<unsigned char>(*at)))
+      ++at;
+    return std::string(start, at);
+  }
+
+  bool consume(const char c) {
+    if (at < end && *at == c) {
+      ++at;
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  const char* at;
+  const char* end;
+};
+
+RawCorner parseCorner(LineCursor& cursor, const ObjChunk& chunk) {
+  const size_t counts[3] = {chunk.positions.size(), chunk.texCoords.size(), chunk.normals.size()};
+
+  RawCorner corner{{missingIndex, missingIndex, missingIndex}, 0};
+  for (int component = 0; component < 3; ++component) {
+    if (component > 0 && !cursor.consume('/'))
+      break;
+
+    const long value = cursor.readInt();
+    if (value > 0) {
+      corner.index[component] = static_cast<int32_t>(value - 1);
+    } else if (value < 0) {
+      corner.index[component] = static_cast<int32_t>(static_cast<long>(counts[component]) + value);
+      corner.relative |= 1 << component;
+    }
+  }
+
+  if (corner.index[0] == missingIndex)
+    throw std::runtime_error("obj face without a position index!");
+
+  return corner;
+}
+
+void parseObjLine(const char* begin, const char* end, ObjChunk& chunk) {
+  LineCursor cursor(begin, end);
+  const std::string keyword = cursor.readWord();
+
+  if (keyword == "v") {
+    const float x = cursor.readFloat();
+    const float y = cursor.readFloat();
+    const float z = cursor.readFloat();
+    chunk.positions.emplace_back(x, y, z);
+  } else if (keyword == "vt") {
+    const float u = cursor.readFloat();
+    const float v = cursor.atEnd() ? 0.0f : cursor.readFloat();
+    // obj is bottom left origin, vulkan samples top left
+    chunk.texCoords.emplace_back(u, 1.0f - v);
+  } else if (keyword == "vn") {
+    const float x = cursor.readFloat();
+    const float y = cursor.readFloat();
+    const float z = cursor.readFloat();
+    chunk.normals.emplace_back(x, y, z);
+  } else if (keyword == "f") {
+    RawCorner first{}, previous{};
+    int count = 0;
+    while (!cursor.atEnd()) {
+      const RawCorner corner = parseCorner(cursor, chunk);
+      if (count == 0) {
+        first = corner;
+      } else if (count >= 2) {
+        chunk.corners.push_back(first);
+        chunk.corners.push_back(previous);
+        chunk.corners.push_back(corner);
+      }
+      previous = corner;
+      ++count;
+    }
+  } else if (keyword == "usemtl") {
+    chunk.materials.push_back({chunk.corners.size(), cursor.readWord()});
+  }
+  // o, g, s, mtllib, comments etc. don't change the geometry
+}
+
+void parseObjChunk(const char* begin, const char* end, ObjChunk& chunk) {
+  const char* line = begin;
+  while (line < end) {
+    const char* lineEnd = static_cast<const char*>(memchr(line, '\n', end - line));
+    if (!lineEnd)
+      lineEnd = end;
+
+    if (lineEnd > line && *line != '#')
+      parseObjLine(line, lineEnd, chunk);
+
+    line = lineEnd + 1;
+  }
+}
+
+// Moves a split point forward to the start of the next line
+const char* nextLineStart(const char* at, const char* begin, const char* end) {
+  if (at <= begin)
+    return begin;
+  if (at[-1] == '\n')
+    return at;
+
+  const char* newline = static_cast<const char*>(memchr(at, '\n', end - at));
+  return newline ? newline + 1 : end;
+}
+
+std::string lowerExtension(const std::string& path) {
+  const auto dot = path.find_last_of('.');
+  if (dot == std::string::npos)
+    return "";
+
+  std::string extension = path.substr(dot + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+      [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return extension;
+}
+}
+
+MeshFormat::MeshData importObj(const std::string& path, const ImportOptions& options) {
+  const MappedFile file(path);
+  const char* begin = reinterpret_cast<const char*>(file.data());
+  const char* end = begin + file.size();
+
+  const unsigned threads = options.threads ? options.threads : defaultThreadCount();
+  // A few chunks per thread so one heavy region doesn't hold everyone up
+  const size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threads * 4, file.size() / 4096 + 1));
+
+  std::vector<const char*> splits(chunkCount + 1);
+  for (size_t i = 0; i <= chunkCount; ++i)
+    splits[i] = nextLineStart(begin + file.size() * i / chunkCount, begin, end);
+
+  std::vector<ObjChunk> chunks(chunkCount);
+  parallelFor(chunkCount, threads, [&](const size_t i) {
+    parseObjChunk(splits[i], splits[i + 1], chunks[i]);
+  });
+
+  // Where each chunk's elements land globally
+  struct Bases { size_t counts[3]; size_t corners; };
+  std::vector<Bases> bases(chunkCount + 1, Bases{{0, 0, 0}, 0});
+  for (size_t i = 0; i < chunkCount; ++i) {
+    bases[i + 1].counts[0] = bases[i].counts[0] + chunks[i].positions.size();
+    bases[i + 1].counts[1] = bases[i].counts[1] + chunks[i].texCoords.size();
+    bases[i + 1].counts[2] = bases[i].counts[2] + chunks[i].normals.size();
+    bases[i + 1].corners = bases[i].corners + chunks[i].corners.size();
+  }
+  const Bases& totals = bases[chunkCount];
+
+  std::vector<glm::vec3> positions(totals.counts[0]);
+  std::vector<glm::vec2> texCoords(totals.counts[1]);
+  std::vector<glm::vec3> normals(totals.counts[2]);
+  std::vector<Corner> corners(totals.corners);
+
+  parallelFor(chunkCount, threads, [&](const size_t i) {
+    const ObjChunk& chunk = chunks[i];
+    std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + bases[i].counts[0]);
+    std::copy(chunk.texCoords.begin(), chunk.texCoords.end(), texCoords.begin() + bases[i].counts[1]);
+    std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + bases[i].counts[2]);
+
+    Corner* out = corners.data() + bases[i].corners;
+    for (const RawCorner& raw : chunk.corners) {
+      int32_t resolved[3];
+      for (int component = 0; component < 3; ++component) {
+        int64_t index = raw.index[component];
+        if (index == missingIndex) {
+          resolved[component] = -1;
+          continue;
+        }
+        if (raw.relative & (1 << component))
+          index += static_cast<int64_t>(bases[i].counts[component]);
+        if (index < 0 || index >= static_cast<int64_t>(totals.counts[component]))
+          throw std::runtime_error("obj face index out of range in " + path + "!");
+        resolved[component] = static_cast<int32_t>(index);
+      }
+      *out++ = {resolved[0], resolved[1], resolved[2]};
+    }
+  });
+
+  // Material runs in file order, indices come out in corner order so the
+  // runs map straight onto index ranges
+  std::unordered_map<std::string, uint32_t> materialIds;
+  std::vector<std::pair<size_t, uint32_t>> runs;
+  for (size_t i = 0; i < chunkCount; ++i) {
+    for (const auto& material : chunks[i].materials) {
+      const auto id = materialIds.emplace(material.name, static_cast<uint32_t>(materialIds.size())).first->second;
+      runs.emplace_back(bases[i].corners + material.firstCorner, id);
+    }
+  }
+  chunks.clear();
+
+  std::vector<uint32_t> remap, firstOf;
+  dedupe(
+      corners.data(),
+      corners.size(),
+      threads,
+      [](const Corner& corner) { return hashWords(reinterpret_cast<const uint32_t*>(&corner), 3); },
+      [](const Corner& a, const Corner& b) { return a == b; },
+      remap,
+      firstOf);
+
+  MeshFormat::MeshData mesh;
+  mesh.indices = std::move(remap);
+  mesh.vertices.resize(firstOf.size());
+  std::vector<uint8_t> needsNormal(firstOf.size(), 0);
+
+  parallelFor(firstOf.size(), threads, [&](const size_t i) {
+    const Corner& corner = corners[firstOf[i]];
+    GraphicsTypes::Vertex& vertex = mesh.vertices[i];
+    vertex.position = positions[corner.position];
+    if (corner.texCoord >= 0)
+      vertex.texCoord = texCoords[corner.texCoord];
+    if (corner.normal >= 0)
+      vertex.normal = normals[corner.normal];
+    else
+      needsNormal[i] = 1;
+  });
+  const bool anyMissingNormals = std::find(needsNormal.begin(), needsNormal.end(), 1) != needsNormal.end();
+
+  // Faces before the first usemtl go in with the first material
+  if (!runs.empty() && runs.front().first > 0)
+    runs.insert(runs.begin(), {0, runs.front().second});
+  for (size_t i = 0; i < runs.size(); ++i) {
+    const size_t first = runs[i].first;
+    const size_t last = i + 1 < runs.size() ? runs[i + 1].first : mesh.indices.size();
+    if (last > first)
+      mesh.submeshes.push_back({static_cast<uint32_t>(first), static_cast<uint32_t>(last - first), runs[i].second, 0, {}});
+  }
+
+  if (options.generateNormals && anyMissingNormals)
+    generateNormals(mesh, needsNormal);
+
+  return mesh;
+}
+
+void weldVertices(MeshFormat::MeshData& mesh, const unsigned threads) {
+  static_assert(sizeof(GraphicsTypes::Vertex) % sizeof(uint32_t) == 0, "hashed as words");
+  constexpr size_t words = sizeof(GraphicsTypes::Vertex) / sizeof(uint32_t);
+
+  std::vector<uint32_t> remap, firstOf;
+  const size_t unique = dedupe(
+      mesh.vertices.data(),
+      mesh.vertices.size(),
+      threads,
+      [](const GraphicsTypes::Vertex& vertex) { return hashWords(reinterpret_cast<const uint32_t*>(&vertex), words); },
+      [](const GraphicsTypes::Vertex& a, const GraphicsTypes::Vertex& b) { return memcmp(&a, &b, sizeof(a)) == 0; },
+      remap,
+      firstOf);
+  if (unique == mesh.vertices.size())
+    return;
+
+  std::vector<GraphicsTypes::Vertex> vertices(unique);
+  parallelFor(unique, threads, [&](const size_t i) { vertices[i] = mesh.vertices[firstOf[i]]; });
+  parallelFor(mesh.indices.size(), threads, [&](const size_t i) { mesh.indices[i] = remap[mesh.indices[i]]; });
+  mesh.vertices = std::move(vertices);
+}
+
+void generateNormals(MeshFormat::MeshData& mesh, const std::vector<uint8_t>& needsNormal) {
+  // Smooth across uv seams etc., so accumulate per position rather than per vertex
+  std::vector<uint32_t> positionId, firstOf;
+  const size_t positionCount = dedupe(
+      mesh.vertices.data(),
+      mesh.vertices.size(),
+      0,
+      [](const GraphicsTypes::Vertex& vertex) { return hashWords(reinterpret_cast<const uint32_t*>(&vertex.position), 3); },
+      [](const GraphicsTypes::Vertex& a, const GraphicsTypes::Vertex& b) {
+        return memcmp(&a.position, &b.position, sizeof(a.position)) == 0;
+      },
+      positionId,
+      firstOf);
+
+  std::vector<glm::vec3> accumulated(positionCount, glm::vec3(0.0f));
+  for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+    const uint32_t a = mesh.indices[i], b = mesh.indices[i + 1], c = mesh.indices[i + 2];
+    const glm::vec3& pa = mesh.vertices[a].position;
+    // Not normalized, bigger faces count for more
+    const glm::vec3 faceNormal = glm::cross(mesh.vertices[b].position - pa, mesh.vertices[c].position - pa);
+    accumulated[positionId[a]] += faceNormal;
+    accumulated[positionId[b]] += faceNormal;
+    accumulated[positionId[c]] += faceNormal;
+  }
+
+  for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+    if (!needsNormal.empty() && !needsNormal[i])
+      continue;
+
+    const glm::vec3& normal = accumulated[positionId[i]];
+    const float length = glm::length(normal);
+    mesh.vertices[i].normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+  }
+}
+
+MeshFormat::MeshData importMesh(const std::string& path, const ImportOptions& options) {
+  const std::string extension = lowerExtension(path);
+  if (extension == "obj")
+    return importObj(path, options);
+  if (extension == "gltf" || extension == "glb")
+    return importGltf(path, options);
+
+  throw std::invalid_argument("don't know how to import " + path);
+}
+
+}
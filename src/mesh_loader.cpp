@@ -0,0 +1,247 @@
+#include "vulkan_utils/mesh_loader.h"
+
+#include <iostream>
+#include <stdexcept>
+
+#include "asset_cook.h"
+#include "asset_pack.h"
+#include "mapped_file.h"
+#include "mesh_optimizer.h"
+#include "meshlets.h"
+#include "vertex_quantization.h"
+
+namespace VulkanUtils {
+namespace {
+bool isCookedMesh(const std::string& path) {
+  return path.size() >= 6 && path.compare(path.size() - 6, 6, ".vmesh") == 0;
+}
+}
+
+PreparedMesh prepareMesh(
+    std::shared_ptr<const void> source,
+    const uint8_t* data,
+    const size_t size,
+    const std::string& name,
+    const MeshFormat::VertexFormat vertexFormat,
+    const bool withMeshlets) {
+  const MeshFormat::MeshView mesh(data, size);
+  const auto& header = mesh.getHeader();
+
+  PreparedMesh prepared;
+  prepared.name = name;
+  prepared.source = std::move(source);
+  prepared.vertexData = mesh.vertexData();
+  prepared.vertexBytes = mesh.vertexBytes();
+  prepared.indexData = mesh.indexData();
+  prepared.indexCount = header.indexCount;
+  prepared.indexType = header.indexSize == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+  prepared.bounds = header.bounds;
+  prepared.lod0 = mesh.getLod(0);
+  prepared.lods.assign(mesh.getLods().begin(), mesh.getLods().end());
+
+  // Encoded geometry gets decoded once here, plain sections are used in place
+  if (mesh.isEncoded()) {
+    prepared.decodedVertices.resize(mesh.vertexBytes());
+    prepared.decodedIndices.resize(mesh.indexBytes());
+    mesh.decodeVertices(prepared.decodedVertices.data());
+    mesh.decodeIndices(prepared.decodedIndices.data());
+    prepared.vertexData = prepared.decodedVertices.data();
+    prepared.indexData = prepared.decodedIndices.data();
+  }
+
+  if (header.vertexFormat == MeshFormat::VertexFormat::float32 &&
+      header.vertexStride == sizeof(GraphicsTypes::Vertex)) {
+    if (vertexFormat == MeshFormat::VertexFormat::quantized16) {
+      // Sections are 16 byte aligned within the file and the file starts on a
+      // page (mapping, pack entry) or malloc's alignment, fine to read in place
+      prepared.quantizedVertices = VertexQuantize::quantizeVertices(
+          static_cast<const GraphicsTypes::Vertex*>(prepared.vertexData), header.vertexCount, header.bounds);
+      prepared.vertexData = prepared.quantizedVertices.data();
+      prepared.vertexBytes = prepared.quantizedVertices.size() * sizeof(GraphicsTypes::QuantizedVertex);
+      std::vector<uint8_t>().swap(prepared.decodedVertices);
+    }
+  } else if (header.vertexFormat == MeshFormat::VertexFormat::quantized16 &&
+             header.vertexStride == sizeof(GraphicsTypes::QuantizedVertex)) {
+    if (vertexFormat != MeshFormat::VertexFormat::quantized16)
+      throw std::runtime_error(name + " has quantized vertices, the pipeline wants floats!");
+  } else {
+    throw std::runtime_error(name + " has a vertex format the pipeline can't take!");
+  }
+  prepared.quantized = vertexFormat == MeshFormat::VertexFormat::quantized16;
+
+  if (withMeshlets) {
+    if (mesh.getMeshlets().empty())
+      std::cout << name << " has no meshlets, drawing without cluster culling" << std::endl;
+    else
+      prepared.meshlets = mesh.getMeshlets();
+  }
+
+  return prepared;
+}
+
+PreparedMesh prepareMesh(
+    std::shared_ptr<const MeshFormat::MeshData> mesh,
+    const std::string& name,
+    const MeshFormat::VertexFormat vertexFormat,
+    const bool withMeshlets) {
+  if (withMeshlets && mesh->meshlets.empty() && !mesh->indices.empty()) {
+    auto clustered = std::make_shared<MeshFormat::MeshData>(*mesh);
+    Meshlets::buildMeshlets(*clustered);
+    mesh = std::move(clustered);
+  }
+
+  PreparedMesh prepared;
+  prepared.name = name;
+  prepared.vertexData = mesh->vertices.data();
+  prepared.vertexBytes = mesh->vertices.size() * sizeof(GraphicsTypes::Vertex);
+  prepared.indexData = mesh->indices.data();
+  prepared.indexCount = static_cast<uint32_t>(mesh->indices.size());
+  prepared.bounds = MeshFormat::computeBounds(mesh->vertices.data(), mesh->vertices.size());
+  prepared.lod0 = mesh->lods.empty() ? MeshFormat::Lod{0, prepared.indexCount, 0.0f, 0} : mesh->lods[0];
+  prepared.lods = mesh->lods;
+
+  if (vertexFormat == MeshFormat::VertexFormat::quantized16) {
+    prepared.quantizedVertices =
+        VertexQuantize::quantizeVertices(mesh->vertices.data(), mesh->vertices.size(), prepared.bounds);
+    prepared.vertexData = prepared.quantizedVertices.data();
+    prepared.vertexBytes = prepared.quantizedVertices.size() * sizeof(GraphicsTypes::QuantizedVertex);
+    prepared.quantized = true;
+  }
+
+  if (MeshOptimize::fitsIn16BitIndices(mesh->vertices.size())) {
+    prepared.shortIndices = MeshOptimize::to16BitIndices(mesh->indices);
+    prepared.indexData = prepared.shortIndices.data();
+    prepared.indexType = VK_INDEX_TYPE_UINT16;
+  }
+
+  if (withMeshlets && !mesh->meshlets.empty())
+    prepared.meshlets = mesh->meshletsView();
+
+  prepared.source = std::move(mesh);
+  return prepared;
+}
+
+PreparedMesh prepareMeshFile(
+    const std::string& path,
+    const MeshFormat::VertexFormat vertexFormat,
+    const bool withMeshlets) {
+  if (!isCookedMesh(path)) {
+    // Same steps assetcook runs, cook ahead of time to skip all of this
+    std::cout << path << " isn't cooked, converting at load" << std::endl;
+    AssetCook::MeshCookOptions options;
+    options.buildMeshlets = withMeshlets;
+    auto imported = std::make_shared<MeshFormat::MeshData>(AssetCook::cookMesh(path, options));
+    for (size_t level = 0; level < imported->lods.size(); ++level)
+      std::cout << "  lod " << level << ": " << imported->lods[level].indexCount / 3 << " triangles, error "
+                << imported->lods[level].error << std::endl;
+
+    return prepareMesh(std::move(imported), path, vertexFormat, withMeshlets);
+  }
+
+  auto file = std::make_shared<const MappedFile>(path);
+  const uint8_t* data = file->data();
+  const size_t size = file->size();
+  return prepareMesh(std::move(file), data, size, path, vertexFormat, withMeshlets);
+}
+
+void applyPreparedMesh(
+    DeviceManager& devManager,
+    VulkanModel& model,
+    const PreparedMesh& mesh,
+    const ClusterCullingPass* clusterCulling) {
+  model.firstIndex = mesh.lod0.firstIndex;
+  model.indexCount = mesh.lod0.indexCount;
+  model.boundingSphere = glm::vec4(mesh.bounds.center[0], mesh.bounds.center[1], mesh.bounds.center[2], mesh.bounds.radius);
+  model.lods = mesh.lods;
+
+  if (mesh.quantized) {
+    const VertexQuantize::PositionTransform transform = VertexQuantize::positionTransform(mesh.bounds);
+    model.positionScale = glm::vec4(transform.scale, 0.0f);
+    model.positionOffset = glm::vec4(transform.offset, 0.0f);
+  }
+
+  if (clusterCulling && mesh.meshlets)
+    model.clusters = std::make_unique<ClusteredMesh>(devManager, clusterCulling->getSetLayout(), *mesh.meshlets);
+}
+
+VulkanModel createMeshModel(
+    DeviceManager& devManager,
+    const PreparedMesh& mesh,
+    const ClusterCullingPass* clusterCulling) {
+  VulkanModel model(
+      devManager,
+      mesh.vertexData,
+      mesh.vertexBytes,
+      mesh.indexData,
+      mesh.indexCount,
+      mesh.indexType);
+  applyPreparedMesh(devManager, model, mesh, clusterCulling);
+  return model;
+}
+
+VulkanModel createMeshModel(
+    DeviceManager& devManager,
+    const MeshFormat::MeshData& mesh,
+    const MeshFormat::VertexFormat vertexFormat,
+    const ClusterCullingPass* clusterCulling) {
+  // Only the cube goes through here, the copy doesn't matter
+  const PreparedMesh prepared = prepareMesh(
+      std::make_shared<const MeshFormat::MeshData>(mesh), "mesh", vertexFormat, clusterCulling != nullptr);
+  return createMeshModel(devManager, prepared, clusterCulling);
+}
+
+VulkanModel loadMeshModel(
+    DeviceManager& devManager,
+    const std::string& path,
+    const MeshFormat::VertexFormat vertexFormat,
+    const ClusterCullingPass* clusterCulling) {
+  return createMeshModel(devManager, prepareMeshFile(path, vertexFormat, clusterCulling != nullptr), clusterCulling);
+}
+
+VulkanModel loadMeshModel(
+    DeviceManager& devManager,
+    const uint8_t* data,
+    const size_t size,
+    const std::string& name,
+    const MeshFormat::VertexFormat vertexFormat,
+    const ClusterCullingPass* clusterCulling) {
+  return createMeshModel(
+      devManager, prepareMesh(nullptr, data, size, name, vertexFormat, clusterCulling != nullptr), clusterCulling);
+}
+
+std::vector<VulkanModel> loadMeshModels(
+    DeviceManager& devManager,
+    const AssetPack::PackReader& pack,
+    const std::vector<std::string>& names,
+    const MeshFormat::VertexFormat vertexFormat,
+    const ClusterCullingPass* clusterCulling) {
+  // Stored entries are used from the mapping, compressed ones all get
+  // decompressed together before any upload starts
+  std::vector<const AssetPack::Entry*> entries;
+  std::vector<std::vector<uint8_t>> decompressed(names.size());
+  std::vector<AssetPack::PackReader::ReadRequest> requests;
+  for (size_t i = 0; i < names.size(); ++i) {
+    const AssetPack::Entry* entry = pack.find(names[i]);
+    if (!entry)
+      throw std::runtime_error("failed to find " + names[i] + " in the asset pack!");
+    entries.push_back(entry);
+    if (!pack.mappedData(*entry)) {
+      decompressed[i].resize(entry->size);
+      requests.push_back({entry, decompressed[i].data()});
+    }
+  }
+  pack.readParallel(requests);
+
+  std::vector<VulkanModel> models;
+  for (size_t i = 0; i < names.size(); ++i) {
+    const uint8_t* data = pack.mappedData(*entries[i]);
+    if (!data)
+      data = decompressed[i].data();
+    models.push_back(loadMeshModel(devManager, data, entries[i]->size, names[i], vertexFormat, clusterCulling));
+    // Uploaded, no need to hold on to it while the rest go
+    std::vector<uint8_t>().swap(decompressed[i]);
+  }
+  return models;
+}
+
+}
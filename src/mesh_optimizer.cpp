@@ -0,0 +1,306 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+namespace MeshOptimize {
+namespace {
+// FIFO cache via timestamps: a vertex is cached while fewer than cacheSize
+// misses happened since it was last loaded. Only misses advance time.
+class FifoCache {
+ public:
+  FifoCache(const size_t vertexCount, const uint32_t _cacheSize)
+    : cacheSize(_cacheSize), loadedAt(vertexCount, 0), time(_cacheSize) {}
+
+  // true on a miss
+  bool access(const uint32_t vertex) {
+    if (loadedAt[vertex] != 0 && time - loadedAt[vertex] < cacheSize)
+      return false;
+    loadedAt[vertex] = ++time;
+    return true;
+  }
+
+  void flush() { time += cacheSize; }
+
+ private:
+  const uint32_t cacheSize;
+  std::vector<uint64_t> loadedAt;
+  uint64_t time;
+};
+
+// Triangles using each vertex, as one flat array
+struct Adjacency {
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> triangles;
+
+  Adjacency(const uint32_t* indices, const size_t indexCount, const size_t vertexCount)
+    : offsets(vertexCount + 1, 0), triangles(indexCount) {
+    for (size_t i = 0; i < indexCount; ++i)
+      ++offsets[indices[i] + 1];
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indexCount; ++i)
+      triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+  }
+
+  uint32_t count(const uint32_t vertex) const { return offsets[vertex + 1] - offsets[vertex]; }
+};
+
+glm::vec3 triangleCross(const uint32_t* triangle, const GraphicsTypes::Vertex* vertices) {
+  const glm::vec3& a = vertices[triangle[0]].position;
+  return glm::cross(vertices[triangle[1]].position - a, vertices[triangle[2]].position - a);
+}
+
+glm::vec3 triangleCentroid(const uint32_t* triangle, const GraphicsTypes::Vertex* vertices) {
+  return (vertices[triangle[0]].position + vertices[triangle[1]].position + vertices[triangle[2]].position) / 3.0f;
+}
+}
+
+CacheStats analyzeVertexCache(
+    const uint32_t* indices,
+    const size_t indexCount,
+    const size_t vertexCount,
+    const uint32_t cacheSize) {
+  CacheStats stats;
+  if (indexCount < 3)
+    return stats;
+
+  FifoCache cache(vertexCount, cacheSize);
+  std::vector<uint8_t> used(vertexCount, 0);
+  size_t misses = 0, unique = 0;
+  for (size_t i = 0; i < indexCount; ++i) {
+    misses += cache.access(indices[i]);
+    if (!used[indices[i]]) {
+      used[indices[i]] = 1;
+      ++unique;
+    }
+  }
+
+  stats.acmr = float(misses) / float(indexCount / 3);
+  stats.atvr = float(misses) / float(unique);
+  return stats;
+}
+
+void optimizeVertexCache(
+    uint32_t* indices,
+    const size_t indexCount,
+    const size_t vertexCount,
+    const uint32_t cacheSize) {
+  const size_t triangleCount = indexCount / 3;
+  if (triangleCount == 0)
+    return;
+
+  const Adjacency adjacency(indices, triangleCount * 3, vertexCount);
+  std::vector<uint32_t> liveTriangles(vertexCount);
+  for (uint32_t v = 0; v < vertexCount; ++v)
+    liveTriangles[v] = adjacency.count(v);
+
+  std::vector<uint32_t> cacheTime(vertexCount, 0);
+  std::vector<uint8_t> emitted(triangleCount, 0);
+  std::vector<uint32_t> deadEnd;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> output;
+  output.reserve(triangleCount * 3);
+
+  uint32_t time = cacheSize + 1;
+  uint32_t scan = 0;
+  int64_t fan = 0;
+  while (fan >= 0) {
+    candidates.clear();
+    const uint32_t fanVertex = static_cast<uint32_t>(fan);
+    for (uint32_t a = adjacency.offsets[fanVertex]; a < adjacency.offsets[fanVertex + 1]; ++a) {
+      const uint32_t triangle = adjacency.triangles[a];
+      if (emitted[triangle])
+        continue;
+
+      for (int corner = 0; corner < 3; ++corner) {
+        const uint32_t v = indices[triangle * 3 + corner];
+        output.push_back(v);
+        deadEnd.push_back(v);
+        candidates.push_back(v);
+        --liveTriangles[v];
+        if (time - cacheTime[v] > cacheSize)
+          cacheTime[v] = time++;
+      }
+      emitted[triangle] = 1;
+    }
+
+    // Best candidate: still has work and will still be cached after its fan
+    fan = -1;
+    int64_t best = -1;
+    for (const uint32_t v : candidates) {
+      if (liveTriangles[v] == 0)
+        continue;
+      int64_t priority = 0;
+      if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+        priority = time - cacheTime[v];
+      if (priority > best) {
+        best = priority;
+        fan = v;
+      }
+    }
+
+    if (fan >= 0)
+      continue;
+
+    // Dead end: recently used vertices first, then whatever's left in order
+    while (!deadEnd.empty() && fan < 0) {
+      const uint32_t v = deadEnd.back();
+      deadEnd.pop_back();
+      if (liveTriangles[v] > 0)
+        fan = v;
+    }
+    while (fan < 0 && scan < vertexCount) {
+      if (liveTriangles[scan] > 0)
+        fan = scan;
+      ++scan;
+    }
+  }
+
+  std::copy(output.begin(), output.end(), indices);
+}
+
+void optimizeOverdraw(
+    uint32_t* indices,
+    const size_t indexCount,
+    const GraphicsTypes::Vertex* vertices,
+    const size_t vertexCount,
+    const float threshold,
+    const uint32_t cacheSize) {
+  const size_t triangleCount = indexCount / 3;
+  if (triangleCount < 2)
+    return;
+
+  const float targetAcmr = threshold * analyzeVertexCache(indices, triangleCount * 3, vertexCount, cacheSize).acmr;
+
+  // Hard boundaries are where the cache runs dry anyway (all three corners
+  // miss), cutting there is free. Inside those, cut again whenever the cluster
+  // so far is cheap enough.
+  std::vector<size_t> clusterStarts;
+  {
+    FifoCache cache(vertexCount, cacheSize);
+    size_t clusterStart = 0, clusterMisses = 0;
+    for (size_t t = 0; t < triangleCount; ++t) {
+      const uint32_t* triangle = indices + t * 3;
+      const int misses = cache.access(triangle[0]) + cache.access(triangle[1]) + cache.access(triangle[2]);
+      if (misses == 3 || t == 0) {
+        clusterStarts.push_back(t);
+        clusterStart = t;
+        clusterMisses = 0;
+      }
+
+      clusterMisses += misses;
+      const float clusterAcmr = float(clusterMisses) / float(t - clusterStart + 1);
+      if (clusterAcmr <= targetAcmr && t + 1 < triangleCount) {
+        clusterStarts.push_back(t + 1);
+        clusterStart = t + 1;
+        clusterMisses = 0;
+        cache.flush();
+      }
+    }
+  }
+  clusterStarts.erase(std::unique(clusterStarts.begin(), clusterStarts.end()), clusterStarts.end());
+  clusterStarts.push_back(triangleCount);
+
+  const size_t clusterCount = clusterStarts.size() - 1;
+  if (clusterCount < 2)
+    return;
+
+  // Area weighted centroid and normal per cluster
+  std::vector<glm::vec3> centroids(clusterCount, glm::vec3(0.0f));
+  std::vector<glm::vec3> normals(clusterCount, glm::vec3(0.0f));
+  glm::vec3 meshCentroid(0.0f);
+  float meshArea = 0.0f;
+  for (size_t c = 0; c < clusterCount; ++c) {
+    float clusterArea = 0.0f;
+    for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t) {
+      const glm::vec3 cross = triangleCross(indices + t * 3, vertices);
+      const float area = glm::length(cross);
+      centroids[c] += triangleCentroid(indices + t * 3, vertices) * area;
+      normals[c] += cross;
+      clusterArea += area;
+    }
+    meshCentroid += centroids[c];
+    meshArea += clusterArea;
+    if (clusterArea > 0.0f)
+      centroids[c] /= clusterArea;
+  }
+  if (meshArea > 0.0f)
+    meshCentroid /= meshArea;
+
+  // Further out along its own normal means more likely to occlude
+  std::vector<float> occlusion(clusterCount);
+  for (size_t c = 0; c < clusterCount; ++c) {
+    const float length = glm::length(normals[c]);
+    occlusion[c] = length > 0.0f ? glm::dot(centroids[c] - meshCentroid, normals[c] / length) : 0.0f;
+  }
+
+  std::vector<size_t> order(clusterCount);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return occlusion[a] > occlusion[b]; });
+
+  std::vector<uint32_t> sorted;
+  sorted.reserve(triangleCount * 3);
+  for (const size_t c : order)
+    sorted.insert(sorted.end(), indices + clusterStarts[c] * 3, indices + clusterStarts[c + 1] * 3);
+  std::copy(sorted.begin(), sorted.end(), indices);
+}
+
+void optimizeVertexFetch(MeshFormat::MeshData& mesh) {
+  constexpr uint32_t unassigned = ~0u;
+  std::vector<uint32_t> remap(mesh.vertices.size(), unassigned);
+  std::vector<GraphicsTypes::Vertex> vertices;
+  vertices.reserve(mesh.vertices.size());
+
+  for (auto& index : mesh.indices) {
+    if (remap[index] == unassigned) {
+      remap[index] = static_cast<uint32_t>(vertices.size());
+      vertices.push_back(mesh.vertices[index]);
+    }
+    index = remap[index];
+  }
+
+  mesh.vertices = std::move(vertices);
+}
+
+std::vector<uint16_t> to16BitIndices(const std::vector<uint32_t>& indices) {
+  std::vector<uint16_t> out(indices.size());
+  for (size_t i = 0; i < indices.size(); ++i) {
+    if (indices[i] > 0xffff)
+      throw std::invalid_argument("index doesn't fit in 16 bits!");
+    out[i] = static_cast<uint16_t>(indices[i]);
+  }
+  return out;
+}
+
+OptimizeReport optimizeMesh(MeshFormat::MeshData& mesh, const float overdrawThreshold) {
+  OptimizeReport report;
+  report.before = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+
+  // Triangles only move within their own submesh, and lods past 0 (which live
+  // after the submeshes in the index buffer) within their own range
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;
+  for (const auto& submesh : mesh.submeshes)
+    ranges.emplace_back(submesh.firstIndex, submesh.indexCount);
+  if (ranges.empty() && !mesh.lods.empty())
+    ranges.emplace_back(mesh.lods[0].firstIndex, mesh.lods[0].indexCount);
+  if (ranges.empty())
+    ranges.emplace_back(0, static_cast<uint32_t>(mesh.indices.size()));
+  for (size_t lod = 1; lod < mesh.lods.size(); ++lod)
+    ranges.emplace_back(mesh.lods[lod].firstIndex, mesh.lods[lod].indexCount);
+
+  for (const auto& [first, count] : ranges) {
+    uint32_t* range = mesh.indices.data() + first;
+    optimizeVertexCache(range, count, mesh.vertices.size());
+    optimizeOverdraw(range, count, mesh.vertices.data(), mesh.vertices.size(), overdrawThreshold);
+  }
+
+  optimizeVertexFetch(mesh);
+
+  report.after = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+  return report;
+}
+
+}
@@ -0,0 +1,301 @@
+#include "mesh_simplify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+namespace MeshSimplify {
+namespace {
+// error(p) = (p.A.p + 2 b.p + c) / weight, i.e. area weighted mean squared
+// distance to the planes that went into it
+struct Quadric {
+  double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+  double b0 = 0, b1 = 0, b2 = 0;
+  double c = 0;
+  double weight = 0;
+
+  void addPlane(const glm::vec3& normal, const float distance, const float planeWeight) {
+    const double x = normal.x, y = normal.y, z = normal.z, d = distance, w = planeWeight;
+    a00 += w * x * x; a01 += w * x * y; a02 += w * x * z;
+    a11 += w * y * y; a12 += w * y * z; a22 += w * z * z;
+    b0 += w * x * d; b1 += w * y * d; b2 += w * z * d;
+    c += w * d * d;
+    weight += w;
+  }
+
+  Quadric& operator+=(const Quadric& other) {
+    a00 += other.a00; a01 += other.a01; a02 += other.a02;
+    a11 += other.a11; a12 += other.a12; a22 += other.a22;
+    b0 += other.b0; b1 += other.b1; b2 += other.b2;
+    c += other.c;
+    weight += other.weight;
+    return *this;
+  }
+
+  double error(const glm::vec3& p) const {
+    const double x = p.x, y = p.y, z = p.z;
+    const double result =
+        a00 * x * x + a11 * y * y + a22 * z * z +
+        2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+        2.0 * (b0 * x + b1 * y + b2 * z) + c;
+    return weight > 0.0 ? std::max(result, 0.0) / weight : 0.0;
+  }
+};
+
+struct PositionHash {
+  size_t operator()(const glm::vec3& p) const {
+    uint32_t bits[3];
+    std::memcpy(bits, &p.x, sizeof(float));
+    std::memcpy(bits + 1, &p.y, sizeof(float));
+    std::memcpy(bits + 2, &p.z, sizeof(float));
+    return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+  }
+};
+
+struct PositionEqual {
+  bool operator()(const glm::vec3& a, const glm::vec3& b) const { return a.x == b.x && a.y == b.y && a.z == b.z; }
+};
+
+struct Collapse {
+  double error;
+  uint32_t from;
+  uint32_t to;
+};
+
+uint64_t edgeKey(uint32_t a, uint32_t b) {
+  if (a > b)
+    std::swap(a, b);
+  return (uint64_t(a) << 32) | b;
+}
+}
+
+std::vector<uint32_t> simplify(
+    const std::vector<GraphicsTypes::Vertex>& vertices,
+    const uint32_t* indices,
+    const size_t indexCount,
+    const size_t targetIndexCount,
+    const float maxError,
+    float* resultError) {
+  std::vector<uint32_t> result(indices, indices + indexCount / 3 * 3);
+  if (resultError)
+    *resultError = 0.0f;
+  if (result.size() <= targetIndexCount)
+    return result;
+
+  // Vertices at the same position are one point topologically, the
+  // separate copies are attribute seams
+  const size_t vertexCount = vertices.size();
+  std::vector<uint32_t> position(vertexCount);
+  std::vector<uint32_t> copiesAtPosition(vertexCount, 0);
+  {
+    std::unordered_map<glm::vec3, uint32_t, PositionHash, PositionEqual> firstAt;
+    firstAt.reserve(vertexCount);
+    std::vector<uint8_t> used(vertexCount, 0);
+    for (const uint32_t index : result)
+      used[index] = 1;
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+      position[v] = firstAt.emplace(vertices[v].position, v).first->second;
+      copiesAtPosition[position[v]] += used[v];
+    }
+  }
+
+  // Locked: seams, open borders and non-manifold edges
+  std::vector<uint8_t> locked(vertexCount, 0);
+  {
+    std::unordered_map<uint64_t, uint32_t> edgeUses;
+    edgeUses.reserve(result.size());
+    for (size_t i = 0; i < result.size(); i += 3)
+      for (int e = 0; e < 3; ++e)
+        ++edgeUses[edgeKey(position[result[i + e]], position[result[i + (e + 1) % 3]])];
+
+    for (const auto& [key, uses] : edgeUses) {
+      if (uses == 2)
+        continue;
+      locked[key >> 32] = 1;
+      locked[key & 0xffffffff] = 1;
+    }
+    for (uint32_t v = 0; v < vertexCount; ++v)
+      if (copiesAtPosition[position[v]] > 1)
+        locked[position[v]] = 1;
+  }
+
+  std::vector<Quadric> quadrics(vertexCount);
+  for (size_t i = 0; i < result.size(); i += 3) {
+    const glm::vec3& p0 = vertices[result[i]].position;
+    const glm::vec3 cross = glm::cross(vertices[result[i + 1]].position - p0, vertices[result[i + 2]].position - p0);
+    const float area = glm::length(cross);
+    if (area == 0.0f)
+      continue;
+    const glm::vec3 normal = cross / area;
+    const float distance = -glm::dot(normal, p0);
+    for (int corner = 0; corner < 3; ++corner)
+      quadrics[position[result[i + corner]]].addPlane(normal, distance, area);
+  }
+
+  const double maxErrorSquared = double(maxError) * maxError;
+  double worstError = 0.0;
+
+  std::vector<uint32_t> adjacencyOffsets;
+  std::vector<uint32_t> adjacency;
+  std::vector<Collapse> collapses;
+  std::vector<uint32_t> collapseTo(vertexCount);
+  std::vector<uint8_t> touched(vertexCount);
+
+  // Passes of independent collapses, cheapest first, until the target or
+  // the error limit is hit
+  while (result.size() > targetIndexCount) {
+    const size_t triangleCount = result.size() / 3;
+
+    adjacencyOffsets.assign(vertexCount + 1, 0);
+    for (const uint32_t index : result)
+      ++adjacencyOffsets[index + 1];
+    std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+    adjacency.resize(result.size());
+    {
+      std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+      for (size_t i = 0; i < result.size(); ++i)
+        adjacency[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    // Interior edges show up once each way, take the a < b one and try both
+    // directions on it
+    collapses.clear();
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (int e = 0; e < 3; ++e) {
+        const uint32_t a = result[i + e];
+        const uint32_t b = result[i + (e + 1) % 3];
+        if (a >= b)
+          continue;
+
+        Quadric merged = quadrics[position[a]];
+        merged += quadrics[position[b]];
+        const double errorAtB = locked[position[a]] ? -1.0 : merged.error(vertices[b].position);
+        const double errorAtA = locked[position[b]] ? -1.0 : merged.error(vertices[a].position);
+        if (errorAtB < 0.0 && errorAtA < 0.0)
+          continue;
+
+        if (errorAtA < 0.0 || (errorAtB >= 0.0 && errorAtB <= errorAtA))
+          collapses.push_back({errorAtB, a, b});
+        else
+          collapses.push_back({errorAtA, b, a});
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+
+    std::iota(collapseTo.begin(), collapseTo.end(), 0);
+    std::fill(touched.begin(), touched.end(), 0);
+    const size_t trianglesToRemove = triangleCount - targetIndexCount / 3;
+    size_t removed = 0;
+    size_t applied = 0;
+    for (const Collapse& collapse : collapses) {
+      if (collapse.error > maxErrorSquared || removed >= trianglesToRemove)
+        break;
+      if (touched[collapse.from] || touched[collapse.to])
+        continue;
+
+      // Reject anything that flips or badly folds a surviving triangle
+      const glm::vec3& target = vertices[collapse.to].position;
+      bool flips = false;
+      size_t shared = 0;
+      for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1] && !flips; ++a) {
+        const uint32_t* triangle = result.data() + adjacency[a] * 3;
+        if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) {
+          ++shared;
+          continue;
+        }
+
+        glm::vec3 before[3], after[3];
+        for (int corner = 0; corner < 3; ++corner) {
+          before[corner] = vertices[triangle[corner]].position;
+          after[corner] = triangle[corner] == collapse.from ? target : before[corner];
+        }
+        const glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+        const glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+        flips = glm::dot(normalBefore, normalAfter) <= 0.25f * glm::length(normalBefore) * glm::length(normalAfter);
+      }
+      if (flips)
+        continue;
+
+      collapseTo[collapse.from] = collapse.to;
+      touched[collapse.from] = touched[collapse.to] = 1;
+      quadrics[position[collapse.to]] += quadrics[position[collapse.from]];
+      worstError = std::max(worstError, collapse.error);
+      removed += shared;
+      ++applied;
+    }
+
+    if (applied == 0)
+      break;
+
+    size_t write = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      const uint32_t a = collapseTo[result[i]];
+      const uint32_t b = collapseTo[result[i + 1]];
+      const uint32_t c = collapseTo[result[i + 2]];
+      if (a == b || b == c || a == c)
+        continue;
+      result[write++] = a;
+      result[write++] = b;
+      result[write++] = c;
+    }
+    result.resize(write);
+  }
+
+  if (resultError)
+    *resultError = static_cast<float>(std::sqrt(worstError));
+  return result;
+}
+
+void buildLodChain(MeshFormat::MeshData& mesh, const LodChainOptions& options) {
+  const uint32_t lod0Count = static_cast<uint32_t>(mesh.indices.size());
+  mesh.lods.clear();
+  mesh.lods.push_back({0, lod0Count, 0.0f, 0});
+
+  std::vector<std::vector<uint32_t>> previous;
+  if (mesh.submeshes.empty()) {
+    previous.emplace_back(mesh.indices.begin(), mesh.indices.end());
+  } else {
+    for (const auto& submesh : mesh.submeshes)
+      previous.emplace_back(
+          mesh.indices.begin() + submesh.firstIndex,
+          mesh.indices.begin() + submesh.firstIndex + submesh.indexCount);
+  }
+
+  const MeshFormat::Bounds bounds = MeshFormat::computeBounds(mesh.vertices.data(), mesh.vertices.size());
+  const float maxError = options.maxRelativeError * bounds.radius;
+
+  size_t previousCount = lod0Count;
+  float previousError = 0.0f;
+  for (uint32_t level = 1; level < options.maxLods; ++level) {
+    std::vector<std::vector<uint32_t>> next;
+    size_t nextCount = 0;
+    // Fresh quadrics per level only measure the step from the level before.
+    // Steps add up at worst (triangle inequality), so the sum bounds the
+    // distance from lod 0.
+    float stepError = 0.0f;
+    for (const auto& part : previous) {
+      const size_t target = size_t(part.size() / 3 * options.reduction) * 3;
+      float partError = 0.0f;
+      next.push_back(simplify(mesh.vertices, part.data(), part.size(), target, maxError, &partError));
+      nextCount += next.back().size();
+      stepError = std::max(stepError, partError);
+    }
+    const float levelError = previousError + stepError;
+
+    if (nextCount == 0 || nextCount > previousCount * options.minProgress)
+      break;
+
+    const uint32_t firstIndex = static_cast<uint32_t>(mesh.indices.size());
+    for (const auto& part : next)
+      mesh.indices.insert(mesh.indices.end(), part.begin(), part.end());
+    mesh.lods.push_back({firstIndex, static_cast<uint32_t>(nextCount), levelError, 0});
+
+    previous = std::move(next);
+    previousCount = nextCount;
+    previousError = levelError;
+  }
+}
+
+}
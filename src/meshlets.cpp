@@ -0,0 +1,145 @@
+#include "meshlets.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace Meshlets {
+namespace {
+// Sphere around the box center and cone of the triangle normals
+void computeMeshletBounds(
+    MeshFormat::Meshlet& meshlet,
+    const std::vector<GraphicsTypes::Vertex>& vertices,
+    const uint32_t* meshletVertices,
+    const uint32_t* meshletTriangles) {
+  glm::vec3 low = vertices[meshletVertices[0]].position;
+  glm::vec3 high = low;
+  for (uint32_t i = 1; i < meshlet.vertexCount; ++i) {
+    low = glm::min(low, vertices[meshletVertices[i]].position);
+    high = glm::max(high, vertices[meshletVertices[i]].position);
+  }
+
+  const glm::vec3 center = (low + high) * 0.5f;
+  float radius = 0.0f;
+  for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+    radius = std::max(radius, glm::length(vertices[meshletVertices[i]].position - center));
+
+  std::vector<glm::vec3> normals;
+  normals.reserve(meshlet.triangleCount);
+  glm::vec3 axis(0.0f);
+  for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+    const uint32_t packed = meshletTriangles[t];
+    const glm::vec3& a = vertices[meshletVertices[packed & 0xff]].position;
+    const glm::vec3& b = vertices[meshletVertices[(packed >> 8) & 0xff]].position;
+    const glm::vec3& c = vertices[meshletVertices[(packed >> 16) & 0xff]].position;
+    const glm::vec3 normal = glm::cross(b - a, c - a);
+    const float length = glm::length(normal);
+    // degenerate triangles can't be backfacing
+    if (length == 0.0f)
+      continue;
+    normals.push_back(normal / length);
+    axis += normals.back();
+  }
+
+  float minDot = 1.0f;
+  const float axisLength = glm::length(axis);
+  if (axisLength > 0.0f) {
+    axis /= axisLength;
+    for (const glm::vec3& normal : normals)
+      minDot = std::min(minDot, glm::dot(axis, normal));
+  }
+
+  for (int i = 0; i < 3; ++i)
+    meshlet.center[i] = center[i];
+  meshlet.radius = radius;
+
+  // Normals spread over more than ~85 degrees, the cone would never cull
+  if (axisLength == 0.0f || minDot <= 0.1f) {
+    meshlet.coneAxis[0] = meshlet.coneAxis[1] = meshlet.coneAxis[2] = 0.0f;
+    meshlet.coneCutoff = 1.0f;
+    return;
+  }
+
+  for (int i = 0; i < 3; ++i)
+    meshlet.coneAxis[i] = axis[i];
+  // sin of the half angle, the view direction has to be this far past perpendicular
+  meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+}
+
+void buildMeshlets(MeshFormat::MeshData& mesh, const uint32_t maxVertices, const uint32_t maxTriangles) {
+  if (maxVertices < 3 || maxVertices > 256 || maxTriangles < 1)
+    throw std::invalid_argument("meshlet limits out of range!");
+
+  mesh.meshlets.clear();
+  mesh.meshletVertices.clear();
+  mesh.meshletTriangles.clear();
+
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;
+  for (const auto& submesh : mesh.submeshes)
+    ranges.emplace_back(submesh.firstIndex, submesh.indexCount);
+  if (ranges.empty()) {
+    const MeshFormat::Lod lod0 = mesh.lods.empty()
+        ? MeshFormat::Lod{0, static_cast<uint32_t>(mesh.indices.size()), 0.0f, 0}
+        : mesh.lods[0];
+    ranges.emplace_back(lod0.firstIndex, lod0.indexCount);
+  }
+
+  // Local slot of each mesh vertex in the open meshlet, ~0 if not in it
+  constexpr uint32_t notInMeshlet = ~0u;
+  std::vector<uint32_t> localIndex(mesh.vertices.size(), notInMeshlet);
+
+  MeshFormat::Meshlet current{};
+  auto finish = [&]() {
+    if (current.triangleCount == 0)
+      return;
+    computeMeshletBounds(
+        current,
+        mesh.vertices,
+        mesh.meshletVertices.data() + current.vertexOffset,
+        mesh.meshletTriangles.data() + current.triangleOffset);
+    for (uint32_t i = 0; i < current.vertexCount; ++i)
+      localIndex[mesh.meshletVertices[current.vertexOffset + i]] = notInMeshlet;
+    mesh.meshlets.push_back(current);
+
+    current = {};
+    current.vertexOffset = static_cast<uint32_t>(mesh.meshletVertices.size());
+    current.triangleOffset = static_cast<uint32_t>(mesh.meshletTriangles.size());
+  };
+
+  for (const auto& [first, count] : ranges) {
+    for (uint32_t i = first; i + 2 < first + count; i += 3) {
+      const uint32_t* triangle = mesh.indices.data() + i;
+      uint32_t newVertices = 0;
+      for (int corner = 0; corner < 3; ++corner)
+        newVertices += localIndex[triangle[corner]] == notInMeshlet;
+
+      if (current.vertexCount + newVertices > maxVertices || current.triangleCount + 1 > maxTriangles)
+        finish();
+
+      uint32_t packed = 0;
+      for (int corner = 0; corner < 3; ++corner) {
+        uint32_t& local = localIndex[triangle[corner]];
+        if (local == notInMeshlet) {
+          local = current.vertexCount++;
+          mesh.meshletVertices.push_back(triangle[corner]);
+        }
+        packed |= local << (corner * 8);
+      }
+      mesh.meshletTriangles.push_back(packed);
+      ++current.triangleCount;
+    }
+    finish();
+  }
+}
+
+size_t meshletIndexCount(const MeshFormat::MeshletsView& meshlets) {
+  size_t count = 0;
+  for (const auto& meshlet : meshlets.meshlets)
+    count += size_t(meshlet.triangleCount) * 3;
+  return count;
+}
+
+}
@@ -0,0 +1,374 @@
+#include "vulkan_utils/mip_generator.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include "file_loader.h"
+#include "vulkan_utils/host_allocator.h"
+
+namespace VulkanUtils {
+namespace {
+constexpr const char* downsampleShaderPath = "build/mip_downsample.spv";
+constexpr uint32_t groupSize = 8;
+
+struct MipPushConstants {
+  int32_t sourceSize[2];
+  int32_t destinationSize[2];
+};
+
+uint32_t levelSize(const uint32_t size, const uint32_t level) {
+  return std::max(size >> level, 1u);
+}
+
+VkAccessFlags accessFor(const VkImageLayout layout) {
+  switch (layout) {
+    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+      return VK_ACCESS_TRANSFER_WRITE_BIT;
+    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+      return VK_ACCESS_TRANSFER_READ_BIT;
+    case VK_IMAGE_LAYOUT_GENERAL:
+      return VK_ACCESS_SHADER_WRITE_BIT;
+    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+      return VK_ACCESS_SHADER_READ_BIT;
+    default:
+      return 0;
+  }
+}
+
+VkImageMemoryBarrier levelBarrier(
+    const VkImage image,
+    const uint32_t baseLevel,
+    const uint32_t levelCount,
+    const VkImageLayout oldLayout,
+    const VkImageLayout newLayout) {
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = accessFor(oldLayout);
+  barrier.dstAccessMask = accessFor(newLayout);
+  barrier.oldLayout = oldLayout;
+  barrier.newLayout = newLayout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = baseLevel;
+  barrier.subresourceRange.levelCount = levelCount;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+  return barrier;
+}
+}
+
+MipGenerator::Scratch::~Scratch() {
+  for (const VkImageView view : views)
+    vkDestroyImageView(device, view, allocationCallbacks());
+  if (descriptorPool != VK_NULL_HANDLE)
+    vkDestroyDescriptorPool(device, descriptorPool, allocationCallbacks());
+}
+
+MipGenerator::Scratch::Scratch(Scratch&& other) noexcept
+  : device(other.device),
+    views(std::move(other.views)),
+    descriptorPool(other.descriptorPool) {
+  other.views.clear();
+  other.descriptorPool = VK_NULL_HANDLE;
+}
+
+MipGenerator::MipGenerator(DeviceManager& _devManager)
+  : devManager(_devManager),
+    device(_devManager.getDevice()) {
+  if (!devManager.hasStorageImageWriteWithoutFormat())
+    return;
+
+  std::vector<char> shaderCode;
+  try {
+    shaderCode = readFile(downsampleShaderPath);
+  } catch (const std::exception&) {
+    std::cout << "no " << downsampleShaderPath << ", mips only for blittable formats" << std::endl;
+    return;
+  }
+
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.maxLod = 0.0f;
+  sampler = devManager.getSamplerCache().get(samplerInfo);
+
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+  bindings[0].binding = 0;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[0].descriptorCount = 1;
+  bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  bindings[1].binding = 1;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  bindings[1].descriptorCount = 1;
+  bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+  setLayout = devManager.getLayoutCache().get(layoutInfo);
+
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(MipPushConstants);
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &setLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+  if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocationCallbacks(), &pipelineLayout) != VK_SUCCESS)
+    throw std::runtime_error("failed to create mip pipeline layout!");
+
+  VkShaderModuleCreateInfo moduleInfo{};
+  moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = shaderCode.size();
+  moduleInfo.pCode = reinterpret_cast<const uint32_t*>(shaderCode.data());
+
+  VkShaderModule shaderModule;
+  if (vkCreateShaderModule(device, &moduleInfo, allocationCallbacks(), &shaderModule) != VK_SUCCESS)
+    throw std::runtime_error("failed to create shader module!");
+
+  VkComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = shaderModule;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = pipelineLayout;
+
+  const VkResult result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocationCallbacks(), &pipeline);
+  vkDestroyShaderModule(device, shaderModule, allocationCallbacks());
+  if (result != VK_SUCCESS)
+    throw std::runtime_error("failed to create mip pipeline!");
+}
+
+MipGenerator::~MipGenerator() {
+  if (pipeline != VK_NULL_HANDLE)
+    vkDestroyPipeline(device, pipeline, allocationCallbacks());
+  if (pipelineLayout != VK_NULL_HANDLE)
+    vkDestroyPipelineLayout(device, pipelineLayout, allocationCallbacks());
+}
+
+MipGenerator::Method MipGenerator::methodFor(const VkFormat format) const {
+  const auto found = methods.find(format);
+  if (found != methods.end())
+    return found->second;
+
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties(devManager.getPhysicalDevice(), format, &properties);
+  const VkFormatFeatureFlags features = properties.optimalTilingFeatures;
+
+  const VkFormatFeatureFlags blit =
+      VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  const VkFormatFeatureFlags compute = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
+
+  Method method = Method::unsupported;
+  if ((features & blit) == blit)
+    method = Method::blit;
+  else if (pipeline != VK_NULL_HANDLE && (features & compute) == compute)
+    method = Method::compute;
+
+  methods.emplace(format, method);
+  return method;
+}
+
+VkImageUsageFlags MipGenerator::requiredUsage(const VkFormat format) const {
+  switch (methodFor(format)) {
+    case Method::blit:
+      return VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    case Method::compute:
+      return VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    default:
+      return 0;
+  }
+}
+
+MipGenerator::Scratch MipGenerator::record(const VkCommandBuffer commandBuffer, const std::vector<Request>& requests) const {
+  Scratch scratch(device);
+
+  // Layout of every level of every request as recorded so far
+  std::vector<Method> requestMethods(requests.size());
+  std::vector<std::vector<VkImageLayout>> layouts(requests.size());
+  uint32_t maxLevels = 1;
+  uint32_t computeLevels = 0;
+  for (size_t i = 0; i < requests.size(); ++i) {
+    const Request& request = requests[i];
+    requestMethods[i] = request.mipLevels > 1 ? methodFor(request.format) : Method::blit;
+    if (requestMethods[i] == Method::unsupported)
+      throw std::invalid_argument("can't generate mips for format " + std::to_string(request.format));
+
+    layouts[i].assign(request.mipLevels, VK_IMAGE_LAYOUT_UNDEFINED);
+    layouts[i][0] = request.currentLayout;
+    maxLevels = std::max(maxLevels, request.mipLevels);
+    if (requestMethods[i] == Method::compute)
+      computeLevels += request.mipLevels - 1;
+  }
+
+  if (computeLevels > 0) {
+    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[0].descriptorCount = computeLevels;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[1].descriptorCount = computeLevels;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = computeLevels;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    if (vkCreateDescriptorPool(device, &poolInfo, allocationCallbacks(), &scratch.descriptorPool) != VK_SUCCESS)
+      throw std::runtime_error("failed to create mip descriptor pool!");
+  }
+
+  const auto levelView = [&](const Request& request, const uint32_t level) {
+    VkImageView view;
+    if (devManager.createImageView(request.image, request.format, VK_IMAGE_ASPECT_COLOR_BIT, view, 1, level) != VK_SUCCESS)
+      throw std::runtime_error("failed to create mip view!");
+    scratch.views.push_back(view);
+    return view;
+  };
+
+  const VkPipelineStageFlags workStages = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  std::vector<VkImageMemoryBarrier> barriers;
+  for (uint32_t level = 1; level < maxLevels; ++level) {
+    // Level above becomes readable, this one writable, for every image at once
+    barriers.clear();
+    for (size_t i = 0; i < requests.size(); ++i) {
+      if (level >= requests[i].mipLevels)
+        continue;
+
+      const bool blit = requestMethods[i] == Method::blit;
+      const VkImageLayout readLayout = blit ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      const VkImageLayout writeLayout = blit ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+      barriers.push_back(levelBarrier(requests[i].image, level - 1, 1, layouts[i][level - 1], readLayout));
+      barriers.push_back(levelBarrier(requests[i].image, level, 1, VK_IMAGE_LAYOUT_UNDEFINED, writeLayout));
+      layouts[i][level - 1] = readLayout;
+      layouts[i][level] = writeLayout;
+    }
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        workStages,
+        workStages,
+        0,
+        0, nullptr,
+        0, nullptr,
+        static_cast<uint32_t>(barriers.size()), barriers.data());
+
+    bool pipelineBound = false;
+    for (size_t i = 0; i < requests.size(); ++i) {
+      const Request& request = requests[i];
+      if (level >= request.mipLevels)
+        continue;
+
+      const uint32_t srcWidth = levelSize(request.width, level - 1);
+      const uint32_t srcHeight = levelSize(request.height, level - 1);
+      const uint32_t dstWidth = levelSize(request.width, level);
+      const uint32_t dstHeight = levelSize(request.height, level);
+
+      if (requestMethods[i] == Method::blit) {
+        VkImageBlit blit{};
+        blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1};
+        blit.srcOffsets[1] = {static_cast<int32_t>(srcWidth), static_cast<int32_t>(srcHeight), 1};
+        blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+        blit.dstOffsets[1] = {static_cast<int32_t>(dstWidth), static_cast<int32_t>(dstHeight), 1};
+        vkCmdBlitImage(
+            commandBuffer,
+            request.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            request.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &blit,
+            VK_FILTER_LINEAR);
+        continue;
+      }
+
+      if (!pipelineBound) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        pipelineBound = true;
+      }
+
+      VkDescriptorSetAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+      allocInfo.descriptorPool = scratch.descriptorPool;
+      allocInfo.descriptorSetCount = 1;
+      allocInfo.pSetLayouts = &setLayout;
+      VkDescriptorSet descriptorSet;
+      if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS)
+        throw std::runtime_error("failed to allocate mip descriptor set!");
+
+      VkDescriptorImageInfo sourceInfo{sampler, levelView(request, level - 1), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+      VkDescriptorImageInfo destinationInfo{VK_NULL_HANDLE, levelView(request, level), VK_IMAGE_LAYOUT_GENERAL};
+      std::array<VkWriteDescriptorSet, 2> writes{};
+      writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[0].dstSet = descriptorSet;
+      writes[0].dstBinding = 0;
+      writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      writes[0].descriptorCount = 1;
+      writes[0].pImageInfo = &sourceInfo;
+      writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[1].dstSet = descriptorSet;
+      writes[1].dstBinding = 1;
+      writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      writes[1].descriptorCount = 1;
+      writes[1].pImageInfo = &destinationInfo;
+      vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+      vkCmdBindDescriptorSets(
+          commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+      const MipPushConstants constants{
+          {static_cast<int32_t>(srcWidth), static_cast<int32_t>(srcHeight)},
+          {static_cast<int32_t>(dstWidth), static_cast<int32_t>(dstHeight)}};
+      vkCmdPushConstants(
+          commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+      vkCmdDispatch(commandBuffer, (dstWidth + groupSize - 1) / groupSize, (dstHeight + groupSize - 1) / groupSize, 1);
+    }
+  }
+
+  // Everything into its final layout, runs of levels sharing a layout together
+  barriers.clear();
+  for (size_t i = 0; i < requests.size(); ++i) {
+    const Request& request = requests[i];
+    for (uint32_t level = 0; level < request.mipLevels;) {
+      uint32_t end = level + 1;
+      while (end < request.mipLevels && layouts[i][end] == layouts[i][level])
+        ++end;
+      if (layouts[i][level] != request.finalLayout)
+        barriers.push_back(levelBarrier(request.image, level, end - level, layouts[i][level], request.finalLayout));
+      level = end;
+    }
+  }
+  if (!barriers.empty())
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        workStages,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        0, nullptr,
+        0, nullptr,
+        static_cast<uint32_t>(barriers.size()), barriers.data());
+
+  return scratch;
+}
+
+void MipGenerator::generate(const std::vector<Request>& requests) const {
+  std::optional<Scratch> scratch;
+  {
+    // Submits and waits when it goes out of scope, before scratch does
+    ScopedCommandBuffer commandBuffer = devManager.createScopedCommandBuffer();
+    scratch.emplace(record(commandBuffer.get(), requests));
+  }
+}
+
+}
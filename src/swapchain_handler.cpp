@@ -4,6 +4,8 @@
 #include <limits>
 #include <tuple>
 
+#include "vulkan_utils/host_allocator.h"
+
 namespace VulkanUtils {
 namespace {
 VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
@@ -16,34 +18,161 @@ VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>
   return availableFormats[0];
 }
 
-VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
+VkPresentModeKHR chooseSwapPresentMode(
+    const std::vector<VkPresentModeKHR>& availablePresentModes,
+    const VkPresentModeKHR preferred) {
   for (const auto& availablePresentMode : availablePresentModes)
-    if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+    if (availablePresentMode == preferred)
       return availablePresentMode;
 
   return VK_PRESENT_MODE_FIFO_KHR;
 }
 }
 
-SwapChainHandler::SwapChainHandler(const DeviceManager& devManager, const WindowAndSurfaceManager& window)
- : device(devManager.getDevice())
+SwapChainHandler::SwapChainHandler(
+    const DeviceManager& devManager,
+    const WindowAndSurfaceManager& window,
+    const SwapChainOptions& options)
+ : devManager(devManager),
+   device(devManager.getDevice()),
+   dynamicRendering(devManager.hasDynamicRendering()),
+   physicalDevice(devManager.getPhysicalDevice()),
+   options(options)
 {
-  createSwapChain(devManager.getPhysicalDevice(), window);
+  createSwapChain(window, VK_NULL_HANDLE);
   createImageViews();
-  createRenderPass();
-  createFramebuffers();
+  if (!dynamicRendering) {
+    createRenderPass();
+    createFramebuffers();
+  }
+}
+
+void SwapChainHandler::recreate(
+    const WindowAndSurfaceManager& window,
+    DeferredDestructionQueue& retired,
+    const uint64_t lastUsedSerial) {
+  const VkSwapchainKHR oldSwapchain = swapchain;
+  const VkFormat oldFormat = swapchainImageFormat;
+  std::vector<VkImageView> oldImageViews = std::move(swapchainImageViews);
+  std::vector<VkFramebuffer> oldFramebuffers = std::move(swapchainFramebuffers);
+  swapchainImageViews.clear();
+  swapchainFramebuffers.clear();
+
+  createSwapChain(window, oldSwapchain);
+
+  retired.retire(lastUsedSerial, oldFramebuffers, oldImageViews, oldSwapchain);
+
+  if (swapchainImageFormat != oldFormat)
+    throw std::runtime_error("swapchain format changed, render pass is no longer compatible!");
+
+  createImageViews();
+  if (!dynamicRendering)
+    createFramebuffers();
+}
+
+void SwapChainHandler::beginRendering(
+    const VkCommandBuffer commandBuffer,
+    const uint32_t imageIndex,
+    const VkClearValue& clearColor) {
+  if (!dynamicRendering) {
+    auto renderPassInfo = createRenderBeginInfo(imageIndex);
+    renderPassInfo.clearValueCount = 1;
+    renderPassInfo.pClearValues = &clearColor;
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    return;
+  }
+
+  // Same as the render pass' initialLayout + external dependency
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = swapchainImages[imageIndex];
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.layerCount = 1;
+
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      0,
+      0,
+      nullptr,
+      0,
+      nullptr,
+      1,
+      &barrier);
+
+  VkRenderingAttachmentInfoKHR colorAttachment{};
+  colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+  colorAttachment.imageView = swapchainImageViews[imageIndex];
+  colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  colorAttachment.clearValue = clearColor;
+
+  VkRenderingInfoKHR renderingInfo{};
+  renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+  renderingInfo.renderArea.offset = {0, 0};
+  renderingInfo.renderArea.extent = swapchainExtent;
+  renderingInfo.layerCount = 1;
+  renderingInfo.colorAttachmentCount = 1;
+  renderingInfo.pColorAttachments = &colorAttachment;
+
+  devManager.cmdBeginRendering(commandBuffer, renderingInfo);
+}
+
+void SwapChainHandler::endRendering(const VkCommandBuffer commandBuffer, const uint32_t imageIndex) {
+  if (!dynamicRendering) {
+    vkCmdEndRenderPass(commandBuffer);
+    return;
+  }
+
+  devManager.cmdEndRendering(commandBuffer);
+
+  // The render pass' finalLayout. Present waits on a semaphore so no dst access
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  barrier.dstAccessMask = 0;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = swapchainImages[imageIndex];
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.layerCount = 1;
+
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      0,
+      0,
+      nullptr,
+      0,
+      nullptr,
+      1,
+      &barrier);
 }
 
 SwapChainHandler::~SwapChainHandler() {
   for (auto imageView : swapchainImageViews)
-    vkDestroyImageView(device, imageView, nullptr);
+    vkDestroyImageView(device, imageView, allocationCallbacks());
 
-  vkDestroySwapchainKHR(device, swapchain, nullptr);
+  vkDestroySwapchainKHR(device, swapchain, allocationCallbacks());
 
   for (auto framebuffer : swapchainFramebuffers)
-    vkDestroyFramebuffer(device, framebuffer, nullptr);
+    vkDestroyFramebuffer(device, framebuffer, allocationCallbacks());
 
-  vkDestroyRenderPass(device, renderPass, nullptr);
+  if (renderPass != VK_NULL_HANDLE)
+    vkDestroyRenderPass(device, renderPass, allocationCallbacks());
 }
 
 void SwapChainHandler::createFramebuffers() {
@@ -63,7 +192,7 @@ void SwapChainHandler::createFramebuffers() {
     framebufferInfo.height = swapchainExtent.height;
     framebufferInfo.layers = 1;
 
-    if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapchainFramebuffers[i]) != VK_SUCCESS)
+    if (vkCreateFramebuffer(device, &framebufferInfo, allocationCallbacks(), &swapchainFramebuffers[i]) != VK_SUCCESS)
       throw std::runtime_error("failed to create framebuffer!");
   }
 }
@@ -87,17 +216,21 @@ VkExtent2D SwapChainHandler::chooseSwapExtent(const WindowAndSurfaceManager& win
   }
 }
 
-void SwapChainHandler::createSwapChain(const VkPhysicalDevice physicalDevice, const WindowAndSurfaceManager& window) {
+void SwapChainHandler::createSwapChain(
+    const WindowAndSurfaceManager& window,
+    const VkSwapchainKHR oldSwapchain) {
   SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice, window.getSurface());
 
   const VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
-  const VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+  presentMode = chooseSwapPresentMode(swapChainSupport.presentModes, options.presentMode);
   const VkExtent2D extent = chooseSwapExtent(window, swapChainSupport.capabilities);
 
   swapchainImageFormat = surfaceFormat.format;
   swapchainExtent = extent;
 
-  uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+  uint32_t imageCount = options.desiredImageCount == 0
+      ? swapChainSupport.capabilities.minImageCount + 1
+      : std::max(options.desiredImageCount, swapChainSupport.capabilities.minImageCount);
   if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
     imageCount = swapChainSupport.capabilities.maxImageCount;
   
@@ -128,9 +261,9 @@ void SwapChainHandler::createSwapChain(const VkPhysicalDevice physicalDevice, co
   createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
   createInfo.presentMode = presentMode;
   createInfo.clipped = VK_TRUE;
-  createInfo.oldSwapchain = VK_NULL_HANDLE;
+  createInfo.oldSwapchain = oldSwapchain;
 
-  if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapchain) != VK_SUCCESS)
+  if (vkCreateSwapchainKHR(device, &createInfo, allocationCallbacks(), &swapchain) != VK_SUCCESS)
     throw std::runtime_error("failed to create swap chain!");
 
   vkGetSwapchainImagesKHR(device, swapchain, &imageCount, nullptr);
@@ -157,7 +290,7 @@ void SwapChainHandler::createImageViews() {
     createInfo.subresourceRange.baseArrayLayer = 0;
     createInfo.subresourceRange.layerCount = 1;
 
-    if (vkCreateImageView(device, &createInfo, nullptr, &swapchainImageViews[i]) != VK_SUCCESS)
+    if (vkCreateImageView(device, &createInfo, allocationCallbacks(), &swapchainImageViews[i]) != VK_SUCCESS)
       throw std::runtime_error("failed to create image views!");
   }
 }
@@ -199,7 +332,7 @@ void SwapChainHandler::createRenderPass() {
   renderPassInfo.dependencyCount = 1;
   renderPassInfo.pDependencies = &dependency;
 
-  if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
+  if (vkCreateRenderPass(device, &renderPassInfo, allocationCallbacks(), &renderPass) != VK_SUCCESS)
     throw std::runtime_error("failed to create render pass!");
 }
 
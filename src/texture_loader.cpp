@@ -0,0 +1,248 @@
+#include "vulkan_utils/texture_loader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "block_compression.h"
+#include "ktx2.h"
+#include "mapped_file.h"
+#include "vulkan_utils/host_allocator.h"
+
+namespace VulkanUtils {
+namespace {
+struct StagingBuffer {
+  VkDevice device;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+
+  ~StagingBuffer() {
+    if (buffer != VK_NULL_HANDLE)
+      vkDestroyBuffer(device, buffer, allocationCallbacks());
+    if (memory != VK_NULL_HANDLE)
+      vkFreeMemory(device, memory, allocationCallbacks());
+  }
+};
+
+// Until the VulkanTexture owns them
+struct PendingImage {
+  VkDevice device;
+  VkImage image = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkImageView view = VK_NULL_HANDLE;
+
+  ~PendingImage() {
+    if (view != VK_NULL_HANDLE)
+      vkDestroyImageView(device, view, allocationCallbacks());
+    if (image != VK_NULL_HANDLE)
+      vkDestroyImage(device, image, allocationCallbacks());
+    if (memory != VK_NULL_HANDLE)
+      vkFreeMemory(device, memory, allocationCallbacks());
+  }
+};
+
+VkImageMemoryBarrier levelsBarrier(
+    const VkImage image,
+    const VkImageLayout oldLayout,
+    const VkImageLayout newLayout,
+    const VkAccessFlags srcAccess,
+    const VkAccessFlags dstAccess,
+    const uint32_t mipLevels) {
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.oldLayout = oldLayout;
+  barrier.newLayout = newLayout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.levelCount = mipLevels;
+  barrier.subresourceRange.layerCount = 1;
+  barrier.srcAccessMask = srcAccess;
+  barrier.dstAccessMask = dstAccess;
+  return barrier;
+}
+}
+
+VkFormat chooseUploadFormat(const VkPhysicalDevice physicalDevice, const VkFormat fileFormat) {
+  const auto sampleable = [&](const VkFormat format) {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+    constexpr VkFormatFeatureFlags needed =
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    return (properties.optimalTilingFeatures & needed) == needed;
+  };
+  if (sampleable(fileFormat))
+    return fileFormat;
+  if (BlockCompression::canDecode(fileFormat) && sampleable(BlockCompression::decodedFormat(fileFormat)))
+    return BlockCompression::decodedFormat(fileFormat);
+  return VK_FORMAT_UNDEFINED;
+}
+
+VulkanTexture loadTexture(DeviceManager& devManager, const std::string& path, const MipGenerator* mips) {
+  const MappedFile file(path);
+  return loadTexture(devManager, file.data(), file.size(), path, mips);
+}
+
+VulkanTexture loadTexture(
+    DeviceManager& devManager,
+    const void* data,
+    const size_t size,
+    const std::string& name,
+    const MipGenerator* mips) {
+  const VkDevice device = devManager.getDevice();
+  const Ktx2::Texture source(data, size, name);
+  const VkFormat format = chooseUploadFormat(devManager.getPhysicalDevice(), source.getFormat());
+  if (format == VK_FORMAT_UNDEFINED)
+    throw std::runtime_error(name + " has a format the device can't sample (" + std::to_string(source.getFormat()) + ")!");
+  const bool decode = format != source.getFormat();
+
+  const uint32_t width = source.getWidth();
+  const uint32_t height = source.getHeight();
+  const uint32_t fileLevels = source.getLevelCount();
+  const bool generateMips = fileLevels == 1 && mips != nullptr && !BlockCompression::formatInfo(format).compressed &&
+      mips->methodFor(format) != MipGenerator::Method::unsupported;
+  const uint32_t mipLevels = generateMips ? mipLevelCount(width, height) : fileLevels;
+
+  // Every level into one staging buffer. 16 byte offsets satisfy both the
+  // texel block size and the 4 byte copy alignment.
+  std::vector<VkBufferImageCopy> regions(fileLevels);
+  VkDeviceSize stagingSize = 0;
+  for (uint32_t level = 0; level < fileLevels; ++level) {
+    VkBufferImageCopy& region = regions[level];
+    region = {};
+    region.bufferOffset = stagingSize;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = level;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {source.levelWidth(level), source.levelHeight(level), 1};
+    stagingSize += (BlockCompression::levelSize(format, source.levelWidth(level), source.levelHeight(level)) + 15) & ~VkDeviceSize(15);
+  }
+
+  StagingBuffer staging{device};
+  if (devManager.createStagingBuffer(stagingSize, staging.buffer, staging.memory) != VK_SUCCESS)
+    throw std::runtime_error("failed to create texture staging buffer!");
+  {
+    void* mapped = nullptr;
+    vkMapMemory(device, staging.memory, 0, stagingSize, 0, &mapped);
+    std::vector<uint8_t> encoded;
+    for (uint32_t level = 0; level < fileLevels; ++level) {
+      uint8_t* destination = static_cast<uint8_t*>(mapped) + regions[level].bufferOffset;
+      if (decode) {
+        encoded.resize(source.levelSize(level));
+        source.readLevel(level, encoded.data());
+        BlockCompression::decode(
+            source.getFormat(), encoded.data(), source.levelWidth(level), source.levelHeight(level), destination);
+      } else {
+        source.readLevel(level, destination);
+      }
+    }
+    vkUnmapMemory(device, staging.memory);
+  }
+
+  PendingImage pending{device};
+  const VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+      (generateMips ? mips->requiredUsage(format) : 0);
+  // UNDEFINED skips createImage's own blocking transition, the copy's
+  // command buffer does it
+  if (devManager.createImage(
+          width,
+          height,
+          format,
+          VK_IMAGE_TILING_OPTIMAL,
+          usage,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+          pending.image,
+          pending.memory,
+          VK_IMAGE_LAYOUT_UNDEFINED,
+          mipLevels) != VK_SUCCESS)
+    throw std::runtime_error("failed to create texture image for " + name + "!");
+  const VkImage image = pending.image;
+
+  {
+    // Declared first so it outlives the command buffer's wait
+    std::optional<MipGenerator::Scratch> scratch;
+    ScopedCommandBuffer commandBuffer = devManager.createScopedCommandBuffer();
+    const VkImageMemoryBarrier toTransfer = levelsBarrier(
+        image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT, mipLevels);
+    vkCmdPipelineBarrier(
+        commandBuffer.get(),
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        1,
+        &toTransfer);
+    vkCmdCopyBufferToImage(
+        commandBuffer.get(),
+        staging.buffer,
+        image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(regions.size()),
+        regions.data());
+
+    if (generateMips) {
+      MipGenerator::Request request{image, format, width, height, mipLevels};
+      scratch.emplace(mips->record(commandBuffer.get(), {request}));
+    } else {
+      const VkImageMemoryBarrier toShader = levelsBarrier(
+          image,
+          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+          VK_ACCESS_TRANSFER_WRITE_BIT,
+          VK_ACCESS_SHADER_READ_BIT,
+          mipLevels);
+      vkCmdPipelineBarrier(
+          commandBuffer.get(),
+          VK_PIPELINE_STAGE_TRANSFER_BIT,
+          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+          0,
+          0,
+          nullptr,
+          0,
+          nullptr,
+          1,
+          &toShader);
+    }
+  }
+
+  if (devManager.createImageView(image, format, VK_IMAGE_ASPECT_COLOR_BIT, pending.view, mipLevels) != VK_SUCCESS)
+    throw std::runtime_error("failed to create texture image view for " + name + "!");
+
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.anisotropyEnable = VK_FALSE;
+  samplerInfo.maxAnisotropy = 1.0f;
+  samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+  samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+  samplerInfo.minLod = 0.0f;
+  // The view clamps to the chain, so every texture shares this one
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+  const VkSampler sampler = devManager.getSamplerCache().get(samplerInfo);
+
+  VulkanTexture texture(
+      device,
+      std::exchange(pending.image, VK_NULL_HANDLE),
+      std::exchange(pending.memory, VK_NULL_HANDLE),
+      std::exchange(pending.view, VK_NULL_HANDLE),
+      sampler,
+      format,
+      width,
+      height,
+      mipLevels);
+  return texture;
+}
+
+}
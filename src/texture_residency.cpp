@@ -0,0 +1,577 @@
+#include "vulkan_utils/texture_residency.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+#include "block_compression.h"
+#include "vulkan_utils/host_allocator.h"
+#include "vulkan_utils/texture_loader.h"
+
+namespace VulkanUtils {
+namespace {
+// Level offsets in staging, covers the texel block size and the 4 byte copy
+// alignment like loadTexture
+constexpr VkDeviceSize levelAlignment = 16;
+
+VkDeviceSize alignUp(const VkDeviceSize value, const VkDeviceSize alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+VkImageMemoryBarrier imageBarrier(
+    const VkImage image,
+    const VkImageLayout oldLayout,
+    const VkImageLayout newLayout,
+    const VkAccessFlags srcAccess,
+    const VkAccessFlags dstAccess,
+    const uint32_t mipLevels) {
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.oldLayout = oldLayout;
+  barrier.newLayout = newLayout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.levelCount = mipLevels;
+  barrier.subresourceRange.layerCount = 1;
+  barrier.srcAccessMask = srcAccess;
+  barrier.dstAccessMask = dstAccess;
+  return barrier;
+}
+}
+
+TextureResidencyManager::TextureResidencyManager(
+    DeviceManager& _devManager,
+    DeviceMemoryManager& _memory,
+    const ResidencyOptions& _options,
+    const AssetPack::PackReader* _pack)
+  : devManager(_devManager),
+    memory(_memory),
+    device(_devManager.getDevice()),
+    options(_options),
+    pack(_pack),
+    ring(_options.stagingSize) {
+  if (devManager.createStagingBuffer(options.stagingSize, ringBuffer, ringMemory) != VK_SUCCESS)
+    throw std::runtime_error("failed to create texture streaming staging buffer!");
+
+  const auto destroyRing = [&] {
+    vkDestroyBuffer(device, ringBuffer, allocationCallbacks());
+    vkFreeMemory(device, ringMemory, allocationCallbacks());
+  };
+  void* mapped = nullptr;
+  if (vkMapMemory(device, ringMemory, 0, options.stagingSize, 0, &mapped) != VK_SUCCESS) {
+    destroyRing();
+    throw std::runtime_error("failed to map texture streaming staging buffer!");
+  }
+  ringMapping = static_cast<uint8_t*>(mapped);
+
+  // Images only ever hold resident levels, so no lod clamping needed
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.anisotropyEnable = VK_FALSE;
+  samplerInfo.maxAnisotropy = 1.0f;
+  samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+  samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+  try {
+    sampler = devManager.getSamplerCache().get(samplerInfo);
+  } catch (...) {
+    vkUnmapMemory(device, ringMemory);
+    destroyRing();
+    throw;
+  }
+
+  worker = std::thread(&TextureResidencyManager::workerLoop, this);
+  memoryClient = memory.addStreamingClient(
+      [this] { return committedBytes; },
+      [this](const VkDeviceSize limit) { memoryLimit = limit; });
+}
+
+TextureResidencyManager::~TextureResidencyManager() {
+  {
+    std::lock_guard<std::mutex> lock(jobMutex);
+    stopping = true;
+  }
+  {
+    // Under the ring's lock too, so the loader can't miss it between checking
+    // and going to sleep
+    std::lock_guard<std::mutex> lock(ringMutex);
+    jobAvailable.notify_all();
+    ringFreed.notify_all();
+  }
+  worker.join();
+  memory.removeStreamingClient(memoryClient);
+
+  retired.flush();
+  for (auto& texture : textures)
+    retire(texture);
+  retired.flush();
+
+  vkUnmapMemory(device, ringMemory);
+  vkDestroyBuffer(device, ringBuffer, allocationCallbacks());
+  vkFreeMemory(device, ringMemory, allocationCallbacks());
+}
+
+TextureResidencyManager::Handle TextureResidencyManager::addTexture(const std::string& name) {
+  Texture& texture = textures.emplace_back();
+  texture.name = name;
+  VkDeviceSize tailBytes = 0;
+  try {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    if (pack) {
+      const AssetPack::Entry* entry = pack->find(name);
+      if (!entry)
+        throw std::runtime_error(name + " is not in the asset pack!");
+      data = pack->mappedData(*entry);
+      if (!data) {
+        texture.copy = pack->read(*entry);
+        data = texture.copy.data();
+      }
+      size = entry->size;
+    } else {
+      texture.file.emplace(name);
+      data = texture.file->data();
+      size = texture.file->size();
+    }
+    texture.source.emplace(data, size, name);
+
+    const Ktx2::Texture& source = *texture.source;
+    texture.format = chooseUploadFormat(devManager.getPhysicalDevice(), source.getFormat());
+    if (texture.format == VK_FORMAT_UNDEFINED)
+      throw std::runtime_error(name + " has a format the device can't sample (" + std::to_string(source.getFormat()) + ")!");
+
+    const uint32_t levelCount = source.getLevelCount();
+    texture.tailBase = levelCount - 1;
+    while (texture.tailBase > 0 &&
+           std::max(source.levelWidth(texture.tailBase - 1), source.levelHeight(texture.tailBase - 1)) <= options.tailSize)
+      --texture.tailBase;
+    tailBytes = levelBytes(texture, texture.tailBase, levelCount);
+    if (tailBytes > ring.getCapacity())
+      throw std::runtime_error(name + "'s mip tail doesn't fit the texture staging ring!");
+    texture.base = levelCount;
+  } catch (...) {
+    textures.pop_back();
+    throw;
+  }
+
+  // Tails go in regardless of the budget
+  texture.loading = true;
+  committedBytes += tailBytes;
+  {
+    std::lock_guard<std::mutex> lock(jobMutex);
+    jobs.push_back({&texture, texture.tailBase, texture.base, tailBytes});
+  }
+  jobAvailable.notify_one();
+  return static_cast<Handle>(textures.size() - 1);
+}
+
+void TextureResidencyManager::requestLevel(const Handle handle, const uint32_t level) {
+  Texture& texture = textures[handle];
+  if (texture.requestFrame != frame) {
+    texture.requestFrame = frame;
+    texture.requested = level;
+  } else {
+    texture.requested = std::min(texture.requested, level);
+  }
+}
+
+uint32_t TextureResidencyManager::levelForCoverage(const uint32_t textureSize, const float screenPixels) {
+  if (!(screenPixels > 0.0f))
+    return UINT32_MAX;
+  const float ratio = static_cast<float>(textureSize) / screenPixels;
+  if (ratio <= 1.0f)
+    return 0;
+  return static_cast<uint32_t>(std::floor(std::log2(ratio)));
+}
+
+VkDeviceSize TextureResidencyManager::levelBytes(const Texture& texture, const uint32_t first, const uint32_t last) const {
+  VkDeviceSize bytes = 0;
+  for (uint32_t level = first; level < last; ++level)
+    bytes += alignUp(
+        BlockCompression::levelSize(texture.format, texture.source->levelWidth(level), texture.source->levelHeight(level)),
+        levelAlignment);
+  return bytes;
+}
+
+uint32_t TextureResidencyManager::wantedLevel(const Texture& texture) const {
+  if (frame - texture.requestFrame > options.idleFrames)
+    return texture.tailBase;
+  return std::min(texture.requested, texture.tailBase);
+}
+
+void TextureResidencyManager::workerLoop() {
+  for (;;) {
+    Load load;
+    {
+      std::unique_lock<std::mutex> lock(jobMutex);
+      jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+      if (stopping)
+        return;
+      load = jobs.front();
+      jobs.pop_front();
+    }
+
+    try {
+      if (!stage(load))
+        return;
+    } catch (const std::exception& e) {
+      std::cerr << "failed to stream " << load.texture->name << ": " << e.what() << std::endl;
+      if (load.ringOffset != RingAllocator::invalid) {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        ring.free(load.ringOffset);
+        load.ringOffset = RingAllocator::invalid;
+      }
+      ringFreed.notify_all();
+      load.failed = true;
+    }
+
+    std::lock_guard<std::mutex> lock(stagedMutex);
+    staged.push_back(load);
+  }
+}
+
+bool TextureResidencyManager::stage(Load& load) {
+  {
+    std::unique_lock<std::mutex> lock(ringMutex);
+    ringFreed.wait(lock, [&] {
+      if (stopping)
+        return true;
+      load.ringOffset = ring.allocate(load.size, levelAlignment);
+      return load.ringOffset != RingAllocator::invalid;
+    });
+    if (load.ringOffset == RingAllocator::invalid)
+      return false;
+  }
+
+  // The source and format never change once added
+  const Texture& texture = *load.texture;
+  const Ktx2::Texture& source = *texture.source;
+  const bool decode = texture.format != source.getFormat();
+  std::vector<uint8_t> encoded;
+  uint8_t* destination = ringMapping + load.ringOffset;
+  for (uint32_t level = load.first; level < load.last; ++level) {
+    const uint32_t width = source.levelWidth(level);
+    const uint32_t height = source.levelHeight(level);
+    if (decode) {
+      encoded.resize(source.levelSize(level));
+      source.readLevel(level, encoded.data());
+      BlockCompression::decode(source.getFormat(), encoded.data(), width, height, destination);
+    } else {
+      source.readLevel(level, destination);
+    }
+    destination += alignUp(BlockCompression::levelSize(texture.format, width, height), levelAlignment);
+  }
+  return true;
+}
+
+bool TextureResidencyManager::makeRoom(const VkDeviceSize bytes, const Texture* texture, std::vector<uint32_t>& planned) {
+  // Least recently used first
+  std::vector<uint32_t> victims;
+  for (uint32_t i = 0; i < textures.size(); ++i) {
+    const Texture& victim = textures[i];
+    if (&victim != texture && !victim.loading && planned[i] < victim.tailBase)
+      victims.push_back(i);
+  }
+  std::sort(victims.begin(), victims.end(), [&](const uint32_t a, const uint32_t b) {
+    return textures[a].requestFrame < textures[b].requestFrame;
+  });
+
+  std::vector<uint32_t> trial = planned;
+  VkDeviceSize freed = 0;
+  const auto enough = [&] { return committedBytes - freed + bytes <= getBudget(); };
+  const auto evictTo = [&](const uint32_t i, const uint32_t level) {
+    const Texture& victim = textures[i];
+    while (trial[i] < level && !enough()) {
+      freed += levelBytes(victim, trial[i], trial[i] + 1);
+      ++trial[i];
+    }
+  };
+  // Levels nobody is asking for go first, then whole levels from textures
+  // used longer ago than this one, a level at a time down to their tails
+  for (const uint32_t i : victims)
+    evictTo(i, wantedLevel(textures[i]));
+  for (const uint32_t i : victims)
+    if (!texture || textures[i].requestFrame < texture->requestFrame)
+      evictTo(i, textures[i].tailBase);
+  if (!enough() && texture)
+    return false;
+
+  planned.swap(trial);
+  committedBytes -= freed;
+  return enough();
+}
+
+void TextureResidencyManager::update(const VkCommandBuffer commandBuffer, const uint64_t completedSerial) {
+  retired.collect(completedSerial);
+
+  std::vector<Load> finished;
+  {
+    std::lock_guard<std::mutex> lock(stagedMutex);
+    finished.swap(staged);
+  }
+
+  std::vector<Rebuild> rebuilds;
+  for (const Load& load : finished) {
+    Texture& texture = *load.texture;
+    if (load.failed) {
+      texture.failed = true;
+      committedBytes -= load.size;
+      continue;
+    }
+    rebuilds.push_back({&texture, load.first, &load});
+    ++stats.streamIns;
+    stats.streamedInBytes += load.size;
+  }
+
+  // Where every base ends up this frame once evictions are in. Textures with
+  // a load in flight or finishing now keep theirs.
+  std::vector<uint32_t> planned(textures.size());
+  std::vector<uint32_t> candidates;
+  for (uint32_t i = 0; i < textures.size(); ++i) {
+    const Texture& texture = textures[i];
+    planned[i] = texture.base;
+    if (!texture.loading && !texture.failed && texture.view != VK_NULL_HANDLE && wantedLevel(texture) < texture.base)
+      candidates.push_back(i);
+  }
+  // The memory manager lowered the budget, give back what's over it before
+  // anything new comes in
+  if (committedBytes > getBudget())
+    makeRoom(0, nullptr, planned);
+
+  // Most recently used, then furthest from what it wants
+  std::sort(candidates.begin(), candidates.end(), [&](const uint32_t a, const uint32_t b) {
+    const Texture& first = textures[a];
+    const Texture& second = textures[b];
+    if (first.requestFrame != second.requestFrame)
+      return first.requestFrame > second.requestFrame;
+    return first.base - wantedLevel(first) > second.base - wantedLevel(second);
+  });
+
+  std::vector<Load> loads;
+  VkDeviceSize uploadLeft = options.uploadPerFrame;
+  for (const uint32_t i : candidates) {
+    Texture& texture = textures[i];
+    // Gave up levels to an earlier load this frame
+    if (planned[i] != texture.base)
+      continue;
+    // As many levels as fit, dropping the finest until they do
+    for (uint32_t first = wantedLevel(texture); first < texture.base; ++first) {
+      const VkDeviceSize bytes = levelBytes(texture, first, texture.base);
+      if (bytes > ring.getCapacity() || (bytes > uploadLeft && !loads.empty()))
+        continue;
+      if (committedBytes + bytes > getBudget() && !makeRoom(bytes, &texture, planned))
+        continue;
+
+      committedBytes += bytes;
+      uploadLeft -= std::min(bytes, uploadLeft);
+      texture.loading = true;
+      loads.push_back({&texture, first, texture.base, bytes});
+      break;
+    }
+  }
+  if (!loads.empty()) {
+    {
+      std::lock_guard<std::mutex> lock(jobMutex);
+      jobs.insert(jobs.end(), loads.begin(), loads.end());
+    }
+    jobAvailable.notify_one();
+  }
+
+  for (uint32_t i = 0; i < textures.size(); ++i) {
+    Texture& texture = textures[i];
+    if (planned[i] == texture.base)
+      continue;
+    rebuilds.push_back({&texture, planned[i], nullptr});
+    ++stats.evictions;
+    stats.evictedBytes += levelBytes(texture, texture.base, planned[i]);
+  }
+
+  record(commandBuffer, rebuilds);
+
+  for (const Load& load : finished) {
+    load.texture->loading = false;
+    if (load.ringOffset == RingAllocator::invalid)
+      continue;
+    const uint64_t offset = load.ringOffset;
+    retired.enqueuePending([this, offset] {
+      {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        ring.free(offset);
+      }
+      ringFreed.notify_all();
+    });
+  }
+  ++frame;
+}
+
+void TextureResidencyManager::record(const VkCommandBuffer commandBuffer, std::vector<Rebuild>& rebuilds) {
+  if (rebuilds.empty())
+    return;
+
+  std::vector<VkImageMemoryBarrier> toTransfer;
+  std::vector<VkImageMemoryBarrier> toShader;
+  for (Rebuild& rebuild : rebuilds) {
+    Texture& texture = *rebuild.texture;
+    const Ktx2::Texture& source = *texture.source;
+    const uint32_t levels = source.getLevelCount() - rebuild.newBase;
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = {source.levelWidth(rebuild.newBase), source.levelHeight(rebuild.newBase), 1};
+    imageInfo.mipLevels = levels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = texture.format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    // Shader read only by the time the memory manager gets to record
+    rebuild.allocation = memory.createImage(
+        imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, [this, &texture] {
+          moved(texture);
+        });
+    rebuild.image = memory.getImage(rebuild.allocation);
+
+    toTransfer.push_back(imageBarrier(
+        rebuild.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT, levels));
+    if (texture.image != VK_NULL_HANDLE)
+      toTransfer.push_back(imageBarrier(
+          texture.image,
+          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+          0,
+          VK_ACCESS_TRANSFER_READ_BIT,
+          source.getLevelCount() - texture.base));
+    toShader.push_back(imageBarrier(
+        rebuild.image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_ACCESS_SHADER_READ_BIT,
+        levels));
+  }
+
+  // Earlier frames sampling the old images are before this in submission order
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      0,
+      0, nullptr,
+      0, nullptr,
+      static_cast<uint32_t>(toTransfer.size()), toTransfer.data());
+
+  for (const Rebuild& rebuild : rebuilds) {
+    const Texture& texture = *rebuild.texture;
+    const Ktx2::Texture& source = *texture.source;
+
+    // Levels both images have, straight across on the gpu
+    std::vector<VkImageCopy> kept;
+    if (texture.image != VK_NULL_HANDLE) {
+      for (uint32_t level = std::max(rebuild.newBase, texture.base); level < source.getLevelCount(); ++level) {
+        VkImageCopy copy{};
+        copy.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - texture.base, 0, 1};
+        copy.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - rebuild.newBase, 0, 1};
+        copy.extent = {source.levelWidth(level), source.levelHeight(level), 1};
+        kept.push_back(copy);
+      }
+      vkCmdCopyImage(
+          commandBuffer,
+          texture.image,
+          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+          rebuild.image,
+          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          static_cast<uint32_t>(kept.size()),
+          kept.data());
+    }
+
+    if (const Load* load = rebuild.load) {
+      std::vector<VkBufferImageCopy> regions;
+      VkDeviceSize offset = load->ringOffset;
+      for (uint32_t level = load->first; level < load->last; ++level) {
+        VkBufferImageCopy region{};
+        region.bufferOffset = offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level - rebuild.newBase;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = {source.levelWidth(level), source.levelHeight(level), 1};
+        regions.push_back(region);
+        offset += levelBytes(texture, level, level + 1);
+      }
+      vkCmdCopyBufferToImage(
+          commandBuffer,
+          ringBuffer,
+          rebuild.image,
+          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          static_cast<uint32_t>(regions.size()),
+          regions.data());
+    }
+  }
+
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      0,
+      0, nullptr,
+      0, nullptr,
+      static_cast<uint32_t>(toShader.size()), toShader.data());
+
+  for (Rebuild& rebuild : rebuilds) {
+    Texture& texture = *rebuild.texture;
+    const uint32_t levelCount = texture.source->getLevelCount();
+    VkImageView view = VK_NULL_HANDLE;
+    if (devManager.createImageView(rebuild.image, texture.format, VK_IMAGE_ASPECT_COLOR_BIT, view, levelCount - rebuild.newBase) !=
+        VK_SUCCESS)
+      throw std::runtime_error("failed to create texture image view for " + texture.name + "!");
+
+    if (texture.image != VK_NULL_HANDLE)
+      stats.residentBytes -= levelBytes(texture, texture.base, levelCount);
+    stats.residentBytes += levelBytes(texture, rebuild.newBase, levelCount);
+    retire(texture);
+    texture.allocation = rebuild.allocation;
+    texture.image = rebuild.image;
+    texture.view = view;
+    texture.base = rebuild.newBase;
+  }
+}
+
+void TextureResidencyManager::retire(Texture& texture) {
+  if (texture.image == VK_NULL_HANDLE)
+    return;
+
+  // The image waits for the frame inside the memory manager
+  memory.release(texture.allocation);
+  retired.retirePending(texture.view);
+  texture.allocation = DeviceMemoryManager::invalid;
+  texture.image = VK_NULL_HANDLE;
+  texture.view = VK_NULL_HANDLE;
+}
+
+void TextureResidencyManager::moved(Texture& texture) {
+  retired.retirePending(texture.view);
+
+  texture.image = memory.getImage(texture.allocation);
+  texture.view = VK_NULL_HANDLE;
+  if (devManager.createImageView(
+          texture.image, texture.format, VK_IMAGE_ASPECT_COLOR_BIT, texture.view, texture.source->getLevelCount() - texture.base) !=
+      VK_SUCCESS)
+    throw std::runtime_error("failed to create texture image view for " + texture.name + "!");
+}
+
+void TextureResidencyManager::submitted(const uint64_t serial) {
+  retired.submitted(serial);
+}
+
+}
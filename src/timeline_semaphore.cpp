@@ -0,0 +1,117 @@
+#include "vulkan_utils/timeline_semaphore.h"
+
+#include <stdexcept>
+
+#include "vulkan_utils/host_allocator.h"
+
+namespace VulkanUtils {
+
+TimelineSemaphore::TimelineSemaphore(const VkDevice device, const uint64_t initialValue)
+ : device(device)
+{
+  VkSemaphoreTypeCreateInfo typeInfo{};
+  typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeInfo.initialValue = initialValue;
+
+  VkSemaphoreCreateInfo createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  createInfo.pNext = &typeInfo;
+
+  if (vkCreateSemaphore(device, &createInfo, allocationCallbacks(), &semaphore) != VK_SUCCESS)
+    throw std::runtime_error("failed to create timeline semaphore!");
+}
+
+TimelineSemaphore::~TimelineSemaphore() {
+  if (semaphore != VK_NULL_HANDLE)
+    vkDestroySemaphore(device, semaphore, allocationCallbacks());
+}
+
+uint64_t TimelineSemaphore::completedValue() const {
+  uint64_t value = 0;
+  if (vkGetSemaphoreCounterValue(device, semaphore, &value) != VK_SUCCESS)
+    throw std::runtime_error("failed to read timeline semaphore value!");
+
+  return value;
+}
+
+bool TimelineSemaphore::wait(const uint64_t value, const uint64_t timeout) const {
+  VkSemaphoreWaitInfo waitInfo{};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &semaphore;
+  waitInfo.pValues = &value;
+
+  const VkResult result = vkWaitSemaphores(device, &waitInfo, timeout);
+  if (result == VK_TIMEOUT)
+    return false;
+  if (result != VK_SUCCESS)
+    throw std::runtime_error("failed to wait on timeline semaphore!");
+
+  return true;
+}
+
+void TimelineSemaphore::signalFromHost(const uint64_t value) {
+  VkSemaphoreSignalInfo signalInfo{};
+  signalInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO;
+  signalInfo.semaphore = semaphore;
+  signalInfo.value = value;
+
+  if (vkSignalSemaphore(device, &signalInfo) != VK_SUCCESS)
+    throw std::runtime_error("failed to signal timeline semaphore!");
+}
+
+QueueTimeline::QueueTimeline(const VkDevice device, const VkQueue queue)
+ : queue(queue), timeline(device, 0) {}
+
+uint64_t QueueTimeline::submit(
+    const std::vector<VkCommandBuffer>& commandBuffers,
+    const std::vector<SemaphoreWait>& waits,
+    const std::vector<SemaphoreSignal>& signals) {
+  const uint64_t value = nextValue;
+
+  std::vector<VkSemaphore> waitSemaphores;
+  std::vector<uint64_t> waitValues;
+  std::vector<VkPipelineStageFlags> waitStages;
+  for (const auto& wait : waits) {
+    waitSemaphores.push_back(wait.semaphore);
+    waitValues.push_back(wait.value);
+    waitStages.push_back(wait.stage);
+  }
+
+  // Our own timeline always goes last
+  std::vector<VkSemaphore> signalSemaphores;
+  std::vector<uint64_t> signalValues;
+  for (const auto& signal : signals) {
+    signalSemaphores.push_back(signal.semaphore);
+    signalValues.push_back(signal.value);
+  }
+  signalSemaphores.push_back(timeline.get());
+  signalValues.push_back(value);
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+  timelineInfo.pWaitSemaphoreValues = waitValues.data();
+  timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+  timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+  submitInfo.pWaitSemaphores = waitSemaphores.data();
+  submitInfo.pWaitDstStageMask = waitStages.data();
+  submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+  submitInfo.pCommandBuffers = commandBuffers.data();
+  submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+  submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+  if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+    throw std::runtime_error("failed to submit to queue timeline!");
+
+  ++nextValue;
+  return value;
+}
+
+}
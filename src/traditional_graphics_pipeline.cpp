@@ -2,10 +2,12 @@
 
 #include "file_loader.h"
 #include "graphics_types.h"
+#include "vulkan_utils/host_allocator.h"
 
 namespace VulkanUtils {
 namespace {
 constexpr const char* vertShaderPath = "build/vert.spv";
+constexpr const char* quantizedVertShaderPath = "build/vert_quantized.spv";
 constexpr const char* fragShaderPath = "build/frag.spv";
 
 }
@@ -17,18 +19,35 @@ VkShaderModule TraditionalGraphicsPipeline::createShaderModule(const std::vector
   createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
 
   VkShaderModule shaderModule;
-  if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) 
+  if (vkCreateShaderModule(device, &createInfo, allocationCallbacks(), &shaderModule) != VK_SUCCESS) 
     throw std::runtime_error("failed to create shader module!");
 
   return shaderModule;
 }
 
-TraditionalGraphicsPipeline::TraditionalGraphicsPipeline(DeviceManager& devManager, const SwapChainHandler& swapchainHandler)
+TraditionalGraphicsPipeline::TraditionalGraphicsPipeline(
+    DeviceManager& devManager,
+    const SwapChainHandler& swapchainHandler,
+    const uint32_t framesInFlight,
+    const bool quantizedVertices)
   : device(devManager.getDevice()),
-    staticDescriptorSetLayout(createStaticDescriptorSetLayout()),
-    dynamicDescriptorSetLayout(createDynamicDescriptorSetLayout())
+    staticDescriptorSetLayout(createStaticDescriptorSetLayout(devManager)),
+    dynamicDescriptorSetLayout(createDynamicDescriptorSetLayout(devManager)),
+    instanceDescriptorSetLayout(InstanceBuffer::createSetLayout(devManager)),
+    staticDescriptors(device, {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f}}, 1)
   {
-  const auto vertShaderCode = readFile(vertShaderPath);
+  for (uint32_t frame = 0; frame < framesInFlight; ++frame)
+    frameDescriptors.emplace_back(device, std::vector<DescriptorPoolRatio>{{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f}}, 64);
+
+  VkDescriptorUpdateTemplateEntry textureEntry{};
+  textureEntry.dstBinding = 0;
+  textureEntry.descriptorCount = 1;
+  textureEntry.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  textureEntry.offset = 0;
+  textureEntry.stride = sizeof(VkDescriptorImageInfo);
+  textureTemplate.emplace(devManager, dynamicDescriptorSetLayout, std::vector<VkDescriptorUpdateTemplateEntry>{textureEntry});
+
+  const auto vertShaderCode = readFile(quantizedVertices ? quantizedVertShaderPath : vertShaderPath);
   const auto fragShaderCode = readFile(fragShaderPath);
 
   VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
@@ -48,8 +67,12 @@ TraditionalGraphicsPipeline::TraditionalGraphicsPipeline(DeviceManager& devManag
 
   VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
-  auto bindingDescription = GraphicsTypes::getVertexBindingDescription();
-  auto attributeDescriptions = GraphicsTypes::getVertexAttributeDescriptions();
+  auto bindingDescription = quantizedVertices
+      ? GraphicsTypes::VertexLayoutQuantized::bindingDescription()
+      : GraphicsTypes::getVertexBindingDescription();
+  auto attributeDescriptions = quantizedVertices
+      ? GraphicsTypes::VertexLayoutQuantized::attributeDescriptions()
+      : GraphicsTypes::getVertexAttributeDescriptions();
   VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
   vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
   vertexInputInfo.vertexBindingDescriptionCount = 1;
@@ -140,15 +163,16 @@ TraditionalGraphicsPipeline::TraditionalGraphicsPipeline(DeviceManager& devManag
   colorBlending.blendConstants[2] = 0.0f; // Optional
   colorBlending.blendConstants[3] = 0.0f; // Optional
 
-  // To allow pushing a unique model matrix for each
+  // Which InstanceData each draw is, the matrices etc. are in set 2
   VkPushConstantRange pushConstantRange{};
   pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
   pushConstantRange.offset = 0;
-  pushConstantRange.size = sizeof(PerModelPushConstants);
+  pushConstantRange.size = sizeof(PerDrawPushConstants);
 
-  std::array<VkDescriptorSetLayout, 2> layouts = {
+  std::array<VkDescriptorSetLayout, 3> layouts = {
       staticDescriptorSetLayout,
-      dynamicDescriptorSetLayout
+      dynamicDescriptorSetLayout,
+      instanceDescriptorSetLayout
   };
 
   VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
@@ -159,11 +183,9 @@ TraditionalGraphicsPipeline::TraditionalGraphicsPipeline(DeviceManager& devManag
   pipelineLayoutInfo.pushConstantRangeCount = 1;
   pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
-  if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+  if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocationCallbacks(), &pipelineLayout) != VK_SUCCESS)
     throw std::runtime_error("failed to create pipeline layout!");
 
-  createDescriptorPool();
-
   // learn more about passes
   VkGraphicsPipelineCreateInfo pipelineInfo{};
   pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -180,14 +202,23 @@ TraditionalGraphicsPipeline::TraditionalGraphicsPipeline(DeviceManager& devManag
   pipelineInfo.layout = pipelineLayout;
   pipelineInfo.renderPass = swapchainHandler.getRenderPass();
   pipelineInfo.subpass = 0;
+
+  // No render pass to be compatible with, just the attachment formats
+  const VkFormat colorFormat = swapchainHandler.getImageFormat();
+  VkPipelineRenderingCreateInfoKHR renderingInfo{};
+  renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+  renderingInfo.colorAttachmentCount = 1;
+  renderingInfo.pColorAttachmentFormats = &colorFormat;
+  if (swapchainHandler.usesDynamicRendering())
+    pipelineInfo.pNext = &renderingInfo;
   pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
   pipelineInfo.basePipelineIndex = -1; // Optional
 
-  if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
+  if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocationCallbacks(), &graphicsPipeline) != VK_SUCCESS)
     throw std::runtime_error("failed to create graphics pipeline!");
 
-  vkDestroyShaderModule(device, fragShaderModule, nullptr);
-  vkDestroyShaderModule(device, vertShaderModule, nullptr);
+  vkDestroyShaderModule(device, fragShaderModule, allocationCallbacks());
+  vkDestroyShaderModule(device, vertShaderModule, allocationCallbacks());
 
   // Create a buffer abstaction class
   devManager.createUniformBuffer(sizeof(SceneUBO), sceneUniformBuffer, sceneUniformMemory);
@@ -197,94 +228,63 @@ TraditionalGraphicsPipeline::TraditionalGraphicsPipeline(DeviceManager& devManag
   vkMapMemory(device, lightUniformMemory, 0, sizeof(LightUBO), 0, (void**)&light);
   *light = LightUBO{};
 
-  allocateDescriptorSets();
+  staticDescriptorSet = staticDescriptors.allocate(staticDescriptorSetLayout);
   updateStaticDescriptorSet();
 }
 
 TraditionalGraphicsPipeline::~TraditionalGraphicsPipeline() {
-  vkDestroyPipeline(device, graphicsPipeline, nullptr);
-  vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+  vkDestroyPipeline(device, graphicsPipeline, allocationCallbacks());
+  vkDestroyPipelineLayout(device, pipelineLayout, allocationCallbacks());
 
   if (sceneUniformBuffer != VK_NULL_HANDLE)
-    vkDestroyBuffer(device, sceneUniformBuffer, nullptr);
+    vkDestroyBuffer(device, sceneUniformBuffer, allocationCallbacks());
 
   if (sceneUniformMemory != VK_NULL_HANDLE) {
     vkUnmapMemory(device, sceneUniformMemory);
-    vkFreeMemory(device, sceneUniformMemory, nullptr);
+    vkFreeMemory(device, sceneUniformMemory, allocationCallbacks());
   }
 
   if (lightUniformBuffer != VK_NULL_HANDLE)
-    vkDestroyBuffer(device, lightUniformBuffer, nullptr);
+    vkDestroyBuffer(device, lightUniformBuffer, allocationCallbacks());
 
   if (lightUniformMemory != VK_NULL_HANDLE) {
     vkUnmapMemory(device, lightUniformMemory);
-    vkFreeMemory(device, lightUniformMemory, nullptr);
-
-  if (descriptorPool != VK_NULL_HANDLE)
-    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkFreeMemory(device, lightUniformMemory, allocationCallbacks());
   }
 }
 
-void TraditionalGraphicsPipeline::createDescriptorPool() {
-  std::array<VkDescriptorPoolSize, 2> poolSizes{};
-  poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  poolSizes[0].descriptorCount = 2; // for scene + light
-  poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  poolSizes[1].descriptorCount = 1; // not fully sure how this works yet, or if this is the right number
-
-  VkDescriptorPoolCreateInfo poolInfo{};
-  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-  poolInfo.pPoolSizes = poolSizes.data();
-
-  poolInfo.maxSets = 2;
-
-  if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
-    throw std::runtime_error("failed to create descriptor pool!");
+void TraditionalGraphicsPipeline::beginFrame(const uint32_t frameIndex) {
+  currentFrame = frameIndex;
+  frameDescriptors[frameIndex].reset();
+  textureSets.clear();
 }
 
-void TraditionalGraphicsPipeline::allocateDescriptorSets() {
-  std::array<VkDescriptorSetLayout, 2> setLayouts = {
-      staticDescriptorSetLayout, // global
-      dynamicDescriptorSetLayout // texture
-  };
-
-  VkDescriptorSetAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-  allocInfo.descriptorPool = descriptorPool;
-  allocInfo.descriptorSetCount = static_cast<uint32_t>(setLayouts.size());
-  allocInfo.pSetLayouts = setLayouts.data();
-
-  std::array<VkDescriptorSet, 2> sets{};
-  if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS)
-    throw std::runtime_error("failed to allocate descriptor sets!");
-
-  staticDescriptorSet = sets[0];
-  dynamicDescriptorSet = sets[1];
-}
-
-void TraditionalGraphicsPipeline::updateTextureDescriptorSet(
+void TraditionalGraphicsPipeline::bindTexture(
+    VkCommandBuffer commandBuffer,
     VkImageView textureImageView,
     VkSampler textureSampler) {
-  std::vector<VkWriteDescriptorSet> descriptorWrites;
-
-  // binding 0, image sampler
-  VkDescriptorImageInfo imageInfo{};
-  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-  imageInfo.imageView = textureImageView;
-  imageInfo.sampler = textureSampler;
-
-  VkWriteDescriptorSet samplerWrite{};
-  samplerWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  samplerWrite.dstSet = dynamicDescriptorSet;
-  samplerWrite.dstBinding = 0;
-  samplerWrite.dstArrayElement = 0;
-  samplerWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  samplerWrite.descriptorCount = 1;
-  samplerWrite.pImageInfo = &imageInfo;
-  descriptorWrites.push_back(samplerWrite);
+  const auto key = std::make_pair(textureImageView, textureSampler);
+  auto found = textureSets.find(key);
+  if (found == textureSets.end()) {
+    const VkDescriptorSet set = frameDescriptors[currentFrame].allocate(dynamicDescriptorSetLayout);
+    // binding 0, image sampler
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfo.imageView = textureImageView;
+    imageInfo.sampler = textureSampler;
+    textureTemplate->update(set, &imageInfo);
+    found = textureSets.emplace(key, set).first;
+  }
 
-  vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+  vkCmdBindDescriptorSets(
+      commandBuffer,
+      VK_PIPELINE_BIND_POINT_GRAPHICS,
+      pipelineLayout,
+      1, // Position for dynamic data
+      1,
+      &found->second,
+      0,
+      nullptr);
 }
 
 void TraditionalGraphicsPipeline::updateStaticDescriptorSet() {
@@ -324,7 +324,7 @@ void TraditionalGraphicsPipeline::updateStaticDescriptorSet() {
   vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
 
-VkDescriptorSetLayout TraditionalGraphicsPipeline::createStaticDescriptorSetLayout() {
+VkDescriptorSetLayout TraditionalGraphicsPipeline::createStaticDescriptorSetLayout(DeviceManager& devManager) {
   // binding 0, scene UBO
   VkDescriptorSetLayoutBinding sceneBinding{};
   sceneBinding.binding = 0;
@@ -350,14 +350,10 @@ VkDescriptorSetLayout TraditionalGraphicsPipeline::createStaticDescriptorSetLayo
   layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
   layoutInfo.pBindings = bindings.data();
 
-  VkDescriptorSetLayout descriptorSetLayout;
-  if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
-    throw std::runtime_error("failed to create descriptor set layout!");
-
-  return descriptorSetLayout;
+  return devManager.getLayoutCache().get(layoutInfo);
 }
 
-VkDescriptorSetLayout TraditionalGraphicsPipeline::createDynamicDescriptorSetLayout() {
+VkDescriptorSetLayout TraditionalGraphicsPipeline::createDynamicDescriptorSetLayout(DeviceManager& devManager) {
   // binding 0, image sampler
   VkDescriptorSetLayoutBinding textureBinding{};
   textureBinding.binding = 0;
@@ -371,11 +367,7 @@ VkDescriptorSetLayout TraditionalGraphicsPipeline::createDynamicDescriptorSetLay
   layoutInfo.bindingCount = 1;
   layoutInfo.pBindings = &textureBinding;
 
-  VkDescriptorSetLayout layout;
-  if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS)
-    throw std::runtime_error("failed to create dynamic descriptor set layout!");
-
-  return layout;
+  return devManager.getLayoutCache().get(layoutInfo);
 }
 
 }
\ No newline at end of file
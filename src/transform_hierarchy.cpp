@@ -0,0 +1,294 @@
+#include "transform_hierarchy.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define TRANSFORM_SSE 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TRANSFORM_NEON 1
+#endif
+
+namespace {
+
+// translate * rotate * scale, without going through three matrices
+glm::mat4 compose(const glm::vec3& t, const glm::quat& q, const glm::vec3& s) {
+  const float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+  const float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+  const float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+  glm::mat4 m;
+  m[0] = glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * s.x;
+  m[1] = glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * s.y;
+  m[2] = glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * s.z;
+  m[3] = glm::vec4(t.x, t.y, t.z, 1.0f);
+  return m;
+}
+
+template <class T>
+void reorderArray(std::vector<T>& values, const std::vector<uint32_t>& from) {
+  std::vector<T> reordered;
+  reordered.reserve(from.size());
+  for (const uint32_t old : from)
+    reordered.push_back(values[old]);
+  values.swap(reordered);
+}
+
+} // namespace
+
+void TransformHierarchy::multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out) {
+  // Column j of the product is a's columns weighted by column j of b
+#if defined(TRANSFORM_SSE)
+  const __m128 a0 = _mm_loadu_ps(&a[0][0]);
+  const __m128 a1 = _mm_loadu_ps(&a[1][0]);
+  const __m128 a2 = _mm_loadu_ps(&a[2][0]);
+  const __m128 a3 = _mm_loadu_ps(&a[3][0]);
+  for (int j = 0; j < 4; ++j) {
+    __m128 column = _mm_mul_ps(a0, _mm_set1_ps(b[j][0]));
+    column = _mm_add_ps(column, _mm_mul_ps(a1, _mm_set1_ps(b[j][1])));
+    column = _mm_add_ps(column, _mm_mul_ps(a2, _mm_set1_ps(b[j][2])));
+    column = _mm_add_ps(column, _mm_mul_ps(a3, _mm_set1_ps(b[j][3])));
+    _mm_storeu_ps(&out[j][0], column);
+  }
+#elif defined(TRANSFORM_NEON)
+  const float32x4_t a0 = vld1q_f32(&a[0][0]);
+  const float32x4_t a1 = vld1q_f32(&a[1][0]);
+  const float32x4_t a2 = vld1q_f32(&a[2][0]);
+  const float32x4_t a3 = vld1q_f32(&a[3][0]);
+  for (int j = 0; j < 4; ++j) {
+    float32x4_t column = vmulq_n_f32(a0, b[j][0]);
+    column = vmlaq_n_f32(column, a1, b[j][1]);
+    column = vmlaq_n_f32(column, a2, b[j][2]);
+    column = vmlaq_n_f32(column, a3, b[j][3]);
+    vst1q_f32(&out[j][0], column);
+  }
+#else
+  out = a * b;
+#endif
+}
+
+TransformHierarchy::Handle TransformHierarchy::add(const LocalTransform& local, const Handle parent) {
+  uint32_t parentDense = invalidIndex;
+  uint32_t depth = 0;
+  if (parent) {
+    parentDense = denseIndex(parent);
+    depth = depths[parentDense] + 1;
+  }
+  // Appending only keeps the order when nothing already there is deeper
+  if (!depths.empty() && depths.back() > depth)
+    sorted = false;
+
+  uint32_t index;
+  if (!freeSlots.empty()) {
+    index = freeSlots.back();
+    freeSlots.pop_back();
+  } else {
+    index = static_cast<uint32_t>(slots.size());
+    slots.push_back({});
+  }
+  const auto dense = static_cast<uint32_t>(slotOf.size());
+  slots[index].dense = dense;
+
+  translations.push_back(local.translation);
+  rotations.push_back(local.rotation);
+  scales.push_back(local.scale);
+  parents.push_back(parentDense);
+  depths.push_back(depth);
+  worlds.push_back(glm::mat4(1.0f));
+  dirty.push_back(0);
+  slotOf.push_back(index);
+  markDirty(dense);
+  return {index, slots[index].generation};
+}
+
+void TransformHierarchy::remove(const Handle node) {
+  if (!sorted)
+    sortByDepth();
+
+  // Descendants all come after, and their parent before them
+  const uint32_t root = denseIndex(node);
+  std::vector<uint8_t> keep(slotOf.size(), 1);
+  keep[root] = 0;
+  for (size_t i = root + 1; i < slotOf.size(); ++i)
+    if (parents[i] != invalidIndex && !keep[parents[i]])
+      keep[i] = 0;
+
+  for (size_t i = root; i < slotOf.size(); ++i) {
+    if (keep[i])
+      continue;
+    Slot& slot = slots[slotOf[i]];
+    slot.dense = invalidIndex;
+    ++slot.generation;
+    freeSlots.push_back(slotOf[i]);
+  }
+  compact(keep);
+}
+
+void TransformHierarchy::setParent(const Handle node, const Handle parent) {
+  if (!sorted)
+    sortByDepth();
+
+  const uint32_t dense = denseIndex(node);
+  uint32_t parentDense = invalidIndex;
+  if (parent) {
+    parentDense = denseIndex(parent);
+    for (uint32_t ancestor = parentDense; ancestor != invalidIndex; ancestor = parents[ancestor])
+      if (ancestor == dense)
+        throw std::invalid_argument("transform can't be parented under itself!");
+  }
+  parents[dense] = parentDense;
+
+  // New depths for the subtree, it only has to be walked once in order
+  const uint32_t oldDepth = depths[dense];
+  depths[dense] = parentDense == invalidIndex ? 0 : depths[parentDense] + 1;
+  if (depths[dense] != oldDepth) {
+    std::vector<uint8_t> inSubtree(slotOf.size(), 0);
+    inSubtree[dense] = 1;
+    for (size_t i = dense + 1; i < slotOf.size(); ++i) {
+      if (parents[i] != invalidIndex && inSubtree[parents[i]]) {
+        inSubtree[i] = 1;
+        depths[i] = depths[parents[i]] + 1;
+      }
+    }
+    sorted = false;
+  }
+  markDirty(dense);
+}
+
+void TransformHierarchy::setLocal(const Handle node, const LocalTransform& local) {
+  const uint32_t dense = denseIndex(node);
+  translations[dense] = local.translation;
+  rotations[dense] = local.rotation;
+  scales[dense] = local.scale;
+  markDirty(dense);
+}
+
+void TransformHierarchy::setTranslation(const Handle node, const glm::vec3& translation) {
+  const uint32_t dense = denseIndex(node);
+  translations[dense] = translation;
+  markDirty(dense);
+}
+
+void TransformHierarchy::setRotation(const Handle node, const glm::quat& rotation) {
+  const uint32_t dense = denseIndex(node);
+  rotations[dense] = rotation;
+  markDirty(dense);
+}
+
+void TransformHierarchy::setScale(const Handle node, const glm::vec3& scale) {
+  const uint32_t dense = denseIndex(node);
+  scales[dense] = scale;
+  markDirty(dense);
+}
+
+LocalTransform TransformHierarchy::getLocal(const Handle node) const {
+  const uint32_t dense = denseIndex(node);
+  LocalTransform local;
+  local.translation = translations[dense];
+  local.rotation = rotations[dense];
+  local.scale = scales[dense];
+  return local;
+}
+
+TransformHierarchy::Handle TransformHierarchy::getParent(const Handle node) const {
+  const uint32_t parent = parents[denseIndex(node)];
+  if (parent == invalidIndex)
+    return {};
+  return {slotOf[parent], slots[slotOf[parent]].generation};
+}
+
+const std::vector<TransformHierarchy::Handle>& TransformHierarchy::update() {
+  changed.clear();
+  if (firstDirty == invalidIndex)
+    return changed;
+  if (!sorted)
+    sortByDepth();
+
+  // A node is redone when it was touched or its parent was, which by then
+  // is settled since parents come first. Flags go down the tree in a
+  // branchless pass of its own, the one doing the work then only branches
+  // on nodes that are mostly clean.
+  const auto count = static_cast<uint32_t>(slotOf.size());
+  for (uint32_t i = firstDirty; i < count; ++i) {
+    const uint32_t parent = parents[i];
+    dirty[i] |= dirty[parent == invalidIndex ? i : parent];
+  }
+  for (uint32_t i = firstDirty; i < count; ++i) {
+    if (!dirty[i])
+      continue;
+
+    const uint32_t parent = parents[i];
+    const glm::mat4 local = compose(translations[i], rotations[i], scales[i]);
+    if (parent == invalidIndex)
+      worlds[i] = local;
+    else
+      multiply(worlds[parent], local, worlds[i]);
+    changed.push_back({slotOf[i], slots[slotOf[i]].generation});
+  }
+  std::memset(dirty.data() + firstDirty, 0, count - firstDirty);
+  firstDirty = invalidIndex;
+  return changed;
+}
+
+uint32_t TransformHierarchy::denseIndex(const Handle node) const {
+  if (!contains(node))
+    throw std::invalid_argument("stale or invalid transform handle!");
+  return slots[node.index].dense;
+}
+
+void TransformHierarchy::markDirty(const uint32_t dense) {
+  dirty[dense] = 1;
+  firstDirty = std::min(firstDirty, dense);
+}
+
+void TransformHierarchy::sortByDepth() {
+  std::vector<uint32_t> from(slotOf.size());
+  std::iota(from.begin(), from.end(), 0u);
+  std::stable_sort(from.begin(), from.end(), [this](const uint32_t a, const uint32_t b) { return depths[a] < depths[b]; });
+  reorder(from);
+  sorted = true;
+}
+
+void TransformHierarchy::compact(const std::vector<uint8_t>& keep) {
+  std::vector<uint32_t> from;
+  from.reserve(slotOf.size());
+  for (uint32_t i = 0; i < keep.size(); ++i)
+    if (keep[i])
+      from.push_back(i);
+  reorder(from);
+}
+
+void TransformHierarchy::reorder(const std::vector<uint32_t>& from) {
+  // Old dense index to new, for the parents. Whatever's dropped can't be
+  // anyone's parent anymore.
+  std::vector<uint32_t> to(slotOf.size(), invalidIndex);
+  for (uint32_t i = 0; i < from.size(); ++i)
+    to[from[i]] = i;
+
+  reorderArray(translations, from);
+  reorderArray(rotations, from);
+  reorderArray(scales, from);
+  reorderArray(parents, from);
+  reorderArray(depths, from);
+  reorderArray(worlds, from);
+  reorderArray(dirty, from);
+  reorderArray(slotOf, from);
+  for (auto& parent : parents)
+    if (parent != invalidIndex)
+      parent = to[parent];
+  for (uint32_t i = 0; i < slotOf.size(); ++i)
+    slots[slotOf[i]].dense = i;
+
+  // Dirty nodes could have moved anywhere
+  firstDirty = invalidIndex;
+  for (uint32_t i = 0; i < dirty.size(); ++i) {
+    if (dirty[i]) {
+      firstDirty = i;
+      break;
+    }
+  }
+}
@@ -0,0 +1,152 @@
+#include "vertex_quantization.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace VertexQuantize {
+namespace {
+float signNotZero(const float value) {
+  return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+int16_t toSnorm16(const float value) {
+  return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+float fromSnorm16(const int16_t value) {
+  return std::max(float(value) / 32767.0f, -1.0f);
+}
+}
+
+PositionTransform positionTransform(const MeshFormat::Bounds& bounds) {
+  PositionTransform transform;
+  transform.offset = glm::vec3(bounds.min[0], bounds.min[1], bounds.min[2]);
+  transform.scale = glm::vec3(bounds.max[0], bounds.max[1], bounds.max[2]) - transform.offset;
+  return transform;
+}
+
+uint16_t floatToHalf(const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const int32_t exponent = int32_t((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+
+  // nan stays nan, inf and overflow go to inf
+  if (((bits >> 23) & 0xff) == 0xff)
+    return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+  if (exponent >= 31)
+    return static_cast<uint16_t>(sign | 0x7c00);
+
+  if (exponent <= 0) {
+    // denormal or zero
+    if (exponent < -10)
+      return static_cast<uint16_t>(sign);
+    mantissa |= 0x800000;
+    const uint32_t shift = static_cast<uint32_t>(14 - exponent);
+    uint32_t half = mantissa >> shift;
+    const uint32_t remainder = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (half & 1)))
+      ++half;
+    return static_cast<uint16_t>(sign | half);
+  }
+
+  // round to nearest even, a carry into the exponent is still correct
+  uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+  const uint32_t remainder = mantissa & 0x1fff;
+  if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+    ++half;
+  return static_cast<uint16_t>(sign | half);
+}
+
+float halfToFloat(const uint16_t half) {
+  const uint32_t sign = uint32_t(half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+
+  uint32_t bits;
+  if (exponent == 0x1f) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else if (exponent != 0) {
+    bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {
+    bits = sign;
+  } else {
+    // renormalize
+    exponent = 127 - 15 + 1;
+    while (!(mantissa & 0x400)) {
+      mantissa <<= 1;
+      --exponent;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+  }
+
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+glm::vec2 octEncode(const glm::vec3& normal) {
+  const float l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+  if (l1 == 0.0f)
+    return glm::vec2(0.0f);
+
+  glm::vec2 encoded(normal.x / l1, normal.y / l1);
+  // fold the lower hemisphere over the diagonals
+  if (normal.z < 0.0f)
+    encoded = glm::vec2(
+        (1.0f - std::abs(encoded.y)) * signNotZero(encoded.x),
+        (1.0f - std::abs(encoded.x)) * signNotZero(encoded.y));
+  return encoded;
+}
+
+glm::vec3 octDecode(const glm::vec2& encoded) {
+  glm::vec3 normal(encoded.x, encoded.y, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+  const float t = std::max(-normal.z, 0.0f);
+  normal.x += normal.x >= 0.0f ? -t : t;
+  normal.y += normal.y >= 0.0f ? -t : t;
+  return glm::normalize(normal);
+}
+
+std::vector<GraphicsTypes::QuantizedVertex> quantizeVertices(
+    const GraphicsTypes::Vertex* vertices,
+    const size_t count,
+    const MeshFormat::Bounds& bounds) {
+  const PositionTransform transform = positionTransform(bounds);
+  // flat axis (e.g. a quad), everything quantizes to 0
+  const glm::vec3 inverseScale(
+      transform.scale.x > 0.0f ? 1.0f / transform.scale.x : 0.0f,
+      transform.scale.y > 0.0f ? 1.0f / transform.scale.y : 0.0f,
+      transform.scale.z > 0.0f ? 1.0f / transform.scale.z : 0.0f);
+
+  std::vector<GraphicsTypes::QuantizedVertex> out(count);
+  for (size_t i = 0; i < count; ++i) {
+    const GraphicsTypes::Vertex& in = vertices[i];
+    GraphicsTypes::QuantizedVertex& q = out[i];
+
+    const glm::vec3 unit = (in.position - transform.offset) * inverseScale;
+    for (int c = 0; c < 3; ++c)
+      q.position[c] = static_cast<uint16_t>(std::lround(std::clamp(unit[c], 0.0f, 1.0f) * 65535.0f));
+    q.position[3] = 0;
+
+    const glm::vec2 octahedral = octEncode(in.normal);
+    q.normal = {toSnorm16(octahedral.x), toSnorm16(octahedral.y)};
+    q.texCoord = {floatToHalf(in.texCoord.x), floatToHalf(in.texCoord.y)};
+  }
+
+  return out;
+}
+
+GraphicsTypes::Vertex dequantizeVertex(const GraphicsTypes::QuantizedVertex& vertex, const PositionTransform& transform) {
+  GraphicsTypes::Vertex out;
+  const glm::vec3 unit(vertex.position[0] / 65535.0f, vertex.position[1] / 65535.0f, vertex.position[2] / 65535.0f);
+  out.position = transform.offset + unit * transform.scale;
+  out.normal = octDecode(glm::vec2(fromSnorm16(vertex.normal[0]), fromSnorm16(vertex.normal[1])));
+  out.texCoord = glm::vec2(halfToFloat(vertex.texCoord[0]), halfToFloat(vertex.texCoord[1]));
+  return out;
+}
+
+}
@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "asset_cook.h"
+#include "asset_pack.h"
+#include "json.h"
+#include "mesh_format.h"
+#include "mesh_importer.h"
+#include "parallel_for.h"
+
+// Offline half of the asset pipeline. Walks a source tree and writes the
+// runtime formats under the output dir with the same layout:
+//   .obj .gltf .glb            -> .vmesh (AssetCook::cookMesh)
+//   .vert .frag .comp ...      -> .spv next to the stage suffix, via glslc
+//   .png .jpg .tga ...         -> BCn .ktx2 with mips (toktx for the mips,
+//                                 AssetCook::cookTexture for the blocks)
+//   .ktx2                      -> copied
+// Inputs whose content hash and cook key match manifest.json are skipped.
+// --pack also bundles the outputs into one AssetPack .vpak.
+namespace fs = std::filesystem;
+
+namespace {
+struct CookConfig {
+  fs::path sourceDir;
+  fs::path outputDir;
+  // 0 is one per core
+  unsigned jobs = 0;
+  // Recook everything
+  bool force = false;
+  // Hash every input even when its size and mtime match the manifest
+  bool rehash = false;
+  std::string glslc = "glslc";
+  std::string toktx = "toktx";
+  // Also bundle every output into this .vpak, empty for none
+  std::string pack;
+  AssetCook::MeshCookOptions mesh;
+  AssetCook::TextureCookOptions texture;
+};
+
+enum class Kind { mesh, shader, texture, copy };
+
+struct Job {
+  fs::path source;
+  std::string relative;
+  Kind kind;
+  std::string output;
+  uint64_t sourceSize = 0;
+  int64_t sourceTime = 0;
+  uint64_t sourceHash = 0;
+  uint64_t cookKey = 0;
+  bool dirty = true;
+  bool failed = false;
+  uint64_t outputSize = 0;
+};
+
+const char* kindName(const Kind kind) {
+  switch (kind) {
+    case Kind::mesh: return "mesh";
+    case Kind::shader: return "shader";
+    case Kind::texture: return "texture";
+    case Kind::copy: return "copy";
+  }
+  return "";
+}
+
+// Output extension for an input, false for files the cooker doesn't take
+// (.bin/.mtl next to meshes and the like)
+bool classify(const fs::path& path, Kind& kind, std::string& outputExtension) {
+  std::string extension = path.extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+
+  if (extension == ".obj" || extension == ".gltf" || extension == ".glb") {
+    kind = Kind::mesh;
+    outputExtension = ".vmesh";
+  } else if (extension == ".vert" || extension == ".frag" || extension == ".comp" || extension == ".geom" ||
+             extension == ".tesc" || extension == ".tese") {
+    kind = Kind::shader;
+    outputExtension = extension + ".spv";
+  } else if (extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".tga" ||
+             extension == ".bmp") {
+    kind = Kind::texture;
+    outputExtension = ".ktx2";
+  } else if (extension == ".ktx2") {
+    kind = Kind::copy;
+    outputExtension = ".ktx2";
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::string cookKeyText(const Kind kind, const CookConfig& config) {
+  switch (kind) {
+    case Kind::mesh: return config.mesh.key();
+    case Kind::shader: return "shader glslc";
+    case Kind::texture: return "toktx --t2 --genmipmap --target_type RGBA " + config.texture.key();
+    case Kind::copy: return "copy";
+  }
+  return "";
+}
+
+std::string quoted(const fs::path& path) {
+  return "\"" + path.string() + "\"";
+}
+
+// .gltf can pull its buffers from other files, those go into its hash too
+std::vector<fs::path> meshDependencies(const fs::path& source) {
+  std::vector<fs::path> dependencies;
+  if (source.extension() != ".gltf")
+    return dependencies;
+
+  std::ifstream file(source, std::ios::binary);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  const Json::Value root = Json::parse(contents.str());
+  for (const Json::Value& buffer : root["buffers"].items()) {
+    const std::string& uri = buffer["uri"].asString();
+    if (!uri.empty() && uri.compare(0, 5, "data:") != 0)
+      dependencies.push_back(source.parent_path() / MeshImport::percentDecode(uri));
+  }
+  return dependencies;
+}
+
+uint64_t hashSource(const Job& job) {
+  uint64_t hash = AssetCook::hashFile(job.source.string());
+  if (job.kind == Kind::mesh)
+    for (const fs::path& dependency : meshDependencies(job.source)) {
+      const uint64_t dependencyHash = AssetCook::hashFile(dependency.string());
+      hash = AssetCook::contentHash(&dependencyHash, sizeof(dependencyHash), hash);
+    }
+  return hash;
+}
+
+void runTool(const std::string& command) {
+  if (std::system(command.c_str()) != 0)
+    throw std::runtime_error("failed to run " + command + "!");
+}
+
+// Everything goes to a temporary first, a killed cook never leaves a
+// truncated output that looks up to date
+void cook(const Job& job, const CookConfig& config, const fs::path& output) {
+  const fs::path temporary = output.string() + ".tmp";
+  fs::create_directories(output.parent_path());
+
+  switch (job.kind) {
+    case Kind::mesh:
+      MeshFormat::writeMeshFile(
+          temporary.string(),
+          AssetCook::cookMesh(job.source.string(), config.mesh),
+          config.mesh.vertexFormat,
+          config.mesh.encodeGeometry);
+      break;
+    case Kind::shader:
+      runTool(config.glslc + " " + quoted(job.source) + " -o " + quoted(temporary));
+      break;
+    case Kind::texture: {
+      // toktx decodes and builds the mips uncompressed, the blocks get
+      // encoded here. Normal maps stay linear.
+      const bool normalMap = AssetCook::isNormalMap(job.source.string());
+      const fs::path uncompressed = output.string() + ".rgba.tmp";
+      runTool(
+          config.toktx + " --t2 --genmipmap --target_type RGBA" + (normalMap ? " --assign_oetf linear " : " ") +
+          quoted(uncompressed) + " " + quoted(job.source));
+      const std::vector<uint8_t> cooked = AssetCook::cookTexture(uncompressed.string(), normalMap, config.texture);
+      fs::remove(uncompressed);
+      std::ofstream file(temporary, std::ios::binary);
+      file.write(reinterpret_cast<const char*>(cooked.data()), static_cast<std::streamsize>(cooked.size()));
+      if (!file)
+        throw std::runtime_error("failed to write " + temporary.string() + "!");
+      break;
+    }
+    case Kind::copy:
+      fs::copy_file(job.source, temporary, fs::copy_options::overwrite_existing);
+      break;
+  }
+  fs::rename(temporary, output);
+}
+
+AssetCook::TextureEncoding parseTextureEncoding(const std::string& name) {
+  if (name == "auto")
+    return AssetCook::TextureEncoding::automatic;
+  if (name == "bc1")
+    return AssetCook::TextureEncoding::bc1;
+  if (name == "bc3")
+    return AssetCook::TextureEncoding::bc3;
+  if (name == "bc5")
+    return AssetCook::TextureEncoding::bc5;
+  if (name == "rgba8")
+    return AssetCook::TextureEncoding::rgba8;
+  throw std::invalid_argument("unknown texture format " + name);
+}
+
+CookConfig parseArgs(int argc, char** argv) {
+  CookConfig config;
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    const std::string key = arg.substr(0, eq);
+    const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+    if (arg.compare(0, 2, "--") != 0)
+      positional.push_back(arg);
+    else if (key == "--jobs")
+      config.jobs = static_cast<unsigned>(std::stoul(value));
+    else if (key == "--force")
+      config.force = true;
+    else if (key == "--rehash")
+      config.rehash = true;
+    else if (key == "--glslc")
+      config.glslc = value;
+    else if (key == "--toktx")
+      config.toktx = value;
+    else if (key == "--pack")
+      config.pack = value;
+    else if (key == "--quantized-vertices")
+      config.mesh.vertexFormat = MeshFormat::VertexFormat::quantized16;
+    else if (key == "--no-lods")
+      config.mesh.buildLods = false;
+    else if (key == "--no-meshlets")
+      config.mesh.buildMeshlets = false;
+    else if (key == "--encode-geometry")
+      config.mesh.encodeGeometry = true;
+    else if (key == "--texture-format")
+      config.texture.encoding = parseTextureEncoding(value);
+    else if (key == "--no-supercompression")
+      config.texture.supercompress = false;
+    else
+      std::cerr << "ignoring unknown argument " << arg << std::endl;
+  }
+
+  if (positional.size() != 2)
+    throw std::invalid_argument(
+        "usage: assetcook <source dir> <output dir> [--jobs=N] [--force] [--rehash] "
+        "[--quantized-vertices] [--no-lods] [--no-meshlets] [--encode-geometry] "
+        "[--texture-format=auto|bc1|bc3|bc5|rgba8] [--no-supercompression] [--glslc=path] [--toktx=path] "
+        "[--pack=path]");
+  config.sourceDir = positional[0];
+  config.outputDir = positional[1];
+  return config;
+}
+
+int run(const CookConfig& config) {
+  const auto start = std::chrono::steady_clock::now();
+  if (!fs::is_directory(config.sourceDir))
+    throw std::runtime_error("failed to find source dir " + config.sourceDir.string() + "!");
+  fs::create_directories(config.outputDir);
+
+  const std::string manifestPath = (config.outputDir / "manifest.json").string();
+  const AssetCook::Manifest previous = AssetCook::readManifest(manifestPath);
+
+  std::vector<Job> jobs;
+  for (const auto& item : fs::recursive_directory_iterator(config.sourceDir)) {
+    if (!item.is_regular_file())
+      continue;
+    Job job;
+    std::string outputExtension;
+    if (!classify(item.path(), job.kind, outputExtension))
+      continue;
+    job.source = item.path();
+    job.relative = fs::relative(item.path(), config.sourceDir).generic_string();
+    job.output = fs::path(job.relative).replace_extension(outputExtension).generic_string();
+    job.sourceSize = item.file_size();
+    job.sourceTime = static_cast<int64_t>(item.last_write_time().time_since_epoch().count());
+    const std::string keyText = cookKeyText(job.kind, config);
+    job.cookKey = AssetCook::contentHash(keyText.data(), keyText.size(), AssetCook::cookerVersion);
+    jobs.push_back(std::move(job));
+  }
+  std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.relative < b.relative; });
+
+  // a.obj and a.gltf would both want a.vmesh
+  {
+    std::vector<const Job*> byOutput;
+    for (const Job& job : jobs)
+      byOutput.push_back(&job);
+    std::sort(byOutput.begin(), byOutput.end(), [](const Job* a, const Job* b) { return a->output < b->output; });
+    for (size_t i = 1; i < byOutput.size(); ++i)
+      if (byOutput[i]->output == byOutput[i - 1]->output)
+        throw std::runtime_error(byOutput[i - 1]->relative + " and " + byOutput[i]->relative + " both cook to " +
+                                 byOutput[i]->output + "!");
+  }
+
+  // Hashing is the whole cost of a no-op run. Size + mtime matching the
+  // manifest reuses its hash, .gltf always rehashes since its buffers can
+  // change under it.
+  std::atomic<size_t> hashed{0};
+  parallelFor(jobs.size(), config.jobs, [&](const size_t i) {
+    Job& job = jobs[i];
+    const AssetCook::ManifestEntry* entry = previous.find(job.relative);
+    const bool touched = !entry || entry->sourceSize != job.sourceSize || entry->sourceTime != job.sourceTime ||
+                         job.source.extension() == ".gltf";
+    if (config.rehash || touched) {
+      job.sourceHash = hashSource(job);
+      ++hashed;
+    } else {
+      job.sourceHash = entry->sourceHash;
+    }
+
+    job.dirty = config.force || !entry || entry->sourceHash != job.sourceHash || entry->cookKey != job.cookKey ||
+                entry->output != job.output;
+    if (!job.dirty) {
+      std::error_code error;
+      const uint64_t outputSize = fs::file_size(config.outputDir / job.output, error);
+      job.dirty = error || outputSize != entry->outputSize;
+      job.outputSize = outputSize;
+    }
+  });
+
+  // Biggest first so one large mesh doesn't start last and hold up the end
+  std::vector<Job*> dirty;
+  for (Job& job : jobs)
+    if (job.dirty)
+      dirty.push_back(&job);
+  std::sort(dirty.begin(), dirty.end(), [](const Job* a, const Job* b) { return a->sourceSize > b->sourceSize; });
+
+  // With several assets in flight they're the parallelism, one at a time
+  // lets the importer have every core
+  CookConfig jobConfig = config;
+  jobConfig.mesh.threads = dirty.size() > 1 && config.jobs != 1 ? 1 : 0;
+
+  std::mutex logMutex;
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> failures{0};
+  parallelRanges(dirty.size(), config.jobs, [&](size_t, size_t, unsigned) {
+    for (size_t i = next++; i < dirty.size(); i = next++) {
+      Job& job = *dirty[i];
+      const auto jobStart = std::chrono::steady_clock::now();
+      try {
+        const fs::path output = config.outputDir / job.output;
+        cook(job, jobConfig, output);
+        job.outputSize = fs::file_size(output);
+        const double ms =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - jobStart).count();
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::cout << "cooked " << job.relative << " -> " << job.output << " (" << ms << " ms)" << std::endl;
+      } catch (const std::exception& e) {
+        job.failed = true;
+        ++failures;
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::cerr << "failed to cook " << job.relative << ": " << e.what() << std::endl;
+      }
+    }
+  });
+
+  // Outputs of sources that went away
+  size_t removed = 0;
+  for (const AssetCook::ManifestEntry& entry : previous.entries) {
+    const auto it = std::lower_bound(jobs.begin(), jobs.end(), entry.source, [](const Job& job, const std::string& key) {
+      return job.relative < key;
+    });
+    const bool stillThere = it != jobs.end() && it->relative == entry.source && it->output == entry.output;
+    if (!stillThere && !entry.output.empty()) {
+      std::error_code error;
+      removed += fs::remove(config.outputDir / entry.output, error) ? 1 : 0;
+    }
+  }
+
+  // Failed ones stay out so the next run tries again
+  AssetCook::Manifest manifest;
+  manifest.cookerVersion = AssetCook::cookerVersion;
+  for (const Job& job : jobs) {
+    if (job.failed)
+      continue;
+    AssetCook::ManifestEntry entry;
+    entry.source = job.relative;
+    entry.output = job.output;
+    entry.kind = kindName(job.kind);
+    entry.sourceHash = job.sourceHash;
+    entry.sourceSize = job.sourceSize;
+    entry.sourceTime = job.sourceTime;
+    entry.cookKey = job.cookKey;
+    entry.outputSize = job.outputSize;
+    manifest.entries.push_back(std::move(entry));
+  }
+  AssetCook::writeManifest(manifestPath, manifest);
+
+  // Rebuilt whole whenever anything in it changed. Textures are already
+  // block compressed and go to the gpu as is, so they stay stored.
+  const bool packChanged = dirty.size() > 0 || removed > 0;
+  if (!config.pack.empty() && (packChanged || !fs::exists(config.pack))) {
+    AssetPack::PackWriter writer;
+    for (const AssetCook::ManifestEntry& entry : manifest.entries) {
+      std::ifstream file(config.outputDir / entry.output, std::ios::binary);
+      std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+      const bool gpuReady = entry.kind == kindName(Kind::texture) || entry.kind == kindName(Kind::copy);
+      writer.add(entry.output, std::move(data), !gpuReady);
+    }
+    writer.write(config.pack, config.jobs);
+    std::cout << "packed " << manifest.entries.size() << " assets into " << config.pack << std::endl;
+  }
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << jobs.size() << " assets, " << dirty.size() - failures << " cooked, "
+            << jobs.size() - dirty.size() << " up to date, " << failures << " failed, " << removed
+            << " stale outputs removed, " << hashed << " hashed, " << seconds << " s" << std::endl;
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+}
+
+int main(int argc, char** argv) {
+  try {
+    return run(parseArgs(argc, argv));
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
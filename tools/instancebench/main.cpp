@@ -0,0 +1,168 @@
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "instance_kernels.h"
+
+// Times InstanceKernels::computeMatrices on every path this machine
+// supports against the plain glm one, the way the renderer calls it:
+// records sizeof(VulkanUtils::InstanceData) apart, gathered through a drawn
+// index list that skips every fourth instance. Each path is checked against
+// scalar before it's timed.
+namespace {
+// sizeof(VulkanUtils::InstanceData), without pulling in the vulkan headers
+constexpr size_t instanceStride = 224;
+
+struct BenchConfig {
+  // Empty is 128, 1024 and 100000
+  std::vector<size_t> instanceCounts;
+  // Best of
+  unsigned runs = 5;
+};
+
+struct alignas(16) Chunk {
+  float values[4];
+};
+
+BenchConfig parseArgs(int argc, char** argv) {
+  BenchConfig config;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    const std::string key = arg.substr(0, eq);
+    const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+    if (key == "--instances")
+      config.instanceCounts.push_back(std::stoul(value));
+    else if (key == "--runs")
+      config.runs = std::max(1u, static_cast<unsigned>(std::stoul(value)));
+    else
+      throw std::invalid_argument("usage: instancebench [--instances=N]... [--runs=N]");
+  }
+  if (config.instanceCounts.empty())
+    config.instanceCounts = {128, 1024, 100000};
+  return config;
+}
+
+// Rotation, scale and translation, a few mirrored
+std::vector<glm::mat4> randomModels(const size_t count, std::mt19937& rng) {
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+  std::vector<glm::mat4> models(count);
+  for (size_t i = 0; i < count; ++i) {
+    for (int column = 0; column < 3; ++column)
+      models[i][column] = glm::vec4(unit(rng), unit(rng), unit(rng), 0.0f);
+    models[i][3] = glm::vec4(unit(rng) * 100.0f, unit(rng) * 100.0f, unit(rng) * 100.0f, 1.0f);
+    if (i % 8 == 0)
+      models[i][0] = -models[i][0];
+  }
+  return models;
+}
+
+const InstanceMatrices& recordAt(const std::vector<Chunk>& out, const size_t i) {
+  return *reinterpret_cast<const InstanceMatrices*>(reinterpret_cast<const uint8_t*>(out.data()) + i * instanceStride);
+}
+
+// Largest difference relative to the largest value in the record
+float relativeError(const InstanceMatrices& a, const InstanceMatrices& b) {
+  const float* x = &a.model[0][0];
+  const float* y = &b.model[0][0];
+  const size_t floats = sizeof(InstanceMatrices) / sizeof(float);
+  float largest = 0.0f, error = 0.0f;
+  for (size_t i = 0; i < floats; ++i) {
+    largest = std::max(largest, std::abs(x[i]));
+    error = std::max(error, std::abs(x[i] - y[i]));
+  }
+  return largest > 0.0f ? error / largest : error;
+}
+
+double bestNsPerInstance(
+    const InstanceKernels::Path path,
+    const glm::mat4& viewProjection,
+    const std::vector<glm::mat4>& models,
+    const std::vector<uint32_t>& drawn,
+    std::vector<Chunk>& out,
+    const unsigned runs) {
+  auto* records = reinterpret_cast<InstanceMatrices*>(out.data());
+  // Enough repeats per run that small counts aren't all timer noise
+  const size_t repeats = std::max<size_t>(1, 1000000 / drawn.size());
+  double best = 1e30;
+  for (unsigned run = 0; run < runs; ++run) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t repeat = 0; repeat < repeats; ++repeat)
+      InstanceKernels::computeMatrices(
+          viewProjection, models.data(), drawn.data(), drawn.size(), records, instanceStride, path);
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count() / double(repeats * drawn.size()));
+  }
+  return best;
+}
+
+int run(const BenchConfig& config) {
+  using InstanceKernels::Path;
+  std::mt19937 rng(1);
+  std::vector<Path> paths;
+  for (const Path path : {Path::scalar, Path::sse, Path::avx2, Path::neon})
+    if (InstanceKernels::supported(path))
+      paths.push_back(path);
+
+  std::cout << std::setw(10) << "instances";
+  for (const Path path : paths)
+    std::cout << std::setw(10) << InstanceKernels::pathName(path);
+  std::cout << "   (ns/instance, best of " << config.runs << ")" << std::endl;
+
+  int status = EXIT_SUCCESS;
+  for (const size_t count : config.instanceCounts) {
+    const std::vector<glm::mat4> models = randomModels(count, rng);
+    const glm::mat4 viewProjection = randomModels(1, rng)[0];
+    std::vector<uint32_t> drawn;
+    for (uint32_t i = 0; i < count; ++i)
+      if (i % 4 != 3)
+        drawn.push_back(i);
+    if (drawn.empty())
+      continue;
+
+    const size_t chunks = drawn.size() * instanceStride / sizeof(Chunk);
+    std::vector<Chunk> expected(chunks), out(chunks);
+    InstanceKernels::computeMatrices(
+        viewProjection, models.data(), drawn.data(), drawn.size(),
+        reinterpret_cast<InstanceMatrices*>(expected.data()), instanceStride, Path::scalar);
+
+    std::cout << std::setw(10) << count << std::fixed << std::setprecision(1);
+    for (const Path path : paths) {
+      InstanceKernels::computeMatrices(
+          viewProjection, models.data(), drawn.data(), drawn.size(),
+          reinterpret_cast<InstanceMatrices*>(out.data()), instanceStride, path);
+      float error = 0.0f;
+      for (size_t i = 0; i < drawn.size(); ++i)
+        error = std::max(error, relativeError(recordAt(expected, i), recordAt(out, i)));
+      if (error > 1e-5f) {
+        std::cerr << InstanceKernels::pathName(path) << " is off from scalar by " << error << std::endl;
+        status = EXIT_FAILURE;
+      }
+      std::cout << std::setw(10) << bestNsPerInstance(path, viewProjection, models, drawn, out, config.runs);
+    }
+    std::cout << std::endl;
+  }
+  return status;
+}
+}
+
+int main(int argc, char** argv) {
+  try {
+    return run(parseArgs(argc, argv));
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
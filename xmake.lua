@@ -9,17 +9,67 @@ target("SimpleVulkanRenderer")
     set_languages("c++17")
     add_files("src/*.cpp")
     add_includedirs("include")
-    add_syslinks("glfw", "vulkan", "dl", "pthread", "X11", "Xxf86vm", "Xrandr", "Xi")
+    add_syslinks("glfw", "vulkan", "dl", "pthread", "X11", "Xxf86vm", "Xrandr", "Xi", "z")
     if is_mode("debug") then
         add_cxxflags("-Og", "-g", "-ggdb",  "-Wall", "-Wextra", {force = true})
     elseif is_mode("release") then
         add_cxxflags("-O3")
     end
 
+-- Offline asset cooker, only the non-vulkan sources (it still needs the
+-- vulkan headers for the vertex types)
+target("assetcook")
+    set_kind("binary")
+    set_languages("c++17")
+    add_files("tools/assetcook/*.cpp")
+    add_files("src/asset_cook.cpp", "src/asset_pack.cpp", "src/block_compression.cpp", "src/gltf_importer.cpp",
+              "src/json.cpp", "src/ktx2.cpp", "src/mesh_codec.cpp", "src/mesh_format.cpp", "src/mesh_importer.cpp",
+              "src/mesh_optimizer.cpp", "src/mesh_simplify.cpp", "src/meshlets.cpp", "src/vertex_quantization.cpp")
+    add_includedirs("include")
+    add_syslinks("pthread", "z")
+    if is_mode("debug") then
+        add_cxxflags("-Og", "-g", "-ggdb",  "-Wall", "-Wextra", {force = true})
+    elseif is_mode("release") then
+        add_cxxflags("-O3")
+    end
+
+-- InstanceKernels paths timed against plain glm, no vulkan needed
+target("instancebench")
+    set_kind("binary")
+    set_languages("c++17")
+    add_files("tools/instancebench/*.cpp", "src/instance_kernels.cpp")
+    add_includedirs("include")
+    if is_mode("debug") then
+        add_cxxflags("-Og", "-g", "-ggdb",  "-Wall", "-Wextra", {force = true})
+    elseif is_mode("release") then
+        add_cxxflags("-O3")
+    end
+
+task("cook")
+    on_run(function()
+        import("core.base.option")
+        -- xmake run starts in the binary's dir, hand it absolute paths
+        local source = path.absolute(option.get("source"))
+        local output = path.absolute(option.get("output"))
+        os.exec("xmake build assetcook")
+        os.execv("xmake", {"run", "assetcook", source, output, "--glslc=/usr/local/bin/glslc", "--pack=" .. output .. ".vpak"})
+    end)
+    set_menu {
+        usage = "xmake cook [options]",
+        description = "Cook assets into runtime formats, skipping unchanged ones",
+        options = {
+            {nil, "source", "kv", "assets", "Source asset dir"},
+            {nil, "output", "kv", "build/assets", "Cooked output dir"}
+        }
+    }
+
 task("shaders")
     on_run(function()
         os.mkdir("shaders")
         os.exec("/usr/local/bin/glslc shaders/simple_shader.vert -o build/vert.spv")
+        os.exec("/usr/local/bin/glslc shaders/quantized_shader.vert -o build/vert_quantized.spv")
+        os.exec("/usr/local/bin/glslc shaders/cluster_cull.comp -o build/cluster_cull.spv")
+        os.exec("/usr/local/bin/glslc shaders/mip_downsample.comp -o build/mip_downsample.spv")
         os.exec("/usr/local/bin/glslc shaders/simple_shader.frag -o build/frag.spv")
     end)
     set_menu {